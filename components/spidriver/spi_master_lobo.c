@@ -81,6 +81,7 @@ Main driver's function is 'spi_lobo_transfer_data()'
 #include "driver/gpio.h"
 #include "driver/periph_ctrl.h"
 #include "esp_heap_caps.h"
+#include "soc/soc_memory_layout.h"
 #include "driver/periph_ctrl.h"
 #include "spi_master_lobo.h"
 
@@ -200,7 +201,7 @@ typedef void(*dmaworkaround_cb_t)(void *arg);
 
 //Set up a list of dma descriptors. dmadesc is an array of descriptors. Data is the buffer to point to.
 //--------------------------------------------------------------------------------------------
-void spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *data, bool isrx)
+void IRAM_ATTR spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *data, bool isrx)
 {
     int n = 0;
     while (len) {
@@ -227,6 +228,47 @@ void spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *da
     dmadesc[n - 1].qe.stqe_next = NULL;
 }
 
+/*
+ * Set up a circular DMA descriptor chain for sending the same data repeatedly.
+ * All 'ndesc' descriptors point to the same buffer and the last one is linked back to the first.
+ * The chain never ends, the transfer length must be limited by the spi mosi_dlen register.
+ */
+//-----------------------------------------------------------------------------------------
+void spi_lobo_setup_dma_desc_loop(lldesc_t *dmadesc, int ndesc, const uint8_t *data, int len)
+{
+    if (len > SPI_MAX_DMA_LEN) len = SPI_MAX_DMA_LEN;
+    if (ndesc < 1) ndesc = 1;
+    for (int n=0; n<ndesc; n++) {
+        dmadesc[n].size = len;
+        dmadesc[n].length = len;
+        dmadesc[n].buf = (uint8_t *)data;
+        dmadesc[n].eof = 0;
+        dmadesc[n].sosf = 0;
+        dmadesc[n].owner = 1;
+        dmadesc[n].qe.stqe_next = &dmadesc[(n + 1) % ndesc];
+    }
+}
+
+/*
+ * Append the descriptors for 'len' bytes of 'data' to the DMA descriptor chain of 'used' descriptors.
+ * The chain stays terminated by the last appended descriptor.
+ * Returns the new number of used descriptors, or -1 if the array of 'ndesc' descriptors is too small.
+ */
+//--------------------------------------------------------------------------------------------------------
+int spi_lobo_dma_desc_append(lldesc_t *dmadesc, int ndesc, int used, const uint8_t *data, int len)
+{
+    int need = (len + SPI_MAX_DMA_LEN - 1) / SPI_MAX_DMA_LEN;
+    if ((len <= 0) || ((used + need) > ndesc)) return -1;
+
+    spi_lobo_setup_dma_desc_links(&dmadesc[used], len, data, false);
+    if (used > 0) {
+        // link the previous end of chain to the appended descriptors
+        dmadesc[used - 1].eof = 0;
+        dmadesc[used - 1].qe.stqe_next = &dmadesc[used];
+    }
+    return used + need;
+}
+
 
 /*
 Code for workaround for DMA issue in ESP32 v0/v1 silicon
@@ -349,6 +391,26 @@ bool spi_lobo_dma_chan_free(int dma_chan)
 }
 
 
+// 'Transaction done' interrupt handler
+// Calls the 'transaction done' callback, which may start the next transfer,
+// and wakes the task waiting in 'spi_lobo_wait_trans_done' or 'spi_lobo_wait_done_signal'
+//-------------------------------------------
+static void IRAM_ATTR spi_lobo_intr(void *arg)
+{
+    BaseType_t do_yield = pdFALSE;
+    spi_lobo_host_t *host = (spi_lobo_host_t *)arg;
+    spi_lobo_done_cb_t done_cb = host->done_cb;
+
+    host->hw->slave.trans_done = 0;
+    esp_intr_disable(host->intr);
+    if (done_cb) done_cb(host->done_arg, &do_yield);
+    if ((host->intr_wait) || (done_cb)) {
+        host->intr_wait = false;
+        xSemaphoreGiveFromISR(host->done_sem, &do_yield);
+    }
+    if (do_yield) portYIELD_FROM_ISR();
+}
+
 //======================================================================================================
 
 
@@ -385,6 +447,10 @@ static esp_err_t spi_lobo_bus_initialize(spi_lobo_host_device_t host, spi_lobo_b
 		// Create semaphore
 		spihost[host]->spi_lobo_bus_mutex = xSemaphoreCreateMutex();
 		if (!spihost[host]->spi_lobo_bus_mutex) return ESP_ERR_NO_MEM;
+		// Create the semaphores signalling transfer end and bus handover, the task notifications are left to the application
+		spihost[host]->done_sem = xSemaphoreCreateBinary();
+		spihost[host]->yield_sem = xSemaphoreCreateBinary();
+		if ((!spihost[host]->done_sem) || (!spihost[host]->yield_sem)) return ESP_ERR_NO_MEM;
     }
 
     spihost[host]->cur_device = -1;
@@ -488,6 +554,17 @@ static esp_err_t spi_lobo_bus_initialize(spi_lobo_host_device_t host, spi_lobo_b
 
 		//Select DMA channel.
 		DPORT_SET_PERI_REG_BITS(DPORT_SPI_DMA_CHAN_SEL_REG, 3, init, (host * 2));
+
+        // Allocate the 'transaction done' interrupt, initially disabled.
+        // It is enabled only while some task waits for the transfer to finish.
+        // If it cannot be allocated, transfers are always polled.
+        if (esp_intr_alloc(io_signal[host].irq, ESP_INTR_FLAG_INTRDISABLED | ESP_INTR_FLAG_IRAM, spi_lobo_intr, (void *)spihost[host], &spihost[host]->intr) == ESP_OK) {
+            spihost[host]->intr_min_us = SPI_INTR_WAIT_MIN_US;
+        }
+        else {
+            ESP_LOGW(SPI_TAG, "spi interrupt not allocated, using polling");
+            spihost[host]->intr = NULL;
+        }
     }
     return ESP_OK;
 
@@ -521,7 +598,10 @@ static esp_err_t spi_lobo_bus_free(spi_lobo_host_device_t host, int dofree)
     spi_lobo_periph_free(host);
 
     if (dofree) {
+		if (spihost[host]->intr) esp_intr_free(spihost[host]->intr);
 		vSemaphoreDelete(spihost[host]->spi_lobo_bus_mutex);
+		vSemaphoreDelete(spihost[host]->done_sem);
+		vSemaphoreDelete(spihost[host]->yield_sem);
 	    free(spihost[host]->dmadesc_tx);
 	    free(spihost[host]->dmadesc_rx);
 		free(spihost[host]);
@@ -530,6 +610,176 @@ static esp_err_t spi_lobo_bus_free(spi_lobo_host_device_t host, int dofree)
     return ESP_OK;
 }
 
+//-----------------------------------------------------------------
+static int IRAM_ATTR spi_freq_for_pre_n(int fapb, int pre, int n) {
+    return (fapb / (pre * n));
+}
+
+// Local copy of a spi hw register, used to build the device's register image
+#define SPI_REG_T(reg) __typeof__(((spi_dev_t *)0)->reg)
+
+/*
+ * Calculate the SPI clock register value for a certain frequency. Returns the effective frequency, which may be slightly
+ * different from the requested frequency.
+ */
+//-------------------------------------------------------------------------------------
+static int IRAM_ATTR spi_set_clock(uint32_t *clock_reg, int fapb, int hz, int duty_cycle) {
+   int pre, n, h, l, eff_clk;
+   SPI_REG_T(clock) clock;
+   clock.val = 0;
+
+    //In hw, n, h and l are 1-64, pre is 1-8K. Value written to register is one lower than used value.
+    if (hz>((fapb/4)*3)) {
+        //Using Fapb directly will give us the best result here.
+        clock.clkcnt_l=0;
+        clock.clkcnt_h=0;
+        clock.clkcnt_n=0;
+        clock.clkdiv_pre=0;
+        clock.clk_equ_sysclk=1;
+        eff_clk=fapb;
+    } else {
+        //For best duty cycle resolution, we want n to be as close to 32 as possible, but
+        //we also need a pre/n combo that gets us as close as possible to the intended freq.
+        //To do this, we bruteforce n and calculate the best pre to go along with that.
+        //If there's a choice between pre/n combos that give the same result, use the one
+        //with the higher n.
+        int bestn=-1;
+        int bestpre=-1;
+        int besterr=0;
+        int errval;
+        for (n=1; n<=64; n++) {
+            //Effectively, this does pre=round((fapb/n)/hz).
+            pre=((fapb/n)+(hz/2))/hz;
+            if (pre<=0) pre=1;
+            if (pre>8192) pre=8192;
+            errval=abs(spi_freq_for_pre_n(fapb, pre, n)-hz);
+            if (bestn==-1 || errval<=besterr) {
+                besterr=errval;
+                bestn=n;
+                bestpre=pre;
+            }
+        }
+
+        n=bestn;
+        pre=bestpre;
+        l=n;
+        //This effectively does round((duty_cycle*n)/256)
+        h=(duty_cycle*n+127)/256;
+        if (h<=0) h=1;
+
+        clock.clk_equ_sysclk=0;
+        clock.clkcnt_n=n-1;
+        clock.clkdiv_pre=pre-1;
+        clock.clkcnt_h=h-1;
+        clock.clkcnt_l=l-1;
+        eff_clk=spi_freq_for_pre_n(fapb, pre, n);
+    }
+    *clock_reg = clock.val;
+    return eff_clk;
+}
+
+// Set the register image field and its mask
+#define SPI_REG_SET(reg, field, value, field_mask) do { reg##_v.field = (value); reg##_m.field = (field_mask); } while (0)
+
+// Precompute the spi hw register image of the device from its configuration
+//-----------------------------------------------------------------
+static void IRAM_ATTR spi_lobo_setup_dev_regs(spi_lobo_device_handle_t handle)
+{
+	spi_lobo_host_t *host = handle->host;
+	spi_lobo_dev_regs_t *regs = &handle->regs;
+	SPI_REG_T(ctrl) ctrl_v, ctrl_m;
+	SPI_REG_T(ctrl2) ctrl2_v, ctrl2_m;
+	SPI_REG_T(pin) pin_v, pin_m;
+	SPI_REG_T(user) user_v, user_m;
+	SPI_REG_T(user1) user1_v;
+	SPI_REG_T(user2) user2_v, user2_m;
+
+	ctrl_v.val = 0; ctrl_m.val = 0;
+	ctrl2_v.val = 0; ctrl2_m.val = 0;
+	pin_v.val = 0; pin_m.val = 0;
+	user_v.val = 0; user_m.val = 0;
+	user1_v.val = 0;
+	user2_v.val = 0; user2_m.val = 0;
+
+    //Assumes a hardcoded 80MHz Fapb for now. ToDo: figure out something better once we have clock scaling working.
+	int apbclk=APB_CLK_FREQ;
+
+    //Speeds >=40MHz over GPIO matrix needs a dummy cycle, but these don't work for full-duplex connections.
+    if (((handle->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX) == 0) && (handle->cfg.clock_speed_hz > ((apbclk*2)/5)) && (!host->no_gpio_matrix)) {
+    	// set speed to 32 MHz
+    	handle->cfg.clock_speed_hz = (apbclk*2)/5;
+    }
+
+	int effclk=spi_set_clock(&regs->clock, apbclk, handle->cfg.clock_speed_hz, handle->cfg.duty_cycle_pos);
+	regs->eff_clk = effclk;
+	//Configure bit order
+	SPI_REG_SET(ctrl, rd_bit_order, (handle->cfg.flags & LB_SPI_DEVICE_RXBIT_LSBFIRST)?1:0, 1);
+	SPI_REG_SET(ctrl, wr_bit_order, (handle->cfg.flags & LB_SPI_DEVICE_TXBIT_LSBFIRST)?1:0, 1);
+
+	//Configure polarity
+    //SPI iface needs to be configured for a delay in some cases.
+	int nodelay=0;
+    int extra_dummy=0;
+    if (host->no_gpio_matrix) {
+        if (effclk >= apbclk/2) {
+            nodelay=1;
+        }
+    } else {
+        if (effclk >= apbclk/2) {
+            nodelay=1;
+            extra_dummy=1;          //Note: This only works on half-duplex connections. spi_lobo_bus_add_device checks for this.
+        } else if (effclk >= apbclk/4) {
+            nodelay=1;
+        }
+    }
+	if (handle->cfg.mode==0) {
+		SPI_REG_SET(pin, ck_idle_edge, 0, 1);
+		SPI_REG_SET(user, ck_out_edge, 0, 1);
+		SPI_REG_SET(ctrl2, miso_delay_mode, nodelay?0:2, 3);
+	} else if (handle->cfg.mode==1) {
+		SPI_REG_SET(pin, ck_idle_edge, 0, 1);
+		SPI_REG_SET(user, ck_out_edge, 1, 1);
+		SPI_REG_SET(ctrl2, miso_delay_mode, nodelay?0:1, 3);
+	} else if (handle->cfg.mode==2) {
+		SPI_REG_SET(pin, ck_idle_edge, 1, 1);
+		SPI_REG_SET(user, ck_out_edge, 1, 1);
+		SPI_REG_SET(ctrl2, miso_delay_mode, nodelay?0:1, 3);
+	} else if (handle->cfg.mode==3) {
+		SPI_REG_SET(pin, ck_idle_edge, 1, 1);
+		SPI_REG_SET(user, ck_out_edge, 0, 1);
+		SPI_REG_SET(ctrl2, miso_delay_mode, nodelay?0:2, 3);
+	}
+
+	//Configure bit sizes, load addr and command
+	SPI_REG_SET(user, usr_dummy, (handle->cfg.dummy_bits+extra_dummy)?1:0, 1);
+	SPI_REG_SET(user, usr_addr, (handle->cfg.address_bits)?1:0, 1);
+	SPI_REG_SET(user, usr_command, (handle->cfg.command_bits)?1:0, 1);
+	user1_v.usr_addr_bitlen=handle->cfg.address_bits-1;
+	user1_v.usr_dummy_cyclelen=handle->cfg.dummy_bits+extra_dummy-1;
+	SPI_REG_SET(user2, usr_command_bitlen, handle->cfg.command_bits-1, 0xF);
+	//Configure misc stuff
+	SPI_REG_SET(user, doutdin, (handle->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)?0:1, 1);
+	SPI_REG_SET(user, sio, (handle->cfg.flags & LB_SPI_DEVICE_3WIRE)?1:0, 1);
+
+	SPI_REG_SET(ctrl2, setup_time, handle->cfg.cs_ena_pretrans-1, 0xF);
+	SPI_REG_SET(user, cs_setup, handle->cfg.cs_ena_pretrans?1:0, 1);
+	SPI_REG_SET(ctrl2, hold_time, handle->cfg.cs_ena_posttrans-1, 0xF);
+	SPI_REG_SET(user, cs_hold, (handle->cfg.cs_ena_posttrans)?1:0, 1);
+
+	//Configure CS pin
+	SPI_REG_SET(pin, cs0_dis, (handle->slot==0)?0:1, 1);
+	SPI_REG_SET(pin, cs1_dis, (handle->slot==1)?0:1, 1);
+	SPI_REG_SET(pin, cs2_dis, (handle->slot==2)?0:1, 1);
+
+	regs->ctrl = ctrl_v.val; regs->ctrl_mask = ctrl_m.val;
+	regs->ctrl2 = ctrl2_v.val; regs->ctrl2_mask = ctrl2_m.val;
+	regs->pin = pin_v.val; regs->pin_mask = pin_m.val;
+	regs->user = user_v.val; regs->user_mask = user_m.val;
+	regs->user1 = user1_v.val;
+	regs->user2 = user2_v.val; regs->user2_mask = user2_m.val;
+	regs->no_gpio_matrix = host->no_gpio_matrix;
+}
+
 //---------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 esp_err_t spi_lobo_bus_add_device(spi_lobo_host_device_t host, spi_lobo_bus_config_t *bus_config, spi_lobo_device_interface_config_t *dev_config, spi_lobo_device_handle_t *handle)
 {
@@ -587,6 +837,24 @@ esp_err_t spi_lobo_bus_add_device(spi_lobo_host_device_t host, spi_lobo_bus_conf
     memcpy(&dev->cfg, dev_config, sizeof(spi_lobo_device_interface_config_t));
     //We want to save a copy of the bus config in the dev struct.
     memcpy(&dev->bus_config, bus_config, sizeof(spi_lobo_bus_config_t));
+    dev->slot = freecs;
+
+    // Devices with the same bus configuration share the bus id, no bus reconfiguration is needed when switching between them
+    for (int x=0; x<NO_DEV; x++) {
+        spi_lobo_device_t *other = spihost[host]->device[x];
+        if ((other == NULL) || (other == dev) || (other == (spi_lobo_device_t *)1)) continue;
+        if (memcmp(&other->bus_config, bus_config, sizeof(spi_lobo_bus_config_t)) == 0) {
+            dev->bus_id = other->bus_id;
+            break;
+        }
+    }
+    if (dev->bus_id == 0) dev->bus_id = ++spihost[host]->bus_ids;
+    if ((spihost[host]->cur_bus_id == 0) && (memcmp(&spihost[host]->cur_bus_config, bus_config, sizeof(spi_lobo_bus_config_t)) == 0)) {
+        spihost[host]->cur_bus_id = dev->bus_id;
+    }
+
+    // Precompute the spi register image
+    spi_lobo_setup_dev_regs(dev);
 
     //Set CS pin, CS options
     if (dev_config->spics_io_num > 0) {
@@ -629,6 +897,8 @@ esp_err_t spi_lobo_bus_remove_device(spi_lobo_device_handle_t handle)
     for (x=0; x<NO_DEV; x++) {
         if (handle->host->device[x] == handle) handle->host->device[x]=NULL;
     }
+    // The next device in this slot must load its registers
+    if (handle->host->cur_device == handle->slot) handle->host->cur_device = -1;
 	
 	// Check if all devices are removed from this host and free the bus if yes
 	for (x=0; x<NO_DEV; x++) {
@@ -643,70 +913,19 @@ esp_err_t spi_lobo_bus_remove_device(spi_lobo_device_handle_t handle)
 	return ESP_OK;
 }
 
-//-----------------------------------------------------------------
-static int IRAM_ATTR spi_freq_for_pre_n(int fapb, int pre, int n) {
-    return (fapb / (pre * n));
-}
-
-/*
- * Set the SPI clock to a certain frequency. Returns the effective frequency set, which may be slightly
- * different from the requested frequency.
- */
-//-----------------------------------------------------------------------------------
-static int IRAM_ATTR spi_set_clock(spi_dev_t *hw, int fapb, int hz, int duty_cycle) {
-   int pre, n, h, l, eff_clk;
-
-    //In hw, n, h and l are 1-64, pre is 1-8K. Value written to register is one lower than used value.
-    if (hz>((fapb/4)*3)) {
-        //Using Fapb directly will give us the best result here.
-        hw->clock.clkcnt_l=0;
-        hw->clock.clkcnt_h=0;
-        hw->clock.clkcnt_n=0;
-        hw->clock.clkdiv_pre=0;
-        hw->clock.clk_equ_sysclk=1;
-        eff_clk=fapb;
-    } else {
-        //For best duty cycle resolution, we want n to be as close to 32 as possible, but
-        //we also need a pre/n combo that gets us as close as possible to the intended freq.
-        //To do this, we bruteforce n and calculate the best pre to go along with that.
-        //If there's a choice between pre/n combos that give the same result, use the one
-        //with the higher n.
-        int bestn=-1;
-        int bestpre=-1;
-        int besterr=0;
-        int errval;
-        for (n=1; n<=64; n++) {
-            //Effectively, this does pre=round((fapb/n)/hz).
-            pre=((fapb/n)+(hz/2))/hz;
-            if (pre<=0) pre=1;
-            if (pre>8192) pre=8192;
-            errval=abs(spi_freq_for_pre_n(fapb, pre, n)-hz);
-            if (bestn==-1 || errval<=besterr) {
-                besterr=errval;
-                bestn=n;
-                bestpre=pre;
-            }
-        }
-
-        n=bestn;
-        pre=bestpre;
-        l=n;
-        //This effectively does round((duty_cycle*n)/256)
-        h=(duty_cycle*n+127)/256;
-        if (h<=0) h=1;
-
-        hw->clock.clk_equ_sysclk=0;
-        hw->clock.clkcnt_n=n-1;
-        hw->clock.clkdiv_pre=pre-1;
-        hw->clock.clkcnt_h=h-1;
-        hw->clock.clkcnt_l=l-1;
-        eff_clk=spi_freq_for_pre_n(fapb, pre, n);
-    }
-    return eff_clk;
+// Check if a device with priority higher than 'prio' waits for the bus
+//------------------------------------------------------------------------------
+static bool IRAM_ATTR spi_lobo_bus_higher_waiting(spi_lobo_host_t *host, uint8_t prio)
+{
+	uint32_t waiting = host->bus_waiting;
+	for (int x=0; (waiting) && (x<NO_DEV); x++, waiting >>= 1) {
+		if ((waiting & 1) == 0) continue;
+		spi_lobo_device_t *dev = host->device[x];
+		if ((dev) && (dev != (spi_lobo_device_t *)1) && (dev->cfg.priority > prio)) return true;
+	}
+	return false;
 }
 
-
-
 //------------------------------------------------------------------------------------
 esp_err_t IRAM_ATTR spi_lobo_device_select(spi_lobo_device_handle_t handle, int force)
 {
@@ -714,104 +933,67 @@ esp_err_t IRAM_ATTR spi_lobo_device_select(spi_lobo_device_handle_t handle, int
 
 	if ((handle->cfg.selected == 1) && (!force)) return ESP_OK;  // already selected
 
-	int i;
 	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
 
-	// find device's host bus
-	for (i=0; i<NO_DEV; i++) {
-		if (host->device[i] == handle) break;
+	// check the device is on its host bus
+	if (host->device[handle->slot] != handle) return ESP_ERR_INVALID_ARG;
+
+	// Take the bus, higher priority devices waiting for it are seen by the device holding it
+	// The mutex is granted in task priority order, so if a device with higher bus priority
+	// still waits when the bus is taken, it is passed on to that device first
+	uint32_t start_cycles = xthal_get_ccount();
+	BaseType_t taken;
+	__sync_fetch_and_or(&host->bus_waiting, (1 << handle->slot));
+	for (;;) {
+		taken = xSemaphoreTake(host->spi_lobo_bus_mutex, SPI_SEMAPHORE_WAIT);
+		if ((!taken) || (!spi_lobo_bus_higher_waiting(host, handle->cfg.priority))) break;
+		xSemaphoreGive(host->spi_lobo_bus_mutex);
+		while (spi_lobo_bus_higher_waiting(host, handle->cfg.priority)) vTaskDelay(1);
+	}
+	__sync_fetch_and_and(&host->bus_waiting, ~(1 << handle->slot));
+	if (!taken) return ESP_ERR_INVALID_STATE;
+
+	uint32_t wait_us = (xthal_get_ccount() - start_cycles) / ets_get_cpu_frequency();
+	handle->bus_stats.acquires++;
+	handle->bus_stats.last_wait_us = wait_us;
+	handle->bus_stats.total_wait_us += wait_us;
+	if (wait_us > handle->bus_stats.max_wait_us) handle->bus_stats.max_wait_us = wait_us;
+
+	// If the bus was released to higher priority devices, let the releasing task continue when they all got it
+	if ((host->yield_task) && (!spi_lobo_bus_higher_waiting(host, host->yield_prio))) {
+		host->yield_task = NULL;
+		xSemaphoreGive(host->yield_sem);
 	}
-	if (i == NO_DEV) return ESP_ERR_INVALID_ARG;
-
-	if (!(xSemaphoreTake(host->spi_lobo_bus_mutex, SPI_SEMAPHORE_WAIT))) return ESP_ERR_INVALID_STATE;
 
 	// Check if previously used device's bus device is the same
-	if (memcmp(&host->cur_bus_config, &handle->bus_config, sizeof(spi_lobo_bus_config_t)) != 0) {
-		// device has different bus configuration, we need to reconfigure the bus
-		esp_err_t err = spi_lobo_bus_free(1, 0);
-		if (err) {
-			xSemaphoreGive(host->spi_lobo_bus_mutex);
-			return err;
-		}
-		err = spi_lobo_bus_initialize(i, &handle->bus_config, -1);
+	if (host->cur_bus_id != handle->bus_id) {
+		// device has different bus configuration, we need to reconfigure the bus pins
+		esp_err_t err = spi_lobo_bus_initialize(handle->host_dev, &handle->bus_config, -1);
 		if (err) {
 			xSemaphoreGive(host->spi_lobo_bus_mutex);
 			return err;
 		}
+		host->cur_bus_id = handle->bus_id;
 	}
 
 	//Reconfigure according to device settings, but only if the device changed or forced.
-	if ((force) || (host->device[host->cur_device] != handle)) {
-	    //Assumes a hardcoded 80MHz Fapb for now. ToDo: figure out something better once we have clock scaling working.
-		int apbclk=APB_CLK_FREQ;
-
-	    //Speeds >=40MHz over GPIO matrix needs a dummy cycle, but these don't work for full-duplex connections.
-	    if (((handle->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX) == 0) && (handle->cfg.clock_speed_hz > ((apbclk*2)/5)) && (!host->no_gpio_matrix)) {
-	    	// set speed to 32 MHz
-	    	handle->cfg.clock_speed_hz = (apbclk*2)/5;
-	    }
-
-		int effclk=spi_set_clock(host->hw, apbclk, handle->cfg.clock_speed_hz, handle->cfg.duty_cycle_pos);
-		//Configure bit order
-		host->hw->ctrl.rd_bit_order=(handle->cfg.flags & LB_SPI_DEVICE_RXBIT_LSBFIRST)?1:0;
-		host->hw->ctrl.wr_bit_order=(handle->cfg.flags & LB_SPI_DEVICE_TXBIT_LSBFIRST)?1:0;
-		
-		//Configure polarity
-        //SPI iface needs to be configured for a delay in some cases.
-		int nodelay=0;
-        int extra_dummy=0;
-        if (host->no_gpio_matrix) {
-            if (effclk >= apbclk/2) {
-                nodelay=1;
-            }
-        } else {
-            if (effclk >= apbclk/2) {
-                nodelay=1;
-                extra_dummy=1;          //Note: This only works on half-duplex connections. spi_lobo_bus_add_device checks for this.
-            } else if (effclk >= apbclk/4) {
-                nodelay=1;
-            }
-        }
-		if (handle->cfg.mode==0) {
-			host->hw->pin.ck_idle_edge=0;
-			host->hw->user.ck_out_edge=0;
-			host->hw->ctrl2.miso_delay_mode=nodelay?0:2;
-		} else if (handle->cfg.mode==1) {
-			host->hw->pin.ck_idle_edge=0;
-			host->hw->user.ck_out_edge=1;
-			host->hw->ctrl2.miso_delay_mode=nodelay?0:1;
-		} else if (handle->cfg.mode==2) {
-			host->hw->pin.ck_idle_edge=1;
-			host->hw->user.ck_out_edge=1;
-			host->hw->ctrl2.miso_delay_mode=nodelay?0:1;
-		} else if (handle->cfg.mode==3) {
-			host->hw->pin.ck_idle_edge=1;
-			host->hw->user.ck_out_edge=0;
-			host->hw->ctrl2.miso_delay_mode=nodelay?0:2;
-		}
-
-		//Configure bit sizes, load addr and command
-		host->hw->user.usr_dummy=(handle->cfg.dummy_bits+extra_dummy)?1:0;
-		host->hw->user.usr_addr=(handle->cfg.address_bits)?1:0;
-		host->hw->user.usr_command=(handle->cfg.command_bits)?1:0;
-		host->hw->user1.usr_addr_bitlen=handle->cfg.address_bits-1;
-		host->hw->user1.usr_dummy_cyclelen=handle->cfg.dummy_bits+extra_dummy-1;
-		host->hw->user2.usr_command_bitlen=handle->cfg.command_bits-1;
-		//Configure misc stuff
-		host->hw->user.doutdin=(handle->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)?0:1;
-		host->hw->user.sio=(handle->cfg.flags & LB_SPI_DEVICE_3WIRE)?1:0;
-
-		host->hw->ctrl2.setup_time=handle->cfg.cs_ena_pretrans-1;
-		host->hw->user.cs_setup=handle->cfg.cs_ena_pretrans?1:0;
-		host->hw->ctrl2.hold_time=handle->cfg.cs_ena_posttrans-1;
-		host->hw->user.cs_hold=(handle->cfg.cs_ena_posttrans)?1:0;
-
-		//Configure CS pin
-		host->hw->pin.cs0_dis=(i==0)?0:1;
-		host->hw->pin.cs1_dis=(i==1)?0:1;
-		host->hw->pin.cs2_dis=(i==2)?0:1;
-		
-		host->cur_device = i;
+	if ((force) || (host->cur_device != handle->slot)) {
+		// dummy cycle & miso delay depend on the pin routing of the current bus configuration
+		if ((force) || (handle->regs.no_gpio_matrix != host->no_gpio_matrix)) spi_lobo_setup_dev_regs(handle);
+
+		// Load the device's register image
+		spi_lobo_dev_regs_t *regs = &handle->regs;
+		host->hw->clock.val = regs->clock;
+		host->hw->ctrl.val = (host->hw->ctrl.val & ~regs->ctrl_mask) | regs->ctrl;
+		host->hw->ctrl2.val = (host->hw->ctrl2.val & ~regs->ctrl2_mask) | regs->ctrl2;
+		host->hw->pin.val = (host->hw->pin.val & ~regs->pin_mask) | regs->pin;
+		host->hw->user.val = (host->hw->user.val & ~regs->user_mask) | regs->user;
+		host->hw->user1.val = regs->user1;
+		host->hw->user2.val = (host->hw->user2.val & ~regs->user2_mask) | regs->user2;
+		host->eff_clk = regs->eff_clk;
+
+		host->cur_device = handle->slot;
+		handle->bus_stats.switches++;
 	}
 
 	if ((handle->cfg.spics_io_num < 0) && (handle->cfg.spics_ext_io_num > 0)) {
@@ -830,15 +1012,11 @@ esp_err_t IRAM_ATTR spi_lobo_device_deselect(spi_lobo_device_handle_t handle)
 
 	if (handle->cfg.selected == 0) return ESP_OK;  // already deselected
 
-	int i;
 	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
 
-	for (i=0; i<NO_DEV; i++) {
-		if (host->device[i] == handle) break;
-	}
-	if (i == NO_DEV) return ESP_ERR_INVALID_ARG;
+	if (host->device[handle->slot] != handle) return ESP_ERR_INVALID_ARG;
 	
-	if (host->device[host->cur_device] == handle) {
+	if (host->cur_device == handle->slot) {
 		if ((handle->cfg.spics_io_num < 0) && (handle->cfg.spics_ext_io_num > 0)) {
 			gpio_set_level(handle->cfg.spics_ext_io_num, 1);
 		}
@@ -863,6 +1041,206 @@ void IRAM_ATTR spi_lobo_device_GiveSemaphore(spi_lobo_device_handle_t handle)
 	xSemaphoreTake(handle->host->spi_lobo_bus_mutex, portMAX_DELAY);
 }
 
+//-----------------------------------------------------------------------------
+esp_err_t IRAM_ATTR spi_lobo_wait_trans_done(spi_lobo_device_handle_t handle)
+{
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	if (host->hw->cmd.usr == 0) return ESP_OK;
+
+	if ((host->intr) && (host->intr_min_us) && (host->eff_clk > 0) && (!xPortInIsrContext()) &&
+			(xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)) {
+		// Estimate the transfer time from the number of bits and spi clock
+		uint32_t bits = host->hw->mosi_dlen.usr_mosi_dbitlen + 1;
+		if ((host->hw->user.usr_miso) && ((host->hw->miso_dlen.usr_miso_dbitlen + 1) > bits)) bits = host->hw->miso_dlen.usr_miso_dbitlen + 1;
+		uint32_t trans_us = (uint32_t)(((uint64_t)bits * 1000000) / host->eff_clk);
+
+		if (trans_us >= host->intr_min_us) {
+			// Long transfer, block the task until the 'transaction done' interrupt
+			uint32_t start_cycles = xthal_get_ccount();
+			host->hw->slave.trans_done = 0;
+			xSemaphoreTake(host->done_sem, 0);	// clear the signal of an earlier interrupt
+			host->intr_wait = true;
+			esp_intr_enable(host->intr);
+			if (host->hw->cmd.usr == 0) {
+				// The transfer finished before 'trans_done' was cleared, the interrupt will not fire
+				esp_intr_disable(host->intr);
+				host->intr_wait = false;
+			}
+			else if (xSemaphoreTake(host->done_sem, (trans_us / 1000 / portTICK_PERIOD_MS) + 2) != pdTRUE) {
+				// timeout, should not happen
+				esp_intr_disable(host->intr);
+				host->intr_wait = false;
+			}
+			while (host->hw->cmd.usr);
+
+			uint32_t cycles = xthal_get_ccount() - start_cycles;
+			host->wait_stats.intr_waits++;
+			host->wait_stats.last_cycles_saved = cycles;
+			host->wait_stats.cycles_saved += cycles;
+			return ESP_OK;
+		}
+	}
+
+	// Short transfer, poll the spi hw
+	spi_lobo_spin_trans_done(handle);
+	host->wait_stats.spin_waits++;
+	return ESP_OK;
+}
+
+//---------------------------------------------------------------------------------
+esp_err_t spi_lobo_set_wait_mode(spi_lobo_device_handle_t handle, uint32_t min_us)
+{
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+
+	if ((min_us) && (handle->host->intr == NULL)) return ESP_ERR_NOT_SUPPORTED;
+	handle->host->intr_min_us = min_us;
+	return ESP_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR spi_lobo_set_done_cb(spi_lobo_device_handle_t handle, spi_lobo_done_cb_t cb, void *arg)
+{
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	if ((cb) && (host->intr == NULL)) return ESP_ERR_NOT_SUPPORTED;
+	host->done_cb = NULL;
+	host->done_arg = arg;
+	host->done_cb = cb;
+	return ESP_OK;
+}
+
+//------------------------------------------------------------------
+void IRAM_ATTR spi_lobo_done_intr_arm(spi_lobo_device_handle_t handle)
+{
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	host->hw->slave.trans_done = 0;
+	esp_intr_enable(host->intr);
+}
+
+//---------------------------------------------------------------------------------------
+esp_err_t spi_lobo_wait_done_signal(spi_lobo_device_handle_t handle, uint32_t ticks)
+{
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+
+	if (xSemaphoreTake(handle->host->done_sem, ticks) != pdTRUE) return ESP_ERR_TIMEOUT;
+	return ESP_OK;
+}
+
+//------------------------------------------------------------------------------------------------------------
+esp_err_t spi_lobo_get_wait_stats(spi_lobo_device_handle_t handle, spi_lobo_wait_stats_t *stats, bool reset)
+{
+	if ((handle == NULL) || (stats == NULL)) return ESP_ERR_INVALID_ARG;
+
+	memcpy(stats, &handle->host->wait_stats, sizeof(spi_lobo_wait_stats_t));
+	if (reset) memset(&handle->host->wait_stats, 0, sizeof(spi_lobo_wait_stats_t));
+	return ESP_OK;
+}
+
+//---------------------------------------------------------------------------
+bool IRAM_ATTR spi_lobo_bus_yield_requested(spi_lobo_device_handle_t handle)
+{
+	if (handle == NULL) return false;
+	if (handle->host->bus_waiting == 0) return false;
+	return spi_lobo_bus_higher_waiting(handle->host, handle->cfg.priority);
+}
+
+//-------------------------------------------------------------------
+esp_err_t IRAM_ATTR spi_lobo_bus_yield(spi_lobo_device_handle_t handle)
+{
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+	if ((handle->cfg.selected == 0) || (!spi_lobo_bus_yield_requested(handle))) return ESP_OK;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	spi_lobo_wait_trans_done(handle);
+
+	host->yield_prio = handle->cfg.priority;
+	xSemaphoreTake(host->yield_sem, 0);	// clear the signal of an earlier yield
+	host->yield_task = xTaskGetCurrentTaskHandle();
+	spi_lobo_device_deselect(handle);
+
+	// Wait until the higher priority devices got the bus (the last one gives 'yield_sem')
+	// or stopped waiting for it
+	while ((host->yield_task) && (spi_lobo_bus_higher_waiting(host, handle->cfg.priority))) {
+		xSemaphoreTake(host->yield_sem, 1);
+	}
+	host->yield_task = NULL;
+	handle->bus_stats.yields++;
+
+	// Wait for the bus and select the device again
+	return spi_lobo_device_select(handle, 0);
+}
+
+//-------------------------------------------------------------------
+uint32_t spi_lobo_bus_slice_bytes(spi_lobo_device_handle_t handle)
+{
+	if (handle == NULL) return 0;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	uint32_t latency_us = 0;
+
+	for (int x=0; x<NO_DEV; x++) {
+		spi_lobo_device_t *dev = host->device[x];
+		if ((dev == NULL) || (dev == (spi_lobo_device_t *)1) || (dev == handle)) continue;
+		if ((dev->cfg.priority > handle->cfg.priority) && (dev->cfg.latency_us) &&
+				((latency_us == 0) || (dev->cfg.latency_us < latency_us))) latency_us = dev->cfg.latency_us;
+	}
+	if (latency_us == 0) return 0;
+
+	// Bytes sent at the device's clock in half of the latency target,
+	// the rest is left for the device switch and the waiting device's own transfer
+	uint32_t slice = (uint32_t)(((uint64_t)latency_us * handle->regs.eff_clk) / 8 / 1000000 / 2);
+	if (slice < SPI_BUS_MIN_SLICE) slice = SPI_BUS_MIN_SLICE;
+	return slice;
+}
+
+//------------------------------------------------------------------------------------------------------------
+esp_err_t spi_lobo_get_bus_stats(spi_lobo_device_handle_t handle, spi_lobo_bus_stats_t *stats, bool reset)
+{
+	if ((handle == NULL) || (stats == NULL)) return ESP_ERR_INVALID_ARG;
+
+	memcpy(stats, &handle->bus_stats, sizeof(spi_lobo_bus_stats_t));
+	if (reset) memset(&handle->bus_stats, 0, sizeof(spi_lobo_bus_stats_t));
+	stats->direct_transactions = stats->transactions - stats->dma_transactions;
+	stats->spin_us = stats->spin_cycles / ets_get_cpu_frequency();
+	return ESP_OK;
+}
+
+//------------------------------------------------------------------------------------------------------------
+esp_err_t spi_lobo_get_host_stats(spi_lobo_device_handle_t handle, spi_lobo_bus_stats_t *stats, bool reset)
+{
+	if ((handle == NULL) || (stats == NULL)) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	memset(stats, 0, sizeof(spi_lobo_bus_stats_t));
+	for (int x=0; x<NO_DEV; x++) {
+		spi_lobo_device_t *dev = host->device[x];
+		if ((dev == NULL) || (dev == (spi_lobo_device_t *)1)) continue;
+		spi_lobo_bus_stats_t *dstats = &dev->bus_stats;
+		stats->acquires += dstats->acquires;
+		if (dstats->max_wait_us > stats->max_wait_us) stats->max_wait_us = dstats->max_wait_us;
+		stats->total_wait_us += dstats->total_wait_us;
+		stats->yields += dstats->yields;
+		stats->switches += dstats->switches;
+		stats->transactions += dstats->transactions;
+		stats->dma_transactions += dstats->dma_transactions;
+		stats->tx_bytes += dstats->tx_bytes;
+		stats->rx_bytes += dstats->rx_bytes;
+		stats->spin_cycles += dstats->spin_cycles;
+		if (reset) memset(dstats, 0, sizeof(spi_lobo_bus_stats_t));
+	}
+	stats->direct_transactions = stats->transactions - stats->dma_transactions;
+	stats->spin_us = stats->spin_cycles / ets_get_cpu_frequency();
+	return ESP_OK;
+}
+
 //----------------------------------------------------------
 uint32_t spi_lobo_get_speed(spi_lobo_device_handle_t handle)
 {
@@ -908,6 +1286,74 @@ void spi_lobo_get_native_pins(int host, int *sdi, int *sdo, int *sck)
 	*sck = io_signal[host].spiclk_native;
 }
 
+// Return the number of bytes from 'buf' which can be transferred using DMA
+// The buffer must be DMA capable and 32-bit aligned, only whole 32-bit words are transferred
+//-------------------------------------------------------------------------------------------
+static uint32_t IRAM_ATTR spi_lobo_dma_len(spi_lobo_host_t *host, const uint8_t *buf, uint32_t len)
+{
+	if ((host->dma_chan == 0) || (len < SPI_DMA_MIN_TRANS_LEN)) return 0;
+	if ((((uint32_t)buf & 3) != 0) || (!esp_ptr_dma_capable(buf))) return 0;
+	return len & ~3;
+}
+
+// Transfer 'len' bytes using DMA in chunks of the bus max transfer size
+// If 'txbuf' is NULL only receives, if 'rxbuf' is NULL only transmits
+// Command and address phases, if used, are repeated for each chunk
+//-------------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR spi_lobo_dma_transfer(spi_lobo_device_handle_t handle, const uint8_t *txbuf, uint8_t *rxbuf, uint32_t len)
+{
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	uint32_t max_chunk = host->max_transfer_sz & ~3;
+	uint32_t chunk;
+
+	while (len > 0) {
+		chunk = (len > max_chunk) ? max_chunk : len;
+
+		//Fill DMA descriptors
+		spi_lobo_dmaworkaround_transfer_active(host->dma_chan); //mark channel as active
+		if (rxbuf) {
+			spi_lobo_setup_dma_desc_links(host->dmadesc_rx, chunk, rxbuf, true);
+			host->hw->user.usr_miso = 1;
+			host->hw->miso_dlen.usr_miso_dbitlen = (chunk * 8) - 1;
+			host->hw->dma_in_link.addr=(int)(&host->dmadesc_rx[0]) & 0xFFFFF;
+			host->hw->dma_in_link.start=1;
+		}
+		else {
+			host->hw->user.usr_miso = 0;
+			host->hw->miso_dlen.usr_miso_dbitlen = 0;
+		}
+		if (txbuf) {
+			spi_lobo_setup_dma_desc_links(host->dmadesc_tx, chunk, txbuf, false);
+			host->hw->user.usr_mosi = 1;
+			host->hw->mosi_dlen.usr_mosi_dbitlen = (chunk * 8) - 1;
+			host->hw->dma_out_link.addr=(int)(&host->dmadesc_tx[0]) & 0xFFFFF;
+			host->hw->dma_out_link.start=1;
+		}
+		else {
+			host->hw->user.usr_mosi = 0;
+			host->hw->mosi_dlen.usr_mosi_dbitlen = 0;
+		}
+
+		// ** Start the transaction ***
+		spi_lobo_start_trans(handle, true);
+		// Wait the transaction to finish
+		spi_lobo_wait_trans_done(handle);
+
+		//Tell common code DMA workaround that our DMA channel is idle. If needed, the code will do a DMA reset.
+		spi_lobo_dmaworkaround_idle(host->dma_chan);
+		// Reset DMA, the next transaction may use the spi hw buffer
+		host->hw->dma_conf.val |= SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+		host->hw->dma_out_link.start=0;
+		host->hw->dma_in_link.start=0;
+		host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+		host->hw->dma_conf.out_data_burst_en=1;
+
+		if (txbuf) txbuf += chunk;
+		if (rxbuf) rxbuf += chunk;
+		len -= chunk;
+	}
+}
+
 /*
 When using  'spi_lobo_transfer_data' function we can have several scenarios:
 
@@ -916,6 +1362,8 @@ B: Receive only   (trans->txlength = 0)
 C: Send & receive (trans->txlength > 0 & trans->rxlength > 0)
 D: No operation   (trans->txlength = 0 & trans->rxlength = 0)
 
+Transfers of at least SPI_DMA_MIN_TRANS_LEN bytes from/to DMA capable, 32-bit aligned buffers
+are done using DMA, only the remaining bytes are transferred using the 64-byte spi hw buffer.
 */
 //----------------------------------------------------------------------------------------------------------
 esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans) {
@@ -961,7 +1409,7 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 	if ((rxbuffer == &trans->rx_data[0]) && (rxlen > 4)) return ESP_ERR_INVALID_ARG;
 
 	// --- Wait for SPI bus ready ---
-	while (host->hw->cmd.usr);
+	spi_lobo_wait_trans_done(handle);
 
     // ** If the device was not selected, select it
 	if (handle->cfg.selected == 0) {
@@ -995,8 +1443,25 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 		host->hw->addr=trans->address & 0xffffffff;
 	}
 
-	// Check if we have to transmit some data
+	// ** Transfer the bulk of transmit data using DMA if possible
 	if (txlen > 0) {
+		uint32_t dma_len = spi_lobo_dma_len(host, txbuffer, txlen);
+		if ((duplex) && (rdcount > 0)) {
+			// In full duplex mode we are receiving while sending, both buffers must be DMA capable
+			if (dma_len > rdcount) dma_len = rdcount & ~3;
+			if (spi_lobo_dma_len(host, rxbuffer, dma_len) < dma_len) dma_len = 0;
+			if (dma_len > 0) {
+				spi_lobo_dma_transfer(handle, txbuffer, rxbuffer, dma_len);
+				rd_read += dma_len;
+				rdcount -= dma_len;
+			}
+		}
+		else if (dma_len > 0) spi_lobo_dma_transfer(handle, txbuffer, NULL, dma_len);
+		count = dma_len;
+	}
+
+	// Check if we have to transmit some data
+	if (count < txlen) {
 		host->hw->user.usr_mosi = 1;
 		uint8_t idx;
 		bits = 0;				// remaining bits to send
@@ -1028,9 +1493,9 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 				}
 
 				// ** Start the transaction ***
-				host->hw->cmd.usr=1;
+				spi_lobo_start_trans(handle, false);
                 // Wait the transaction to finish
-				while (host->hw->cmd.usr);
+				spi_lobo_wait_trans_done(handle);
 
 				if ((duplex) && (rdcount > 0)) {
 					// *** in full duplex mode transfer received data to input buffer ***
@@ -1070,9 +1535,9 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 			}
 
 			// ** Start the transaction ***
-			host->hw->cmd.usr=1;
+			spi_lobo_start_trans(handle, false);
             // Wait the transaction to finish
-			while (host->hw->cmd.usr);
+			spi_lobo_wait_trans_done(handle);
 
 			if ((duplex) && (rdcount > 0)) {
                 // *** in full duplex mode transfer received data to input buffer ***
@@ -1107,6 +1572,14 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 		//     This is true if we operate in Half duplex mode when receiving after transmission is done,
 		//     or not all data was received in Full duplex mode during the transmission (trans->rxlength > trans->txlength)
 		// ----------------------------------------------------------------------------------------------------------------
+		// ** Receive the bulk of data using DMA if possible
+		uint32_t dma_len = spi_lobo_dma_len(host, rxbuffer + rd_read, rdcount);
+		if (dma_len > 0) {
+			spi_lobo_dma_transfer(handle, NULL, rxbuffer + rd_read, dma_len);
+			rd_read += dma_len;
+			rdcount -= dma_len;
+		}
+
 		host->hw->user.usr_mosi = 0;  // do not send
 		host->hw->user.usr_miso = 1;  // do receive
 		while (rdcount > 0) {
@@ -1118,9 +1591,9 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 			host->hw->miso_dlen.usr_miso_dbitlen=rdbits-1;
 
 			// ** Start the transaction ***
-			host->hw->cmd.usr=1;
+			spi_lobo_start_trans(handle, false);
 			// Wait the transaction to finish
-			while (host->hw->cmd.usr);
+			spi_lobo_wait_trans_done(handle);
 
 			// *** transfer received data to input buffer ***
 			rdidx = 0;
@@ -19,7 +19,10 @@
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/xtensa_api.h"
 #include "soc/spi_struct.h"
+#include "soc/gpio_struct.h"
 
 #include "esp_intr.h"
 #include "esp_intr_alloc.h"
@@ -74,6 +77,7 @@ typedef struct {
 
 typedef struct spi_lobo_transaction_t spi_lobo_transaction_t;
 typedef void(*spi_lobo_transaction_cb_t)(spi_lobo_transaction_t *trans);
+typedef void(*spi_lobo_done_cb_t)(void *arg, BaseType_t *do_yield);
 
 /**
  * @brief This is a configuration for a SPI slave device that is connected to one of the SPI buses.
@@ -93,6 +97,8 @@ typedef struct {
     spi_lobo_transaction_cb_t pre_cb;   ///< Callback to be called before a transmission is started. This callback from 'spi_lobo_transfer_data' function.
     spi_lobo_transaction_cb_t post_cb;  ///< Callback to be called after a transmission has completed. This callback from 'spi_lobo_transfer_data' function.
     uint8_t selected;                   ///< **INTERNAL** 1 if the device's CS pin is active
+    uint8_t priority;                   ///< Bus priority; a device holding the bus yields it between slices of long transfers if a higher priority device waits, and the bus is handed to the waiting device with the highest priority
+    uint32_t latency_us;                ///< Target maximal time in us the device waits for the bus held by a lower priority device; 0 for no target
 } spi_lobo_device_interface_config_t;
 
 
@@ -125,6 +131,54 @@ struct spi_lobo_transaction_t {
 #define NO_CS 3					    // Number of CS pins per SPI host
 #define NO_DEV 6				    // Number of spi devices per SPI host; more than 3 devices can be attached to the same bus if using software CS's
 #define SPI_SEMAPHORE_WAIT 2000     // Time in ms to wait for SPI mutex
+#define SPI_INTR_WAIT_MIN_US 20     // Default minimal estimated transfer time in us for which the interrupt wait is used
+#define SPI_DMA_MIN_TRANS_LEN 128   // Minimal data length in bytes for which spi_lobo_transfer_data uses DMA
+#define SPI_BUS_MIN_SLICE 512       // Minimal slice in bytes of long transfers interrupted to meet other devices latency targets
+
+/**
+ * Transaction completion wait statistics, see spi_lobo_get_wait_stats()
+ */
+typedef struct {
+    uint32_t intr_waits;            ///< Number of waits completed by 'transaction done' interrupt
+    uint32_t spin_waits;            ///< Number of waits completed by polling the spi hw (short transfers)
+    uint32_t last_cycles_saved;     ///< CPU cycles the waiting task was blocked during the last interrupt wait
+    uint64_t cycles_saved;          ///< Total CPU cycles available to other tasks while waiting for transfers to finish
+} spi_lobo_wait_stats_t;
+
+/**
+ * Precomputed spi hw register image of the device, loaded on device switch
+ * Registers shared with other settings are written only in the bits set in '*_mask'
+ */
+typedef struct {
+    uint32_t clock;                 ///< spi clock register
+    uint32_t ctrl, ctrl_mask;       ///< bit order
+    uint32_t ctrl2, ctrl2_mask;     ///< cs setup/hold time, miso delay
+    uint32_t pin, pin_mask;         ///< clock idle edge, hw cs
+    uint32_t user, user_mask;       ///< clock edge, phases, duplex mode, cs setup/hold
+    uint32_t user1;                 ///< address & dummy lengths
+    uint32_t user2, user2_mask;     ///< command length
+    int eff_clk;                    ///< effective spi clock
+    bool no_gpio_matrix;            ///< bus pin routing (native or GPIO matrix) the image was computed for
+} spi_lobo_dev_regs_t;
+
+/**
+ * Bus access and transfer statistics of the device or host, see spi_lobo_get_bus_stats()
+ */
+typedef struct {
+    uint32_t acquires;              ///< Number of times the device took the bus
+    uint32_t last_wait_us;          ///< Time waited for the bus the last time
+    uint32_t max_wait_us;           ///< Worst case time waited for the bus
+    uint64_t total_wait_us;         ///< Total time waited for the bus
+    uint32_t yields;                ///< Number of times the device released the bus to a higher priority device
+    uint32_t switches;              ///< Number of times the spi hw was configured for the device
+    uint32_t transactions;          ///< Number of spi hw transactions
+    uint32_t dma_transactions;      ///< Number of spi hw transactions using DMA
+    uint32_t direct_transactions;   ///< Number of spi hw transactions using the spi hw data buffer
+    uint64_t tx_bytes;              ///< Bytes transmitted
+    uint64_t rx_bytes;              ///< Bytes received
+    uint64_t spin_cycles;           ///< CPU cycles spent polling the spi hw for transaction end
+    uint64_t spin_us;               ///< Time spent polling the spi hw for transaction end, calculated from 'spin_cycles'
+} spi_lobo_bus_stats_t;
 
 typedef struct spi_lobo_device_t spi_lobo_device_t;
 
@@ -141,6 +195,19 @@ typedef struct {
     int max_transfer_sz;
     QueueHandle_t spi_lobo_bus_mutex;
     spi_lobo_bus_config_t cur_bus_config;
+    int cur_bus_id;                 // id of the current bus configuration
+    int bus_ids;                    // number of different bus configurations used by the devices
+    int eff_clk;                    // effective spi clock of the current device
+    uint32_t intr_min_us;           // transfers estimated to last less than this are polled; 0 -> always poll
+    volatile bool intr_wait;        // a task waits for the 'transaction done' interrupt in spi_lobo_wait_trans_done()
+    SemaphoreHandle_t done_sem;     // given by the 'transaction done' interrupt
+    spi_lobo_done_cb_t done_cb;     // called from the 'transaction done' interrupt, see spi_lobo_set_done_cb()
+    void *done_arg;
+    volatile uint32_t bus_waiting;  // bit mask of device slots waiting for the bus
+    TaskHandle_t yield_task;        // task which released the bus to higher priority devices
+    SemaphoreHandle_t yield_sem;    // given when the higher priority devices got the bus
+    uint8_t yield_prio;             // priority of the device which released the bus
+    spi_lobo_wait_stats_t wait_stats;
 } spi_lobo_host_t;
 
 struct spi_lobo_device_t {
@@ -148,12 +215,75 @@ struct spi_lobo_device_t {
     spi_lobo_host_t *host;
     spi_lobo_bus_config_t bus_config;
 	spi_lobo_host_device_t host_dev;
+    int slot;                       // index in host's device list
+    int bus_id;                     // devices with the same bus configuration have the same id
+    spi_lobo_dev_regs_t regs;       // spi hw register image
+    spi_lobo_bus_stats_t bus_stats;
 };
 
 typedef spi_lobo_device_t* spi_lobo_device_handle_t;  ///< Handle for a device on a SPI bus
 typedef spi_lobo_host_t* spi_lobo_host_handle_t;
 typedef spi_lobo_device_interface_config_t* spi_lobo_device_interface_config_handle_t;
 
+/**
+ * @brief Start the spi transaction prepared in the device's spi hw registers
+ *
+ * Counts the transaction and transfer lengths in the device's statistics.
+ * All transactions started by the driver and by the device drivers using direct spi hw access should use it.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param dma    true if the transaction uses DMA
+ */
+static inline void spi_lobo_start_trans(spi_lobo_device_handle_t handle, bool dma)
+{
+	spi_dev_t *hw = handle->host->hw;
+	spi_lobo_bus_stats_t *stats = &handle->bus_stats;
+
+	stats->transactions++;
+	if (dma) stats->dma_transactions++;
+	if (hw->user.usr_mosi) stats->tx_bytes += (hw->mosi_dlen.usr_mosi_dbitlen + 8) / 8;
+	if (hw->user.usr_miso) stats->rx_bytes += (hw->miso_dlen.usr_miso_dbitlen + 8) / 8;
+	hw->cmd.usr = 1;
+}
+
+/**
+ * @brief Set the GPIO output level by writing the GPIO registers directly
+ *
+ * Usable from IRAM interrupt handlers, the pin must already be configured as output.
+ *
+ * @param gpio_num GPIO pin number
+ * @param level    Output level
+ */
+static inline void spi_lobo_gpio_set_level(int gpio_num, uint32_t level)
+{
+	if (gpio_num < 32) {
+		if (level) GPIO.out_w1ts = (1 << gpio_num);
+		else GPIO.out_w1tc = (1 << gpio_num);
+	}
+	else {
+		if (level) GPIO.out1_w1ts.data = (1 << (gpio_num - 32));
+		else GPIO.out1_w1tc.data = (1 << (gpio_num - 32));
+	}
+}
+
+/**
+ * @brief Poll the spi hw until the current transaction is finished
+ *
+ * Use for short transactions, the time spent is counted in the device's statistics.
+ * For long transfers use spi_lobo_wait_trans_done().
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ */
+static inline void spi_lobo_spin_trans_done(spi_lobo_device_handle_t handle)
+{
+	spi_dev_t *hw = handle->host->hw;
+
+	if (hw->cmd.usr == 0) return;
+	uint32_t start_cycles = xthal_get_ccount();
+	while (hw->cmd.usr);
+	handle->bus_stats.spin_cycles += xthal_get_ccount() - start_cycles;
+}
+
 
 /**
  * @brief Add a device. This allocates a CS line for the device, allocates memory for the device structure and hooks
@@ -223,12 +353,14 @@ uint32_t spi_lobo_set_speed(spi_lobo_device_handle_t handle, uint32_t speed);
  * @brief Select spi device for transmission
  *
  * It configures spi bus with selected spi device parameters if previously selected device was different than the current
+ * The device's spi register image is precomputed when the device is added, switching devices only loads it
  * If device's spics_io_num=-1 and spics_ext_io_num > 0 'spics_ext_io_num' pin is set to active state (low)
  * 
  * spi bus device's semaphore is taken before selecting the device
  *
  * @param handle Device handle obtained using spi_lobo_bus_add_device
- * @param force  configure spi bus even if the previous device was the same
+ * @param force  recompute the register image from device configuration and configure spi bus
+ *               even if the previous device was the same; use if the device's 'cfg' was changed
  * 
  * @return 
  *         - ESP_ERR_INVALID_ARG   if parameter is invalid
@@ -286,6 +418,9 @@ void spi_lobo_get_native_pins(int host, int *sdi, int *sdo, int *sck);
  * 'address', 'command' and 'dummy bits' are transmitted before data phase IF set in device's configuration
  *   and IF 'trans->length' and 'trans->rx_length' are NOT both 0
  * If device was not previously selected, it will be selected before transmission and deselected after transmission.
+ * If the bus uses a DMA channel, transfers of at least SPI_DMA_MIN_TRANS_LEN bytes are done using DMA in chunks
+ *   of the bus 'max_transfer_sz' if the buffers are DMA capable and 32-bit aligned.
+ *   'command' and 'address' phases are repeated for each chunk, as they are for each 64-byte hw buffer transfer.
  *
  * @param handle Device handle obtained using spi_lobo_bus_add_device
  * 
@@ -300,6 +435,163 @@ void spi_lobo_get_native_pins(int host, int *sdi, int *sdo, int *sck);
 esp_err_t spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
 
 
+/**
+ * @brief Wait for the current spi transaction on the device's bus to finish
+ *
+ * If the estimated transfer time (from the transfer length and spi clock) is shorter than the
+ * threshold set by spi_lobo_set_wait_mode(), the spi hw is polled.
+ * Otherwise, the calling task is blocked until the 'transaction done' interrupt wakes it
+ * using the host's semaphore, leaving the CPU to other tasks; the task notifications are not used.
+ * The spi hw is always polled if called from ISR or before the scheduler is started.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_wait_trans_done(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Set the completion wait mode for the device's spi bus
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param min_us Minimal estimated transfer time in us for which the interrupt wait is used
+ *               Shorter transfers are polled. If 0, the interrupt wait is not used at all.
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_NOT_SUPPORTED if the spi interrupt could not be allocated
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_set_wait_mode(spi_lobo_device_handle_t handle, uint32_t min_us);
+
+/**
+ * @brief Set the callback called from the 'transaction done' interrupt of the device's spi bus
+ *
+ * The callback runs in the IRAM interrupt handler and can start the next transfer of the device
+ * holding the bus, so the transfers are chained without the task which queued them.
+ * The interrupt must be armed by spi_lobo_done_intr_arm() before each transfer it should follow.
+ * Only the device holding the bus may set the callback; set 'cb' to NULL to remove it.
+ * The bus stays owned by the task which selected the device and must be released by that task.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param cb     Callback function, called with 'arg', or NULL
+ * @param arg    Argument passed to the callback
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_NOT_SUPPORTED if the spi interrupt could not be allocated
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_set_done_cb(spi_lobo_device_handle_t handle, spi_lobo_done_cb_t cb, void *arg);
+
+/**
+ * @brief Arm the 'transaction done' interrupt for the next transaction
+ *
+ * Call before starting the transaction, the callback set by spi_lobo_set_done_cb() is called when it is finished.
+ * Usable from the callback.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ */
+void spi_lobo_done_intr_arm(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Block the calling task until the 'transaction done' interrupt calls the callback set by spi_lobo_set_done_cb()
+ *
+ * The signal of an interrupt which occurred before the call is kept, so none is lost,
+ * but the caller must check its wait condition again when this function returns.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param ticks  Maximal time to wait in RTOS ticks
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_TIMEOUT       if no interrupt was signalled
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_wait_done_signal(spi_lobo_device_handle_t handle, uint32_t ticks);
+
+/**
+ * @brief Get the completion wait statistics for the device's spi bus
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param stats  Pointer to spi_lobo_wait_stats_t variable to hold the statistics
+ * @param reset  If true, the statistics are reset after reading
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_get_wait_stats(spi_lobo_device_handle_t handle, spi_lobo_wait_stats_t *stats, bool reset);
+
+/**
+ * @brief Check if a device with higher priority than this one waits for the bus
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return true if the device should release the bus using spi_lobo_bus_yield()
+ */
+bool spi_lobo_bus_yield_requested(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Release the bus to higher priority devices waiting for it
+ *
+ * If a device with higher priority waits for the bus, waits for the current transfer to finish,
+ * deselects the device, lets the waiting devices take the bus and selects the device again.
+ * The device's CS line is deactivated in between, the caller must restart the device's data stream.
+ * Can be called only from a task, with the device selected.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return
+ *         - ESP_OK                if the bus was not needed or the device is selected again
+ *         - ESP error code        if the device cannot be selected again
+ */
+esp_err_t spi_lobo_bus_yield(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Get the slice size for long transfers of the device
+ *
+ * Long transfers should be split into slices of this size, calling spi_lobo_bus_yield() between them,
+ * so that the latency targets of higher priority devices on the bus can be met.
+ * The size is calculated from the shortest 'latency_us' of the higher priority devices and the current spi clock.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return slice size in bytes, 0 if the transfers need not be split
+ */
+uint32_t spi_lobo_bus_slice_bytes(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Get the bus access and transfer statistics of the device
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param stats  Pointer to spi_lobo_bus_stats_t variable to hold the statistics snapshot
+ * @param reset  If true, the statistics are reset after reading
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_get_bus_stats(spi_lobo_device_handle_t handle, spi_lobo_bus_stats_t *stats, bool reset);
+
+/**
+ * @brief Get the bus access and transfer statistics of all devices on the device's host
+ *
+ * Counters are summed, 'max_wait_us' is the worst case of all devices, 'last_wait_us' is not used
+ *
+ * @param handle Device handle of any device on the host
+ * @param stats  Pointer to spi_lobo_bus_stats_t variable to hold the statistics snapshot
+ * @param reset  If true, the statistics of all host's devices are reset after reading
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_get_host_stats(spi_lobo_device_handle_t handle, spi_lobo_bus_stats_t *stats, bool reset);
+
+
 /*
  * SPI transactions uses the semaphore (taken in select function) to protect the transfer
  */
@@ -323,6 +615,40 @@ void spi_lobo_device_GiveSemaphore(spi_lobo_device_handle_t handle);
  */
 void spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *data, bool isrx);
 
+/**
+ * @brief Setup a circular DMA link chain for repeated sending of the same data
+ *
+ * All ``ndesc`` descriptors in the array pointed to by ``dmadesc`` point to the same ``data`` buffer
+ * of ``len`` bytes and the last descriptor is linked back to the first one.
+ * Feeding ``dmadesc[0]`` into DMA hardware sends the buffer content repeatedly, the transfer
+ * length must be set by the SPI data bit length (max 2^24 bits).
+ *
+ * @param dmadesc Pointer to array of at least ``ndesc`` DMA descriptors
+ * @param ndesc Number of descriptors to link in the loop (1 or more)
+ * @param data Data buffer to be sent repeatedly, must be DMA capable
+ * @param len Length of buffer, max SPI_MAX_DMA_LEN; should be a multiple of 4
+ */
+void spi_lobo_setup_dma_desc_loop(lldesc_t *dmadesc, int ndesc, const uint8_t *data, int len);
+
+/**
+ * @brief Append data to a transmit DMA descriptor chain (gather)
+ *
+ * The descriptors for ``len`` bytes of ``data`` are set up after the first ``used`` descriptors
+ * of ``dmadesc`` and linked to the end of the chain. Feeding ``dmadesc[0]`` into DMA hardware sends
+ * all appended buffers as one stream.
+ * All buffers must be DMA capable and 32-bit aligned, all but the last appended buffer should have
+ * the length of multiple of 4 bytes.
+ *
+ * @param dmadesc Pointer to array of ``ndesc`` DMA descriptors
+ * @param ndesc Number of descriptors in the array
+ * @param used Number of descriptors already used by the chain, 0 to start a new chain
+ * @param data Data buffer to be appended
+ * @param len Length of the data buffer
+ *
+ * @return the new number of used descriptors, -1 if there are not enough descriptors
+ */
+int spi_lobo_dma_desc_append(lldesc_t *dmadesc, int ndesc, int used, const uint8_t *data, int len);
+
 /**
  * @brief Check if a DMA reset is requested but has not completed yet
  *
@@ -5,10 +5,14 @@
  *  Module supporting SPI TFT displays based on ILI9341 & ILI9488 controllers
 */
 
+// The library uses the former global variable names internally
+#define TFT_LEGACY_NAMES
+
 #include <stdio.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <stddef.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
@@ -16,6 +20,7 @@
 #include "time.h"
 #include <math.h>
 #include "rom/tjpgd.h"
+#include "rom/crc.h"
 #include "esp_heap_caps.h"
 #include "tftspi.h"
 
@@ -67,60 +72,152 @@ const color_t TFT_PINK        = { 252, 192, 202 };
 
 // ==============================================================
 // ==== Set default values of global variables ==================
-uint8_t orientation = LANDSCAPE;// screen orientation
-uint16_t font_rotate = 0;		// font rotation
-uint8_t	font_transparent = 0;
-uint8_t	font_forceFixed = 0;
-uint8_t	text_wrap = 0;			// character wrapping to new line
-color_t	_fg = {  0, 255,   0};
-color_t _bg = {  0,   0,   0};
 uint8_t image_debug = 0;
 
-float _angleOffset = DEFAULT_ANGLE_OFFSET;
+#if USE_TOUCH == TOUCH_TYPE_STMPE610
+uint32_t tp_calx = TP_CALX_STMPE610;
+uint32_t tp_caly = TP_CALY_STMPE610;
+#else
+uint32_t tp_calx = TP_CALX_XPT2046;
+uint32_t tp_caly = TP_CALY_XPT2046;
+#endif
+
+// Default display context, used by tasks without bound context
+tft_ctx_t tft_default_ctx;
+// Number of tasks with bound display context
+uint32_t tft_ctx_bound = 0;
+// ==============================================================
 
-int	TFT_X = 0;
-int	TFT_Y = 0;
+// Inside the library the display variables are accessed through the display context
+// pointer 'ctx', passed to all functions which use the display
+#undef tft_orientation
+#undef tft_font_rotate
+#undef tft_font_transparent
+#undef tft_font_forceFixed
+#undef tft_font_buffered_char
+#undef tft_font_line_space
+#undef tft_text_wrap
+#undef tft_fg
+#undef tft_bg
+#undef tft_dispWin
+#undef tft_angleOffset
+#undef tft_cfont
+#undef tft_text_x
+#undef tft_text_y
+#define tft_orientation			(ctx->orient)
+#define tft_font_rotate			(ctx->rotate)
+#define tft_font_transparent	(ctx->transparent)
+#define tft_font_forceFixed		(ctx->force_fixed)
+#define tft_font_buffered_char	(ctx->buffered_char)
+#define tft_font_line_space		(ctx->line_space)
+#define tft_text_wrap			(ctx->wrap)
+#define tft_fg					(ctx->fg)
+#define tft_bg					(ctx->bg)
+#define tft_dispWin				(ctx->win)
+#define tft_angleOffset			(ctx->angle_offset)
+#define tft_cfont				(ctx->font)
+#define tft_text_x				(ctx->text_x)
+#define tft_text_y				(ctx->text_y)
+
+#undef tft_gray_scale
+#undef tft_max_rdclock
+#undef tft_color_bits
+#undef tft_width
+#undef tft_height
+#undef tft_disp_type
+#undef tft_disp_spi
+#define tft_gray_scale			(ctx->drv.gray)
+#define tft_max_rdclock			(ctx->drv.rdclock)
+#define tft_color_bits			(ctx->drv.color_bits)
+#define tft_width				(ctx->drv.width)
+#define tft_height				(ctx->drv.height)
+#define tft_disp_type			(ctx->drv.type)
+#define tft_disp_spi			(ctx->drv.spi)
+
+// Display context fields used by the TFT functions only
+#define dispWinTemp		(ctx->win_temp)
+#define userfont		(ctx->user_font)
+#define TFT_OFFSET		(ctx->font_offset)
+#define fontChar		(ctx->font_char)
+#define _arcAngleMax	(ctx->arc_angle_max)
+
+// ==== Pixel batch, coalescing of per-pixel drawing ====
+#define pb_pixels		(ctx->pb.pixels)
+#define pb_runs			(ctx->pb.runs)
+#define pb_count		(ctx->pb.count)
+#define pb_depth		(ctx->pb.depth)
+
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS <= TFT_CTX_TLS_INDEX
+#error "Set CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS greater than TFT_CTX_TLS_INDEX"
+#endif
 
-uint32_t tp_calx = 7472920;
-uint32_t tp_caly = 122224794;
+static portMUX_TYPE ctx_mux = portMUX_INITIALIZER_UNLOCKED;
 
-dispWin_t dispWin = {
-  .x1 = 0,
-  .y1 = 0,
-  .x2 = DEFAULT_TFT_DISPLAY_WIDTH,
-  .y2 = DEFAULT_TFT_DISPLAY_HEIGHT,
-};
 
-Font cfont = {
-	.font = tft_DefaultFont,
-	.x_size = 0,
-	.y_size = 0x0B,
-	.offset = 0,
-	.numchars = 95,
-	.bitmap = 1,
-};
+// ==== Display context =====================================
 
-uint8_t font_buffered_char = 1;
-uint8_t font_line_space = 0;
-// ==============================================================
+// Set the display context to default values
+//---------------------------------------------------
+static void _tft_ctx_defaults(tft_ctx_t *ctx)
+{
+	memset(ctx, 0, sizeof(tft_ctx_t));
+	disp_drv_init(&ctx->drv);
+
+	ctx->orient = LANDSCAPE;
+	ctx->fg = (color_t){  0, 255,   0};
+	ctx->bg = (color_t){  0,   0,   0};
+	ctx->angle_offset = DEFAULT_ANGLE_OFFSET;
+	ctx->win.x2 = DEFAULT_TFT_DISPLAY_WIDTH;
+	ctx->win.y2 = DEFAULT_TFT_DISPLAY_HEIGHT;
+	ctx->font.font = tft_DefaultFont;
+	ctx->font.y_size = 0x0B;
+	ctx->font.numchars = 95;
+	ctx->font.bitmap = 1;
+	ctx->buffered_char = 1;
+	ctx->arc_angle_max = DEFAULT_ARC_ANGLE_MAX;
+}
 
+// The default context is initialized before app_main() is started
+//-----------------------------------------------------------------
+static void __attribute__((constructor)) _tft_default_ctx_init()
+{
+	_tft_ctx_defaults(&tft_default_ctx);
+}
 
-typedef struct {
-      uint8_t charCode;
-      int adjYOffset;
-      int width;
-      int height;
-      int xOffset;
-      int xDelta;
-      uint16_t dataPtr;
-} propFont;
+//============================
+tft_ctx_t *TFT_ctx_create()
+{
+	// driver state contains DMA descriptors and fill pattern
+	tft_ctx_t *ctx = heap_caps_malloc(sizeof(tft_ctx_t), MALLOC_CAP_DMA);
+	if (ctx) _tft_ctx_defaults(ctx);
+	return ctx;
+}
 
-static dispWin_t dispWinTemp;
+//=====================================
+void TFT_ctx_delete(tft_ctx_t *ctx)
+{
+	if ((ctx == NULL) || (ctx == &tft_default_ctx)) return;
+	if (ctx->user_font) free(ctx->user_font);
+	free(ctx);
+}
+
+//=======================================
+tft_ctx_t *TFT_ctx_bind(tft_ctx_t *ctx)
+{
+	tft_ctx_t *prev = NULL;
 
-static uint8_t *userfont = NULL;
-static int TFT_OFFSET = 0;
-static propFont	fontChar;
-static float _arcAngleMax = DEFAULT_ARC_ANGLE_MAX;
+	if (ctx == &tft_default_ctx) ctx = NULL;
+	if (tft_ctx_bound) prev = (tft_ctx_t *)pvTaskGetThreadLocalStoragePointer(NULL, TFT_CTX_TLS_INDEX);
+	if (prev == ctx) return prev;
+
+	portENTER_CRITICAL(&ctx_mux);
+	if ((prev == NULL) && (ctx)) tft_ctx_bound++;
+	else if ((prev) && (ctx == NULL)) tft_ctx_bound--;
+	portEXIT_CRITICAL(&ctx_mux);
+
+	vTaskSetThreadLocalStoragePointer(NULL, TFT_CTX_TLS_INDEX, ctx);
+	return prev;
+}
 
 
 // =========================================================================
@@ -142,30 +239,143 @@ int TFT_compare_colors(color_t c1, color_t c2)
 	return 0;
 }
 
-// draw color pixel on screen
-//------------------------------------------------------------------------
-static void _drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel) {
+// ==== Pixel batch ====================================================
+// Pixels drawn between _pixel_batch_begin() and _pixel_batch_end() are collected,
+// sorted by row and column, and sent as horizontal runs of the same color.
+// Runs with the same columns and color in successive rows are merged into rectangles.
+
+//------------------------------------------------------------
+static int _pixel_cmp(const void *a, const void *b)
+{
+	const batch_pixel_t *pa = (const batch_pixel_t *)a;
+	const batch_pixel_t *pb = (const batch_pixel_t *)b;
 
-	if ((x < dispWin.x1) || (y < dispWin.y1) || (x > dispWin.x2) || (y > dispWin.y2)) return;
-	drawPixel(x, y, color, sel);
+	if (pa->y != pb->y) return pa->y - pb->y;
+	if (pa->x != pb->x) return pa->x - pb->x;
+	return pa->seq - pb->seq;
 }
 
-//====================================================================
-void TFT_drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel) {
+//---------------------------------------------------
+static uint8_t _same_color(color_t c1, color_t c2)
+{
+	return ((c1.r == c2.r) && (c1.g == c2.g) && (c1.b == c2.b));
+}
+
+// Send all collected pixels to the display
+//--------------------------------------------
+static void _pixel_batch_flush(tft_ctx_t *ctx)
+{
+	int i, j, n, k, m, nruns, y2;
+	uint8_t found;
+
+	if (pb_count == 0) return;
+
+	qsort(pb_pixels, pb_count, sizeof(batch_pixel_t), _pixel_cmp);
+
+	// Remove overwritten pixels, keep the last drawn
+	n = 0;
+	for (i=0; i<pb_count; i++) {
+		if ((n > 0) && (pb_pixels[i].x == pb_pixels[n-1].x) && (pb_pixels[i].y == pb_pixels[n-1].y)) pb_pixels[n-1] = pb_pixels[i];
+		else pb_pixels[n++] = pb_pixels[i];
+	}
+	pb_count = 0;
+
+	// Collect horizontal runs of adjacent pixels of the same color
+	nruns = 0;
+	i = 0;
+	while (i < n) {
+		j = i+1;
+		while ((j < n) && (pb_pixels[j].y == pb_pixels[i].y) && (pb_pixels[j].x == (pb_pixels[j-1].x+1)) &&
+				(_same_color(pb_pixels[j].color, pb_pixels[i].color))) j++;
+		pb_runs[nruns].x1 = pb_pixels[i].x;
+		pb_runs[nruns].x2 = pb_pixels[j-1].x;
+		pb_runs[nruns].y = pb_pixels[i].y;
+		pb_runs[nruns].color = pb_pixels[i].color;
+		pb_runs[nruns].used = 0;
+		nruns++;
+		i = j;
+	}
+
+	uint8_t was_selected = disp_spi->cfg.selected;
+	if (!was_selected) {
+		if (disp_drv_select(&ctx->drv) != ESP_OK) return;
+	}
+
+	for (i=0; i<nruns; i++) {
+		if (pb_runs[i].used) continue;
+		// Extend the run down while the next row has the same run
+		y2 = pb_runs[i].y;
+		k = i+1;
+		do {
+			found = 0;
+			while ((k < nruns) && (pb_runs[k].y <= y2)) k++;
+			for (m=k; (m < nruns) && (pb_runs[m].y == (y2+1)) && (pb_runs[m].x1 <= pb_runs[i].x1); m++) {
+				if ((!pb_runs[m].used) && (pb_runs[m].x1 == pb_runs[i].x1) && (pb_runs[m].x2 == pb_runs[i].x2) &&
+						(_same_color(pb_runs[m].color, pb_runs[i].color))) {
+					pb_runs[m].used = 1;
+					y2++;
+					found = 1;
+					break;
+				}
+			}
+		} while (found);
+
+		disp_drv_send_data_rep(&ctx->drv, pb_runs[i].x1, pb_runs[i].y, pb_runs[i].x2, y2,
+				(uint32_t)(pb_runs[i].x2-pb_runs[i].x1+1) * (uint32_t)(y2-pb_runs[i].y+1), pb_runs[i].color);
+	}
 
-	_drawPixel(x+dispWin.x1, y+dispWin.y1, color, sel);
+	if (!was_selected) disp_drv_deselect(&ctx->drv);
 }
 
-//===========================================
-color_t TFT_readPixel(int16_t x, int16_t y) {
+// Start collecting pixels, calls can be nested
+//--------------------------------------------
+static void _pixel_batch_begin(tft_ctx_t *ctx)
+{
+	pb_depth++;
+}
+
+// Stop collecting pixels, send them if outermost batch
+//------------------------------------------
+static void _pixel_batch_end(tft_ctx_t *ctx)
+{
+	if (pb_depth == 0) return;
+	pb_depth--;
+	if (pb_depth == 0) _pixel_batch_flush(ctx);
+}
+
+// draw color pixel on screen
+//----------------------------------------------------------------------------------------
+static void _drawPixel(tft_ctx_t *ctx, int16_t x, int16_t y, color_t color, uint8_t sel) {
+
+	if ((x < ctx->win.x1) || (y < ctx->win.y1) || (x > ctx->win.x2) || (y > ctx->win.y2)) return;
+	if (pb_depth) {
+		if (pb_count >= PIXEL_BATCH_SIZE) _pixel_batch_flush(ctx);
+		pb_pixels[pb_count].x = x;
+		pb_pixels[pb_count].y = y;
+		pb_pixels[pb_count].seq = pb_count;
+		pb_pixels[pb_count].color = color;
+		pb_count++;
+		return;
+	}
+	disp_drv_drawPixel(&ctx->drv, x, y, color, sel);
+}
+
+//========================================================================================
+void TFT_ctx_drawPixel(tft_ctx_t *ctx, int16_t x, int16_t y, color_t color, uint8_t sel) {
+
+	_drawPixel(ctx, x+dispWin.x1, y+dispWin.y1, color, sel);
+}
+
+//===============================================================
+color_t TFT_ctx_readPixel(tft_ctx_t *ctx, int16_t x, int16_t y) {
 
   if ((x < dispWin.x1) || (y < dispWin.y1) || (x > dispWin.x2) || (y > dispWin.y2)) return TFT_BLACK;
 
-  return readPixel(x, y);
+  return disp_drv_readPixel(&ctx->drv, x, y);
 }
 
-//--------------------------------------------------------------------------
-static void _drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color) {
+//------------------------------------------------------------------------------------------
+static void _drawFastVLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t h, color_t color) {
 	// clipping
 	if ((x < dispWin.x1) || (x > dispWin.x2) || (y > dispWin.y2)) return;
 	if (y < dispWin.y1) {
@@ -175,11 +385,11 @@ static void _drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color) {
 	if (h < 0) h = 0;
 	if ((y + h) > (dispWin.y2+1)) h = dispWin.y2 - y + 1;
 	if (h == 0) h = 1;
-	TFT_pushColorRep(x, y, x, y+h-1, color, (uint32_t)h);
+	disp_drv_pushColorRep(&ctx->drv, x, y, x, y+h-1, color, (uint32_t)h);
 }
 
-//--------------------------------------------------------------------------
-static void _drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color) {
+//------------------------------------------------------------------------------------------
+static void _drawFastHLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, color_t color) {
 	// clipping
 	if ((y < dispWin.y1) || (x > dispWin.x2) || (y > dispWin.y2)) return;
 	if (x < dispWin.x1) {
@@ -190,32 +400,32 @@ static void _drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color) {
 	if ((x + w) > (dispWin.x2+1)) w = dispWin.x2 - x + 1;
 	if (w == 0) w = 1;
 
-	TFT_pushColorRep(x, y, x+w-1, y, color, (uint32_t)w);
+	disp_drv_pushColorRep(&ctx->drv, x, y, x+w-1, y, color, (uint32_t)w);
 }
 
-//======================================================================
-void TFT_drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color) {
-	_drawFastVLine(x+dispWin.x1, y+dispWin.y1, h, color);
+//==========================================================================================
+void TFT_ctx_drawFastVLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t h, color_t color) {
+	_drawFastVLine(ctx, x+dispWin.x1, y+dispWin.y1, h, color);
 }
 
-//======================================================================
-void TFT_drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color) {
-	_drawFastHLine(x+dispWin.x1, y+dispWin.y1, w, color);
+//==========================================================================================
+void TFT_ctx_drawFastHLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, color_t color) {
+	_drawFastHLine(ctx, x+dispWin.x1, y+dispWin.y1, w, color);
 }
 
 // Bresenham's algorithm - thx wikipedia - speed enhanced by Bodmer this uses
 // the eficient FastH/V Line draw routine for segments of 2 pixels or more
-//----------------------------------------------------------------------------------
-static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
+//--------------------------------------------------------------------------------------------------
+static void _drawLine(tft_ctx_t *ctx, int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
 {
   if (x0 == x1) {
-	  if (y0 <= y1) _drawFastVLine(x0, y0, y1-y0, color);
-	  else _drawFastVLine(x0, y1, y0-y1, color);
+	  if (y0 <= y1) _drawFastVLine(ctx, x0, y0, y1-y0, color);
+	  else _drawFastVLine(ctx, x0, y1, y0-y1, color);
 	  return;
   }
   if (y0 == y1) {
-	  if (x0 <= x1) _drawFastHLine(x0, y0, x1-x0, color);
-	  else _drawFastHLine(x1, y0, x0-x1, color);
+	  if (x0 <= x1) _drawFastHLine(ctx, x0, y0, x1-x0, color);
+	  else _drawFastHLine(ctx, x1, y0, x0-x1, color);
 	  return;
   }
 
@@ -242,12 +452,12 @@ static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t co
       err -= dy;
       if (err < 0) {
         err += dx;
-        if (dlen == 1) _drawPixel(y0, xs, color, 1);
-        else _drawFastVLine(y0, xs, dlen, color);
+        if (dlen == 1) _drawPixel(ctx, y0, xs, color, 1);
+        else _drawFastVLine(ctx, y0, xs, dlen, color);
         dlen = 0; y0 += ystep; xs = x0 + 1;
       }
     }
-    if (dlen) _drawFastVLine(y0, xs, dlen, color);
+    if (dlen) _drawFastVLine(ctx, y0, xs, dlen, color);
   }
   else
   {
@@ -256,24 +466,24 @@ static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t co
       err -= dy;
       if (err < 0) {
         err += dx;
-        if (dlen == 1) _drawPixel(xs, y0, color, 1);
-        else _drawFastHLine(xs, y0, dlen, color);
+        if (dlen == 1) _drawPixel(ctx, xs, y0, color, 1);
+        else _drawFastHLine(ctx, xs, y0, dlen, color);
         dlen = 0; y0 += ystep; xs = x0 + 1;
       }
     }
-    if (dlen) _drawFastHLine(xs, y0, dlen, color);
+    if (dlen) _drawFastHLine(ctx, xs, y0, dlen, color);
   }
 }
 
-//==============================================================================
-void TFT_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
+//==================================================================================================
+void TFT_ctx_drawLine(tft_ctx_t *ctx, int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
 {
-	_drawLine(x0+dispWin.x1, y0+dispWin.y1, x1+dispWin.x1, y1+dispWin.y1, color);
+	_drawLine(ctx, x0+dispWin.x1, y0+dispWin.y1, x1+dispWin.x1, y1+dispWin.y1, color);
 }
 
 // fill a rectangle
-//--------------------------------------------------------------------------------
-static void _fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color) {
+//------------------------------------------------------------------------------------------------
+static void _fillRect(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, int16_t h, color_t color) {
 	// clipping
 	if ((x >= dispWin.x2) || (y > dispWin.y2)) return;
 
@@ -292,22 +502,22 @@ static void _fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color)
 	if ((y + h) > (dispWin.y2+1)) h = dispWin.y2 - y + 1;
 	if (w == 0) w = 1;
 	if (h == 0) h = 1;
-	TFT_pushColorRep(x, y, x+w-1, y+h-1, color, (uint32_t)(h*w));
+	disp_drv_pushColorRep(&ctx->drv, x, y, x+w-1, y+h-1, color, (uint32_t)(h*w));
 }
 
-//============================================================================
-void TFT_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color) {
-	_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, color);
+//================================================================================================
+void TFT_ctx_fillRect(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, int16_t h, color_t color) {
+	_fillRect(ctx, x+dispWin.x1, y+dispWin.y1, w, h, color);
 }
 
-//==================================
-void TFT_fillScreen(color_t color) {
-	TFT_pushColorRep(0, 0, _width-1, _height-1, color, (uint32_t)(_height*_width));
+//======================================================
+void TFT_ctx_fillScreen(tft_ctx_t *ctx, color_t color) {
+	disp_drv_pushColorRep(&ctx->drv, 0, 0, _width-1, _height-1, color, (uint32_t)(_height*_width));
 }
 
-//==================================
-void TFT_fillWindow(color_t color) {
-	TFT_pushColorRep(dispWin.x1, dispWin.y1, dispWin.x2, dispWin.y2,
+//======================================================
+void TFT_ctx_fillWindow(tft_ctx_t *ctx, color_t color) {
+	disp_drv_pushColorRep(&ctx->drv, dispWin.x1, dispWin.y1, dispWin.x2, dispWin.y2,
 			color, (uint32_t)((dispWin.x2-dispWin.x1+1) * (dispWin.y2-dispWin.y1+1)));
 }
 
@@ -316,21 +526,21 @@ void TFT_fillWindow(color_t color) {
 
 // ================ Graphics drawing functions ==================================
 
-//-----------------------------------------------------------------------------------
-static void _drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color) {
-  _drawFastHLine(x1,y1,w, color);
-  _drawFastVLine(x1+w-1,y1,h, color);
-  _drawFastHLine(x1,y1+h-1,w, color);
-  _drawFastVLine(x1,y1,h, color);
+//---------------------------------------------------------------------------------------------------
+static void _drawRect(tft_ctx_t *ctx, uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color) {
+  _drawFastHLine(ctx, x1,y1,w, color);
+  _drawFastVLine(ctx, x1+w-1,y1,h, color);
+  _drawFastHLine(ctx, x1,y1+h-1,w, color);
+  _drawFastVLine(ctx, x1,y1,h, color);
 }
 
-//===============================================================================
-void TFT_drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color) {
-	_drawRect(x1+dispWin.x1, y1+dispWin.y1, w, h, color);
+//===================================================================================================
+void TFT_ctx_drawRect(tft_ctx_t *ctx, uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color) {
+	_drawRect(ctx, x1+dispWin.x1, y1+dispWin.y1, w, h, color);
 }
 
-//-------------------------------------------------------------------------------------------------
-static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornername, color_t color)
+//----------------------------------------------------------------------------------------------------------------
+static void drawCircleHelper(tft_ctx_t *ctx, int16_t x0, int16_t y0, int16_t r, uint8_t cornername, color_t color)
 {
 	int16_t f = 1 - r;
 	int16_t ddF_x = 1;
@@ -338,7 +548,8 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 	int16_t x = 0;
 	int16_t y = r;
 
-	disp_select();
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
 	while (x < y) {
 		if (f >= 0) {
 			y--;
@@ -349,28 +560,29 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 		ddF_x += 2;
 		f += ddF_x;
 		if (cornername & 0x4) {
-			_drawPixel(x0 + x, y0 + y, color, 0);
-			_drawPixel(x0 + y, y0 + x, color, 0);
+			_drawPixel(ctx, x0 + x, y0 + y, color, 0);
+			_drawPixel(ctx, x0 + y, y0 + x, color, 0);
 		}
 		if (cornername & 0x2) {
-			_drawPixel(x0 + x, y0 - y, color, 0);
-			_drawPixel(x0 + y, y0 - x, color, 0);
+			_drawPixel(ctx, x0 + x, y0 - y, color, 0);
+			_drawPixel(ctx, x0 + y, y0 - x, color, 0);
 		}
 		if (cornername & 0x8) {
-			_drawPixel(x0 - y, y0 + x, color, 0);
-			_drawPixel(x0 - x, y0 + y, color, 0);
+			_drawPixel(ctx, x0 - y, y0 + x, color, 0);
+			_drawPixel(ctx, x0 - x, y0 + y, color, 0);
 		}
 		if (cornername & 0x1) {
-			_drawPixel(x0 - y, y0 - x, color, 0);
-			_drawPixel(x0 - x, y0 - y, color, 0);
+			_drawPixel(ctx, x0 - y, y0 - x, color, 0);
+			_drawPixel(ctx, x0 - x, y0 - y, color, 0);
 		}
 	}
-	disp_deselect();
+	_pixel_batch_end(ctx);
+	disp_drv_deselect(&ctx->drv);
 }
 
 // Used to do circles and roundrects
-//----------------------------------------------------------------------------------------------------------------
-static void fillCircleHelper(int16_t x0, int16_t y0, int16_t r,	uint8_t cornername, int16_t delta, color_t color)
+//-------------------------------------------------------------------------------------------------------------------------------
+static void fillCircleHelper(tft_ctx_t *ctx, int16_t x0, int16_t y0, int16_t r,	uint8_t cornername, int16_t delta, color_t color)
 {
 	int16_t f = 1 - r;
 	int16_t ddF_x = 1;
@@ -381,8 +593,8 @@ static void fillCircleHelper(int16_t x0, int16_t y0, int16_t r,	uint8_t cornerna
 
 	while (x < y) {
 		if (f >= 0) {
-			if (cornername & 0x1) _drawFastVLine(x0 + y, y0 - x, 2 * x + 1 + delta, color);
-			if (cornername & 0x2) _drawFastVLine(x0 - y, y0 - x, 2 * x + 1 + delta, color);
+			if (cornername & 0x1) _drawFastVLine(ctx, x0 + y, y0 - x, 2 * x + 1 + delta, color);
+			if (cornername & 0x2) _drawFastVLine(ctx, x0 - y, y0 - x, 2 * x + 1 + delta, color);
 			ylm = x0 - y;
 			y--;
 			ddF_y += 2;
@@ -393,92 +605,92 @@ static void fillCircleHelper(int16_t x0, int16_t y0, int16_t r,	uint8_t cornerna
 		f += ddF_x;
 
 		if ((x0 - x) > ylm) {
-			if (cornername & 0x1) _drawFastVLine(x0 + x, y0 - y, 2 * y + 1 + delta, color);
-			if (cornername & 0x2) _drawFastVLine(x0 - x, y0 - y, 2 * y + 1 + delta, color);
+			if (cornername & 0x1) _drawFastVLine(ctx, x0 + x, y0 - y, 2 * y + 1 + delta, color);
+			if (cornername & 0x2) _drawFastVLine(ctx, x0 - x, y0 - y, 2 * y + 1 + delta, color);
 		}
 	}
 }
 
 // Draw a rounded rectangle
-//=============================================================================================
-void TFT_drawRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
+//=================================================================================================================
+void TFT_ctx_drawRoundRect(tft_ctx_t *ctx, int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
 {
 	x += dispWin.x1;
 	y += dispWin.y1;
 
 	// smarter version
-	_drawFastHLine(x + r, y, w - 2 * r, color);			// Top
-	_drawFastHLine(x + r, y + h - 1, w - 2 * r, color);	// Bottom
-	_drawFastVLine(x, y + r, h - 2 * r, color);			// Left
-	_drawFastVLine(x + w - 1, y + r, h - 2 * r, color);	// Right
+	_drawFastHLine(ctx, x + r, y, w - 2 * r, color);			// Top
+	_drawFastHLine(ctx, x + r, y + h - 1, w - 2 * r, color);	// Bottom
+	_drawFastVLine(ctx, x, y + r, h - 2 * r, color);			// Left
+	_drawFastVLine(ctx, x + w - 1, y + r, h - 2 * r, color);	// Right
 
 	// draw four corners
-	drawCircleHelper(x + r, y + r, r, 1, color);
-	drawCircleHelper(x + w - r - 1, y + r, r, 2, color);
-	drawCircleHelper(x + w - r - 1, y + h - r - 1, r, 4, color);
-	drawCircleHelper(x + r, y + h - r - 1, r, 8, color);
+	drawCircleHelper(ctx, x + r, y + r, r, 1, color);
+	drawCircleHelper(ctx, x + w - r - 1, y + r, r, 2, color);
+	drawCircleHelper(ctx, x + w - r - 1, y + h - r - 1, r, 4, color);
+	drawCircleHelper(ctx, x + r, y + h - r - 1, r, 8, color);
 }
 
 // Fill a rounded rectangle
-//=============================================================================================
-void TFT_fillRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
+//=================================================================================================================
+void TFT_ctx_fillRoundRect(tft_ctx_t *ctx, int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
 {
 	x += dispWin.x1;
 	y += dispWin.y1;
 
 	// smarter version
-	_fillRect(x + r, y, w - 2 * r, h, color);
+	_fillRect(ctx, x + r, y, w - 2 * r, h, color);
 
 	// draw four corners
-	fillCircleHelper(x + w - r - 1, y + r, r, 1, h - 2 * r - 1, color);
-	fillCircleHelper(x + r, y + r, r, 2, h - 2 * r - 1, color);
+	fillCircleHelper(ctx, x + w - r - 1, y + r, r, 1, h - 2 * r - 1, color);
+	fillCircleHelper(ctx, x + r, y + r, r, 2, h - 2 * r - 1, color);
 }
 
 
 
 
-//-----------------------------------------------------------------------------------------------
-static void _drawLineByAngle(int16_t x, int16_t y, int16_t angle, uint16_t length, color_t color)
+//---------------------------------------------------------------------------------------------------------------
+static void _drawLineByAngle(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t angle, uint16_t length, color_t color)
 {
-	_drawLine(
+	_drawLine(ctx, 
 		x,
 		y,
 		x + length * cos((angle + _angleOffset) * DEG_TO_RAD),
 		y + length * sin((angle + _angleOffset) * DEG_TO_RAD), color);
 }
 
-//---------------------------------------------------------------------------------------------------------------
-static void _DrawLineByAngle(int16_t x, int16_t y, int16_t angle, uint16_t start, uint16_t length, color_t color)
+//-------------------------------------------------------------------------------------------------------------------------------
+static void _DrawLineByAngle(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t angle, uint16_t start, uint16_t length, color_t color)
 {
-	_drawLine(
+	_drawLine(ctx, 
 		x + start * cos((angle + _angleOffset) * DEG_TO_RAD),
 		y + start * sin((angle + _angleOffset) * DEG_TO_RAD),
 		x + (start + length) * cos((angle + _angleOffset) * DEG_TO_RAD),
 		y + (start + length) * sin((angle + _angleOffset) * DEG_TO_RAD), color);
 }
 
-//===========================================================================================================
-void TFT_drawLineByAngle(uint16_t x, uint16_t y, uint16_t start, uint16_t len, uint16_t angle, color_t color)
+//===============================================================================================================================
+void TFT_ctx_drawLineByAngle(tft_ctx_t *ctx, uint16_t x, uint16_t y, uint16_t start, uint16_t len, uint16_t angle, color_t color)
 {
 	x += dispWin.x1;
 	y += dispWin.y1;
 
-	if (start == 0) _drawLineByAngle(x, y, angle, len, color);
-	else _DrawLineByAngle(x, y, angle, start, len, color);
+	if (start == 0) _drawLineByAngle(ctx, x, y, angle, len, color);
+	else _DrawLineByAngle(ctx, x, y, angle, start, len, color);
 }
 
 
 // Draw a triangle
-//--------------------------------------------------------------------------------------------------------------------
-static void _drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+//------------------------------------------------------------------------------------------------------------------------------------
+static void _drawTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
 {
-	_drawLine(x0, y0, x1, y1, color);
-	_drawLine(x1, y1, x2, y2, color);
-	_drawLine(x2, y2, x0, y0, color);
+	_drawLine(ctx, x0, y0, x1, y1, color);
+	_drawLine(ctx, x1, y1, x2, y2, color);
+	_drawLine(ctx, x2, y2, x0, y0, color);
 }
 
-//================================================================================================================
-void TFT_drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+//====================================================================================================================================
+void TFT_ctx_drawTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
 {
 	x0 += dispWin.x1;
 	y0 += dispWin.y1;
@@ -487,14 +699,14 @@ void TFT_drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16
 	x2 += dispWin.x1;
 	y2 += dispWin.y1;
 
-	_drawLine(x0, y0, x1, y1, color);
-	_drawLine(x1, y1, x2, y2, color);
-	_drawLine(x2, y2, x0, y0, color);
+	_drawLine(ctx, x0, y0, x1, y1, color);
+	_drawLine(ctx, x1, y1, x2, y2, color);
+	_drawLine(ctx, x2, y2, x0, y0, color);
 }
 
 // Fill a triangle
-//--------------------------------------------------------------------------------------------------------------------
-static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+//------------------------------------------------------------------------------------------------------------------------------------
+static void _fillTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
 {
   int16_t a, b, y, last;
 
@@ -515,7 +727,7 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     else if(x1 > b) b = x1;
     if(x2 < a)      a = x2;
     else if(x2 > b) b = x2;
-    _drawFastHLine(a, y0, b-a+1, color);
+    _drawFastHLine(ctx, a, y0, b-a+1, color);
     return;
   }
 
@@ -549,7 +761,7 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
     */
     if(a > b) swap(a,b);
-    _drawFastHLine(a, y, b-a+1, color);
+    _drawFastHLine(ctx, a, y, b-a+1, color);
   }
 
   // For lower part of triangle, find scanline crossings for segments
@@ -566,22 +778,22 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
     */
     if(a > b) swap(a,b);
-    _drawFastHLine(a, y, b-a+1, color);
+    _drawFastHLine(ctx, a, y, b-a+1, color);
   }
 }
 
-//================================================================================================================
-void TFT_fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+//====================================================================================================================================
+void TFT_ctx_fillTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
 {
-	_fillTriangle(
+	_fillTriangle(ctx, 
 			x0 + dispWin.x1, y0 + dispWin.y1,
 			x1 + dispWin.x1, y1 + dispWin.y1,
 			x2 + dispWin.x1, y2 + dispWin.y1,
 			color);
 }
 
-//====================================================================
-void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
+//========================================================================================
+void TFT_ctx_drawCircle(tft_ctx_t *ctx, int16_t x, int16_t y, int radius, color_t color) {
 	x += dispWin.x1;
 	y += dispWin.y1;
 	int f = 1 - radius;
@@ -590,11 +802,12 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 	int x1 = 0;
 	int y1 = radius;
 
-	disp_select();
-	_drawPixel(x, y + radius, color, 0);
-	_drawPixel(x, y - radius, color, 0);
-	_drawPixel(x + radius, y, color, 0);
-	_drawPixel(x - radius, y, color, 0);
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
+	_drawPixel(ctx, x, y + radius, color, 0);
+	_drawPixel(ctx, x, y - radius, color, 0);
+	_drawPixel(ctx, x + radius, y, color, 0);
+	_drawPixel(ctx, x - radius, y, color, 0);
 	while(x1 < y1) {
 		if (f >= 0) {
 			y1--;
@@ -604,44 +817,43 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 		x1++;
 		ddF_x += 2;
 		f += ddF_x;
-		_drawPixel(x + x1, y + y1, color, 0);
-		_drawPixel(x - x1, y + y1, color, 0);
-		_drawPixel(x + x1, y - y1, color, 0);
-		_drawPixel(x - x1, y - y1, color, 0);
-		_drawPixel(x + y1, y + x1, color, 0);
-		_drawPixel(x - y1, y + x1, color, 0);
-		_drawPixel(x + y1, y - x1, color, 0);
-		_drawPixel(x - y1, y - x1, color, 0);
+		_drawPixel(ctx, x + x1, y + y1, color, 0);
+		_drawPixel(ctx, x - x1, y + y1, color, 0);
+		_drawPixel(ctx, x + x1, y - y1, color, 0);
+		_drawPixel(ctx, x - x1, y - y1, color, 0);
+		_drawPixel(ctx, x + y1, y + x1, color, 0);
+		_drawPixel(ctx, x - y1, y + x1, color, 0);
+		_drawPixel(ctx, x + y1, y - x1, color, 0);
+		_drawPixel(ctx, x - y1, y - x1, color, 0);
 	}
-  disp_deselect();
+	_pixel_batch_end(ctx);
+  disp_drv_deselect(&ctx->drv);
 }
 
-//====================================================================
-void TFT_fillCircle(int16_t x, int16_t y, int radius, color_t color) {
+//========================================================================================
+void TFT_ctx_fillCircle(tft_ctx_t *ctx, int16_t x, int16_t y, int radius, color_t color) {
 	x += dispWin.x1;
 	y += dispWin.y1;
 
-	_drawFastVLine(x, y-radius, 2*radius+1, color);
-	fillCircleHelper(x, y, radius, 3, 0, color);
+	_drawFastVLine(ctx, x, y-radius, 2*radius+1, color);
+	fillCircleHelper(ctx, x, y, radius, 3, 0, color);
 }
 
-//----------------------------------------------------------------------------------------------------------------
-static void _draw_ellipse_section(uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
+//--------------------------------------------------------------------------------------------------------------------------------
+static void _draw_ellipse_section(tft_ctx_t *ctx, uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
 {
-	disp_select();
     // upper right
-    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _drawPixel(x0 + x, y0 - y, color, 0);
+    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _drawPixel(ctx, x0 + x, y0 - y, color, 0);
     // upper left
-    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _drawPixel(x0 - x, y0 - y, color, 0);
+    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _drawPixel(ctx, x0 - x, y0 - y, color, 0);
     // lower right
-    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _drawPixel(x0 + x, y0 + y, color, 0);
+    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _drawPixel(ctx, x0 + x, y0 + y, color, 0);
     // lower left
-    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _drawPixel(x0 - x, y0 + y, color, 0);
-	disp_deselect();
+    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _drawPixel(ctx, x0 - x, y0 + y, color, 0);
 }
 
-//=====================================================================================================
-void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
+//=========================================================================================================================
+void TFT_ctx_drawEllipse(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
 {
 	x0 += dispWin.x1;
 	y0 += dispWin.y1;
@@ -679,8 +891,10 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 	stopx *= rx;
 	stopy = 0;
 
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
 	while( stopx >= stopy ) {
-		_draw_ellipse_section(x, y, x0, y0, color, option);
+		_draw_ellipse_section(ctx, x, y, x0, y0, color, option);
 		y++;
 		stopy += rxrx2;
 		err += ychg;
@@ -713,7 +927,7 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 	stopy *= ry;
 
 	while( stopx <= stopy ) {
-		_draw_ellipse_section(x, y, x0, y0, color, option);
+		_draw_ellipse_section(ctx, x, y, x0, y0, color, option);
 		x++;
 		stopx += ryry2;
 		err += xchg;
@@ -725,23 +939,25 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 			ychg += rxrx2;
 		}
 	}
+	_pixel_batch_end(ctx);
+	disp_drv_deselect(&ctx->drv);
 }
 
-//-----------------------------------------------------------------------------------------------------------------------
-static void _draw_filled_ellipse_section(uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
+//---------------------------------------------------------------------------------------------------------------------------------------
+static void _draw_filled_ellipse_section(tft_ctx_t *ctx, uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
 {
     // upper right
-    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _drawFastVLine(x0+x, y0-y, y+1, color);
+    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _drawFastVLine(ctx, x0+x, y0-y, y+1, color);
     // upper left
-    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _drawFastVLine(x0-x, y0-y, y+1, color);
+    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _drawFastVLine(ctx, x0-x, y0-y, y+1, color);
     // lower right
-    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _drawFastVLine(x0+x, y0, y+1, color);
+    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _drawFastVLine(ctx, x0+x, y0, y+1, color);
     // lower left
-    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _drawFastVLine(x0-x, y0, y+1, color);
+    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _drawFastVLine(ctx, x0-x, y0, y+1, color);
 }
 
-//=====================================================================================================
-void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
+//=========================================================================================================================
+void TFT_ctx_fillEllipse(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
 {
 	x0 += dispWin.x1;
 	y0 += dispWin.y1;
@@ -780,7 +996,7 @@ void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 	stopy = 0;
 
 	while( stopx >= stopy ) {
-		_draw_filled_ellipse_section(x, y, x0, y0, color, option);
+		_draw_filled_ellipse_section(ctx, x, y, x0, y0, color, option);
 		y++;
 		stopy += rxrx2;
 		err += ychg;
@@ -813,7 +1029,7 @@ void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 	stopy *= ry;
 
 	while( stopx <= stopy ) {
-		_draw_filled_ellipse_section(x, y, x0, y0, color, option);
+		_draw_filled_ellipse_section(ctx, x, y, x0, y0, color, option);
 		x++;
 		stopx += ryry2;
 		err += xchg;
@@ -830,8 +1046,8 @@ void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 
 // ==== ARC DRAWING ===================================================================
 
-//---------------------------------------------------------------------------------------------------------------------------------
-static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_t thickness, float start, float end, color_t color)
+//-------------------------------------------------------------------------------------------------------------------------------------------------
+static void _fillArcOffsetted(tft_ctx_t *ctx, uint16_t cx, uint16_t cy, uint16_t radius, uint16_t thickness, float start, float end, color_t color)
 {
 	//float sslope = (float)cos_lookup(start) / (float)sin_lookup(start);
 	//float eslope = (float)cos_lookup(end) / (float)sin_lookup(end);
@@ -843,7 +1059,8 @@ static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_
 	int ir2 = (radius - thickness) * (radius - thickness);
 	int or2 = radius * radius;
 
-	disp_select();
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
 	for (int x = -radius; x <= radius; x++) {
 		for (int y = -radius; y <= radius; y++) {
 			int x2 = x * x;
@@ -866,15 +1083,16 @@ static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_
 				(y == 0 && start == 0 && x > 0)
 				)
 				)
-				_drawPixel(cx+x, cy+y, color, 0);
+				_drawPixel(ctx, cx+x, cy+y, color, 0);
 		}
 	}
-	disp_deselect();
+	_pixel_batch_end(ctx);
+	disp_drv_deselect(&ctx->drv);
 }
 
 
-//===========================================================================================================================
-void TFT_drawArc(uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start, float end, color_t color, color_t fillcolor)
+//===============================================================================================================================================
+void TFT_ctx_drawArc(tft_ctx_t *ctx, uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start, float end, color_t color, color_t fillcolor)
 {
 	cx += dispWin.x1;
 	cy += dispWin.y1;
@@ -896,32 +1114,32 @@ void TFT_drawArc(uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start,
 	if (aend == 0) aend = (float)360;
 
 	if (astart > aend) {
-		_fillArcOffsetted(cx, cy, r, th, astart, _arcAngleMax, fillcolor);
-		_fillArcOffsetted(cx, cy, r, th, 0, aend, fillcolor);
+		_fillArcOffsetted(ctx, cx, cy, r, th, astart, _arcAngleMax, fillcolor);
+		_fillArcOffsetted(ctx, cx, cy, r, th, 0, aend, fillcolor);
 		if (f) {
-			_fillArcOffsetted(cx, cy, r, 1, astart, _arcAngleMax, color);
-			_fillArcOffsetted(cx, cy, r, 1, 0, aend, color);
-			_fillArcOffsetted(cx, cy, r-th, 1, astart, _arcAngleMax, color);
-			_fillArcOffsetted(cx, cy, r-th, 1, 0, aend, color);
+			_fillArcOffsetted(ctx, cx, cy, r, 1, astart, _arcAngleMax, color);
+			_fillArcOffsetted(ctx, cx, cy, r, 1, 0, aend, color);
+			_fillArcOffsetted(ctx, cx, cy, r-th, 1, astart, _arcAngleMax, color);
+			_fillArcOffsetted(ctx, cx, cy, r-th, 1, 0, aend, color);
 		}
 	}
 	else {
-		_fillArcOffsetted(cx, cy, r, th, astart, aend, fillcolor);
+		_fillArcOffsetted(ctx, cx, cy, r, th, astart, aend, fillcolor);
 		if (f) {
-			_fillArcOffsetted(cx, cy, r, 1, astart, aend, color);
-			_fillArcOffsetted(cx, cy, r-th, 1, astart, aend, color);
+			_fillArcOffsetted(ctx, cx, cy, r, 1, astart, aend, color);
+			_fillArcOffsetted(ctx, cx, cy, r-th, 1, astart, aend, color);
 		}
 	}
 	if (f) {
-		_drawLine(cx + (r-th) * cos(astart * DEG_TO_RAD), cy + (r-th) * sin(astart * DEG_TO_RAD),
+		_drawLine(ctx, cx + (r-th) * cos(astart * DEG_TO_RAD), cy + (r-th) * sin(astart * DEG_TO_RAD),
 			cx + (r-1) * cos(astart * DEG_TO_RAD), cy + (r-1) * sin(astart * DEG_TO_RAD), color);
-		_drawLine(cx + (r-th) * cos(aend * DEG_TO_RAD), cy + (r-th) * sin(aend * DEG_TO_RAD),
+		_drawLine(ctx, cx + (r-th) * cos(aend * DEG_TO_RAD), cy + (r-th) * sin(aend * DEG_TO_RAD),
 			cx + (r-1) * cos(aend * DEG_TO_RAD), cy + (r-1) * sin(aend * DEG_TO_RAD), color);
 	}
 }
 
-//=============================================================================================================
-void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, color_t fill, int rot, uint8_t th)
+//=================================================================================================================================
+void TFT_ctx_drawPolygon(tft_ctx_t *ctx, int cx, int cy, int sides, int diameter, color_t color, color_t fill, int rot, uint8_t th)
 {
 	cx += dispWin.x1;
 	cy += dispWin.y1;
@@ -943,8 +1161,8 @@ void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, col
 	// Draw the polygon on the screen.
 	if (f) {
 		for(int idx = 0; idx < sides; idx++) {
-			if((idx+1) < sides) _fillTriangle(cx,cy,Xpoints[idx],Ypoints[idx],Xpoints[idx+1],Ypoints[idx+1], fill);
-			else _fillTriangle(cx,cy,Xpoints[idx],Ypoints[idx],Xpoints[0],Ypoints[0], fill);
+			if((idx+1) < sides) _fillTriangle(ctx, cx,cy,Xpoints[idx],Ypoints[idx],Xpoints[idx+1],Ypoints[idx+1], fill);
+			else _fillTriangle(ctx, cx,cy,Xpoints[idx],Ypoints[idx],Xpoints[0],Ypoints[0], fill);
 		}
 	}
 
@@ -958,9 +1176,9 @@ void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, col
 			}
 			for(int idx = 0; idx < sides; idx++) {
 				if( (idx+1) < sides)
-					_drawLine(Xpoints[idx],Ypoints[idx],Xpoints[idx+1],Ypoints[idx+1], color); // draw the lines
+					_drawLine(ctx, Xpoints[idx],Ypoints[idx],Xpoints[idx+1],Ypoints[idx+1], color); // draw the lines
 				else
-					_drawLine(Xpoints[idx],Ypoints[idx],Xpoints[0],Ypoints[0], color); // finishes the last line to close up the polygon.
+					_drawLine(ctx, Xpoints[idx],Ypoints[idx],Xpoints[0],Ypoints[0], color); // finishes the last line to close up the polygon.
 			}
 		}
 	}
@@ -1017,8 +1235,8 @@ void TFT_drawStar(int cx, int cy, int diameter, color_t color, bool fill, float
 
 // ================ Font and string functions ==================================
 
-//--------------------------------------------------------
-static int load_file_font(const char * fontfile, int info)
+//------------------------------------------------------------------------
+static int load_file_font(tft_ctx_t *ctx, const char * fontfile, int info)
 {
 	int err = 0;
 	char err_msg[256] = {'\0'};
@@ -1148,8 +1366,8 @@ exit:
 	return err;
 }
 
-//------------------------------------------------
-int compile_font_file(char *fontfile, uint8_t dbg)
+//------------------------------------------------------------------------
+int TFT_ctx_compile_font_file(tft_ctx_t *ctx, char *fontfile, uint8_t dbg)
 {
 	int err = 0;
 	char err_msg[128] = {'\0'};
@@ -1290,7 +1508,7 @@ int compile_font_file(char *fontfile, uint8_t dbg)
 
 	uint8_t *uf = userfont; // save userfont pointer
 	userfont = NULL;
-	if (load_file_font(outfile, 1) != 0) {
+	if (load_file_font(ctx, outfile, 1) != 0) {
 		sprintf(err_msg, "Error compiling file!");
 		err = 10;
 	}
@@ -1334,8 +1552,8 @@ exit:
 // Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
 //---------------------------------------------------------------------------------------------
 
-//----------------------------------
-void getFontCharacters(uint8_t *buf)
+//----------------------------------------------------------
+void TFT_ctx_getFontCharacters(tft_ctx_t *ctx, uint8_t *buf)
 {
     if (cfont.bitmap == 2) {
     	//For 7 segment font only characters 0,1,2,3,4,5,6,7,8,9, . , - , : , / are available.
@@ -1380,8 +1598,8 @@ void getFontCharacters(uint8_t *buf)
 }
 
 // Set max width & height of the proportional font
-//-----------------------------
-static void getMaxWidthHeight()
+//-------------------------------------------
+static void getMaxWidthHeight(tft_ctx_t *ctx)
 {
 	uint16_t tempPtr = 4; // point at first char data
 	uint8_t cc, cw, ch, cd, cy;
@@ -1412,8 +1630,8 @@ static void getMaxWidthHeight()
 }
 
 // Return the Glyph data for an individual character in the proportional font
-//------------------------------------
-static uint8_t getCharPtr(uint8_t c) {
+//----------------------------------------------------
+static uint8_t getCharPtr(tft_ctx_t *ctx, uint8_t c) {
   uint16_t tempPtr = 4; // point at first char data
 
   do {
@@ -1483,8 +1701,8 @@ static void _testFont() {
 }
 */
 
-//===================================================
-void TFT_setFont(uint8_t font, const char *font_file)
+//=======================================================================
+void TFT_ctx_setFont(tft_ctx_t *ctx, uint8_t font, const char *font_file)
 {
   cfont.font = NULL;
 
@@ -1497,7 +1715,7 @@ void TFT_setFont(uint8_t font, const char *font_file)
   }
   else {
 	  if (font == USER_FONT) {
-		  if (load_file_font(font_file, 0) != 0) cfont.font = tft_DefaultFont;
+		  if (load_file_font(ctx, font_file, 0) != 0) cfont.font = tft_DefaultFont;
 		  else cfont.font = userfont;
 	  }
 	  else if (font == DEJAVU18_FONT) cfont.font = tft_Dejavu18;
@@ -1520,7 +1738,7 @@ void TFT_setFont(uint8_t font, const char *font_file)
 	  }
 	  else {
 		  cfont.offset = 4;
-		  getMaxWidthHeight();
+		  getMaxWidthHeight(ctx);
 	  }
 	  //_testFont();
   }
@@ -1544,56 +1762,56 @@ void TFT_setFont(uint8_t font, const char *font_file)
 
 // print non-rotated proportional character
 // character is already in fontChar
-//----------------------------------------------
-static int printProportionalChar(int x, int y) {
+//--------------------------------------------------------------
+static int printProportionalChar(tft_ctx_t *ctx, int x, int y) {
 	uint8_t ch = 0;
 	int i, j, char_width;
 
-	char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+	char_width = ((ctx->font_char.width > ctx->font_char.xDelta) ? ctx->font_char.width : ctx->font_char.xDelta);
 
-	if ((font_buffered_char) && (!font_transparent)) {
+	if ((ctx->buffered_char) && (!ctx->transparent)) {
 		int len, bufPos;
 
 		// === buffer Glyph data for faster sending ===
-		len = char_width * cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		len = char_width * ctx->font.y_size;
+		color_t *color_line = disp_dma_alloc(len*3);
 		if (color_line) {
 			// fill with background color
 			for (int n = 0; n < len; n++) {
-				color_line[n] = _bg;
+				color_line[n] = ctx->bg;
 			}
 			// set character pixels to foreground color
 			uint8_t mask = 0x80;
-			for (j=0; j < fontChar.height; j++) {
-				for (i=0; i < fontChar.width; i++) {
-					if (((i + (j*fontChar.width)) % 8) == 0) {
+			for (j=0; j < ctx->font_char.height; j++) {
+				for (i=0; i < ctx->font_char.width; i++) {
+					if (((i + (j*ctx->font_char.width)) % 8) == 0) {
 						mask = 0x80;
-						ch = cfont.font[fontChar.dataPtr++];
+						ch = ctx->font.font[ctx->font_char.dataPtr++];
 					}
 					if ((ch & mask) != 0) {
 						// visible pixel
-						bufPos = ((j + fontChar.adjYOffset) * char_width) + (fontChar.xOffset + i);  // bufY + bufX
-						color_line[bufPos] = _fg;
+						bufPos = ((j + ctx->font_char.adjYOffset) * char_width) + (ctx->font_char.xOffset + i);  // bufY + bufX
+						color_line[bufPos] = ctx->fg;
 						/*
-						bufY = (j + fontChar.adjYOffset) * char_width;
-						bufX = fontChar.xOffset + i;
+						bufY = (j + ctx->font_char.adjYOffset) * char_width;
+						bufX = ctx->font_char.xOffset + i;
 						if ((bufX < 0) || (bufX > char_width)) {
-							printf("[%c] X ERR: %d\r\n", fontChar.charCode, bufX);
+							printf("[%c] X ERR: %d\r\n", ctx->font_char.charCode, bufX);
 						}
 						bufPos = bufY + bufX;
-						if ((bufPos < len) && (bufPos > 0)) color_line[bufPos] = _fg;
+						if ((bufPos < len) && (bufPos > 0)) color_line[bufPos] = ctx->fg;
 						else printf("[%c] ERR: %d > %d  W=%d  H=%d  bufX=%d  bufY=%d  X=%d  Y=%d\r\n",
-								fontChar.charCode, bufPos, len, char_width, cfont.y_size, bufX, bufY, fontChar.xOffset + i, j + fontChar.adjYOffset);
+								ctx->font_char.charCode, bufPos, len, char_width, ctx->font.y_size, bufX, bufY, ctx->font_char.xOffset + i, j + ctx->font_char.adjYOffset);
 						*/
 					}
 					mask >>= 1;
 				}
 			}
 			// send to display in one transaction
-			disp_select();
-			send_data(x, y, x+char_width-1, y+cfont.y_size-1, len, color_line);
-			disp_deselect();
-			free(color_line);
+			disp_drv_select(&ctx->drv);
+			disp_drv_send_data(&ctx->drv, x, y, x+char_width-1, y+ctx->font.y_size-1, len, color_line);
+			disp_drv_deselect(&ctx->drv);
+			disp_dma_free(color_line);
 
 			return char_width;
 		}
@@ -1601,191 +1819,199 @@ static int printProportionalChar(int x, int y) {
 
 	int cx, cy;
 
-	if (!font_transparent) _fillRect(x, y, char_width+1, cfont.y_size, _bg);
+	if (!ctx->transparent) _fillRect(ctx, x, y, char_width+1, ctx->font.y_size, ctx->bg);
 
 	// draw Glyph
 	uint8_t mask = 0x80;
-	disp_select();
-	for (j=0; j < fontChar.height; j++) {
-		for (i=0; i < fontChar.width; i++) {
-			if (((i + (j*fontChar.width)) % 8) == 0) {
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
+	for (j=0; j < ctx->font_char.height; j++) {
+		for (i=0; i < ctx->font_char.width; i++) {
+			if (((i + (j*ctx->font_char.width)) % 8) == 0) {
 				mask = 0x80;
-				ch = cfont.font[fontChar.dataPtr++];
+				ch = ctx->font.font[ctx->font_char.dataPtr++];
 			}
 
 			if ((ch & mask) !=0) {
-				cx = (uint16_t)(x+fontChar.xOffset+i);
-				cy = (uint16_t)(y+j+fontChar.adjYOffset);
-				_drawPixel(cx, cy, _fg, 0);
+				cx = (uint16_t)(x+ctx->font_char.xOffset+i);
+				cy = (uint16_t)(y+j+ctx->font_char.adjYOffset);
+				_drawPixel(ctx, cx, cy, ctx->fg, 0);
 			}
 			mask >>= 1;
 		}
 	}
-	disp_deselect();
+	_pixel_batch_end(ctx);
+	disp_drv_deselect(&ctx->drv);
 
 	return char_width;
 }
 
 // non-rotated fixed width character
-//----------------------------------------------
-static void printChar(uint8_t c, int x, int y) {
+//--------------------------------------------------------------
+static void printChar(tft_ctx_t *ctx, uint8_t c, int x, int y) {
 	uint8_t i, j, ch, fz, mask;
 	uint16_t k, temp, cx, cy, len;
 
 	// fz = bytes per char row
-	fz = cfont.x_size/8;
-	if (cfont.x_size % 8) fz++;
+	fz = ctx->font.x_size/8;
+	if (ctx->font.x_size % 8) fz++;
 
 	// get character position in buffer
-	temp = ((c-cfont.offset)*((fz)*cfont.y_size))+4;
+	temp = ((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
 
-	if ((font_buffered_char) && (!font_transparent)) {
+	if ((ctx->buffered_char) && (!ctx->transparent)) {
 		// === buffer Glyph data for faster sending ===
-		len = cfont.x_size * cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		len = ctx->font.x_size * ctx->font.y_size;
+		color_t *color_line = disp_dma_alloc(len*3);
 		if (color_line) {
 			// fill with background color
 			for (int n = 0; n < len; n++) {
-				color_line[n] = _bg;
+				color_line[n] = ctx->bg;
 			}
 			// set character pixels to foreground color
-			for (j=0; j<cfont.y_size; j++) {
+			for (j=0; j<ctx->font.y_size; j++) {
 				for (k=0; k < fz; k++) {
-					ch = cfont.font[temp+k];
+					ch = ctx->font.font[temp+k];
 					mask=0x80;
 					for (i=0; i<8; i++) {
-						if ((ch & mask) !=0) color_line[(j*cfont.x_size) + (i+(k*8))] = _fg;
+						if ((ch & mask) !=0) color_line[(j*ctx->font.x_size) + (i+(k*8))] = ctx->fg;
 						mask >>= 1;
 					}
 				}
 				temp += (fz);
 			}
 			// send to display in one transaction
-			disp_select();
-			send_data(x, y, x+cfont.x_size-1, y+cfont.y_size-1, len, color_line);
-			disp_deselect();
-			free(color_line);
+			disp_drv_select(&ctx->drv);
+			disp_drv_send_data(&ctx->drv, x, y, x+ctx->font.x_size-1, y+ctx->font.y_size-1, len, color_line);
+			disp_drv_deselect(&ctx->drv);
+			disp_dma_free(color_line);
 
 			return;
 		}
 	}
 
-	if (!font_transparent) _fillRect(x, y, cfont.x_size, cfont.y_size, _bg);
+	if (!ctx->transparent) _fillRect(ctx, x, y, ctx->font.x_size, ctx->font.y_size, ctx->bg);
 
-	disp_select();
-	for (j=0; j<cfont.y_size; j++) {
+	disp_drv_select(&ctx->drv);
+	_pixel_batch_begin(ctx);
+	for (j=0; j<ctx->font.y_size; j++) {
 		for (k=0; k < fz; k++) {
-			ch = cfont.font[temp+k];
+			ch = ctx->font.font[temp+k];
 			mask=0x80;
 			for (i=0; i<8; i++) {
 				if ((ch & mask) !=0) {
 					cx = (uint16_t)(x+i+(k*8));
 					cy = (uint16_t)(y+j);
-					_drawPixel(cx, cy, _fg, 0);
+					_drawPixel(ctx, cx, cy, ctx->fg, 0);
 				}
 				mask >>= 1;
 			}
 		}
 		temp += (fz);
 	}
-	disp_deselect();
+	_pixel_batch_end(ctx);
+	disp_drv_deselect(&ctx->drv);
 }
 
 // print rotated proportional character
 // character is already in fontChar
-//---------------------------------------------------
-static int rotatePropChar(int x, int y, int offset) {
+//-------------------------------------------------------------------
+static int rotatePropChar(tft_ctx_t *ctx, int x, int y, int offset) {
   uint8_t ch = 0;
-  double radian = font_rotate * DEG_TO_RAD;
+  double radian = ctx->rotate * DEG_TO_RAD;
   float cos_radian = cos(radian);
   float sin_radian = sin(radian);
 
   uint8_t mask = 0x80;
-  disp_select();
-  for (int j=0; j < fontChar.height; j++) {
-    for (int i=0; i < fontChar.width; i++) {
-      if (((i + (j*fontChar.width)) % 8) == 0) {
+  disp_drv_select(&ctx->drv);
+  _pixel_batch_begin(ctx);
+  for (int j=0; j < ctx->font_char.height; j++) {
+    for (int i=0; i < ctx->font_char.width; i++) {
+      if (((i + (j*ctx->font_char.width)) % 8) == 0) {
         mask = 0x80;
-        ch = cfont.font[fontChar.dataPtr++];
+        ch = ctx->font.font[ctx->font_char.dataPtr++];
       }
 
-      int newX = (int)(x + (((offset + i) * cos_radian) - ((j+fontChar.adjYOffset)*sin_radian)));
-      int newY = (int)(y + (((j+fontChar.adjYOffset) * cos_radian) + ((offset + i) * sin_radian)));
+      int newX = (int)(x + (((offset + i) * cos_radian) - ((j+ctx->font_char.adjYOffset)*sin_radian)));
+      int newY = (int)(y + (((j+ctx->font_char.adjYOffset) * cos_radian) + ((offset + i) * sin_radian)));
 
-      if ((ch & mask) != 0) _drawPixel(newX,newY,_fg, 0);
-      else if (!font_transparent) _drawPixel(newX,newY,_bg, 0);
+      if ((ch & mask) != 0) _drawPixel(ctx, newX,newY,ctx->fg, 0);
+      else if (!ctx->transparent) _drawPixel(ctx, newX,newY,ctx->bg, 0);
 
       mask >>= 1;
     }
   }
-  disp_deselect();
+  _pixel_batch_end(ctx);
+  disp_drv_deselect(&ctx->drv);
 
-  return fontChar.xDelta+1;
+  return ctx->font_char.xDelta+1;
 }
 
 // rotated fixed width character
-//--------------------------------------------------------
-static void rotateChar(uint8_t c, int x, int y, int pos) {
+//------------------------------------------------------------------------
+static void rotateChar(tft_ctx_t *ctx, uint8_t c, int x, int y, int pos) {
   uint8_t i,j,ch,fz,mask;
   uint16_t temp;
   int newx,newy;
-  double radian = font_rotate*0.0175;
+  double radian = ctx->rotate*0.0175;
   float cos_radian = cos(radian);
   float sin_radian = sin(radian);
   int zz;
 
-  if( cfont.x_size < 8 ) fz = cfont.x_size;
-  else fz = cfont.x_size/8;
-  temp=((c-cfont.offset)*((fz)*cfont.y_size))+4;
+  if( ctx->font.x_size < 8 ) fz = ctx->font.x_size;
+  else fz = ctx->font.x_size/8;
+  temp=((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
 
-  disp_select();
-  for (j=0; j<cfont.y_size; j++) {
+  disp_drv_select(&ctx->drv);
+  _pixel_batch_begin(ctx);
+  for (j=0; j<ctx->font.y_size; j++) {
     for (zz=0; zz<(fz); zz++) {
-      ch = cfont.font[temp+zz];
+      ch = ctx->font.font[temp+zz];
       mask = 0x80;
       for (i=0; i<8; i++) {
-        newx=(int)(x+(((i+(zz*8)+(pos*cfont.x_size))*cos_radian)-((j)*sin_radian)));
-        newy=(int)(y+(((j)*cos_radian)+((i+(zz*8)+(pos*cfont.x_size))*sin_radian)));
+        newx=(int)(x+(((i+(zz*8)+(pos*ctx->font.x_size))*cos_radian)-((j)*sin_radian)));
+        newy=(int)(y+(((j)*cos_radian)+((i+(zz*8)+(pos*ctx->font.x_size))*sin_radian)));
 
-        if ((ch & mask) != 0) _drawPixel(newx,newy,_fg, 0);
-        else if (!font_transparent) _drawPixel(newx,newy,_bg, 0);
+        if ((ch & mask) != 0) _drawPixel(ctx, newx,newy,ctx->fg, 0);
+        else if (!ctx->transparent) _drawPixel(ctx, newx,newy,ctx->bg, 0);
         mask >>= 1;
       }
     }
     temp+=(fz);
   }
-  disp_deselect();
+  _pixel_batch_end(ctx);
+  disp_drv_deselect(&ctx->drv);
   // calculate x,y for the next char
-  TFT_X = (int)(x + ((pos+1) * cfont.x_size * cos_radian));
-  TFT_Y = (int)(y + ((pos+1) * cfont.x_size * sin_radian));
+  ctx->text_x = (int)(x + ((pos+1) * ctx->font.x_size * cos_radian));
+  ctx->text_y = (int)(y + ((pos+1) * ctx->font.x_size * sin_radian));
 }
 
-//----------------------
-static int _7seg_width()
+//------------------------------------
+static int _7seg_width(tft_ctx_t *ctx)
 {
 	return (2 * (2 * cfont.y_size + 1)) + cfont.x_size;
 }
 
-//-----------------------
-static int _7seg_height()
+//-------------------------------------
+static int _7seg_height(tft_ctx_t *ctx)
 {
 	return (3 * (2 * cfont.y_size + 1)) + (2 * cfont.x_size);
 }
 
 // Returns the string width in pixels.
 // Useful for positions strings on the screen.
-//===============================
-int TFT_getStringWidth(char* str)
+//===================================================
+int TFT_ctx_getStringWidth(tft_ctx_t *ctx, char* str)
 {
     int strWidth = 0;
 
-	if (cfont.bitmap == 2) strWidth = ((_7seg_width()+2) * strlen(str)) - 2;	// 7-segment font
+	if (cfont.bitmap == 2) strWidth = ((_7seg_width(ctx)+2) * strlen(str)) - 2;	// 7-segment font
 	else if (cfont.x_size != 0) strWidth = strlen(str) * cfont.x_size;			// fixed width font
 	else {
 		// calculate the width of the string of proportional characters
 		char* tempStrptr = str;
 		while (*tempStrptr != 0) {
-			if (getCharPtr(*tempStrptr++)) {
+			if (getCharPtr(ctx, *tempStrptr++)) {
 				strWidth += (((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta) + 1);
 			}
 		}
@@ -1794,12 +2020,12 @@ int TFT_getStringWidth(char* str)
 	return strWidth;
 }
 
-//===============================================
-void TFT_clearStringRect(int x, int y, char *str)
+//===================================================================
+void TFT_ctx_clearStringRect(tft_ctx_t *ctx, int x, int y, char *str)
 {
-	int w = TFT_getStringWidth(str);
-	int h = TFT_getfontheight();
-	TFT_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, _bg);
+	int w = TFT_ctx_getStringWidth(ctx, str);
+	int h = TFT_ctx_getfontheight(ctx);
+	TFT_ctx_fillRect(ctx, x+dispWin.x1, y+dispWin.y1, w, h, _bg);
 }
 
 //==============================================================================
@@ -1831,32 +2057,32 @@ static const uint16_t font_bcd[] = {
   0x900  // 1001 0000 0000  // :
 };
 
-//-----------------------------------------------------------------------------------------------
-static void barVert(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
-  _fillTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, color);
-  _fillTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, color);
-  _fillRect(x, y+2*w+1, 2*w+1, l, color);
+//---------------------------------------------------------------------------------------------------------------
+static void barVert(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
+  _fillTriangle(ctx, x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, color);
+  _fillTriangle(ctx, x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, color);
+  _fillRect(ctx, x, y+2*w+1, 2*w+1, l, color);
   if (cfont.offset) {
-    _drawTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, outline);
-    _drawTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, outline);
-    _drawRect(x, y+2*w+1, 2*w+1, l, outline);
+    _drawTriangle(ctx, x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, outline);
+    _drawTriangle(ctx, x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, outline);
+    _drawRect(ctx, x, y+2*w+1, 2*w+1, l, outline);
   }
 }
 
-//----------------------------------------------------------------------------------------------
-static void barHor(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
-  _fillTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, color);
-  _fillTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, color);
-  _fillRect(x+2*w+1, y, l, 2*w+1, color);
+//--------------------------------------------------------------------------------------------------------------
+static void barHor(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
+  _fillTriangle(ctx, x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, color);
+  _fillTriangle(ctx, x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, color);
+  _fillRect(ctx, x+2*w+1, y, l, 2*w+1, color);
   if (cfont.offset) {
-    _drawTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, outline);
-    _drawTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, outline);
-    _drawRect(x+2*w+1, y, l, 2*w+1, outline);
+    _drawTriangle(ctx, x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, outline);
+    _drawTriangle(ctx, x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, outline);
+    _drawRect(ctx, x+2*w+1, y, l, 2*w+1, outline);
   }
 }
 
-//--------------------------------------------------------------------------------------------
-static void _draw7seg(int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, color_t color) {
+//------------------------------------------------------------------------------------------------------------
+static void _draw7seg(tft_ctx_t *ctx, int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, color_t color) {
   /* TODO: clipping */
   if (num < 0x2D || num > 0x3A) return;
 
@@ -1864,69 +2090,69 @@ static void _draw7seg(int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, co
   int16_t d = 2*w+l+1;
 
   // === Clear unused segments ===
-  if (!(c & 0x001)) barVert(x+d, y+d, w, l, _bg, _bg);
-  if (!(c & 0x002)) barVert(x,   y+d, w, l, _bg, _bg);
-  if (!(c & 0x004)) barVert(x+d, y, w, l, _bg, _bg);
-  if (!(c & 0x008)) barVert(x,   y, w, l, _bg, _bg);
-  if (!(c & 0x010)) barHor(x, y+2*d, w, l, _bg, _bg);
-  if (!(c & 0x020)) barHor(x, y+d, w, l, _bg, _bg);
-  if (!(c & 0x040)) barHor(x, y, w, l, _bg, _bg);
+  if (!(c & 0x001)) barVert(ctx, x+d, y+d, w, l, _bg, _bg);
+  if (!(c & 0x002)) barVert(ctx, x,   y+d, w, l, _bg, _bg);
+  if (!(c & 0x004)) barVert(ctx, x+d, y, w, l, _bg, _bg);
+  if (!(c & 0x008)) barVert(ctx, x,   y, w, l, _bg, _bg);
+  if (!(c & 0x010)) barHor(ctx, x, y+2*d, w, l, _bg, _bg);
+  if (!(c & 0x020)) barHor(ctx, x, y+d, w, l, _bg, _bg);
+  if (!(c & 0x040)) barHor(ctx, x, y, w, l, _bg, _bg);
 
   if (!(c & 0x080)) {
     // low point
-    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
+    _fillRect(ctx, x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
   }
   if (!(c & 0x100)) {
     // down middle point
-    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
+    _fillRect(ctx, x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
   }
   if (!(c & 0x800)) {
 	// up middle point
-    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
+    _fillRect(ctx, x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
   }
   if (!(c & 0x200)) {
     // middle, minus
-    _fillRect(x+2*w+1, y+d, l, 2*w+1, _bg);
-    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, _bg);
+    _fillRect(ctx, x+2*w+1, y+d, l, 2*w+1, _bg);
+    if (cfont.offset) _drawRect(ctx, x+2*w+1, y+d, l, 2*w+1, _bg);
   }
 
   // === Draw used segments ===
-  if (c & 0x001) barVert(x+d, y+d, w, l, color, cfont.color);	// down right
-  if (c & 0x002) barVert(x,   y+d, w, l, color, cfont.color);	// down left
-  if (c & 0x004) barVert(x+d, y, w, l, color, cfont.color);		// up right
-  if (c & 0x008) barVert(x,   y, w, l, color, cfont.color);		// up left
-  if (c & 0x010) barHor(x, y+2*d, w, l, color, cfont.color);	// down
-  if (c & 0x020) barHor(x, y+d, w, l, color, cfont.color);		// middle
-  if (c & 0x040) barHor(x, y, w, l, color, cfont.color);		// up
+  if (c & 0x001) barVert(ctx, x+d, y+d, w, l, color, cfont.color);	// down right
+  if (c & 0x002) barVert(ctx, x,   y+d, w, l, color, cfont.color);	// down left
+  if (c & 0x004) barVert(ctx, x+d, y, w, l, color, cfont.color);		// up right
+  if (c & 0x008) barVert(ctx, x,   y, w, l, color, cfont.color);		// up left
+  if (c & 0x010) barHor(ctx, x, y+2*d, w, l, color, cfont.color);	// down
+  if (c & 0x020) barHor(ctx, x, y+d, w, l, color, cfont.color);		// middle
+  if (c & 0x040) barHor(ctx, x, y, w, l, color, cfont.color);		// up
 
   if (c & 0x080) {
     // low point
-    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, cfont.color);
+    _fillRect(ctx, x+(d/2), y+2*d, 2*w+1, 2*w+1, color);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+2*d, 2*w+1, 2*w+1, cfont.color);
   }
   if (c & 0x100) {
     // down middle point
-    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, cfont.color);
+    _fillRect(ctx, x+(d/2), y+d+2*w+1, 2*w+1, l/2, color);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+d+2*w+1, 2*w+1, l/2, cfont.color);
   }
   if (c & 0x800) {
 	// up middle point
-    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, cfont.color);
+    _fillRect(ctx, x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, color);
+    if (cfont.offset) _drawRect(ctx, x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, cfont.color);
   }
   if (c & 0x200) {
     // middle, minus
-    _fillRect(x+2*w+1, y+d, l, 2*w+1, color);
-    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, cfont.color);
+    _fillRect(ctx, x+2*w+1, y+d, l, 2*w+1, color);
+    if (cfont.offset) _drawRect(ctx, x+2*w+1, y+d, l, 2*w+1, cfont.color);
   }
 }
 //==============================================================================
 
-//======================================
-void TFT_print(char *st, int x, int y) {
+//==========================================================
+void TFT_ctx_print(tft_ctx_t *ctx, char *st, int x, int y) {
 	int stl, i, tmpw, tmph, fh;
 	uint8_t ch;
 
@@ -1947,7 +2173,7 @@ void TFT_print(char *st, int x, int y) {
 	stl = strlen(st);
 
 	// ** Calculate CENTER, RIGHT or BOTTOM position
-	tmpw = TFT_getStringWidth(st);	// string width in pixels
+	tmpw = TFT_ctx_getStringWidth(ctx, st);	// string width in pixels
 	fh = cfont.y_size;			// font height
 	if ((cfont.x_size != 0) && (cfont.bitmap == 2)) {
 		// 7-segment font
@@ -1973,8 +2199,8 @@ void TFT_print(char *st, int x, int y) {
 	tmpw = cfont.x_size;
 	if (cfont.x_size != 0) {
 		if (cfont.bitmap == 2) {	// 7-segment font
-			tmpw = _7seg_width();	// character width
-			tmph = _7seg_height();	// character height
+			tmpw = _7seg_width(ctx);	// character width
+			tmph = _7seg_height(ctx);	// character height
 		}
 	}
 	else TFT_OFFSET = 0;	// fixed font; offset not needed
@@ -1987,7 +2213,7 @@ void TFT_print(char *st, int x, int y) {
 		ch = st[i]; // get string character
 
 		if (ch == 0x0D) { // === '\r', erase to eol ====
-			if ((!font_transparent) && (font_rotate==0)) _fillRect(TFT_X, TFT_Y,  dispWin.x2+1-TFT_X, tmph, _bg);
+			if ((!font_transparent) && (font_rotate==0)) _fillRect(ctx, TFT_X, TFT_Y,  dispWin.x2+1-TFT_X, tmph, _bg);
 		}
 
 		else if (ch == 0x0A) { // ==== '\n', new line ====
@@ -2001,7 +2227,7 @@ void TFT_print(char *st, int x, int y) {
 		else { // ==== other characters ====
 			if (cfont.x_size == 0) {
 				// for proportional font get character data to 'fontChar'
-				if (getCharPtr(ch)) tmpw = fontChar.xDelta;
+				if (getCharPtr(ctx, ch)) tmpw = fontChar.xDelta;
 				else continue;
 			}
 
@@ -2016,10 +2242,10 @@ void TFT_print(char *st, int x, int y) {
 			// Let's print the character
 			if (cfont.x_size == 0) {
 				// == proportional font
-				if (font_rotate == 0) TFT_X += printProportionalChar(TFT_X, TFT_Y) + 1;
+				if (font_rotate == 0) TFT_X += printProportionalChar(ctx, TFT_X, TFT_Y) + 1;
 				else {
 					// rotated proportional font
-					offset += rotatePropChar(x, y, offset);
+					offset += rotatePropChar(ctx, x, y, offset);
 					TFT_OFFSET = offset;
 				}
 			}
@@ -2028,14 +2254,14 @@ void TFT_print(char *st, int x, int y) {
 					// == fixed font
 					if ((ch < cfont.offset) || ((ch-cfont.offset) > cfont.numchars)) ch = cfont.offset;
 					if (font_rotate == 0) {
-						printChar(ch, TFT_X, TFT_Y);
+						printChar(ctx, ch, TFT_X, TFT_Y);
 						TFT_X += tmpw;
 					}
-					else rotateChar(ch, x, y, i);
+					else rotateChar(ctx, ch, x, y, i);
 				}
 				else if (cfont.bitmap == 2) {
 					// == 7-segment font ==
-					_draw7seg(TFT_X, TFT_Y, ch, cfont.y_size, cfont.x_size, _fg);
+					_draw7seg(ctx, TFT_X, TFT_Y, ch, cfont.y_size, cfont.x_size, _fg);
 					TFT_X += (tmpw + 2);
 				}
 			}
@@ -2048,18 +2274,18 @@ void TFT_print(char *st, int x, int y) {
 
 // Change the screen rotation.
 // Input: m new rotation value (0 to 3)
-//=================================
-void TFT_setRotation(uint8_t rot) {
+//=====================================================
+void TFT_ctx_setRotation(tft_ctx_t *ctx, uint8_t rot) {
     if (rot > 3) {
         uint8_t madctl = (rot & 0xF8); // for testing, manually set MADCTL register
-		if (disp_select() == ESP_OK) {
-			disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
-			disp_deselect();
+		if (disp_drv_select(&ctx->drv) == ESP_OK) {
+			disp_drv_transfer_cmd_data(&ctx->drv, TFT_MADCTL, &madctl, 1);
+			disp_drv_deselect(&ctx->drv);
 		}
     }
 	else {
 		orientation = rot;
-        _tft_setRotation(rot);
+        disp_drv_setRotation(&ctx->drv, rot);
 	}
 
 	dispWin.x1 = 0;
@@ -2067,174 +2293,856 @@ void TFT_setRotation(uint8_t rot) {
 	dispWin.x2 = _width-1;
 	dispWin.y2 = _height-1;
 
-	TFT_fillScreen(_bg);
+	TFT_ctx_fillScreen(ctx, _bg);
 }
 
 // Send the command to invert all of the colors.
 // Input: i 0 to disable inversion; non-zero to enable inversion
-//==========================================
-void TFT_invertDisplay(const uint8_t mode) {
-  if ( mode == INVERT_ON ) disp_spi_transfer_cmd(TFT_INVONN);
-  else disp_spi_transfer_cmd(TFT_INVOFF);
+//==============================================================
+void TFT_ctx_invertDisplay(tft_ctx_t *ctx, const uint8_t mode) {
+  if ( mode == INVERT_ON ) disp_drv_transfer_cmd(&ctx->drv, TFT_INVONN);
+  else disp_drv_transfer_cmd(&ctx->drv, TFT_INVOFF);
 }
 
-// Select gamma curve
-// Input: gamma = 0~3
-//==================================
-void TFT_setGammaCurve(uint8_t gm) {
-  uint8_t gamma_curve = 1 << (gm & 0x03);
-  disp_spi_transfer_cmd_data(TFT_CMD_GAMMASET, &gamma_curve, 1);
+// Define the hardware scroll area between 'top' and 'bottom' fixed lines, scroll position is reset
+//==============================================================
+int TFT_ctx_setupScrollArea(tft_ctx_t *ctx, int top, int bottom)
+{
+	return disp_drv_scroll_set(&ctx->drv, top, bottom, 0);
 }
 
-//===========================================================
-color_t HSBtoRGB(float _hue, float _sat, float _brightness) {
- float red = 0.0;
- float green = 0.0;
- float blue = 0.0;
+// Scroll the content of the scroll area up by 'pos' lines from the initial position
+//===========================================
+int TFT_ctx_scrollTo(tft_ctx_t *ctx, int pos)
+{
+	disp_drv_t *drv = disp_drv;
 
- if (_sat == 0.0) {
-   red = _brightness;
-   green = _brightness;
-   blue = _brightness;
- } else {
-   if (_hue == 360.0) {
-     _hue = 0;
-   }
+	if (drv->scroll.vsa == 0) return ESP_ERR_INVALID_STATE;
+	return disp_drv_scroll_set(&ctx->drv, drv->scroll.top, drv->scroll.bottom, pos);
+}
 
-   int slice = (int)(_hue / 60.0);
-   float hue_frac = (_hue / 60.0) - slice;
+// Position of the source pixel which is transformed by 'xform' to (dx,dy)
+// in the transformed 'w' x 'h' source rectangle
+//---------------------------------------------------------------------------------------------
+static void _blit_src_point(int w, int h, uint8_t xform, int dx, int dy, int *sx, int *sy)
+{
+	int x, y;
+
+	switch (xform & 3) {
+		case DISP_XFORM_ROT90:
+			x = dy;
+			y = h-1-dx;
+			break;
+		case DISP_XFORM_ROT180:
+			x = w-1-dx;
+			y = h-1-dy;
+			break;
+		case DISP_XFORM_ROT270:
+			x = w-1-dy;
+			y = dx;
+			break;
+		default:
+			x = dx;
+			y = dy;
+	}
+	*sx = ((xform & DISP_XFORM_FLIPX) ? (w-1-x) : x);
+	*sy = ((xform & DISP_XFORM_FLIPY) ? (h-1-y) : y);
+}
 
-   float aa = _brightness * (1.0 - _sat);
-   float bb = _brightness * (1.0 - _sat * hue_frac);
-   float cc = _brightness * (1.0 - _sat * (1.0 - hue_frac));
+// Draw the 'w' x 'h' pixel buffer rotated and/or flipped by 'xform' with top left corner at (x,y)
+//=======================================================================================
+int TFT_ctx_blit(tft_ctx_t *ctx, int x, int y, int w, int h, color_t *buf, uint8_t xform)
+{
+	int dw, dh, cx1, cy1, cx2, cy2, sx1, sy1, sx2, sy2, t, i, j, sx, sy;
+	esp_err_t ret;
+
+	if ((buf == NULL) || (w <= 0) || (h <= 0)) return ESP_ERR_INVALID_ARG;
+
+	// size of the transformed rectangle
+	dw = ((xform & 1) ? h : w);
+	dh = ((xform & 1) ? w : h);
+
+	// clip the destination to the display window, relative to the blit origin
+	cx1 = ((x < 0) ? -x : 0);
+	cy1 = ((y < 0) ? -y : 0);
+	cx2 = dw-1;
+	cy2 = dh-1;
+	if ((x + cx2) > (dispWin.x2 - dispWin.x1)) cx2 = dispWin.x2 - dispWin.x1 - x;
+	if ((y + cy2) > (dispWin.y2 - dispWin.y1)) cy2 = dispWin.y2 - dispWin.y1 - y;
+	if ((cx2 < cx1) || (cy2 < cy1)) return ESP_OK;
+
+	// source rectangle transformed to the clipped destination
+	_blit_src_point(w, h, xform, cx1, cy1, &sx1, &sy1);
+	_blit_src_point(w, h, xform, cx2, cy2, &sx2, &sy2);
+	if (sx1 > sx2) { t = sx1; sx1 = sx2; sx2 = t; }
+	if (sy1 > sy2) { t = sy1; sy1 = sy2; sy2 = t; }
 
-   switch(slice) {
-     case 0:
-         red = _brightness;
-         green = cc;
-         blue = aa;
-         break;
-     case 1:
-         red = bb;
-         green = _brightness;
-         blue = aa;
-         break;
-     case 2:
-         red = aa;
-         green = _brightness;
-         blue = cc;
-         break;
-     case 3:
-         red = aa;
-         green = bb;
-         blue = _brightness;
-         break;
-     case 4:
-         red = cc;
-         green = aa;
-         blue = _brightness;
-         break;
-     case 5:
-         red = _brightness;
-         green = aa;
-         blue = bb;
-         break;
-     default:
-         red = 0.0;
-         green = 0.0;
-         blue = 0.0;
-         break;
-   }
- }
+	x += dispWin.x1;
+	y += dispWin.y1;
 
- color_t color;
- color.r = ((uint8_t)(red * 255.0)) & 0xFC;
- color.g = ((uint8_t)(green * 255.0)) & 0xFC;
- color.b = ((uint8_t)(blue * 255.0)) & 0xFC;
+	if (disp_drv_select(&ctx->drv) != ESP_OK) return ESP_FAIL;
 
- return color;
+	// Send the pixels in source order with the panel memory access order changed
+	ret = disp_drv_send_data_xform(&ctx->drv, x+cx1, y+cy1, sx2-sx1+1, sy2-sy1+1, buf + (sy1*w) + sx1, w, xform);
+	if (ret != ESP_OK) {
+		// Transform the pixels line by line
+		color_t *color_line = disp_dma_alloc((cx2-cx1+1)*3);
+		if (color_line == NULL) {
+			disp_drv_deselect(&ctx->drv);
+			return ESP_ERR_NO_MEM;
+		}
+		for (j=cy1; j<=cy2; j++) {
+			for (i=cx1; i<=cx2; i++) {
+				_blit_src_point(w, h, xform, i, j, &sx, &sy);
+				color_line[i-cx1] = buf[(sy*w) + sx];
+			}
+			disp_drv_send_data(&ctx->drv, x+cx1, y+j, x+cx2, y+j, cx2-cx1+1, color_line);
+			disp_drv_wait_trans_finish(&ctx->drv, 1);
+		}
+		disp_dma_free(color_line);
+		ret = ESP_OK;
+	}
+	disp_drv_deselect(&ctx->drv);
+
+	return ret;
 }
-//=====================================================================
-void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
-{
-	dispWin.x1 = x1;
-	dispWin.y1 = y1;
-	dispWin.x2 = x2;
-	dispWin.y2 = y2;
 
-	if (dispWin.x2 >= _width) dispWin.x2 = _width-1;
-	if (dispWin.y2 >= _height) dispWin.y2 = _height-1;
-	if (dispWin.x1 > dispWin.x2) dispWin.x1 = dispWin.x2;
-	if (dispWin.y1 > dispWin.y2) dispWin.y1 = dispWin.y2;
+// Enable or disable drawing to the shadow framebuffer
+//========================================================
+int TFT_ctx_setFramebuffer(tft_ctx_t *ctx, uint8_t enable)
+{
+	_pixel_batch_flush(ctx);
+	return disp_drv_fb_enable(&ctx->drv, enable);
 }
 
-//=====================
-void TFT_resetclipwin()
+// Send the changed framebuffer rectangles to the display
+//===============================
+int TFT_ctx_flush(tft_ctx_t *ctx)
 {
-	dispWin.x2 = _width-1;
-	dispWin.y2 = _height-1;
-	dispWin.x1 = 0;
-	dispWin.y1 = 0;
+	_pixel_batch_flush(ctx);
+	return disp_drv_fb_flush(&ctx->drv);
 }
 
-//==========================================================================
-void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color) {
-	if (cfont.bitmap != 2) return;
+// ==== Off-screen canvas ====
 
-	if (l < 6) l = 6;
-    if (l > 40) l = 40;
-    if (w < 1) w = 1;
-    if (w > (l/2)) w = l/2;
-    if (w > 12) w = 12;
+//========================================================================
+tft_canvas_t *TFT_ctx_canvas_create(tft_ctx_t *ctx, int width, int height)
+{
+	if ((width <= 0) || (height <= 0)) return NULL;
 
-    cfont.x_size = l;
-	cfont.y_size = w;
-	cfont.offset = outline;
-	cfont.color  = color;
+	tft_canvas_t *canvas = calloc(1, sizeof(tft_canvas_t));
+	if (canvas == NULL) return NULL;
+
+	uint32_t size = width * height * ((COLOR_BITS == 16) ? 2 : 3);
+	canvas->buf = heap_caps_malloc(size, MALLOC_CAP_DMA);
+	if (canvas->buf == NULL) canvas->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	if (canvas->buf == NULL) {
+		free(canvas);
+		return NULL;
+	}
+	memset(canvas->buf, 0, size);
+	canvas->width = width;
+	canvas->height = height;
+	canvas->color_bits = COLOR_BITS;
+	canvas->clip.x1 = 0;
+	canvas->clip.y1 = 0;
+	canvas->clip.x2 = width-1;
+	canvas->clip.y2 = height-1;
+	return canvas;
 }
 
-//==========================================
-int TFT_getfontsize(int *width, int* height)
+//====================================================================================================================================
+tft_canvas_t *TFT_ctx_canvas_create_indexed(tft_ctx_t *ctx, int width, int height, uint8_t depth, const color_t *palette, int ncolors)
 {
-  if (cfont.bitmap == 1) {
-    if (cfont.x_size != 0) *width = cfont.x_size;	// fixed width font
-    else *width = cfont.max_x_size;					// proportional font
-    *height = cfont.y_size;
-  }
-  else if (cfont.bitmap == 2) {
-	// 7-segment font
-    *width = _7seg_width();
-    *height = _7seg_height();
-  }
-  else {
-    *width = 0;
-    *height = 0;
-    return 0;
-  }
-  return 1;
+	if ((width <= 0) || (height <= 0)) return NULL;
+	if ((depth != 1) && (depth != 2) && (depth != 4) && (depth != 8)) return NULL;
+	if ((palette == NULL) || (ncolors <= 0) || (ncolors > (1 << depth))) return NULL;
+
+	tft_canvas_t *canvas = calloc(1, sizeof(tft_canvas_t));
+	if (canvas == NULL) return NULL;
+
+	// all 2^depth entries exist, so any index can be expanded
+	canvas->palette = calloc(1 << depth, sizeof(color_t));
+	uint32_t size = disp_indexed_row_bytes(width, depth) * height;
+	canvas->buf = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+	if (canvas->buf == NULL) canvas->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	if ((canvas->buf == NULL) || (canvas->palette == NULL)) {
+		TFT_ctx_canvas_delete(ctx, canvas);
+		return NULL;
+	}
+	memset(canvas->buf, 0, size);
+	memcpy(canvas->palette, palette, ncolors * sizeof(color_t));
+	canvas->width = width;
+	canvas->height = height;
+	canvas->color_bits = COLOR_BITS;
+	canvas->depth = depth;
+	canvas->ncolors = ncolors;
+	canvas->clip.x1 = 0;
+	canvas->clip.y1 = 0;
+	canvas->clip.x2 = width-1;
+	canvas->clip.y2 = height-1;
+	return canvas;
 }
 
-//=====================
-int TFT_getfontheight()
+//==============================================================
+void TFT_ctx_canvas_delete(tft_ctx_t *ctx, tft_canvas_t *canvas)
 {
-  if (cfont.bitmap == 1) return cfont.y_size;			// Bitmap font
-  else if (cfont.bitmap == 2) return _7seg_height();	// 7-segment font
-  return 0;
+	if (canvas == NULL) return;
+	// the canvas may still be sent
+	disp_drv_queue_flush(&ctx->drv);
+	if (canvas->buf) free(canvas->buf);
+	if (canvas->palette) free(canvas->palette);
+	free(canvas);
 }
 
-//====================
-void TFT_saveClipWin()
+//============================================================
+int TFT_ctx_canvas_begin(tft_ctx_t *ctx, tft_canvas_t *canvas)
 {
-	dispWinTemp.x1 = dispWin.x1;
-	dispWinTemp.y1 = dispWin.y1;
-	dispWinTemp.x2 = dispWin.x2;
-	dispWinTemp.y2 = dispWin.y2;
+	esp_err_t res;
+
+	if (canvas == NULL) return ESP_ERR_INVALID_ARG;
+	if ((canvas->depth == 0) && (canvas->color_bits != COLOR_BITS)) return ESP_ERR_INVALID_STATE;
+
+	_pixel_batch_flush(ctx);
+	if (canvas->depth) res = disp_drv_tile_begin_indexed(&ctx->drv, canvas->buf, 0, 0, canvas->width, canvas->height,
+			canvas->depth, canvas->palette, canvas->ncolors);
+	else res = disp_drv_tile_begin(&ctx->drv, canvas->buf, 0, 0, canvas->width, canvas->height);
+	if (res != ESP_OK) return ESP_ERR_INVALID_STATE;
+	canvas->saved_win = dispWin;
+	dispWin = canvas->clip;
+	return ESP_OK;
 }
 
-//=======================
-void TFT_restoreClipWin()
+//===========================================================
+void TFT_ctx_canvas_end(tft_ctx_t *ctx, tft_canvas_t *canvas)
 {
-	dispWin.x1 = dispWinTemp.x1;
+	if (canvas == NULL) return;
+
+	_pixel_batch_flush(ctx);
+	disp_drv_tile_end(&ctx->drv);
+	canvas->clip = dispWin;
+	dispWin = canvas->saved_win;
+}
+
+// Send the indexed canvas area (sx,sy),(sx+w-1,sy+h-1) to the display at (x,y)
+// Bands of rows are expanded through the palette into 2 DMA line buffers,
+// the next band is expanded while the previous one is sent from the transaction queue
+//---------------------------------------------------------------------------------------------------------------
+static int _canvas_push_indexed(tft_ctx_t *ctx, tft_canvas_t *canvas, int x, int y, int sx, int sy, int w, int h)
+{
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint32_t row_bytes = disp_indexed_row_bytes(canvas->width, canvas->depth);
+	int rows = TFT_CANVAS_LINE_BUF / (w * bpp);
+	uint32_t fence[2] = {0, 0};
+	uint8_t *buf[2];
+	uint8_t *pal, *p;
+	int r, n, i, cur = 0;
+	esp_err_t ret = ESP_OK;
+
+	if (rows < 1) rows = 1;
+	if (rows > h) rows = h;
+	pal = malloc((1 << canvas->depth) * bpp);
+	buf[0] = disp_dma_alloc(rows * w * bpp);
+	buf[1] = disp_dma_alloc(rows * w * bpp);
+	if ((pal == NULL) || (buf[0] == NULL) || (buf[1] == NULL)) {
+		ret = ESP_ERR_NO_MEM;
+		goto exit;
+	}
+	// palette in display transfer format, gray scale is applied
+	disp_drv_pack_colors(&ctx->drv, pal, canvas->palette, 1 << canvas->depth);
+
+	for (r=0; r<h; r+=n) {
+		n = ((rows > (h-r)) ? (h-r) : rows);
+		if (fence[cur]) disp_drv_queue_wait(&ctx->drv, fence[cur]);
+		p = buf[cur];
+		for (i=0; i<n; i++) {
+			p += disp_drv_expand_indexed(&ctx->drv, p, canvas->buf + ((sy + r + i) * row_bytes), sx, w, canvas->depth, pal);
+		}
+		fence[cur] = disp_drv_queue_send(&ctx->drv, x, y+r, x+w-1, y+r+n-1, buf[cur], n * w * bpp);
+		if (fence[cur] == 0) {
+			ret = ESP_FAIL;
+			break;
+		}
+		cur ^= 1;
+	}
+	// the line buffers are used until sent
+	if (fence[0]) disp_drv_queue_wait(&ctx->drv, fence[0]);
+	if (fence[1]) disp_drv_queue_wait(&ctx->drv, fence[1]);
+
+exit:
+	if (buf[0]) disp_dma_free(buf[0]);
+	if (buf[1]) disp_dma_free(buf[1]);
+	if (pal) free(pal);
+	return ret;
+}
+
+//========================================================================
+int TFT_ctx_pushCanvas(tft_ctx_t *ctx, tft_canvas_t *canvas, int x, int y)
+{
+	int sx = 0, sy = 0, w, h;
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	esp_err_t ret;
+
+	if (canvas == NULL) return ESP_ERR_INVALID_ARG;
+	if ((canvas->depth == 0) && (canvas->color_bits != COLOR_BITS)) return ESP_ERR_INVALID_STATE;
+
+	// clip to the display window
+	x += dispWin.x1;
+	y += dispWin.y1;
+	w = canvas->width;
+	h = canvas->height;
+	if (x < dispWin.x1) {
+		sx = dispWin.x1 - x;
+		w -= sx;
+		x = dispWin.x1;
+	}
+	if (y < dispWin.y1) {
+		sy = dispWin.y1 - y;
+		h -= sy;
+		y = dispWin.y1;
+	}
+	if ((x + w - 1) > dispWin.x2) w = dispWin.x2 - x + 1;
+	if ((y + h - 1) > dispWin.y2) h = dispWin.y2 - y + 1;
+	if ((w <= 0) || (h <= 0)) return ESP_OK;
+
+	_pixel_batch_flush(ctx);
+	if (canvas->depth) return _canvas_push_indexed(ctx, canvas, x, y, sx, sy, w, h);
+	if (disp_drv_select(&ctx->drv) != ESP_OK) return ESP_FAIL;
+	ret = disp_drv_send_data_packed(&ctx->drv, x, y, w, h, canvas->buf + (((sy * canvas->width) + sx) * bpp), canvas->width);
+	disp_drv_deselect(&ctx->drv);
+
+	return ret;
+}
+
+// ==== Tile renderer ====
+
+// Mark the tiles overlapping the screen area (x1,y1),(x2,y2) dirty
+//-----------------------------------------------------------------------------
+static void _tiles_mark(tft_tiles_t *tiles, int x1, int y1, int x2, int y2)
+{
+	int c, r, t;
+
+	// relative to the tiled area
+	x1 -= tiles->x;
+	x2 -= tiles->x;
+	y1 -= tiles->y;
+	y2 -= tiles->y;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 >= tiles->w) x2 = tiles->w-1;
+	if (y2 >= tiles->h) y2 = tiles->h-1;
+	if ((x1 > x2) || (y1 > y2)) return;
+
+	for (r=(y1 / tiles->tile_h); r<=(y2 / tiles->tile_h); r++) {
+		for (c=(x1 / tiles->tile_w); c<=(x2 / tiles->tile_w); c++) {
+			t = (r * tiles->cols) + c;
+			tiles->dirty[t >> 5] |= (1u << (t & 31));
+		}
+	}
+}
+
+//==================================================================================================
+tft_tiles_t *TFT_ctx_tiles_create(tft_ctx_t *ctx, int tile_w, int tile_h, int max_calls, color_t bg)
+{
+	if ((tile_w <= 0) || (tile_h <= 0) || (max_calls <= 0)) return NULL;
+
+	tft_tiles_t *tiles = calloc(1, sizeof(tft_tiles_t));
+	if (tiles == NULL) return NULL;
+
+	tiles->x = dispWin.x1;
+	tiles->y = dispWin.y1;
+	tiles->w = dispWin.x2 - dispWin.x1 + 1;
+	tiles->h = dispWin.y2 - dispWin.y1 + 1;
+	tiles->tile_w = tile_w;
+	tiles->tile_h = tile_h;
+	tiles->cols = (tiles->w + tile_w - 1) / tile_w;
+	tiles->rows = (tiles->h + tile_h - 1) / tile_h;
+	tiles->bg = bg;
+	tiles->max_calls = max_calls;
+	tiles->dirty = calloc(((tiles->cols * tiles->rows) + 31) / 32, sizeof(uint32_t));
+	tiles->calls = calloc(max_calls, sizeof(tft_tile_call_t));
+	// 3 bytes per pixel, the color mode may change
+	tiles->buf[0] = heap_caps_malloc(tile_w * tile_h * 3, MALLOC_CAP_DMA);
+	tiles->buf[1] = heap_caps_malloc(tile_w * tile_h * 3, MALLOC_CAP_DMA);
+	if ((tiles->dirty == NULL) || (tiles->calls == NULL) || (tiles->buf[0] == NULL) || (tiles->buf[1] == NULL)) {
+		TFT_ctx_tiles_delete(ctx, tiles);
+		return NULL;
+	}
+	return tiles;
+}
+
+//===========================================================
+void TFT_ctx_tiles_delete(tft_ctx_t *ctx, tft_tiles_t *tiles)
+{
+	if (tiles == NULL) return;
+
+	// the tile buffers may still be sent
+	disp_drv_queue_flush(&ctx->drv);
+	if (tiles->buf[0]) free(tiles->buf[0]);
+	if (tiles->buf[1]) free(tiles->buf[1]);
+	if (tiles->calls) free(tiles->calls);
+	if (tiles->dirty) free(tiles->dirty);
+	free(tiles);
+}
+
+//==================================================================================================================
+int TFT_ctx_tiles_add(tft_ctx_t *ctx, tft_tiles_t *tiles, int x, int y, int w, int h, tft_draw_cb_t draw, void *arg)
+{
+	if ((tiles == NULL) || (draw == NULL) || (tiles->ncalls >= tiles->max_calls)) return -1;
+
+	tft_tile_call_t *call = &tiles->calls[tiles->ncalls];
+	call->x1 = x + dispWin.x1;
+	call->y1 = y + dispWin.y1;
+	call->x2 = call->x1 + w - 1;
+	call->y2 = call->y1 + h - 1;
+	call->draw = draw;
+	call->arg = arg;
+	_tiles_mark(tiles, call->x1, call->y1, call->x2, call->y2);
+
+	return tiles->ncalls++;
+}
+
+//===========================================================================================
+void TFT_ctx_tiles_invalidate(tft_ctx_t *ctx, tft_tiles_t *tiles, int x, int y, int w, int h)
+{
+	if (tiles == NULL) return;
+	_tiles_mark(tiles, x + dispWin.x1, y + dispWin.y1, x + dispWin.x1 + w - 1, y + dispWin.y1 + h - 1);
+}
+
+//======================================
+void TFT_tiles_reset(tft_tiles_t *tiles)
+{
+	if (tiles) tiles->ncalls = 0;
+}
+
+//==========================================================
+int TFT_ctx_tiles_render(tft_ctx_t *ctx, tft_tiles_t *tiles)
+{
+	int t, i, x, y, w, h, n = 0, cur = 0;
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	tft_tile_call_t *call;
+	tft_ctx_t *prev;
+
+	if (tiles == NULL) return ESP_ERR_INVALID_ARG;
+	if (disp_spi->cfg.selected) return ESP_ERR_INVALID_STATE;
+
+	for (t=0; t<(tiles->cols * tiles->rows); t++) {
+		if ((tiles->dirty[t >> 5] & (1u << (t & 31))) == 0) continue;
+
+		x = (t % tiles->cols) * tiles->tile_w;
+		y = (t / tiles->cols) * tiles->tile_h;
+		w = (((x + tiles->tile_w) > tiles->w) ? (tiles->w - x) : tiles->tile_w);
+		h = (((y + tiles->tile_h) > tiles->h) ? (tiles->h - y) : tiles->tile_h);
+		x += tiles->x;
+		y += tiles->y;
+
+		// The buffer is free when its previous transfer is finished
+		if (tiles->fence[cur]) disp_drv_queue_wait(&ctx->drv, tiles->fence[cur]);
+
+		// ** Render the tile, drawing is clipped to the tile
+		if (disp_drv_tile_begin(&ctx->drv, tiles->buf[cur], x, y, w, h) != ESP_OK) return ESP_ERR_INVALID_STATE;
+		disp_drv_pushColorRep(&ctx->drv, x, y, x+w-1, y+h-1, tiles->bg, (uint32_t)(w * h));
+		// the draw functions use the display context bound to the task
+		prev = TFT_ctx_bind(ctx);
+		for (i=0; i<tiles->ncalls; i++) {
+			call = &tiles->calls[i];
+			if ((call->x1 > (x+w-1)) || (call->x2 < x) || (call->y1 > (y+h-1)) || (call->y2 < y)) continue;
+			call->draw(call->arg);
+		}
+		TFT_ctx_bind(prev);
+		_pixel_batch_flush(ctx);
+		disp_drv_tile_end(&ctx->drv);
+
+		// ** Send the tile in background while the next one is rendered
+		tiles->fence[cur] = disp_drv_queue_send(&ctx->drv, x, y, x+w-1, y+h-1, tiles->buf[cur], w * h * bpp);
+		if (tiles->fence[cur] == 0) return ESP_FAIL;
+		tiles->dirty[t >> 5] &= ~(1u << (t & 31));
+		tiles->tiles_sent++;
+		cur ^= 1;
+		n++;
+	}
+	return n;
+}
+
+// ==== Render/flush pipeline ====
+
+// Frame passed to the flush task, canvas index 0xFF stops the task
+typedef struct {
+	uint8_t index;
+	dispWin_t area;				// area to send, relative to the frame
+} pipeline_frame_t;
+
+// Send the finished frames to the display, the canvas is released when sent
+// Runs on the other core than the rendering task;
+// the display context is used only while holding the pipeline lock
+//-----------------------------------------
+static void _pipeline_task(void *arg)
+{
+	tft_pipeline_t *pipeline = (tft_pipeline_t *)arg;
+	tft_ctx_t *ctx = pipeline->display;
+	pipeline_frame_t frame;
+	tft_canvas_t *canvas;
+	uint32_t t;
+
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+
+	while (1) {
+		if (xQueueReceive(pipeline->sendq, &frame, portMAX_DELAY) != pdTRUE) continue;
+		if (frame.index > 1) break;
+
+		canvas = pipeline->canvas[frame.index];
+		xSemaphoreTake(pipeline->lock, portMAX_DELAY);
+		t = clock();
+		if (disp_drv_select(&ctx->drv) == ESP_OK) {
+			disp_drv_send_data_packed(&ctx->drv, pipeline->x + frame.area.x1, pipeline->y + frame.area.y1,
+					frame.area.x2 - frame.area.x1 + 1, frame.area.y2 - frame.area.y1 + 1,
+					canvas->buf + (((frame.area.y1 * canvas->width) + frame.area.x1) * bpp), canvas->width);
+			// if the shadow framebuffer is enabled, the frame was written to it
+			disp_drv_fb_flush(&ctx->drv);
+			disp_drv_deselect(&ctx->drv);
+		}
+		pipeline->flush_time = clock() - t;
+		xSemaphoreGive(pipeline->lock);
+		pipeline->frames++;
+		// the canvas can be drawn again
+		xSemaphoreGive(pipeline->free);
+	}
+
+	xSemaphoreGive(pipeline->done);
+	vTaskDelete(NULL);
+}
+
+// Create the context drawing the frames, a copy of the display context without
+// the driver run-time state; it never accesses the display, only the back canvas
+//------------------------------------------------------------------
+static tft_ctx_t *_pipeline_render_ctx(tft_ctx_t *display)
+{
+	tft_ctx_t *ctx = TFT_ctx_create();
+	if (ctx == NULL) return NULL;
+
+	memcpy(ctx, display, sizeof(tft_ctx_t));
+	memset(&ctx->drv.fb, 0, sizeof(ctx->drv.fb));
+	memset(&ctx->drv.dq, 0, sizeof(ctx->drv.dq));
+	memset(&ctx->drv.sg, 0, sizeof(ctx->drv.sg));
+	ctx->drv.cline = NULL;
+	ctx->drv.dma_sending = 0;
+	ctx->pb.count = 0;
+	ctx->pb.depth = 0;
+	// the font loaded from file is owned by the display context
+	ctx->user_font = NULL;
+	disp_drv_addrwin_invalidate(&ctx->drv);
+	return ctx;
+}
+
+//---------------------------------------------------------
+static void _pipeline_free(tft_pipeline_t *pipeline)
+{
+	if (pipeline->canvas[0]) TFT_ctx_canvas_delete(pipeline->display, pipeline->canvas[0]);
+	if (pipeline->canvas[1]) TFT_ctx_canvas_delete(pipeline->display, pipeline->canvas[1]);
+	if (pipeline->render) TFT_ctx_delete(pipeline->render);
+	if (pipeline->sendq) vQueueDelete(pipeline->sendq);
+	if (pipeline->free) vSemaphoreDelete(pipeline->free);
+	if (pipeline->done) vSemaphoreDelete(pipeline->done);
+	if (pipeline->lock) vSemaphoreDelete(pipeline->lock);
+	free(pipeline);
+}
+
+//================================================================================================
+tft_pipeline_t *TFT_ctx_pipeline_create(tft_ctx_t *ctx, int x, int y, int w, int h, int core)
+{
+	if ((w <= 0) || (h <= 0)) return NULL;
+
+	tft_pipeline_t *pipeline = calloc(1, sizeof(tft_pipeline_t));
+	if (pipeline == NULL) return NULL;
+
+	_pixel_batch_flush(ctx);
+	pipeline->display = ctx;
+	pipeline->x = x;
+	pipeline->y = y;
+	pipeline->canvas[0] = TFT_ctx_canvas_create(ctx, w, h);
+	pipeline->canvas[1] = TFT_ctx_canvas_create(ctx, w, h);
+	pipeline->render = _pipeline_render_ctx(pipeline->display);
+	pipeline->sendq = xQueueCreate(2, sizeof(pipeline_frame_t));
+	pipeline->free = xSemaphoreCreateCounting(2, 2);
+	pipeline->done = xSemaphoreCreateBinary();
+	pipeline->lock = xSemaphoreCreateMutex();
+	if ((pipeline->canvas[0] == NULL) || (pipeline->canvas[1] == NULL) || (pipeline->render == NULL) ||
+			(pipeline->sendq == NULL) || (pipeline->free == NULL) || (pipeline->done == NULL) || (pipeline->lock == NULL)) {
+		_pipeline_free(pipeline);
+		return NULL;
+	}
+
+	if (xTaskCreatePinnedToCore(_pipeline_task, "tft_flush", TFT_PIPELINE_STACK, pipeline,
+			TFT_PIPELINE_PRIO, &pipeline->task, core) != pdPASS) {
+		_pipeline_free(pipeline);
+		return NULL;
+	}
+	return pipeline;
+}
+
+//==================================================
+void TFT_pipeline_delete(tft_pipeline_t *pipeline)
+{
+	pipeline_frame_t frame = { .index = 0xFF };
+
+	if (pipeline == NULL) return;
+
+	// the frames already queued are sent before the task exits
+	xQueueSend(pipeline->sendq, &frame, portMAX_DELAY);
+	xSemaphoreTake(pipeline->done, portMAX_DELAY);
+	_pipeline_free(pipeline);
+}
+
+//==============================================================
+int TFT_pipeline_begin(tft_pipeline_t *pipeline, uint8_t keep)
+{
+	tft_canvas_t *canvas, *last;
+	uint32_t t;
+
+	if (pipeline == NULL) return ESP_ERR_INVALID_ARG;
+
+	// Wait until the back canvas is sent
+	t = clock();
+	xSemaphoreTake(pipeline->free, portMAX_DELAY);
+	pipeline->wait_time += clock() - t;
+
+	canvas = pipeline->canvas[pipeline->back];
+	last = pipeline->canvas[pipeline->back ^ 1];
+	// the last frame may still be sent, it is only read
+	if (keep) memcpy(canvas->buf, last->buf, canvas->width * canvas->height * ((canvas->color_bits == 16) ? 2 : 3));
+	pipeline->kept = keep;
+
+	pipeline->saved_ctx = TFT_ctx_bind(pipeline->render);
+	if (TFT_ctx_canvas_begin(pipeline->render, canvas) != ESP_OK) {
+		TFT_ctx_bind(pipeline->saved_ctx);
+		xSemaphoreGive(pipeline->free);
+		return ESP_ERR_INVALID_STATE;
+	}
+	return ESP_OK;
+}
+
+//===========================================================================
+void TFT_pipeline_end(tft_pipeline_t *pipeline, const dispWin_t *dirty)
+{
+	pipeline_frame_t frame;
+	tft_canvas_t *canvas;
+
+	if (pipeline == NULL) return;
+
+	canvas = pipeline->canvas[pipeline->back];
+	TFT_ctx_canvas_end(pipeline->render, canvas);
+	TFT_ctx_bind(pipeline->saved_ctx);
+
+	frame.index = pipeline->back;
+	frame.area.x1 = 0;
+	frame.area.y1 = 0;
+	frame.area.x2 = canvas->width - 1;
+	frame.area.y2 = canvas->height - 1;
+	if ((dirty) && (pipeline->kept)) {
+		// only the changed area of the frame is sent
+		if (dirty->x1 > frame.area.x1) frame.area.x1 = dirty->x1;
+		if (dirty->y1 > frame.area.y1) frame.area.y1 = dirty->y1;
+		if (dirty->x2 < frame.area.x2) frame.area.x2 = dirty->x2;
+		if (dirty->y2 < frame.area.y2) frame.area.y2 = dirty->y2;
+	}
+
+	if ((frame.area.x1 > frame.area.x2) || (frame.area.y1 > frame.area.y2)) {
+		// Nothing to send, the next frame is drawn into the same back canvas;
+		// the other canvas may still be sent and is released by the flush task
+		xSemaphoreGive(pipeline->free);
+		return;
+	}
+
+	// ** Swap the canvases, the frame is sent by the flush task
+	xQueueSend(pipeline->sendq, &frame, portMAX_DELAY);
+	pipeline->back ^= 1;
+}
+
+//================================================
+void TFT_pipeline_sync(tft_pipeline_t *pipeline)
+{
+	if (pipeline == NULL) return;
+
+	// both canvases are free when all frames are sent
+	xSemaphoreTake(pipeline->free, portMAX_DELAY);
+	xSemaphoreTake(pipeline->free, portMAX_DELAY);
+	xSemaphoreGive(pipeline->free);
+	xSemaphoreGive(pipeline->free);
+}
+
+//================================================
+void TFT_pipeline_lock(tft_pipeline_t *pipeline)
+{
+	if (pipeline == NULL) return;
+	xSemaphoreTake(pipeline->lock, portMAX_DELAY);
+}
+
+//==================================================
+void TFT_pipeline_unlock(tft_pipeline_t *pipeline)
+{
+	if (pipeline == NULL) return;
+	// the display is released, the flush task selects it again
+	disp_drv_queue_flush(&pipeline->display->drv);
+	xSemaphoreGive(pipeline->lock);
+}
+
+// Select gamma curve
+// Input: gamma = 0~3
+//======================================================
+void TFT_ctx_setGammaCurve(tft_ctx_t *ctx, uint8_t gm) {
+  uint8_t gamma_curve = 1 << (gm & 0x03);
+  disp_drv_transfer_cmd_data(&ctx->drv, TFT_CMD_GAMMASET, &gamma_curve, 1);
+}
+
+//===========================================================
+color_t HSBtoRGB(float _hue, float _sat, float _brightness) {
+ float red = 0.0;
+ float green = 0.0;
+ float blue = 0.0;
+
+ if (_sat == 0.0) {
+   red = _brightness;
+   green = _brightness;
+   blue = _brightness;
+ } else {
+   if (_hue == 360.0) {
+     _hue = 0;
+   }
+
+   int slice = (int)(_hue / 60.0);
+   float hue_frac = (_hue / 60.0) - slice;
+
+   float aa = _brightness * (1.0 - _sat);
+   float bb = _brightness * (1.0 - _sat * hue_frac);
+   float cc = _brightness * (1.0 - _sat * (1.0 - hue_frac));
+
+   switch(slice) {
+     case 0:
+         red = _brightness;
+         green = cc;
+         blue = aa;
+         break;
+     case 1:
+         red = bb;
+         green = _brightness;
+         blue = aa;
+         break;
+     case 2:
+         red = aa;
+         green = _brightness;
+         blue = cc;
+         break;
+     case 3:
+         red = aa;
+         green = bb;
+         blue = _brightness;
+         break;
+     case 4:
+         red = cc;
+         green = aa;
+         blue = _brightness;
+         break;
+     case 5:
+         red = _brightness;
+         green = aa;
+         blue = bb;
+         break;
+     default:
+         red = 0.0;
+         green = 0.0;
+         blue = 0.0;
+         break;
+   }
+ }
+
+ color_t color;
+ color.r = ((uint8_t)(red * 255.0)) & 0xFC;
+ color.g = ((uint8_t)(green * 255.0)) & 0xFC;
+ color.b = ((uint8_t)(blue * 255.0)) & 0xFC;
+
+ return color;
+}
+//=========================================================================================
+void TFT_ctx_setclipwin(tft_ctx_t *ctx, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	dispWin.x1 = x1;
+	dispWin.y1 = y1;
+	dispWin.x2 = x2;
+	dispWin.y2 = y2;
+
+	if (dispWin.x2 >= _width) dispWin.x2 = _width-1;
+	if (dispWin.y2 >= _height) dispWin.y2 = _height-1;
+	if (dispWin.x1 > dispWin.x2) dispWin.x1 = dispWin.x2;
+	if (dispWin.y1 > dispWin.y2) dispWin.y1 = dispWin.y2;
+}
+
+//=======================================
+void TFT_ctx_resetclipwin(tft_ctx_t *ctx)
+{
+	dispWin.x2 = _width-1;
+	dispWin.y2 = _height-1;
+	dispWin.x1 = 0;
+	dispWin.y1 = 0;
+}
+
+//==================================================================================================
+void TFT_ctx_set_7seg_font_atrib(tft_ctx_t *ctx, uint8_t l, uint8_t w, int outline, color_t color) {
+	if (cfont.bitmap != 2) return;
+
+	if (l < 6) l = 6;
+    if (l > 40) l = 40;
+    if (w < 1) w = 1;
+    if (w > (l/2)) w = l/2;
+    if (w > 12) w = 12;
+
+    cfont.x_size = l;
+	cfont.y_size = w;
+	cfont.offset = outline;
+	cfont.color  = color;
+}
+
+//==============================================================
+int TFT_ctx_getfontsize(tft_ctx_t *ctx, int *width, int* height)
+{
+  if (cfont.bitmap == 1) {
+    if (cfont.x_size != 0) *width = cfont.x_size;	// fixed width font
+    else *width = cfont.max_x_size;					// proportional font
+    *height = cfont.y_size;
+  }
+  else if (cfont.bitmap == 2) {
+	// 7-segment font
+    *width = _7seg_width(ctx);
+    *height = _7seg_height(ctx);
+  }
+  else {
+    *width = 0;
+    *height = 0;
+    return 0;
+  }
+  return 1;
+}
+
+//=======================================
+int TFT_ctx_getfontheight(tft_ctx_t *ctx)
+{
+  if (cfont.bitmap == 1) return cfont.y_size;			// Bitmap font
+  else if (cfont.bitmap == 2) return _7seg_height(ctx);	// 7-segment font
+  return 0;
+}
+
+//======================================
+void TFT_ctx_saveClipWin(tft_ctx_t *ctx)
+{
+	dispWinTemp.x1 = dispWin.x1;
+	dispWinTemp.y1 = dispWin.y1;
+	dispWinTemp.x2 = dispWin.x2;
+	dispWinTemp.y2 = dispWin.y2;
+}
+
+//=========================================
+void TFT_ctx_restoreClipWin(tft_ctx_t *ctx)
+{
+	dispWin.x1 = dispWinTemp.x1;
 	dispWin.y1 = dispWinTemp.y1;
 	dispWin.x2 = dispWinTemp.x2;
 	dispWin.y2 = dispWinTemp.y2;
@@ -2244,6 +3152,7 @@ void TFT_restoreClipWin()
 // ================ JPG SUPPORT ================================================
 // User defined device identifier
 typedef struct {
+	tft_ctx_t	*ctx;			// display context the image is drawn on
 	FILE		*fhndl;			// File handler for input function
     int			x;				// image top left point X position
     int			y;				// image top left point Y position
@@ -2313,6 +3222,7 @@ static UINT tjd_output (
 {
 	// Device identifier for the session (5th argument of jd_prepare function)
 	JPGIODEV *dev = (JPGIODEV*)jd->device;
+	tft_ctx_t *ctx = dev->ctx;
 
 	// ** Put the rectangular into the display device **
 	int x;
@@ -2357,12 +3267,14 @@ static UINT tjd_output (
 				else src += 3; // skip
 			}
 		}
-		wait_trans_finish(1);
-		send_data(dleft, dtop, dright, dbottom, len, dev->linbuf[dev->linbuf_idx]);
+		// let higher priority spi devices use the bus between the blocks
+		disp_drv_bus_yield(&ctx->drv);
+		disp_drv_wait_trans_finish(&ctx->drv, 1);
+		disp_drv_send_data(&ctx->drv, dleft, dtop, dright, dbottom, len, dev->linbuf[dev->linbuf_idx]);
 		dev->linbuf_idx = ((dev->linbuf_idx + 1) & 1);
 	}
 	else {
-		wait_trans_finish(1);
+		disp_drv_wait_trans_finish(&ctx->drv, 1);
 		printf("Data size error: %d jpg: (%d,%d,%d,%d) disp: (%d,%d,%d,%d)\r\n", len, left,top,right,bottom, dleft,dtop,dright,dbottom);
 		return 0;  // stop decompression
 	}
@@ -2372,8 +3284,8 @@ static UINT tjd_output (
 
 // tft.jpgimage(X, Y, scale, file_name, buf, size]
 // X & Y can be < 0 !
-//==================================================================================
-void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int size)
+//======================================================================================================
+void TFT_ctx_jpg_image(tft_ctx_t *ctx, int x, int y, uint8_t scale, char *fname, uint8_t *buf, int size)
 {
 	JPGIODEV dev;
     struct stat sb;
@@ -2382,6 +3294,7 @@ void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int s
 	JDEC jd;				// Decompression object (70 bytes)
 	JRESULT rc;
 
+	dev.ctx = ctx;
 	dev.linbuf[0] = NULL;
 	dev.linbuf[1] = NULL;
     dev.linbuf_idx = 0;
@@ -2432,21 +3345,21 @@ void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int s
 			dev.x = x;
 			dev.y = y;
 
-			dev.linbuf[0] = heap_caps_malloc(JPG_IMAGE_LINE_BUF_SIZE*3, MALLOC_CAP_DMA);
+			dev.linbuf[0] = disp_dma_alloc(JPG_IMAGE_LINE_BUF_SIZE*3);
 			if (dev.linbuf[0] == NULL) {
 				if (image_debug) printf("Error allocating line buffer #0\r\n");
 				goto exit;
 			}
-			dev.linbuf[1] = heap_caps_malloc(JPG_IMAGE_LINE_BUF_SIZE*3, MALLOC_CAP_DMA);
+			dev.linbuf[1] = disp_dma_alloc(JPG_IMAGE_LINE_BUF_SIZE*3);
 			if (dev.linbuf[1] == NULL) {
 				if (image_debug) printf("Error allocating line buffer #1\r\n");
 				goto exit;
 			}
 
 			// Start to decode the JPEG file
-			disp_select();
+			disp_drv_select(&ctx->drv);
 			rc = jd_decomp(&jd, tjd_output, scale);
-			disp_deselect();
+			disp_drv_deselect(&ctx->drv);
 
 			if (rc != JDR_OK) {
 				if (image_debug) printf("jpg decompression error %d\r\n", rc);
@@ -2463,14 +3376,14 @@ void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int s
 
 exit:
 	if (work) free(work);  // free work buffer
-	if (dev.linbuf[0]) free(dev.linbuf[0]);
-	if (dev.linbuf[1]) free(dev.linbuf[1]);
+	if (dev.linbuf[0]) disp_dma_free(dev.linbuf[0]);
+	if (dev.linbuf[1]) disp_dma_free(dev.linbuf[1]);
     if (dev.fhndl) fclose(dev.fhndl);  // close input file
 }
 
 
-//====================================================================================
-int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int size)
+//========================================================================================================
+int TFT_ctx_bmp_image(tft_ctx_t *ctx, int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int size)
 {
 	FILE *fhndl = NULL;
 	struct stat sb;
@@ -2600,14 +3513,14 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 	}
 
 	// ** Allocate memory for 2 lines of image pixels
-	line_buf[0] = heap_caps_malloc(img_xsize*3, MALLOC_CAP_DMA);
+	line_buf[0] = disp_dma_alloc(img_xsize*3);
 	if (line_buf[0] == NULL) {
 	    sprintf(err_buf, "allocating line buffer #1");
 		err=-12;
 		goto exit;
 	}
 
-	line_buf[1] = heap_caps_malloc(img_xsize*3, MALLOC_CAP_DMA);
+	line_buf[1] = disp_dma_alloc(img_xsize*3);
 	if (line_buf[1] == NULL) {
 	    sprintf(err_buf, "allocating line buffer #2");
 		err=-13;
@@ -2656,7 +3569,7 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 			img_xsize, img_ysize, scale_pix, img_xlen, img_ylen, img_xstart, img_ystart, disp_xstart, disp_ystart, img_xsize*3, ((scale) ? (rd_len*scale_pix) : 0));
 
 	// * Select the display
-	disp_select();
+	disp_drv_select(&ctx->drv);
 
 	while ((disp_yend >= disp_ystart) && ((img_pos + (img_xsize*3)) <= size)) {
 		if (img_pos > size) {
@@ -2729,33 +3642,193 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 			}
 		}
 
-		wait_trans_finish(1);
-		send_data(disp_xstart, disp_yend, disp_xend, disp_yend, img_xlen, (color_t *)line_buf[lb_idx]);
+		disp_drv_wait_trans_finish(&ctx->drv, 1);
+		// let higher priority spi devices use the bus between the lines
+		disp_drv_bus_yield(&ctx->drv);
+		disp_drv_send_data(&ctx->drv, disp_xstart, disp_yend, disp_xend, disp_yend, img_xlen, (color_t *)line_buf[lb_idx]);
 		lb_idx = (lb_idx + 1) & 1;  // change buffer
 
 		disp_yend--;
 	}
 	err = 0;
 exit1:
-	disp_deselect();
+	disp_drv_deselect(&ctx->drv);
 exit:
 	if (scale_buf) free(scale_buf);
-	if (line_buf[0]) free(line_buf[0]);
-	if (line_buf[1]) free(line_buf[1]);
+	if (line_buf[0]) disp_dma_free(line_buf[0]);
+	if (line_buf[1]) disp_dma_free(line_buf[1]);
 	if (fhndl) fclose(fhndl);
 	if ((err) && (image_debug)) printf("Error: %d [%s]\r\n", err, err_buf);
 
 	return err;
 }
 
+// ============= Region capture ================================================
 
-// ============= Touch panel functions =========================================
-
-#if USE_TOUCH == TOUCH_TYPE_XPT2046
-//-------------------------------------------------------
-static int tp_get_data_xpt2046(uint8_t type, int samples)
+typedef struct {
+	FILE *fhndl;		// output file handle, NULL if writing to memory
+	uint8_t *buf;		// output memory buffer
+	uint32_t pos;		// current write position
+	int err;
+} capture_out_t;
+
+//---------------------------------------------------------------------------
+static void _capture_write(capture_out_t *out, const uint8_t *data, uint32_t len)
 {
-	if (ts_spi == NULL) return 0;
+	if (out->err) return;
+	if (out->fhndl) {
+		if (fwrite(data, 1, len, out->fhndl) != len) out->err = -6;
+	}
+	else memcpy(out->buf + out->pos, data, len);
+	out->pos += len;
+}
+
+// Write the band of 'nrows' rows read from the display
+// For BMP rows are written bottom-up, converted to BGR and padded to 4 bytes
+//---------------------------------------------------------------------------------------------------------
+static void _capture_band(capture_out_t *out, uint8_t *band, int nrows, int row_bytes, uint8_t format)
+{
+	uint8_t tmpc;
+	uint8_t pad[4] = {0,0,0,0};
+	int row_pad = ((row_bytes + 3) & ~3) - row_bytes;
+
+	if (format != TFT_CAPTURE_BMP) {
+		_capture_write(out, band, nrows * row_bytes);
+		return;
+	}
+	for (int row = nrows-1; row >= 0; row--) {
+		uint8_t *line = band + (row * row_bytes);
+		// Convert colors RGB-888 (DISPLAY) -> BGR-888 (BMP)
+		for (int i=0; i < row_bytes; i += 3) {
+			tmpc = line[i];
+			line[i] = line[i+2];
+			line[i+2] = tmpc;
+		}
+		_capture_write(out, line, row_bytes);
+		if (row_pad) _capture_write(out, pad, row_pad);
+	}
+}
+
+//================================================================================================================================
+int TFT_ctx_captureRegion(tft_ctx_t *ctx, int x, int y, int w, int h, uint8_t format, char *fname, uint8_t *buf, uint32_t bufsize)
+{
+	capture_out_t out = {NULL, buf, 0, 0};
+	uint8_t *band_buf[2] = {NULL, NULL};
+	uint8_t hdr[54];
+	uint32_t temp;
+	uint16_t wtemp;
+	int band_idx = 0, prev_rows = 0;
+
+	// ** Clip the region to the screen
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if ((x + w) > _width) w = _width - x;
+	if ((y + h) > _height) h = _height - y;
+	if ((w <= 0) || (h <= 0)) return -1;
+
+	int row_bytes = w * 3;
+	int hdr_size = (format == TFT_CAPTURE_BMP) ? 54 : 0;
+	int row_size = (format == TFT_CAPTURE_BMP) ? ((row_bytes + 3) & ~3) : row_bytes;
+	uint32_t total = hdr_size + (row_size * h);
+
+	if (fname == NULL) {
+		if (buf == NULL) return total;
+		if (bufsize < total) return -2;
+	}
+
+	// ** Allocate 2 band buffers, each holding at least one row
+	int band_rows = TFT_CAPTURE_BUF_SIZE / row_bytes;
+	if (band_rows < 1) band_rows = 1;
+	if (band_rows > h) band_rows = h;
+	// the display wraps inside the read window, round the read size up for DMA
+	int band_size = ((band_rows * row_bytes) + 3) & ~3;
+	band_buf[0] = disp_dma_alloc(band_size);
+	band_buf[1] = disp_dma_alloc(band_size);
+	if ((band_buf[0] == NULL) || (band_buf[1] == NULL)) {
+		out.err = -3;
+		goto exit;
+	}
+
+	if (fname) {
+		out.fhndl = fopen(fname, "wb");
+		if (!out.fhndl) {
+			out.err = -4;
+			goto exit;
+		}
+	}
+
+	if (format == TFT_CAPTURE_BMP) {
+		// ** Create BMP header
+		memset(hdr, 0, sizeof(hdr));
+		hdr[0] = 'B'; hdr[1] = 'M';
+		memcpy(hdr+2, &total, 4);				// file size
+		temp = 54;
+		memcpy(hdr+10, &temp, 4);				// start of pixel data
+		temp = 40;
+		memcpy(hdr+14, &temp, 4);				// BMP header size
+		memcpy(hdr+18, &w, 4);					// the bitmap width in pixels
+		memcpy(hdr+22, &h, 4);					// the bitmap height in pixels, rows bottom-up
+		wtemp = 1;
+		memcpy(hdr+26, &wtemp, 2);				// the number of color planes
+		wtemp = 24;
+		memcpy(hdr+28, &wtemp, 2);				// the number of bits per pixel
+		temp = row_size * h;
+		memcpy(hdr+34, &temp, 4);				// image size
+		temp = 2835;
+		memcpy(hdr+38, &temp, 4);				// horizontal resolution, 72 DPI
+		memcpy(hdr+42, &temp, 4);				// vertical resolution
+		_capture_write(&out, hdr, 54);
+	}
+
+	// ** Read the region in bands, BMP from the bottom band up
+	// The next band is read in background while the previous one is written
+	for (int done = 0; done < h; done += prev_rows) {
+		int nrows = ((h - done) > band_rows) ? band_rows : (h - done);
+		int by1 = (format == TFT_CAPTURE_BMP) ? (y + h - done - nrows) : (y + done);
+
+		// When scrolled, the band must be stored in consecutive GRAM lines
+		if (format == TFT_CAPTURE_BMP) {
+			while (disp_drv_scroll_rows(&ctx->drv, by1, by1+nrows-1) < nrows) {
+				by1++;
+				nrows--;
+			}
+		}
+		else nrows = disp_drv_scroll_rows(&ctx->drv, by1, by1+nrows-1);
+
+		if (disp_drv_read_begin(&ctx->drv, x, by1, x+w-1, by1+nrows-1) != ESP_OK) {
+			disp_drv_read_end(&ctx->drv);
+			out.err = -5;
+			goto exit;
+		}
+		disp_drv_read_next(&ctx->drv, band_buf[band_idx], ((nrows * row_bytes) + 3) & ~3, 0);
+
+		if (prev_rows) _capture_band(&out, band_buf[band_idx ^ 1], prev_rows, row_bytes, format);
+
+		disp_drv_read_wait(&ctx->drv);
+		disp_drv_read_end(&ctx->drv);
+
+		prev_rows = nrows;
+		band_idx ^= 1;
+	}
+	if (prev_rows) _capture_band(&out, band_buf[band_idx ^ 1], prev_rows, row_bytes, format);
+
+exit:
+	if (band_buf[0]) disp_dma_free(band_buf[0]);
+	if (band_buf[1]) disp_dma_free(band_buf[1]);
+	if (out.fhndl) fclose(out.fhndl);
+
+	if (out.err) return out.err;
+	return out.pos;
+}
+
+
+// ============= Touch panel functions =========================================
+
+#if USE_TOUCH == TOUCH_TYPE_XPT2046
+//-------------------------------------------------------
+static int tp_get_data_xpt2046(uint8_t type, int samples)
+{
+	if (ts_spi == NULL) return 0;
 
 	int n, result, val = 0;
 	uint32_t i = 0;
@@ -2839,8 +3912,8 @@ exit:
 }
 #endif
 
-//=============================================
-int TFT_read_touch(int *x, int* y, uint8_t raw)
+//=================================================================
+int TFT_ctx_read_touch(tft_ctx_t *ctx, int *x, int* y, uint8_t raw)
 {
     *x = 0;
     *y = 0;
@@ -2851,14 +3924,13 @@ int TFT_read_touch(int *x, int* y, uint8_t raw)
 	int result = -1;
     int X=0, Y=0;
 
+    // Finish queued display transactions, the touch controller shares the spi bus
+    disp_drv_queue_flush(&ctx->drv);
+
     #if USE_TOUCH == TOUCH_TYPE_XPT2046
-    uint32_t tp_calx = TP_CALX_XPT2046;
-    uint32_t tp_caly = TP_CALY_XPT2046;
    	result = TFT_read_touch_xpt2046(&X, &Y);
    	if (result == 0) return 0;
     #elif USE_TOUCH == TOUCH_TYPE_STMPE610
-    uint32_t tp_calx = TP_CALX_STMPE610;
-    uint32_t tp_caly = TP_CALY_STMPE610;
     uint16_t Xx, Yy, Z=0;
     result = stmpe610_get_touch(&Xx, &Yy, &Z);
     if (result == 0) return 0;
@@ -2948,3 +4020,432 @@ int TFT_read_touch(int *x, int* y, uint8_t raw)
     #endif
 }
 
+// Fill the profile from the current display settings
+//--------------------------------------------------------------
+static void _profile_get(tft_ctx_t *ctx, tft_profile_t *profile)
+{
+	memset(profile, 0, sizeof(tft_profile_t));
+	profile->magic = TFT_PROFILE_MAGIC;
+	profile->panel_id = disp_drv_read_id(&ctx->drv);
+	profile->type = tft_disp_type;
+	profile->color_bits = COLOR_BITS;
+	profile->width = ((_width < _height) ? _width : _height);
+	profile->rd_clock = max_rdclock;
+	profile->tp_calx = tp_calx;
+	profile->tp_caly = tp_caly;
+	profile->crc = crc32_le(0, (uint8_t *)profile, offsetof(tft_profile_t, crc));
+}
+
+//===================================================
+int TFT_ctx_profile_save(tft_ctx_t *ctx, char *fname)
+{
+	tft_profile_t profile;
+	int res = ESP_FAIL;
+
+	_profile_get(ctx, &profile);
+
+	FILE *fhndl = fopen(fname, "wb");
+	if (fhndl == NULL) return ESP_FAIL;
+	if (fwrite(&profile, 1, sizeof(tft_profile_t), fhndl) == sizeof(tft_profile_t)) res = ESP_OK;
+	if (fclose(fhndl) != 0) res = ESP_FAIL;
+	if (res != ESP_OK) remove(fname);
+
+	return res;
+}
+
+//===================================================================
+int TFT_ctx_profile_load(tft_ctx_t *ctx, char *fname, uint8_t verify)
+{
+	tft_profile_t profile;
+	uint32_t rd_clock = max_rdclock;
+	uint32_t wr_clock;
+	size_t size;
+
+	FILE *fhndl = fopen(fname, "rb");
+	if (fhndl == NULL) return ESP_ERR_NOT_FOUND;
+	size = fread(&profile, 1, sizeof(tft_profile_t), fhndl);
+	fclose(fhndl);
+	if (size != sizeof(tft_profile_t)) return ESP_ERR_NOT_FOUND;
+
+	if ((profile.magic != TFT_PROFILE_MAGIC) ||
+			(profile.crc != crc32_le(0, (uint8_t *)&profile, offsetof(tft_profile_t, crc)))) return ESP_ERR_INVALID_CRC;
+	if ((profile.type != tft_disp_type) || (profile.color_bits != COLOR_BITS) ||
+			(profile.width != ((_width < _height) ? _width : _height))) return ESP_ERR_INVALID_VERSION;
+	// the write clock is stored by find_wr_speed()
+	wr_clock = disp_drv_get_wr_speed(&ctx->drv);
+	if ((profile.rd_clock == 0) || (wr_clock == 0)) return ESP_ERR_INVALID_STATE;
+
+	if (verify) {
+		// The display ID is read at the safe read clock, the panel may have been replaced
+		if (disp_drv_read_id(&ctx->drv) != profile.panel_id) return ESP_ERR_INVALID_VERSION;
+		max_rdclock = profile.rd_clock;
+		if (disp_drv_check_wr_speed(&ctx->drv, wr_clock) != ESP_OK) {
+			max_rdclock = rd_clock;
+			return ESP_FAIL;
+		}
+	}
+
+	max_rdclock = profile.rd_clock;
+	spi_lobo_set_speed(disp_spi, wr_clock);
+	tp_calx = profile.tp_calx;
+	tp_caly = profile.tp_caly;
+
+	return ESP_OK;
+}
+
+
+// ==== Functions on the display context bound to the calling task, or the default context ====
+
+//==================================================================
+void TFT_drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
+{
+	TFT_ctx_drawPixel(tft_ctx_current(), x, y, color, sel);
+}
+
+//=========================================
+color_t TFT_readPixel(int16_t x, int16_t y)
+{
+	return TFT_ctx_readPixel(tft_ctx_current(), x, y);
+}
+
+//====================================================================
+void TFT_drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color)
+{
+	TFT_ctx_drawFastVLine(tft_ctx_current(), x, y, h, color);
+}
+
+//====================================================================
+void TFT_drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color)
+{
+	TFT_ctx_drawFastHLine(tft_ctx_current(), x, y, w, color);
+}
+
+//==============================================================================
+void TFT_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
+{
+	TFT_ctx_drawLine(tft_ctx_current(), x0, y0, x1, y1, color);
+}
+
+//==========================================================================
+void TFT_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color)
+{
+	TFT_ctx_fillRect(tft_ctx_current(), x, y, w, h, color);
+}
+
+//================================
+void TFT_fillScreen(color_t color)
+{
+	TFT_ctx_fillScreen(tft_ctx_current(), color);
+}
+
+//================================
+void TFT_fillWindow(color_t color)
+{
+	TFT_ctx_fillWindow(tft_ctx_current(), color);
+}
+
+//=============================================================================
+void TFT_drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color)
+{
+	TFT_ctx_drawRect(tft_ctx_current(), x1, y1, w, h, color);
+}
+
+//=============================================================================================
+void TFT_drawRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
+{
+	TFT_ctx_drawRoundRect(tft_ctx_current(), x, y, w, h, r, color);
+}
+
+//=============================================================================================
+void TFT_fillRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color)
+{
+	TFT_ctx_fillRoundRect(tft_ctx_current(), x, y, w, h, r, color);
+}
+
+//===========================================================================================================
+void TFT_drawLineByAngle(uint16_t x, uint16_t y, uint16_t start, uint16_t len, uint16_t angle, color_t color)
+{
+	TFT_ctx_drawLineByAngle(tft_ctx_current(), x, y, start, len, angle, color);
+}
+
+//================================================================================================================
+void TFT_drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+{
+	TFT_ctx_drawTriangle(tft_ctx_current(), x0, y0, x1, y1, x2, y2, color);
+}
+
+//================================================================================================================
+void TFT_fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color)
+{
+	TFT_ctx_fillTriangle(tft_ctx_current(), x0, y0, x1, y1, x2, y2, color);
+}
+
+//==================================================================
+void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color)
+{
+	TFT_ctx_drawCircle(tft_ctx_current(), x, y, radius, color);
+}
+
+//==================================================================
+void TFT_fillCircle(int16_t x, int16_t y, int radius, color_t color)
+{
+	TFT_ctx_fillCircle(tft_ctx_current(), x, y, radius, color);
+}
+
+//=====================================================================================================
+void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
+{
+	TFT_ctx_drawEllipse(tft_ctx_current(), x0, y0, rx, ry, color, option);
+}
+
+//=====================================================================================================
+void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option)
+{
+	TFT_ctx_fillEllipse(tft_ctx_current(), x0, y0, rx, ry, color, option);
+}
+
+//===========================================================================================================================
+void TFT_drawArc(uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start, float end, color_t color, color_t fillcolor)
+{
+	TFT_ctx_drawArc(tft_ctx_current(), cx, cy, r, th, start, end, color, fillcolor);
+}
+
+//=============================================================================================================
+void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, color_t fill, int rot, uint8_t th)
+{
+	TFT_ctx_drawPolygon(tft_ctx_current(), cx, cy, sides, diameter, color, fill, rot, th);
+}
+
+//================================================
+int compile_font_file(char *fontfile, uint8_t dbg)
+{
+	return TFT_ctx_compile_font_file(tft_ctx_current(), fontfile, dbg);
+}
+
+//==================================
+void getFontCharacters(uint8_t *buf)
+{
+	TFT_ctx_getFontCharacters(tft_ctx_current(), buf);
+}
+
+//===================================================
+void TFT_setFont(uint8_t font, const char *font_file)
+{
+	TFT_ctx_setFont(tft_ctx_current(), font, font_file);
+}
+
+//===============================
+int TFT_getStringWidth(char* str)
+{
+	return TFT_ctx_getStringWidth(tft_ctx_current(), str);
+}
+
+//===============================================
+void TFT_clearStringRect(int x, int y, char *str)
+{
+	TFT_ctx_clearStringRect(tft_ctx_current(), x, y, str);
+}
+
+//====================================
+void TFT_print(char *st, int x, int y)
+{
+	TFT_ctx_print(tft_ctx_current(), st, x, y);
+}
+
+//===============================
+void TFT_setRotation(uint8_t rot)
+{
+	TFT_ctx_setRotation(tft_ctx_current(), rot);
+}
+
+//========================================
+void TFT_invertDisplay(const uint8_t mode)
+{
+	TFT_ctx_invertDisplay(tft_ctx_current(), mode);
+}
+
+//==========================================
+int TFT_setupScrollArea(int top, int bottom)
+{
+	return TFT_ctx_setupScrollArea(tft_ctx_current(), top, bottom);
+}
+
+//=======================
+int TFT_scrollTo(int pos)
+{
+	return TFT_ctx_scrollTo(tft_ctx_current(), pos);
+}
+
+//===================================================================
+int TFT_blit(int x, int y, int w, int h, color_t *buf, uint8_t xform)
+{
+	return TFT_ctx_blit(tft_ctx_current(), x, y, w, h, buf, xform);
+}
+
+//====================================
+int TFT_setFramebuffer(uint8_t enable)
+{
+	return TFT_ctx_setFramebuffer(tft_ctx_current(), enable);
+}
+
+//=============
+int TFT_flush()
+{
+	return TFT_ctx_flush(tft_ctx_current());
+}
+
+//====================================================
+tft_canvas_t *TFT_canvas_create(int width, int height)
+{
+	return TFT_ctx_canvas_create(tft_ctx_current(), width, height);
+}
+
+//================================================================================================================
+tft_canvas_t *TFT_canvas_create_indexed(int width, int height, uint8_t depth, const color_t *palette, int ncolors)
+{
+	return TFT_ctx_canvas_create_indexed(tft_ctx_current(), width, height, depth, palette, ncolors);
+}
+
+//==========================================
+void TFT_canvas_delete(tft_canvas_t *canvas)
+{
+	TFT_ctx_canvas_delete(tft_ctx_current(), canvas);
+}
+
+//========================================
+int TFT_canvas_begin(tft_canvas_t *canvas)
+{
+	return TFT_ctx_canvas_begin(tft_ctx_current(), canvas);
+}
+
+//=======================================
+void TFT_canvas_end(tft_canvas_t *canvas)
+{
+	TFT_ctx_canvas_end(tft_ctx_current(), canvas);
+}
+
+//====================================================
+int TFT_pushCanvas(tft_canvas_t *canvas, int x, int y)
+{
+	return TFT_ctx_pushCanvas(tft_ctx_current(), canvas, x, y);
+}
+
+//==============================================================================
+tft_tiles_t *TFT_tiles_create(int tile_w, int tile_h, int max_calls, color_t bg)
+{
+	return TFT_ctx_tiles_create(tft_ctx_current(), tile_w, tile_h, max_calls, bg);
+}
+
+//=======================================
+void TFT_tiles_delete(tft_tiles_t *tiles)
+{
+	TFT_ctx_tiles_delete(tft_ctx_current(), tiles);
+}
+
+//==============================================================================================
+int TFT_tiles_add(tft_tiles_t *tiles, int x, int y, int w, int h, tft_draw_cb_t draw, void *arg)
+{
+	return TFT_ctx_tiles_add(tft_ctx_current(), tiles, x, y, w, h, draw, arg);
+}
+
+//=======================================================================
+void TFT_tiles_invalidate(tft_tiles_t *tiles, int x, int y, int w, int h)
+{
+	TFT_ctx_tiles_invalidate(tft_ctx_current(), tiles, x, y, w, h);
+}
+
+//======================================
+int TFT_tiles_render(tft_tiles_t *tiles)
+{
+	return TFT_ctx_tiles_render(tft_ctx_current(), tiles);
+}
+
+//========================================================================
+tft_pipeline_t *TFT_pipeline_create(int x, int y, int w, int h, int core)
+{
+	return TFT_ctx_pipeline_create(tft_ctx_current(), x, y, w, h, core);
+}
+
+//================================
+void TFT_setGammaCurve(uint8_t gm)
+{
+	TFT_ctx_setGammaCurve(tft_ctx_current(), gm);
+}
+
+//=====================================================================
+void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	TFT_ctx_setclipwin(tft_ctx_current(), x1, y1, x2, y2);
+}
+
+//=====================
+void TFT_resetclipwin()
+{
+	TFT_ctx_resetclipwin(tft_ctx_current());
+}
+
+//========================================================================
+void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color)
+{
+	TFT_ctx_set_7seg_font_atrib(tft_ctx_current(), l, w, outline, color);
+}
+
+//==========================================
+int TFT_getfontsize(int *width, int* height)
+{
+	return TFT_ctx_getfontsize(tft_ctx_current(), width, height);
+}
+
+//=====================
+int TFT_getfontheight()
+{
+	return TFT_ctx_getfontheight(tft_ctx_current());
+}
+
+//====================
+void TFT_saveClipWin()
+{
+	TFT_ctx_saveClipWin(tft_ctx_current());
+}
+
+//=======================
+void TFT_restoreClipWin()
+{
+	TFT_ctx_restoreClipWin(tft_ctx_current());
+}
+
+//==================================================================================
+void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int size)
+{
+	TFT_ctx_jpg_image(tft_ctx_current(), x, y, scale, fname, buf, size);
+}
+
+//====================================================================================
+int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int size)
+{
+	return TFT_ctx_bmp_image(tft_ctx_current(), x, y, scale, fname, imgbuf, size);
+}
+
+//============================================================================================================
+int TFT_captureRegion(int x, int y, int w, int h, uint8_t format, char *fname, uint8_t *buf, uint32_t bufsize)
+{
+	return TFT_ctx_captureRegion(tft_ctx_current(), x, y, w, h, format, fname, buf, bufsize);
+}
+
+//=============================================
+int TFT_read_touch(int *x, int* y, uint8_t raw)
+{
+	return TFT_ctx_read_touch(tft_ctx_current(), x, y, raw);
+}
+
+//===============================
+int TFT_profile_save(char *fname)
+{
+	return TFT_ctx_profile_save(tft_ctx_current(), fname);
+}
+
+//===============================================
+int TFT_profile_load(char *fname, uint8_t verify)
+{
+	return TFT_ctx_profile_load(tft_ctx_current(), fname, verify);
+}
@@ -8,6 +8,9 @@
 #define _TFT_H_
 
 #include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "tftspi.h"
 
 typedef struct {
@@ -30,37 +33,219 @@ typedef struct {
 } Font;
 
 
+typedef struct {
+      uint8_t charCode;
+      int adjYOffset;
+      int width;
+      int height;
+      int xOffset;
+      int xDelta;
+      uint16_t dataPtr;
+} propFont;
+
+// ==== Pixel batch, coalescing of per-pixel drawing ====
+#define PIXEL_BATCH_SIZE 256
+
+typedef struct {
+	int16_t x;
+	int16_t y;
+	uint16_t seq;		// drawing order, the last drawn pixel wins
+	color_t color;
+} batch_pixel_t;
+
+typedef struct {
+	int16_t x1;
+	int16_t x2;
+	int16_t y;
+	color_t color;
+	uint8_t used;		// merged into the rectangle of the previous row run
+} batch_run_t;
+
+// ==== Display context ====================================================================
+// Holds all the state of one display. Each TFT_xxx function has a TFT_ctx_xxx variant
+// taking the display context as the first parameter; TFT_xxx uses the context bound
+// to the calling task (see TFT_ctx_bind()), or the default context.
+// Each display can be driven from its own task, concurrently with the others.
+struct tft_ctx {
+	disp_drv_t	drv;				// display driver state, must be the first member
+	uint8_t		orient;				// screen orientation
+	uint16_t	rotate;				// font rotation angle
+	uint8_t		transparent;		// if not 0 draw fonts transparent
+	uint8_t		force_fixed;		// if not zero force drawing proportional fonts with fixed width
+	uint8_t		buffered_char;
+	uint8_t		line_space;			// additional spacing between text lines
+	uint8_t		wrap;				// if not 0 wrap long text to the new line, else clip
+	color_t		fg;					// foreground color for fonts
+	color_t		bg;					// background for non transparent fonts
+	dispWin_t	win;				// display clip window
+	float		angle_offset;		// angle offset for arc, polygon and line by angle functions
+	Font		font;				// current font
+	int			text_x;				// position of the next character after TFT_print()
+	int			text_y;
+
+	// ** Used by the TFT functions only **
+	dispWin_t	win_temp;
+	uint8_t		*user_font;			// font loaded from file
+	int			font_offset;
+	propFont	font_char;
+	float		arc_angle_max;
+	struct {
+		batch_pixel_t pixels[PIXEL_BATCH_SIZE];
+		batch_run_t runs[PIXEL_BATCH_SIZE];
+		uint16_t count;
+		uint8_t depth;				// nesting level of _pixel_batch_begin()
+	} pb;
+};
+
 //==========================================================================================
 // ==== Global variables ===================================================================
+// ==== Fields of the current display context, see TFT_ctx_bind() ==========================
+// Each access looks up the context bound to the calling task; to access one display
+// explicitly use the fields of the display context, e.g. 'ctx->fg'
 //==========================================================================================
-extern uint8_t   orientation;		// current screen orientation
-extern uint16_t  font_rotate;   	// current font font_rotate angle (0~395)
-extern uint8_t   font_transparent;	// if not 0 draw fonts transparent
-extern uint8_t   font_forceFixed;   // if not zero force drawing proportional fonts with fixed width
-extern uint8_t   font_buffered_char;
-extern uint8_t   font_line_space;	// additional spacing between text lines; added to font height
-extern uint8_t   text_wrap;         // if not 0 wrap long text to the new line, else clip
-extern color_t   _fg;            	// current foreground color for fonts
-extern color_t   _bg;            	// current background for non transparent fonts
-extern dispWin_t dispWin;			// display clip window
-extern float	  _angleOffset;		// angle offset for arc, polygon and line by angle functions
-extern uint8_t	  image_debug;		// print debug messages during image decode if set to 1
-
-extern Font cfont;					// Current font structure
+#define tft_orientation			(tft_ctx_current()->orient)			// current screen orientation
+#define tft_font_rotate			(tft_ctx_current()->rotate)			// current font font_rotate angle (0~395)
+#define tft_font_transparent	(tft_ctx_current()->transparent)	// if not 0 draw fonts transparent
+#define tft_font_forceFixed		(tft_ctx_current()->force_fixed)	// if not zero force drawing proportional fonts with fixed width
+#define tft_font_buffered_char	(tft_ctx_current()->buffered_char)
+#define tft_font_line_space		(tft_ctx_current()->line_space)		// additional spacing between text lines; added to font height
+#define tft_text_wrap			(tft_ctx_current()->wrap)			// if not 0 wrap long text to the new line, else clip
+#define tft_fg					(tft_ctx_current()->fg)				// current foreground color for fonts
+#define tft_bg					(tft_ctx_current()->bg)				// current background for non transparent fonts
+#define tft_dispWin				(tft_ctx_current()->win)			// display clip window
+#define tft_angleOffset			(tft_ctx_current()->angle_offset)	// angle offset for arc, polygon and line by angle functions
+
+#define tft_cfont				(tft_ctx_current()->font)			// Current font structure
+
+#define tft_text_x				(tft_ctx_current()->text_x)			// X position of the next character after TFT_print() function
+#define tft_text_y				(tft_ctx_current()->text_y)			// Y position of the next character after TFT_print() function
+
+// ** The former global variable names are defined as aliases of the tft_* names only if
+//    TFT_LEGACY_NAMES is defined before including tft.h; they are macros, an application
+//    identifier with the same name (e.g. a local 'orientation' or 'dispWin') fails to compile.
+#ifdef TFT_LEGACY_NAMES
+#define orientation			tft_orientation
+#define font_rotate			tft_font_rotate
+#define font_transparent	tft_font_transparent
+#define font_forceFixed		tft_font_forceFixed
+#define font_buffered_char	tft_font_buffered_char
+#define font_line_space		tft_font_line_space
+#define text_wrap			tft_text_wrap
+#define _fg					tft_fg
+#define _bg					tft_bg
+#define dispWin				tft_dispWin
+#define _angleOffset		tft_angleOffset
+#define cfont				tft_cfont
+#define TFT_X				tft_text_x
+#define TFT_Y				tft_text_y
+#endif
 
-extern int	TFT_X;					// X position of the next character after TFT_print() function
-extern int	TFT_Y;					// Y position of the next character after TFT_print() function
+extern uint8_t	  image_debug;		// print debug messages during image decode if set to 1
 
 extern uint32_t tp_calx;			// touch screen X calibration constant
 extern uint32_t tp_caly;			// touch screen Y calibration constant
 // =========================================================================================
 
+// Call TFT function(s) on display context 'ctx' from any task
+// e.g.: TFT_CTX(ctx2, TFT_fillScreen(TFT_BLUE));
+#define TFT_CTX(ctx, call) do { tft_ctx_t *_tft_prev_ctx = TFT_ctx_bind(ctx); call; TFT_ctx_bind(_tft_prev_ctx); } while (0)
+
 
 // Buffer is created during jpeg decode for sending data
 // Total size of the buffer is  2 * (JPG_IMAGE_LINE_BUF_SIZE * 3)
 // The size must be multiple of 256 bytes !!
 #define JPG_IMAGE_LINE_BUF_SIZE 512
 
+// Image formats used by TFT_captureRegion
+#define TFT_CAPTURE_RAW 0
+#define TFT_CAPTURE_BMP 1
+
+// Size of each of the 2 band buffers used by TFT_captureRegion
+#define TFT_CAPTURE_BUF_SIZE 3072
+
+// Display profile stored by TFT_profile_save, loaded on boot by TFT_profile_load
+// The write clock is not part of the profile, it is stored in NVS by find_wr_speed()
+#define TFT_PROFILE_MAGIC	0x54465032		// 'TFP2'
+
+typedef struct {
+	uint32_t magic;			// TFT_PROFILE_MAGIC
+	uint32_t panel_id;		// display ID read with disp_read_id()
+	uint8_t  type;			// display type
+	uint8_t  color_bits;
+	uint16_t width;			// smaller display dimension
+	uint32_t rd_clock;		// measured maximum read spi clock
+	uint32_t tp_calx;		// touch screen calibration constants
+	uint32_t tp_caly;
+	uint32_t crc;			// crc32 of the previous fields
+} tft_profile_t;
+
+// ==== Off-screen canvas, see TFT_canvas_create() ====
+typedef struct {
+	int width, height;			// canvas size in pixels
+	uint8_t *buf;				// pixels in display transfer format or palette indices
+	uint8_t color_bits;			// display color mode the canvas was created for
+	uint8_t depth;				// bits per pixel of the indexed canvas, 0 if not indexed
+	color_t *palette;			// 2^depth colors of the indexed canvas, may be changed between frames
+	int ncolors;				// number of palette colors used for drawing
+	dispWin_t clip;				// canvas clip window, display window while drawing to the canvas
+	dispWin_t saved_win;		// display window replaced by TFT_canvas_begin()
+} tft_canvas_t;
+
+// Size in bytes of the DMA line buffers used to send the indexed canvas
+#define TFT_CANVAS_LINE_BUF	3072
+
+// ==== Tile renderer, see TFT_tiles_create() ====
+
+// Default tile size in pixels
+#define TFT_TILE_SIZE		32
+
+// Draw function recorded by TFT_tiles_add(), called for each dirty tile it overlaps
+typedef void (*tft_draw_cb_t)(void *arg);
+
+typedef struct {
+	int16_t x1, y1, x2, y2;		// screen area drawn by the function
+	tft_draw_cb_t draw;
+	void *arg;
+} tft_tile_call_t;
+
+typedef struct {
+	int x, y, w, h;				// screen area covered by the tiles, display window at create
+	int tile_w, tile_h;			// tile size
+	int cols, rows;				// number of tiles
+	color_t bg;					// tiles are cleared to this color before drawing
+	uint32_t *dirty;			// dirty tile bitmap, one bit for each tile
+	tft_tile_call_t *calls;		// recorded draw functions, called in order
+	int ncalls;
+	int max_calls;
+	uint8_t *buf[2];			// tile buffers, rendered and sent alternately
+	uint32_t fence[2];			// queued transfer of the buffer
+	uint32_t tiles_sent;		// number of tiles rendered and sent
+} tft_tiles_t;
+
+// ==== Render/flush pipeline, see TFT_pipeline_create() ====
+
+// Flush task stack size and priority
+#define TFT_PIPELINE_STACK	3072
+#define TFT_PIPELINE_PRIO	5
+
+typedef struct {
+	tft_canvas_t *canvas[2];	// frame buffers, drawn and sent alternately
+	tft_ctx_t *display;			// display context, used by the flush task
+	tft_ctx_t *render;			// copy of the display context drawing to the back canvas only
+	tft_ctx_t *saved_ctx;		// context of the rendering task replaced by TFT_pipeline_begin()
+	int x, y;					// frame position on the screen
+	uint8_t back;				// canvas being drawn
+	uint8_t kept;				// back canvas was updated with the last frame
+	TaskHandle_t task;			// flush task
+	QueueHandle_t sendq;		// frames ready for sending
+	SemaphoreHandle_t free;		// number of canvases which can be drawn
+	SemaphoreHandle_t done;		// given by the flush task when it exits
+	SemaphoreHandle_t lock;		// use of the display context, held by the flush task while sending
+	uint32_t frames;			// frames sent
+	uint32_t flush_time;		// last frame send time in ms
+	uint32_t wait_time;			// total time in ms the rendering task waited for a free canvas
+} tft_pipeline_t;
+
 // --- Constants for ellipse function ---
 #define TFT_ELLIPSE_UPPER_RIGHT 0x01
 #define TFT_ELLIPSE_UPPER_LEFT  0x02
@@ -144,6 +329,7 @@ extern const color_t TFT_PINK;
 */
 //-------------------------------------------------------------------
 void TFT_drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
+void TFT_ctx_drawPixel(tft_ctx_t *ctx, int16_t x, int16_t y, color_t color, uint8_t sel);
 
 /*
  * Read pixel color value from display GRAM at given x,y coordinates
@@ -157,6 +343,7 @@ void TFT_drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
 */
 //------------------------------------------
 color_t TFT_readPixel(int16_t x, int16_t y);
+color_t TFT_ctx_readPixel(tft_ctx_t *ctx, int16_t x, int16_t y);
 
 /*
  * Draw vertical line at given x,y coordinates
@@ -169,6 +356,7 @@ color_t TFT_readPixel(int16_t x, int16_t y);
 */
 //---------------------------------------------------------------------
 void TFT_drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color);
+void TFT_ctx_drawFastVLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t h, color_t color);
 
 /*
  * Draw horizontal line at given x,y coordinates
@@ -181,6 +369,7 @@ void TFT_drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color);
 */
 //---------------------------------------------------------------------
 void TFT_drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color);
+void TFT_ctx_drawFastHLine(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, color_t color);
 
 /*
  * Draw line on screen
@@ -194,12 +383,13 @@ void TFT_drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color);
 */
 //-------------------------------------------------------------------------------
 void TFT_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color);
+void TFT_ctx_drawLine(tft_ctx_t *ctx, int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color);
 
 
 /*
  * Draw line on screen from (x,y) point at given angle
  * Line drawing angle starts at lower right quadrant of the screen and is offseted by
- * '_angleOffset' global variable (default: -90 degrees)
+ * 'tft_angleOffset' variable (default: -90 degrees)
  *
  * Params:
  *       x: horizontal start position
@@ -211,6 +401,7 @@ void TFT_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
 */
 //-----------------------------------------------------------------------------------------------------------
 void TFT_drawLineByAngle(uint16_t x, uint16_t y, uint16_t start, uint16_t len, uint16_t angle, color_t color);
+void TFT_ctx_drawLineByAngle(tft_ctx_t *ctx, uint16_t x, uint16_t y, uint16_t start, uint16_t len, uint16_t angle, color_t color);
 
 /*
  * Fill given rectangular screen region with color
@@ -224,6 +415,7 @@ void TFT_drawLineByAngle(uint16_t x, uint16_t y, uint16_t start, uint16_t len, u
 */
 //---------------------------------------------------------------------------
 void TFT_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color);
+void TFT_ctx_fillRect(tft_ctx_t *ctx, int16_t x, int16_t y, int16_t w, int16_t h, color_t color);
 
 /*
  * Draw rectangle on screen
@@ -237,6 +429,7 @@ void TFT_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color);
 */
 //------------------------------------------------------------------------------
 void TFT_drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color);
+void TFT_ctx_drawRect(tft_ctx_t *ctx, uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color);
 
 /*
  * Draw rectangle with rounded corners on screen
@@ -251,6 +444,7 @@ void TFT_drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color);
 */
 //----------------------------------------------------------------------------------------------
 void TFT_drawRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color);
+void TFT_ctx_drawRoundRect(tft_ctx_t *ctx, int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color);
 
 /*
  * Fill given rectangular screen region with rounded corners with color
@@ -265,6 +459,7 @@ void TFT_drawRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r,
 */
 //----------------------------------------------------------------------------------------------
 void TFT_fillRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color);
+void TFT_ctx_fillRoundRect(tft_ctx_t *ctx, int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r, color_t color);
 
 /*
  * Fill the whole screen with color
@@ -274,6 +469,7 @@ void TFT_fillRoundRect(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t r,
 */
 //--------------------------------
 void TFT_fillScreen(color_t color);
+void TFT_ctx_fillScreen(tft_ctx_t *ctx, color_t color);
 
 /*
  * Fill the current clip window with color
@@ -283,6 +479,7 @@ void TFT_fillScreen(color_t color);
 */
 //---------------------------------
 void TFT_fillWindow(color_t color);
+void TFT_ctx_fillWindow(tft_ctx_t *ctx, color_t color);
 
 /*
  * Draw triangle on screen
@@ -298,6 +495,7 @@ void TFT_fillWindow(color_t color);
 */
 //-----------------------------------------------------------------------------------------------------------------
 void TFT_drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color);
+void TFT_ctx_drawTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color);
 
 /*
  * Fill triangular screen region with color
@@ -313,6 +511,7 @@ void TFT_drawTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16
 */
 //-----------------------------------------------------------------------------------------------------------------
 void TFT_fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color);
+void TFT_ctx_fillTriangle(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, color_t color);
 
 /*
  * Draw circle on screen
@@ -325,6 +524,7 @@ void TFT_fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16
 */
 //-------------------------------------------------------------------
 void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color);
+void TFT_ctx_drawCircle(tft_ctx_t *ctx, int16_t x, int16_t y, int radius, color_t color);
 
 /*
  * Fill circle on screen with color
@@ -337,6 +537,7 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color);
 */
 //-------------------------------------------------------------------
 void TFT_fillCircle(int16_t x, int16_t y, int radius, color_t color);
+void TFT_ctx_fillCircle(tft_ctx_t *ctx, int16_t x, int16_t y, int radius, color_t color);
 
 /*
  * Draw ellipse on screen
@@ -357,6 +558,7 @@ void TFT_fillCircle(int16_t x, int16_t y, int radius, color_t color);
 */
 //------------------------------------------------------------------------------------------------------
 void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option);
+void TFT_ctx_drawEllipse(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option);
 
 /*
  * Fill elliptical region on screen
@@ -377,12 +579,13 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 */
 //------------------------------------------------------------------------------------------------------
 void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option);
+void TFT_ctx_fillEllipse(tft_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t color, uint8_t option);
 
 
 /*
  * Draw circle arc on screen
  * Arc drawing angle starts at lower right quadrant of the screen and is offseted by
- * '_angleOffset' global variable (default: -90 degrees)
+ * 'tft_angleOffset' variable (default: -90 degrees)
  *
  * Params:
  *        cx: arc center X position
@@ -396,6 +599,7 @@ void TFT_fillEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 */
 //----------------------------------------------------------------------------------------------------------------------------
 void TFT_drawArc(uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start, float end, color_t color, color_t fillcolor);
+void TFT_ctx_drawArc(tft_ctx_t *ctx, uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start, float end, color_t color, color_t fillcolor);
 
 
 /*
@@ -413,6 +617,7 @@ void TFT_drawArc(uint16_t cx, uint16_t cy, uint16_t r, uint16_t th, float start,
 */
 //--------------------------------------------------------------------------------------------------------------
 void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, color_t fill, int deg, uint8_t th);
+void TFT_ctx_drawPolygon(tft_ctx_t *ctx, int cx, int cy, int sides, int diameter, color_t color, color_t fill, int deg, uint8_t th);
 
 
 //--------------------------------------------------------------------------------------
@@ -433,6 +638,7 @@ void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, col
  */
 //----------------------------------------------------
 void TFT_setFont(uint8_t font, const char *font_file);
+void TFT_ctx_setFont(tft_ctx_t *ctx, uint8_t font, const char *font_file);
 
 /*
  * Returns current font height & width in pixels.
@@ -443,6 +649,7 @@ void TFT_setFont(uint8_t font, const char *font_file);
  */
 //-------------------------------------------
 int TFT_getfontsize(int *width, int* height);
+int TFT_ctx_getfontsize(tft_ctx_t *ctx, int *width, int* height);
 
 
 /*
@@ -451,15 +658,16 @@ int TFT_getfontsize(int *width, int* height);
  */
 //----------------------
 int TFT_getfontheight();
+int TFT_ctx_getfontheight(tft_ctx_t *ctx);
 
 /*
  * Write text to display.
  *
- * Rotation of the displayed text depends on 'font_rotate' variable (0~360)
- * if 'font_transparent' variable is set to 1, no background pixels will be printed
+ * Rotation of the displayed text depends on 'tft_font_rotate' variable (0~360)
+ * if 'tft_font_transparent' variable is set to 1, no background pixels will be printed
  *
- * If the text does not fit the screen width it will be clipped (if text_wrap=0),
- * or continued on next line (if text_wrap=1)
+ * If the text does not fit the screen width it will be clipped (if tft_text_wrap=0),
+ * or continued on next line (if tft_text_wrap=1)
  *
  * Two special characters are allowed in strings:
  * 		‘\r’ CR (0x0D), clears the display to EOL
@@ -481,6 +689,7 @@ int TFT_getfontheight();
  */
 //-------------------------------------
 void TFT_print(char *st, int x, int y);
+void TFT_ctx_print(tft_ctx_t *ctx, char *st, int x, int y);
 
 /*
  * Set atributes for 7 segment vector font
@@ -495,6 +704,7 @@ void TFT_print(char *st, int x, int y);
  */
 //-------------------------------------------------------------------------
 void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color);
+void TFT_ctx_set_7seg_font_atrib(tft_ctx_t *ctx, uint8_t l, uint8_t w, int outline, color_t color);
 
 /*
  * Sets the clipping area coordinates.
@@ -508,6 +718,7 @@ void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color);
  */
 //----------------------------------------------------------------------
 void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+void TFT_ctx_setclipwin(tft_ctx_t *ctx, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
 
 /*
  * Resets the clipping area to full screen (0,0),(_wodth,_height)
@@ -515,6 +726,7 @@ void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
  */
 //----------------------
 void TFT_resetclipwin();
+void TFT_ctx_resetclipwin(tft_ctx_t *ctx);
 
 /*
  * Save current clipping area to temporary variable
@@ -522,6 +734,7 @@ void TFT_resetclipwin();
  */
 //---------------------
 void TFT_saveClipWin();
+void TFT_ctx_saveClipWin(tft_ctx_t *ctx);
 
 /*
  * Restore current clipping area from temporary variable
@@ -529,6 +742,7 @@ void TFT_saveClipWin();
  */
 //------------------------
 void TFT_restoreClipWin();
+void TFT_ctx_restoreClipWin(tft_ctx_t *ctx);
 
 /*
  * Set the screen rotation
@@ -541,6 +755,7 @@ void TFT_restoreClipWin();
  */
 //--------------------------------
 void TFT_setRotation(uint8_t rot);
+void TFT_ctx_setRotation(tft_ctx_t *ctx, uint8_t rot);
 
 /*
  * Set inverted/normal colors
@@ -551,6 +766,322 @@ void TFT_setRotation(uint8_t rot);
  */
 //-----------------------------------------
 void TFT_invertDisplay(const uint8_t mode);
+void TFT_ctx_invertDisplay(tft_ctx_t *ctx, const uint8_t mode);
+
+/*
+ * Define the hardware vertical scroll area and reset the scroll position
+ * Scrolling is supported in the orientations in which the panel scrolls vertically
+ * (PORTRAIT and PORTRAIT_FLIP with the default rotation settings);
+ * changing the orientation leaves the scrolling mode.
+ * While scrolled, all drawing and reading functions use the screen coordinates,
+ * the lines of the scroll area are translated to the GRAM lines displayed at them.
+ *
+ * Params:
+ *         top: number of fixed lines at the top of the screen
+ *      bottom: number of fixed lines at the bottom of the screen
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_NOT_SUPPORTED if the panel scrolls horizontally in the current orientation
+ * 		ESP_ERR_INVALID_ARG if the fixed areas leave no lines to scroll
+ */
+//-------------------------------------------
+int TFT_setupScrollArea(int top, int bottom);
+int TFT_ctx_setupScrollArea(tft_ctx_t *ctx, int top, int bottom);
+
+/*
+ * Set the hardware scroll position
+ * The content of the scroll area is shifted up by 'pos' lines from the position set by TFT_setupScrollArea(),
+ * lines scrolled out at the top reappear at the bottom of the scroll area.
+ * Scrolling by N lines costs one command; only the newly exposed lines need to be redrawn.
+ *
+ * Params:
+ *         pos: scroll position in lines, taken modulo the scroll area height; negative values scroll down
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_INVALID_STATE if the scroll area is not defined
+ */
+//-------------------------
+int TFT_scrollTo(int pos);
+int TFT_ctx_scrollTo(tft_ctx_t *ctx, int pos);
+
+/*
+ * Draw the pixel buffer rotated and/or flipped
+ * The panel memory access order is changed for the write, so the pixels are streamed in buffer order
+ * without software transformation; orientation is restored after the write.
+ * If the display is scrolled, the pixels are transformed line by line.
+ *
+ * Params:
+ *        x, y: top left corner of the drawn (transformed) rectangle, relative to the display window
+ *        w, h: width & height of the source buffer in pixels
+ *         buf: source pixels, 'w' x 'h', should be allocated with disp_dma_alloc() for DMA transfer
+ *       xform: DISP_XFORM_ROT90/ROT180/ROT270 (clockwise), optionally or-ed with DISP_XFORM_FLIPX/FLIPY
+ *              the source is flipped before rotation
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_INVALID_ARG if the buffer or size is not valid
+ * 		ESP_ERR_NO_MEM if the line buffer could not be allocated
+ */
+//=========================================================================
+int TFT_blit(int x, int y, int w, int h, color_t *buf, uint8_t xform);
+int TFT_ctx_blit(tft_ctx_t *ctx, int x, int y, int w, int h, color_t *buf, uint8_t xform);
+
+/*
+ * Enable or disable the shadow framebuffer
+ * When enabled, all drawing functions render into the framebuffer in RAM (PSRAM if available)
+ * and the changed rectangles are recorded; nothing is sent to the display until TFT_flush().
+ * Overlapping draws are sent only once. The framebuffer is loaded from the display when enabled
+ * and flushed when disabled. Hardware scrolling can't be used while the framebuffer is enabled.
+ * Use disp_fb_get_stats() to compare the pixels drawn with the pixels sent.
+ *
+ * Params:
+ *      enable: 1 to draw to the framebuffer, 0 to draw directly to the display
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_NO_MEM if the framebuffer can't be allocated
+ * 		ESP_ERR_INVALID_STATE if the scroll area is defined
+ */
+//--------------------------------------
+int TFT_setFramebuffer(uint8_t enable);
+int TFT_ctx_setFramebuffer(tft_ctx_t *ctx, uint8_t enable);
+
+/*
+ * Send the changed framebuffer rectangles to the display
+ * The rectangles are merged into a minimal set and sent using DMA
+ *
+ * Returns:
+ * 		ESP_OK on success, also if the framebuffer is not enabled
+ */
+//----------------
+int TFT_flush();
+int TFT_ctx_flush(tft_ctx_t *ctx);
+
+/*
+ * Create the off-screen canvas (sprite), cleared to black
+ * The canvas is allocated in DMA capable memory if possible, in PSRAM otherwise
+ *
+ * Params:
+ *   width, height: canvas size in pixels
+ *
+ * Returns:
+ * 		pointer to the canvas, NULL if the memory can't be allocated
+ */
+//--------------------------------------------------------
+tft_canvas_t *TFT_canvas_create(int width, int height);
+tft_canvas_t *TFT_ctx_canvas_create(tft_ctx_t *ctx, int width, int height);
+
+/*
+ * Create the indexed color canvas, cleared to palette color 0
+ * Each pixel is a 'depth' bit index into the canvas palette, the drawn colors are mapped
+ * to the exact or the nearest palette color. The canvas is expanded to the display format
+ * by TFT_pushCanvas() in small DMA line buffers, e.g. a 320x240 4-bit canvas needs 38 KB
+ * instead of 230 KB in 24-bit color mode. It can be sent in any display color mode.
+ *
+ * Params:
+ *   width, height: canvas size in pixels
+ *           depth: bits per pixel, 1, 2, 4 or 8
+ *         palette: palette colors, copied to the canvas
+ *         ncolors: number of palette colors, at most 2^depth; unused entries are black
+ *
+ * Returns:
+ * 		pointer to the canvas, NULL if the memory can't be allocated or the arguments are not valid
+ */
+//--------------------------------------------------------------------------------------------------------------
+tft_canvas_t *TFT_canvas_create_indexed(int width, int height, uint8_t depth, const color_t *palette, int ncolors);
+tft_canvas_t *TFT_ctx_canvas_create_indexed(tft_ctx_t *ctx, int width, int height, uint8_t depth, const color_t *palette, int ncolors);
+
+/*
+ * Free the canvas
+ */
+//-----------------------------------------
+void TFT_canvas_delete(tft_canvas_t *canvas);
+void TFT_ctx_canvas_delete(tft_ctx_t *ctx, tft_canvas_t *canvas);
+
+/*
+ * Draw to the canvas
+ * Until TFT_canvas_end(), all drawing functions (lines, shapes, text, images) render into the canvas.
+ * The display window is set to the canvas clip window, coordinates are relative to the canvas;
+ * TFT_setclipwin() can be used to change the canvas clip window.
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_INVALID_STATE if the display color mode changed or already drawing to a canvas or tile
+ */
+//-------------------------------------------
+int TFT_canvas_begin(tft_canvas_t *canvas);
+int TFT_ctx_canvas_begin(tft_ctx_t *ctx, tft_canvas_t *canvas);
+
+/*
+ * Stop drawing to the canvas, the display window is restored
+ */
+//-------------------------------------------
+void TFT_canvas_end(tft_canvas_t *canvas);
+void TFT_ctx_canvas_end(tft_ctx_t *ctx, tft_canvas_t *canvas);
+
+/*
+ * Send the canvas to the display with top left corner at (x,y), relative to the display window
+ * The canvas is clipped to the display window and sent with one address window in one DMA transfer
+ * The indexed canvas is expanded through its palette, one line buffer band is expanded
+ * while the previous one is sent; the display must not be selected by the caller
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_INVALID_STATE if the display color mode changed (not for the indexed canvas)
+ * 		ESP_ERR_NO_MEM if the line buffers can't be allocated
+ */
+//---------------------------------------------------------
+int TFT_pushCanvas(tft_canvas_t *canvas, int x, int y);
+int TFT_ctx_pushCanvas(tft_ctx_t *ctx, tft_canvas_t *canvas, int x, int y);
+
+/*
+ * Create the tile renderer
+ * Draw functions are recorded with their screen area and binned into fixed size screen tiles.
+ * Each dirty tile is rendered by the recorded functions into a small DMA buffer, with the drawing
+ * clipped to the tile, while the previous tile is sent to the display in background.
+ * Only 2 tile buffers are needed instead of a full framebuffer.
+ * The tiles cover the display window at the time of creation, drawing outside of it is not rendered.
+ * The display window and orientation must not change while the renderer is used.
+ *
+ * Params:
+ *   tile_w, tile_h: tile size in pixels, e.g. TFT_TILE_SIZE
+ *        max_calls: maximum number of recorded draw functions
+ *               bg: tiles are cleared to this color before drawing
+ *
+ * Returns:
+ * 		pointer to the renderer, NULL if the memory can't be allocated
+ */
+//---------------------------------------------------------------------------------
+tft_tiles_t *TFT_tiles_create(int tile_w, int tile_h, int max_calls, color_t bg);
+tft_tiles_t *TFT_ctx_tiles_create(tft_ctx_t *ctx, int tile_w, int tile_h, int max_calls, color_t bg);
+
+/*
+ * Free the tile renderer, the queued tile transfers are finished first
+ */
+//----------------------------------------
+void TFT_tiles_delete(tft_tiles_t *tiles);
+void TFT_ctx_tiles_delete(tft_ctx_t *ctx, tft_tiles_t *tiles);
+
+/*
+ * Record the draw function, the tiles overlapping its area are marked dirty
+ * The function must only draw (no commands, orientation or window changes) and must not draw
+ * outside of its area; the functions are called in the order they were added.
+ *
+ * Params:
+ *   x, y: top left corner of the area drawn by the function, relative to the display window
+ *   w, h: width & height of the area
+ *   draw: draw function, called with 'arg' for each rendered tile it overlaps
+ *
+ * Returns:
+ * 		index of the recorded function, -1 if max_calls functions are already recorded
+ */
+//--------------------------------------------------------------------------------------------------
+int TFT_tiles_add(tft_tiles_t *tiles, int x, int y, int w, int h, tft_draw_cb_t draw, void *arg);
+int TFT_ctx_tiles_add(tft_ctx_t *ctx, tft_tiles_t *tiles, int x, int y, int w, int h, tft_draw_cb_t draw, void *arg);
+
+/*
+ * Mark the tiles overlapping the area dirty, e.g. if the state drawn by a recorded function changed
+ * x, y, w, h are relative to the display window
+ */
+//-----------------------------------------------------------------------
+void TFT_tiles_invalidate(tft_tiles_t *tiles, int x, int y, int w, int h);
+void TFT_ctx_tiles_invalidate(tft_ctx_t *ctx, tft_tiles_t *tiles, int x, int y, int w, int h);
+
+/*
+ * Remove all recorded draw functions, the dirty tiles are not changed
+ */
+//---------------------------------------
+void TFT_tiles_reset(tft_tiles_t *tiles);
+
+/*
+ * Render the dirty tiles and send them to the display
+ * The draw functions are called with the display context bound to the calling task
+ * ** The display must not be selected by the caller **
+ *
+ * Returns:
+ * 		number of tiles sent, negative value on error
+ */
+//---------------------------------------
+int TFT_tiles_render(tft_tiles_t *tiles);
+int TFT_ctx_tiles_render(tft_ctx_t *ctx, tft_tiles_t *tiles);
+
+/*
+ * Create the double buffered render/flush pipeline
+ * Frames are drawn into the back canvas by the calling task while the flush task,
+ * pinned to the other core, sends the previous frame (or its changed area) to the display.
+ * The canvases are swapped at the frame boundary, TFT_pipeline_end().
+ * Drawing uses a copy of the display context, font & color settings are kept between frames;
+ * it renders to the canvas only and never accesses the spi bus.
+ * The display context is owned by the flush task until TFT_pipeline_delete(),
+ * other tasks may use it only between TFT_pipeline_lock() and TFT_pipeline_unlock().
+ *
+ * Params:
+ *   x, y: frame position on the screen
+ *   w, h: frame size in pixels
+ *   core: cpu core of the flush task, normally the core not running the rendering task
+ *
+ * Returns:
+ * 		pointer to the pipeline, NULL if there is no memory
+ */
+//-------------------------------------------------------------------------
+tft_pipeline_t *TFT_pipeline_create(int x, int y, int w, int h, int core);
+tft_pipeline_t *TFT_ctx_pipeline_create(tft_ctx_t *ctx, int x, int y, int w, int h, int core);
+
+/*
+ * Wait until all frames are sent, stop the flush task and free the pipeline
+ */
+//---------------------------------------------------
+void TFT_pipeline_delete(tft_pipeline_t *pipeline);
+
+/*
+ * Start drawing the next frame
+ * Waits until the back canvas is sent, then all drawing functions of the calling task
+ * render into it until TFT_pipeline_end(); the TFT_ctx_xxx functions must use 'pipeline->render'
+ *
+ * Params:
+ *   keep: if not 0, the back canvas is updated with the last drawn frame, only the changes need to be drawn;
+ *         otherwise it holds the frame before the last one
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_ERR_INVALID_STATE if already drawing to a canvas or tile
+ */
+//---------------------------------------------------------------
+int TFT_pipeline_begin(tft_pipeline_t *pipeline, uint8_t keep);
+
+/*
+ * Finish the frame and pass it to the flush task, the canvases are swapped
+ *
+ * Params:
+ *   dirty: frame area to send, relative to the frame; NULL to send the whole frame
+ *          the whole frame is always sent if it was not drawn with 'keep' set;
+ *          if the area is empty nothing is sent and the canvases are not swapped
+ */
+//----------------------------------------------------------------------------
+void TFT_pipeline_end(tft_pipeline_t *pipeline, const dispWin_t *dirty);
+
+/*
+ * Wait until all finished frames are sent to the display
+ */
+//-------------------------------------------------
+void TFT_pipeline_sync(tft_pipeline_t *pipeline);
+
+/*
+ * Get the display context from the flush task, waits until the frame being sent is finished
+ * Drawing to the display (e.g. outside of the frame area) is allowed until TFT_pipeline_unlock(),
+ * the frames finished meanwhile are sent after it
+ * ** The calling task must use the display context, not between TFT_pipeline_begin() and TFT_pipeline_end() **
+ */
+//-------------------------------------------------
+void TFT_pipeline_lock(tft_pipeline_t *pipeline);
+
+/*
+ * Return the display context to the flush task
+ */
+//---------------------------------------------------
+void TFT_pipeline_unlock(tft_pipeline_t *pipeline);
 
 /*
  * Select gamma curve
@@ -559,6 +1090,7 @@ void TFT_invertDisplay(const uint8_t mode);
  */
 //=================================
 void TFT_setGammaCurve(uint8_t gm);
+void TFT_ctx_setGammaCurve(tft_ctx_t *ctx, uint8_t gm);
 
 /*
  * Compare two color structures
@@ -576,12 +1108,14 @@ int TFT_compare_colors(color_t c1, color_t c2);
  */
 //--------------------------------
 int TFT_getStringWidth(char* str);
+int TFT_ctx_getStringWidth(tft_ctx_t *ctx, char* str);
 
 
 /*
  * Fills the rectangle occupied by string with current background color
  */
 void TFT_clearStringRect(int x, int y, char *str);
+void TFT_ctx_clearStringRect(tft_ctx_t *ctx, int x, int y, char *str);
 
 /*
  * Converts the components of a color, as specified by the HSB model,
@@ -619,6 +1153,7 @@ color_t HSBtoRGB(float _hue, float _sat, float _brightness);
  */
 //-----------------------------------------------------------------------------------
 void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int size);
+void TFT_ctx_jpg_image(tft_ctx_t *ctx, int x, int y, uint8_t scale, char *fname, uint8_t *buf, int size);
 
 /*
  * Decodes and displays BMP image
@@ -636,6 +1171,35 @@ void TFT_jpg_image(int x, int y, uint8_t scale, char *fname, uint8_t *buf, int s
  */
 //-------------------------------------------------------------------------------------
 int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int size);
+int TFT_ctx_bmp_image(tft_ctx_t *ctx, int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int size);
+
+/*
+ * Capture the display region to a file or memory buffer
+ * The region is read from display GRAM in bands of rows; reading the next band
+ * overlaps with writing the previous one, no full frame buffer is needed
+ * ** While a band is read the display's spi bus is locked, the file must NOT be on
+ *    a device sharing the display spi bus (e.g. SD card in spi mode) **
+ *
+ * Params:
+ *       x: region left position (screen coordinates)
+ *       y: region top position (screen coordinates)
+ *       w: region width;  region is clipped to the screen
+ *       h: region height; region is clipped to the screen
+ *  format: TFT_CAPTURE_BMP: uncompressed 24-bit BMP image, can be displayed with TFT_bmp_image()
+ *          TFT_CAPTURE_RAW: 3 bytes (R,G,B) per pixel, rows top to bottom, no header
+ *   fname: pointer to the name of the file to which the image will be written
+ *   		if set to NULL, image will be written to memory buffer pointed to by 'buf'
+ *     buf: pointer to the memory buffer to which the image will be written; used if fname=NULL
+ * bufsize: size of the memory buffer; used if fname=NULL & buf!=NULL
+ *
+ * Returns:
+ * 		number of bytes written on success
+ * 		the required buffer size if fname=NULL & buf=NULL
+ * 		negative value on error
+ */
+//-----------------------------------------------------------------------------------------------------------------------
+int TFT_captureRegion(int x, int y, int w, int h, uint8_t format, char *fname, uint8_t *buf, uint32_t bufsize);
+int TFT_ctx_captureRegion(tft_ctx_t *ctx, int x, int y, int w, int h, uint8_t format, char *fname, uint8_t *buf, uint32_t bufsize);
 
 /*
  * Get the touch panel coordinates.
@@ -652,6 +1216,47 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
  */
 //----------------------------------------------
 int TFT_read_touch(int *x, int* y, uint8_t raw);
+int TFT_ctx_read_touch(tft_ctx_t *ctx, int *x, int* y, uint8_t raw);
+
+/*
+ * Save the display profile to file
+ * The profile holds the current read clock (tft_max_rdclock), touch calibration
+ * constants (tp_calx, tp_caly) and the display type & ID
+ * The write clock is kept only in NVS by find_wr_speed(), it must be called before
+ *
+ * Params:
+ * 		fname: profile file name
+ *
+ * Returns:
+ * 		ESP_OK on success
+ * 		ESP_FAIL if the file can't be written
+ */
+//----------------------------------
+int TFT_profile_save(char *fname);
+int TFT_ctx_profile_save(tft_ctx_t *ctx, char *fname);
+
+/*
+ * Load the display profile saved by TFT_profile_save and apply it
+ * Used on boot instead of measuring the spi clocks with find_rd_speed() & find_wr_speed()
+ * The write clock stored in NVS by find_wr_speed() is applied together with the profile
+ * ** Must be used AFTER the display is initialized **
+ *
+ * Params:
+ * 		 fname: profile file name
+ * 		verify: if not 0 the display ID is compared and the write clock is verified
+ * 		        by reading back a test pattern at the read clock before the profile is applied
+ *
+ * Returns:
+ * 		ESP_OK if the profile is applied
+ * 		ESP_ERR_NOT_FOUND if the file can't be read
+ * 		ESP_ERR_INVALID_CRC if the profile is corrupted
+ * 		ESP_ERR_INVALID_VERSION if the profile was saved for another display
+ * 		ESP_ERR_INVALID_STATE if the read clock or the stored write clock is not set
+ * 		ESP_FAIL if verification failed, the clocks should be measured again
+ */
+//-----------------------------------------------------
+int TFT_profile_load(char *fname, uint8_t verify);
+int TFT_ctx_profile_load(tft_ctx_t *ctx, char *fname, uint8_t verify);
 
 
 /*
@@ -670,10 +1275,43 @@ int TFT_read_touch(int *x, int* y, uint8_t raw);
  */
 //------------------------------------------------
 int compile_font_file(char *fontfile, uint8_t dbg);
+int TFT_ctx_compile_font_file(tft_ctx_t *ctx, char *fontfile, uint8_t dbg);
 
 /*
  * Get all font's characters to buffer
  */
 void getFontCharacters(uint8_t *buf);
+void TFT_ctx_getFontCharacters(tft_ctx_t *ctx, uint8_t *buf);
+
+/*
+ * Create new display context with default settings
+ * Set the display variables and pins in 'ctx->drv' (spi, width, height, type, dc_pin, ...),
+ * then call disp_drv_display_init(&ctx->drv)
+ *
+ * Returns:
+ * 		pointer to the new context, NULL if there is no memory
+ */
+//------------------------------
+tft_ctx_t *TFT_ctx_create();
+
+/*
+ * Free the display context created with TFT_ctx_create()
+ * The context must not be bound to any task
+ */
+//----------------------------------------
+void TFT_ctx_delete(tft_ctx_t *ctx);
+
+/*
+ * Bind the display context to the calling task
+ * All TFT functions without the context parameter called from the task will use the context
+ *
+ * Params:
+ *		ctx: pointer to the display context; NULL to use the default context
+ *
+ * Returns:
+ * 		the previously bound context, NULL if the default context was used
+ */
+//------------------------------------------
+tft_ctx_t *TFT_ctx_bind(tft_ctx_t *ctx);
 
 #endif
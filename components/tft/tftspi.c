@@ -8,58 +8,236 @@
  *
 */
 
+// The driver uses the former global variable names internally
+#define TFT_LEGACY_NAMES
+
 #include <string.h>
 #include "tftspi.h"
 #include "esp_system.h"
 #include "freertos/task.h"
 #include "esp_heap_caps.h"
 #include "soc/spi_reg.h"
+#include "soc/soc_memory_layout.h"
+#include "nvs.h"
+
+// Inside the driver the display variables and the driver state are accessed through
+// the local pointer 'drv', the display context is looked up once per function
+#undef tft_gray_scale
+#undef tft_max_rdclock
+#undef tft_color_bits
+#undef tft_width
+#undef tft_height
+#undef tft_disp_type
+#undef tft_disp_spi
+#define tft_gray_scale		(drv->gray)
+#define tft_max_rdclock		(drv->rdclock)
+#define tft_color_bits		(drv->color_bits)
+#define tft_width			(drv->width)
+#define tft_height			(drv->height)
+#define tft_disp_type		(drv->type)
+#define tft_disp_spi		(drv->spi)
 
 
 // ====================================================
 // ==== Global variables, default values ==============
 
-// Converts colors to grayscale if set to 1
-uint8_t gray_scale = 0;
-// Spi clock for reading data from display memory in Hz
-uint32_t max_rdclock = 8000000;
+// Spi device handle for touch screen
+spi_lobo_device_handle_t ts_spi = NULL;
 
-// Default display dimensions
-int _width = DEFAULT_TFT_DISPLAY_WIDTH;
-int _height = DEFAULT_TFT_DISPLAY_HEIGHT;
+// ====================================================
 
-// Display type, DISP_TYPE_ILI9488 or DISP_TYPE_ILI9341
-uint8_t tft_disp_type = DEFAULT_DISP_TYPE;
+// Driver state of the current display context
+#define trans_cline			(drv->cline)
+#define _dma_sending		(drv->dma_sending)
+#define rd_saved_clock		(drv->rd_clock_saved)
+
+// Solid fill pattern, sent repeatedly by circular DMA descriptor chain
+// Maximum bytes in one spi transaction (2^24 bits), multiple of 2 and 3
+#define FILL_MAX_BYTES		0x1FFFFE
+#define fill_pattern		(drv->fill)
+
+// Scatter-gather send, two descriptor sets and stage halves are used alternately,
+// the next chain is built while the previous one is being sent
+#define sg_desc				(sg.desc)
+#define sg					(drv->sg)
+
+// Display transaction queue
+#define disp_queue			(drv->dq.trans)
+#define dq_head				(drv->dq.head)
+#define dq_tail				(drv->dq.tail)
+#define dq_count			(drv->dq.count)
+#define dq_active			(drv->dq.active)
+#define dq_selected			(drv->dq.selected)
+#define dq_fence_submitted	(drv->dq.fence_submitted)
+#define dq_fence_done		(drv->dq.fence_done)
+#define dq_running			(drv->dq.running)
+
+// DMA buffer pool
+static const uint32_t dma_pool_sizes[DISP_DMA_POOL_CLASSES] = DISP_DMA_POOL_SIZES;
+static const uint8_t dma_pool_counts[DISP_DMA_POOL_CLASSES] = DISP_DMA_POOL_COUNTS;
+static uint8_t *dma_pool_mem = NULL;						// pool memory, all classes
+static uint8_t *dma_pool_start[DISP_DMA_POOL_CLASSES];		// first buffer of each class
+static uint32_t dma_pool_free[DISP_DMA_POOL_CLASSES];		// free buffers bitmap of each class
+static uint32_t dma_pool_size = 0;
+static disp_dma_pool_stats_t dma_pool_stats = {0};
+static portMUX_TYPE dma_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Address window cache, current panel column & page window and RAMWR write pointer
+#define aw_x1				(drv->aw.x1)
+#define aw_x2				(drv->aw.x2)
+#define aw_y1				(drv->aw.y1)
+#define aw_y2				(drv->aw.y2)
+#define aw_wx				(drv->aw.wx)
+#define aw_wy				(drv->aw.wy)
+#define aw_ramwr			(drv->aw.ramwr)
+#define aw_stats			(drv->aw.stats)
+
+// RGB to GRAYSCALE constants, 16-bit fixed point (factor * 65536)
+// 0.2989  0.4870  0.2140
+#define GS_FACT_R 19589
+#define GS_FACT_G 31916
+#define GS_FACT_B 14025
 
-// Spi device handles for display and touch screen
-spi_lobo_device_handle_t disp_spi = NULL;
-spi_lobo_device_handle_t ts_spi = NULL;
 
-// ====================================================
 
+// ==== Functions =====================
 
-static color_t *trans_cline = NULL;
-static uint8_t _dma_sending = 0;
+// Set the display driver state to default values
+//=======================================
+void disp_drv_init(disp_drv_t *drv)
+{
+	memset(drv, 0, sizeof(disp_drv_t));
+	drv->width = DEFAULT_TFT_DISPLAY_WIDTH;
+	drv->height = DEFAULT_TFT_DISPLAY_HEIGHT;
+	drv->type = DEFAULT_DISP_TYPE;
+	drv->color_bits = 24;
+	drv->rdclock = 8000000;
+	drv->dc_pin = PIN_NUM_DC;
+	drv->rst_pin = PIN_NUM_RST;
+	drv->bckl_pin = PIN_NUM_BCKL;
+	drv->aw.x1 = -1;
+	drv->aw.x2 = -1;
+	drv->aw.y1 = -1;
+	drv->aw.y2 = -1;
+}
 
-// RGB to GRAYSCALE constants
-// 0.2989  0.5870  0.1140
-#define GS_FACT_R 0.2989
-#define GS_FACT_G 0.4870
-#define GS_FACT_B 0.2140
+// ==== DMA buffer pool ====
 
+//===========================
+esp_err_t disp_dma_pool_init()
+{
+	if (dma_pool_mem) return ESP_OK;
 
+	uint32_t size = 0;
+	for (int i=0; i<DISP_DMA_POOL_CLASSES; i++) {
+		size += dma_pool_sizes[i] * dma_pool_counts[i];
+	}
+	dma_pool_mem = heap_caps_malloc(size, MALLOC_CAP_DMA);
+	if (dma_pool_mem == NULL) return ESP_ERR_NO_MEM;
+	dma_pool_size = size;
+
+	uint8_t *buf = dma_pool_mem;
+	for (int i=0; i<DISP_DMA_POOL_CLASSES; i++) {
+		dma_pool_start[i] = buf;
+		dma_pool_free[i] = (1 << dma_pool_counts[i]) - 1;
+		buf += dma_pool_sizes[i] * dma_pool_counts[i];
+		dma_pool_stats.size[i] = dma_pool_sizes[i];
+		dma_pool_stats.count[i] = dma_pool_counts[i];
+	}
+	return ESP_OK;
+}
 
-// ==== Functions =====================
+//=====================================
+void *disp_dma_alloc(uint32_t size)
+{
+	void *buf = NULL;
+
+	if ((dma_pool_mem) && (size > 0)) {
+		portENTER_CRITICAL(&dma_pool_mux);
+		for (int i=0; i<DISP_DMA_POOL_CLASSES; i++) {
+			if ((dma_pool_sizes[i] < size) || (dma_pool_free[i] == 0)) continue;
+			int n = __builtin_ctz(dma_pool_free[i]);
+			dma_pool_free[i] &= ~(1 << n);
+			buf = dma_pool_start[i] + (n * dma_pool_sizes[i]);
+			dma_pool_stats.in_use[i]++;
+			if (dma_pool_stats.in_use[i] > dma_pool_stats.high_water[i]) dma_pool_stats.high_water[i] = dma_pool_stats.in_use[i];
+			dma_pool_stats.pool_allocs++;
+			break;
+		}
+		portEXIT_CRITICAL(&dma_pool_mux);
+		if (buf) return buf;
+	}
 
-//------------------------------------------------------
-esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
+	buf = heap_caps_malloc(size, MALLOC_CAP_DMA);
+	// the counters are shared by all display contexts
+	portENTER_CRITICAL(&dma_pool_mux);
+	if (buf) dma_pool_stats.heap_allocs++;
+	else dma_pool_stats.failures++;
+	portEXIT_CRITICAL(&dma_pool_mux);
+	return buf;
+}
+
+//==============================
+void disp_dma_free(void *buf)
 {
-	// Wait for SPI bus ready
-	while (disp_spi->host->hw->cmd.usr);
-	if ((free_line) && (trans_cline)) {
-		free(trans_cline);
-		trans_cline = NULL;
+	if (buf == NULL) return;
+
+	uint8_t *b = (uint8_t *)buf;
+	if ((dma_pool_mem) && (b >= dma_pool_mem) && (b < (dma_pool_mem + dma_pool_size))) {
+		portENTER_CRITICAL(&dma_pool_mux);
+		for (int i=DISP_DMA_POOL_CLASSES-1; i>=0; i--) {
+			if (b < dma_pool_start[i]) continue;
+			int n = (b - dma_pool_start[i]) / dma_pool_sizes[i];
+			if ((dma_pool_free[i] & (1 << n)) == 0) {
+				dma_pool_free[i] |= (1 << n);
+				dma_pool_stats.in_use[i]--;
+			}
+			break;
+		}
+		portEXIT_CRITICAL(&dma_pool_mux);
 	}
+	else free(buf);
+}
+
+//===================================================================
+void disp_dma_pool_stats(disp_dma_pool_stats_t *stats, uint8_t reset)
+{
+	portENTER_CRITICAL(&dma_pool_mux);
+	if (stats) memcpy(stats, &dma_pool_stats, sizeof(disp_dma_pool_stats_t));
+	if (reset) {
+		for (int i=0; i<DISP_DMA_POOL_CLASSES; i++) {
+			dma_pool_stats.high_water[i] = dma_pool_stats.in_use[i];
+		}
+		dma_pool_stats.pool_allocs = 0;
+		dma_pool_stats.heap_allocs = 0;
+		dma_pool_stats.failures = 0;
+	}
+	portEXIT_CRITICAL(&dma_pool_mux);
+}
+
+// Forget the cached address window, the next write sends the full window
+//===============================================
+void disp_drv_addrwin_invalidate(disp_drv_t *drv)
+{
+	aw_x1 = -1;
+	aw_x2 = -1;
+	aw_y1 = -1;
+	aw_y2 = -1;
+	aw_ramwr = 0;
+}
+
+// Get the address window cache counters
+//==========================================================================================
+void disp_drv_get_addrwin_stats(disp_drv_t *drv, disp_addrwin_stats_t *stats, uint8_t reset)
+{
+	if (stats) memcpy(stats, &aw_stats, sizeof(disp_addrwin_stats_t));
+	if (reset) memset(&aw_stats, 0, sizeof(disp_addrwin_stats_t));
+}
+
+// Reset DMA after the finished DMA transfer
+//----------------------------------------------
+static void IRAM_ATTR _dma_reset(disp_drv_t *drv)
+{
 	if (_dma_sending) {
 	    //Tell common code DMA workaround that our DMA channel is idle. If needed, the code will do a DMA reset.
 	    if (disp_spi->host->dma_chan) spi_lobo_dmaworkaround_idle(disp_spi->host->dma_chan);
@@ -72,23 +250,61 @@ esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
 		disp_spi->host->hw->dma_conf.out_data_burst_en=1;
 		_dma_sending = 0;
 	}
+}
+
+//--------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_wait_trans_finish(disp_drv_t *drv, uint8_t free_line)
+{
+	// Tile is rendered to RAM, the spi bus may be used by another task (see TFT_pipeline_create())
+	if (drv->fb.tile) {
+		if ((free_line) && (trans_cline)) {
+			disp_dma_free(trans_cline);
+			trans_cline = NULL;
+		}
+		return ESP_OK;
+	}
+	// Wait for SPI bus ready, long transfers are waited for by interrupt
+	spi_lobo_wait_trans_done(disp_spi);
+	if ((free_line) && (trans_cline)) {
+		disp_dma_free(trans_cline);
+		trans_cline = NULL;
+	}
+	_dma_reset(drv);
     return ESP_OK;
 }
 
-//-------------------------------
-esp_err_t IRAM_ATTR disp_select()
+//--------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_select(disp_drv_t *drv)
 {
-	wait_trans_finish(1);
+	// Tile is rendered to RAM while the previous one is sent by the queue
+	if (drv->fb.tile) return ESP_OK;
+	if (dq_count || dq_selected) disp_drv_queue_flush(drv);
+	disp_drv_wait_trans_finish(drv, 1);
 	return spi_lobo_device_select(disp_spi, 0);
 }
 
-//---------------------------------
-esp_err_t IRAM_ATTR disp_deselect()
+//----------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_deselect(disp_drv_t *drv)
 {
-	wait_trans_finish(1);
+	if (drv->fb.tile) return ESP_OK;
+	if (dq_count || dq_selected) disp_drv_queue_flush(drv);
+	disp_drv_wait_trans_finish(drv, 1);
+	aw_ramwr = 0;
 	return spi_lobo_device_deselect(disp_spi);
 }
 
+// Release the spi bus to higher priority devices if they wait for it
+//-----------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_bus_yield(disp_drv_t *drv)
+{
+	if (drv->fb.tile) return ESP_OK;
+	if ((dq_count) || (dq_selected) || (!spi_lobo_bus_yield_requested(disp_spi))) return ESP_OK;
+	disp_drv_wait_trans_finish(drv, 1);
+	// CS is deactivated, RAM WRITE must be sent again
+	aw_ramwr = 0;
+	return spi_lobo_bus_yield(disp_spi);
+}
+
 //---------------------------------------------------------------------------------------------------
 static void IRAM_ATTR _spi_transfer_start(spi_lobo_device_handle_t spi_dev, int wrbits, int rdbits) {
 	// Load send buffer
@@ -104,32 +320,45 @@ static void IRAM_ATTR _spi_transfer_start(spi_lobo_device_handle_t spi_dev, int
         spi_dev->host->hw->user.usr_miso = 0;
     }
 	// Start transfer
-	spi_dev->host->hw->cmd.usr = 1;
+	spi_lobo_start_trans(spi_dev, false);
     // Wait for SPI bus ready
-	while (spi_dev->host->hw->cmd.usr);
+	spi_lobo_spin_trans_done(spi_dev);
+}
+
+// Any command ends the RAMWR stream; all except RAMRD may change the window
+//-------------------------------------------------------------
+static void IRAM_ATTR _aw_command(disp_drv_t *drv, uint8_t cmd)
+{
+	aw_ramwr = 0;
+	if (cmd != TFT_RAMRD) disp_drv_addrwin_invalidate(drv);
 }
 
 // Send 1 byte display command, display must be selected
-//------------------------------------------------
-void IRAM_ATTR disp_spi_transfer_cmd(int8_t cmd) {
+//---------------------------------------------------------------
+void IRAM_ATTR disp_drv_transfer_cmd(disp_drv_t *drv, int8_t cmd) {
+	// nothing is sent while rendering to a tile
+	if (drv->fb.tile) return;
 	// Wait for SPI bus ready
-	while (disp_spi->host->hw->cmd.usr);
+	spi_lobo_wait_trans_done(disp_spi);
+	_aw_command(drv, cmd);
 
 	// Set DC to 0 (command mode);
-    gpio_set_level(PIN_NUM_DC, 0);
+    gpio_set_level(drv->dc_pin, 0);
 
     disp_spi->host->hw->data_buf[0] = (uint32_t)cmd;
     _spi_transfer_start(disp_spi, 8, 0);
 }
 
 // Send command with data to display, display must be selected
-//----------------------------------------------------------------------------------
-void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len) {
+//-------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_drv_transfer_cmd_data(disp_drv_t *drv, int8_t cmd, uint8_t *data, uint32_t len) {
+	if (drv->fb.tile) return;
 	// Wait for SPI bus ready
-	while (disp_spi->host->hw->cmd.usr);
+	spi_lobo_wait_trans_done(disp_spi);
+	_aw_command(drv, cmd);
 
     // Set DC to 0 (command mode);
-    gpio_set_level(PIN_NUM_DC, 0);
+    gpio_set_level(drv->dc_pin, 0);
 
     disp_spi->host->hw->data_buf[0] = (uint32_t)cmd;
     _spi_transfer_start(disp_spi, 8, 0);
@@ -137,7 +366,7 @@ void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t le
 	if ((len == 0) || (data == NULL)) return;
 
     // Set DC to 1 (data mode);
-	gpio_set_level(PIN_NUM_DC, 1);
+	gpio_set_level(drv->dc_pin, 1);
 
 	uint8_t idx=0, bidx=0;
 	uint32_t bits=0;
@@ -171,343 +400,1922 @@ void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t le
     if (bits > 0) _spi_transfer_start(disp_spi, bits, 0);
 }
 
-// Set the address window for display write & read commands, display must be selected
-//---------------------------------------------------------------------------------------------------
-static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
+// Send one address window axis command (CASET or PASET) with its parameters
+//------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _disp_spi_send_axis(disp_drv_t *drv, uint8_t cmd, uint16_t a1, uint16_t a2) {
 	uint32_t wd;
 
-    taskDISABLE_INTERRUPTS();
+    spi_lobo_gpio_set_level(drv->dc_pin, 0);
+	disp_spi->host->hw->data_buf[0] = (uint32_t)cmd;
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
+	spi_lobo_start_trans(disp_spi, false); // Start transfer
+
+	wd = (uint32_t)(a1>>8);
+	wd |= (uint32_t)(a1&0xff) << 8;
+	wd |= (uint32_t)(a2>>8) << 16;
+	wd |= (uint32_t)(a2&0xff) << 24;
+
+	spi_lobo_spin_trans_done(disp_spi); // wait transfer end
+	spi_lobo_gpio_set_level(drv->dc_pin, 1);
+	disp_spi->host->hw->data_buf[0] = wd;
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 31;
+	spi_lobo_start_trans(disp_spi, false); // Start transfer
+	spi_lobo_spin_trans_done(disp_spi);
+}
+
+// Set the address window for display write & read commands, display must be selected
+// Column or page command is not sent if that axis is unchanged
+//---------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR disp_spi_transfer_addrwin(disp_drv_t *drv, uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
 	// Wait for SPI bus ready
-	while (disp_spi->host->hw->cmd.usr);
-    gpio_set_level(PIN_NUM_DC, 0);
+	spi_lobo_wait_trans_done(disp_spi);
 
-	disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_CASET;
 	disp_spi->host->hw->user.usr_mosi_highpart = 0;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
 	disp_spi->host->hw->user.usr_mosi = 1;
 	disp_spi->host->hw->miso_dlen.usr_miso_dbitlen = 0;
 	disp_spi->host->hw->user.usr_miso = 0;
 
-	disp_spi->host->hw->cmd.usr = 1; // Start transfer
+	if ((x1 != aw_x1) || (x2 != aw_x2)) {
+		_disp_spi_send_axis(drv, TFT_CASET, x1, x2);
+		aw_x1 = x1;
+		aw_x2 = x2;
+		aw_stats.caset_sent++;
+	}
+	else aw_stats.caset_skipped++;
 
-	wd = (uint32_t)(x1>>8);
-	wd |= (uint32_t)(x1&0xff) << 8;
-	wd |= (uint32_t)(x2>>8) << 16;
-	wd |= (uint32_t)(x2&0xff) << 24;
+	if ((y1 != aw_y1) || (y2 != aw_y2)) {
+		_disp_spi_send_axis(drv, TFT_PASET, y1, y2);
+		aw_y1 = y1;
+		aw_y2 = y2;
+		aw_stats.paset_sent++;
+	}
+	else aw_stats.paset_skipped++;
 
-	while (disp_spi->host->hw->cmd.usr); // wait transfer end
-	gpio_set_level(PIN_NUM_DC, 1);
-	disp_spi->host->hw->data_buf[0] = wd;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 31;
-	disp_spi->host->hw->cmd.usr = 1; // Start transfer
+	// Write pointer is reset by the following RAMWR or RAMRD command
+	aw_ramwr = 0;
+}
 
-    while (disp_spi->host->hw->cmd.usr);
-    gpio_set_level(PIN_NUM_DC, 0);
-    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_PASET;
+// ==== Hardware vertical scrolling ====
+// The scroll area content is displayed shifted up by 'scroll.pos' lines.
+// Screen lines in the scroll area are translated to the GRAM lines displayed at them,
+// so the drawing and reading functions always use the screen coordinates.
+
+// Translate the screen line to the scrolled GRAM line
+//-------------------------------------------------------
+static int IRAM_ATTR _scroll_line(disp_drv_t *drv, int y)
+{
+
+	if ((drv->scroll.pos == 0) || (y < drv->scroll.top) || (y >= (drv->scroll.top + drv->scroll.vsa))) return y;
+	return drv->scroll.top + ((y - drv->scroll.top + drv->scroll.pos) % drv->scroll.vsa);
+}
+
+//=================================================================
+int IRAM_ATTR disp_drv_scroll_rows(disp_drv_t *drv, int y1, int y2)
+{
+	int n = y2 - y1 + 1;
+	int end = drv->scroll.top + drv->scroll.vsa;
+	int brk;
+
+	if ((drv->scroll.pos == 0) || (n <= 1)) return n;
+
+	// first line which is not stored after the previous one
+	if (y1 < drv->scroll.top) brk = drv->scroll.top;
+	else if (y1 < (end - drv->scroll.pos)) brk = end - drv->scroll.pos;
+	else if (y1 < end) brk = end;
+	else return n;
+
+	if ((y1 + n) > brk) n = brk - y1;
+	return n;
+}
+
+//==========================================================================
+esp_err_t disp_drv_scroll_set(disp_drv_t *drv, int top, int bottom, int pos)
+{
+	int lines = ((_width > _height) ? _width : _height);
+	int vsa = lines - top - bottom;
+	uint16_t tfa, vsp;
+	uint8_t data[6];
+	esp_err_t ret;
+
+	// The panel scrolls along the screen x axis
+	if (drv->madctl & MADCTL_MV) return ESP_ERR_NOT_SUPPORTED;
+	// The framebuffer holds the screen, not the GRAM lines
+	if (drv->fb.buf) return ESP_ERR_INVALID_STATE;
+	if ((top < 0) || (bottom < 0) || (vsa < 1)) return ESP_ERR_INVALID_ARG;
+	pos %= vsa;
+	if (pos < 0) pos += vsa;
+
+	ret = disp_drv_select(drv);
+	if (ret != ESP_OK) return ret;
+
+	// In flipped orientation the screen top is at the GRAM bottom and the content moves the other way
+	tfa = ((drv->madctl & MADCTL_MY) ? bottom : top);
+	if ((drv->scroll.vsa == 0) || (top != drv->scroll.top) || (bottom != drv->scroll.bottom)) {
+		data[0] = tfa >> 8;
+		data[1] = tfa & 0xFF;
+		data[2] = vsa >> 8;
+		data[3] = vsa & 0xFF;
+		data[4] = (lines - tfa - vsa) >> 8;
+		data[5] = (lines - tfa - vsa) & 0xFF;
+		disp_drv_transfer_cmd_data(drv, TFT_VSCRDEF, data, 6);
+	}
+	vsp = tfa + ((drv->madctl & MADCTL_MY) ? ((vsa - pos) % vsa) : pos);
+	data[0] = vsp >> 8;
+	data[1] = vsp & 0xFF;
+	disp_drv_transfer_cmd_data(drv, TFT_VSCRSADD, data, 2);
+
+	drv->scroll.top = top;
+	drv->scroll.bottom = bottom;
+	drv->scroll.vsa = vsa;
+	drv->scroll.pos = pos;
+
+	return disp_drv_deselect(drv);
+}
+
+// Advance the tracked RAMWR write pointer by 'len' pixels
+//--------------------------------------------------------------
+static void IRAM_ATTR _aw_advance(disp_drv_t *drv, uint32_t len)
+{
+	uint32_t w = aw_x2 - aw_x1 + 1;
+	uint32_t off = (aw_wx - aw_x1) + len;
+
+	aw_wy += off / w;
+	aw_wx = aw_x1 + (off % w);
+	// The panel wraps to the window start, stop tracking
+	if (aw_wy > aw_y2) aw_ramwr = 0;
+}
+
+// Send RAM WRITE command, returns in data mode (DC=1)
+//------------------------------------------------------
+static void IRAM_ATTR _send_ramwr(disp_drv_t *drv)
+{
+    spi_lobo_gpio_set_level(drv->dc_pin, 0);
+    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
 	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	disp_spi->host->hw->cmd.usr = 1; // Start transfer
+	spi_lobo_start_trans(disp_spi, false);		// Start transfer
+	spi_lobo_spin_trans_done(disp_spi);	// Wait for SPI bus ready
 
-	wd = (uint32_t)(y1>>8);
-	wd |= (uint32_t)(y1&0xff) << 8;
-	wd |= (uint32_t)(y2>>8) << 16;
-	wd |= (uint32_t)(y2&0xff) << 24;
+	spi_lobo_gpio_set_level(drv->dc_pin, 1);			// Set DC to 1 (data mode);
+}
 
-	while (disp_spi->host->hw->cmd.usr);
-	gpio_set_level(PIN_NUM_DC, 1);
+// Prepare the display for writing 'len' pixels into the window (x1,y1),(x2,y2)
+// If the first pixel is the auto-increment successor of the last written one,
+// the active RAM WRITE stream is continued and no commands are sent.
+// Otherwise only the changed window axes and RAMWR command are sent.
+// Single row writes only need the window to start at (x1,y1), so the wider
+// cached window is reused; single pixels open the window to the display edge.
+// ** Device must already be selected **, returns in data mode (DC=1)
+//--------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR disp_spi_write_window(disp_drv_t *drv, int x1, int x2, int y1, int y2, uint32_t len)
+{
+	uint8_t single_row = ((y1 == y2) && (len <= (x2-x1+1)));
+	int wx1, wx2, wy2;
+
+	// Translate to the scrolled GRAM lines, written lines must be consecutive in GRAM
+	if (drv->scroll.pos) {
+		wy2 = _scroll_line(drv, y1);
+		y2 = wy2 + (y2 - y1);
+		y1 = wy2;
+	}
 
-	disp_spi->host->hw->data_buf[0] = wd;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 31;
-	disp_spi->host->hw->cmd.usr = 1; // Start transfer
-	while (disp_spi->host->hw->cmd.usr);
-    taskENABLE_INTERRUPTS();
+	if ((aw_ramwr) && (x1 == aw_wx) && (y1 == aw_wy)) {
+		if (((single_row) && ((x1+len-1) <= aw_x2)) ||
+				((!single_row) && (x1 == aw_x1) && (x2 == aw_x2) && (y2 <= aw_y2))) {
+			disp_drv_wait_trans_finish(drv, 1);
+			aw_stats.ramwr_continued++;
+			_aw_advance(drv, len);
+			return;
+		}
+	}
+
+	wx1 = x1;
+	wx2 = x2;
+	if (single_row) {
+		if ((x1 == aw_x1) && (aw_x2 >= x2)) wx2 = aw_x2;
+		else if ((x1 == x2) && (x2 < (_width-1))) wx2 = _width-1;
+	}
+	wy2 = ((y2 > (_height-1)) ? y2 : (_height-1));
+	if ((y1 == aw_y1) && (aw_y2 >= y2)) wy2 = aw_y2;
+
+	disp_spi_transfer_addrwin(drv, wx1, wx2, y1, wy2);
+
+	_send_ramwr(drv);
+	aw_stats.ramwr_sent++;
+
+	aw_wx = x1;
+	aw_wy = y1;
+	aw_ramwr = 1;
+	_aw_advance(drv, len);
+}
+
+// Gray level of the color, 16-bit fixed point
+//----------------------------------------------------
+static inline uint8_t IRAM_ATTR _gray_level(color_t color)
+{
+	uint32_t gs_clr = ((GS_FACT_R * color.r) + (GS_FACT_G * color.g) + (GS_FACT_B * color.b) + 32768) >> 16;
+	return ((gs_clr > 255) ? 255 : (uint8_t)gs_clr);
 }
 
 // Convert color to gray scale
 //----------------------------------------------
 static color_t IRAM_ATTR color2gs(color_t color)
 {
-	color_t _color;
-    float gs_clr = GS_FACT_R * color.r + GS_FACT_G * color.g + GS_FACT_B * color.b;
-    if (gs_clr > 255) gs_clr = 255;
+	uint8_t gs_clr = _gray_level(color);
+	return (color_t){gs_clr, gs_clr, gs_clr};
+}
+
+// Get source color 'idx', converted to gray scale if 'gs' is set
+// 'gs' is read from 'gray_scale' once by the caller, not for every pixel
+//-----------------------------------------------------------------------------------
+static inline color_t IRAM_ATTR _src_color(color_t *color, uint32_t idx, uint8_t gs)
+{
+	if (gs) return color2gs(color[idx]);
+	return color[idx];
+}
+
+// Convert color to RGB565, first byte to be sent in low byte
+//-------------------------------------------------
+static uint16_t IRAM_ATTR color2rgb565(color_t color)
+{
+	uint16_t wd = (color.r & 0xF8) | (color.g >> 5);
+	wd |= (uint16_t)(((color.g << 3) & 0xE0) | (color.b >> 3)) << 8;
+	return wd;
+}
 
-    _color.r = (uint8_t)gs_clr;
-    _color.g = (uint8_t)gs_clr;
-    _color.b = (uint8_t)gs_clr;
+// Convert 'len' colors to the display transfer format (3 bytes or RGB565) into 'buf'
+// If rep==true, color[0] is repeated 'len' times
+// If 'gs' is set, the colors are converted to gray scale
+// If 'buf' is 32-bit aligned, pixels are packed and written word-at-a-time
+// (2 pixels per word in 16-bit mode, 4 pixels per 3 words in 24-bit mode)
+// The source buffer is never changed
+// Returns the number of bytes written to 'buf'
+//-------------------------------------------------------------------------------------------------------------------------
+static uint32_t IRAM_ATTR _pack_colors(disp_drv_t *drv, uint8_t *buf, color_t *color, uint32_t len, uint8_t rep, uint8_t gs)
+{
+	uint32_t n = 0;
+	uint32_t *wdest;
+	uint8_t *dest;
+	uint16_t wd;
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint8_t g0, g1, g2, g3;
+	color_t c0, c1, c2, c3;
+
+	c0 = _src_color(color, 0, gs);
+	c1 = c2 = c3 = c0;
+	// the repeated color is converted only once
+	if (rep) gs = 0;
+
+	if (((uint32_t)buf & 3) == 0) {
+		wdest = (uint32_t *)buf;
+		if ((bpp == 2) && (gs)) {
+			for (; (n+2) <= len; n+=2) {
+				g0 = _gray_level(color[n]);
+				g1 = _gray_level(color[n+1]);
+				*wdest++ = (uint32_t)color2rgb565((color_t){g0, g0, g0}) | ((uint32_t)color2rgb565((color_t){g1, g1, g1}) << 16);
+			}
+		}
+		else if (bpp == 2) {
+			for (; (n+2) <= len; n+=2) {
+				if (rep == 0) {
+					c0 = color[n];
+					c1 = color[n+1];
+				}
+				*wdest++ = (uint32_t)color2rgb565(c0) | ((uint32_t)color2rgb565(c1) << 16);
+			}
+		}
+		else if (gs) {
+			for (; (n+4) <= len; n+=4) {
+				g0 = _gray_level(color[n]);
+				g1 = _gray_level(color[n+1]);
+				g2 = _gray_level(color[n+2]);
+				g3 = _gray_level(color[n+3]);
+				*wdest++ = (uint32_t)g0 | ((uint32_t)g0 << 8) | ((uint32_t)g0 << 16) | ((uint32_t)g1 << 24);
+				*wdest++ = (uint32_t)g1 | ((uint32_t)g1 << 8) | ((uint32_t)g2 << 16) | ((uint32_t)g2 << 24);
+				*wdest++ = (uint32_t)g2 | ((uint32_t)g3 << 8) | ((uint32_t)g3 << 16) | ((uint32_t)g3 << 24);
+			}
+		}
+		else {
+			for (; (n+4) <= len; n+=4) {
+				if (rep == 0) {
+					c0 = color[n];
+					c1 = color[n+1];
+					c2 = color[n+2];
+					c3 = color[n+3];
+				}
+				*wdest++ = (uint32_t)c0.r | ((uint32_t)c0.g << 8) | ((uint32_t)c0.b << 16) | ((uint32_t)c1.r << 24);
+				*wdest++ = (uint32_t)c1.g | ((uint32_t)c1.b << 8) | ((uint32_t)c2.r << 16) | ((uint32_t)c2.g << 24);
+				*wdest++ = (uint32_t)c2.b | ((uint32_t)c3.r << 8) | ((uint32_t)c3.g << 16) | ((uint32_t)c3.b << 24);
+			}
+		}
+	}
 
-    return _color;
+	// Remaining pixels or unaligned buffer
+	dest = buf + (n * bpp);
+	for (; n<len; n++) {
+		if (rep == 0) c0 = _src_color(color, n, gs);
+		if (bpp == 2) {
+			wd = color2rgb565(c0);
+			*dest++ = (uint8_t)wd;
+			*dest++ = (uint8_t)(wd >> 8);
+		}
+		else {
+			*dest++ = c0.r;
+			*dest++ = c0.g;
+			*dest++ = c0.b;
+		}
+	}
+	return len * bpp;
 }
 
-// Set display pixel at given coordinates to given color
+// ==== Shadow framebuffer ====
+
+#define fb_on				(drv->fb.on)
+#define fb_buf				(drv->fb.buf)
+#define fb_dirty			(drv->fb.dirty)
+#define fb_ndirty			(drv->fb.ndirty)
+#define fb_stats			(drv->fb.stats)
+#define fb_x				(drv->fb.x)
+#define fb_y				(drv->fb.y)
+#define fb_w				(drv->fb.w)
+#define fb_h				(drv->fb.h)
+#define fb_depth			(drv->fb.depth)
+
+//-----------------------------------------------------
+static inline uint32_t _rect_area(const disp_rect_t *r)
+{
+	return (uint32_t)(r->x2 - r->x1 + 1) * (uint32_t)(r->y2 - r->y1 + 1);
+}
+
+// Merge 'src' into 'dst' if the union costs at most DISP_FB_MERGE_PIXELS more than sending both
+// Returns 1 if merged
+//---------------------------------------------------------------------------
+static int _rect_merge(disp_rect_t *dst, const disp_rect_t *src, uint8_t force)
+{
+	disp_rect_t u;
+	u.x1 = ((dst->x1 < src->x1) ? dst->x1 : src->x1);
+	u.y1 = ((dst->y1 < src->y1) ? dst->y1 : src->y1);
+	u.x2 = ((dst->x2 > src->x2) ? dst->x2 : src->x2);
+	u.y2 = ((dst->y2 > src->y2) ? dst->y2 : src->y2);
+	if ((!force) && (_rect_area(&u) > (_rect_area(dst) + _rect_area(src) + DISP_FB_MERGE_PIXELS))) return 0;
+	*dst = u;
+	return 1;
+}
+
+// Merge the dirty rectangles until no pair can be merged
+//------------------------------------------
+static void _fb_dirty_merge(disp_drv_t *drv)
+{
+	int i, j, merged = 1;
+
+	while (merged) {
+		merged = 0;
+		for (i=0; i<fb_ndirty; i++) {
+			for (j=i+1; j<fb_ndirty; j++) {
+				if (_rect_merge(&fb_dirty[i], &fb_dirty[j], 0)) {
+					fb_dirty[j] = fb_dirty[--fb_ndirty];
+					merged = 1;
+					j--;
+				}
+			}
+		}
+	}
+}
+
+// Add the written rectangle to the dirty list
+// If the list is full, the rectangle is merged with the one growing the least
 //------------------------------------------------------------------------
-void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
+static void _fb_dirty_add(disp_drv_t *drv, int x1, int y1, int x2, int y2)
+{
+	disp_rect_t r = {x1, y1, x2, y2};
+	disp_rect_t u;
+	uint32_t grow, min_grow = 0xFFFFFFFF;
+	int i, min_i = 0;
+
+	for (i=0; i<fb_ndirty; i++) {
+		if (_rect_merge(&fb_dirty[i], &r, 0)) {
+			_fb_dirty_merge(drv);
+			return;
+		}
+	}
+	if (fb_ndirty < DISP_FB_DIRTY_MAX) {
+		fb_dirty[fb_ndirty++] = r;
+		return;
+	}
+	for (i=0; i<fb_ndirty; i++) {
+		u = fb_dirty[i];
+		_rect_merge(&u, &r, 1);
+		grow = _rect_area(&u) - _rect_area(&fb_dirty[i]);
+		if (grow < min_grow) {
+			min_grow = grow;
+			min_i = i;
+		}
+	}
+	_rect_merge(&fb_dirty[min_i], &r, 1);
+	_fb_dirty_merge(drv);
+}
+
+// Add the written part of the window (x1,y1),(x2,y2) to the dirty list, clipped to the target
+//----------------------------------------------------------------------
+static void _fb_written(disp_drv_t *drv, int x1, int y1, int x2, int y2)
+{
+	if (x1 < fb_x) x1 = fb_x;
+	if (y1 < fb_y) y1 = fb_y;
+	if (x2 >= (fb_x + fb_w)) x2 = fb_x + fb_w - 1;
+	if (y2 >= (fb_y + fb_h)) y2 = fb_y + fb_h - 1;
+	if ((x1 > x2) || (y1 > y2)) return;
+	// the whole tile is sent
+	if (drv->fb.tile == 0) _fb_dirty_add(drv, x1, y1, x2, y2);
+}
+
+// Palette index of the color, exact match or the nearest palette color
+//----------------------------------------------------------------------
+static uint8_t IRAM_ATTR _fb_color_index(disp_drv_t *drv, color_t color)
+{
+	const color_t *pal = drv->fb.palette;
+	uint32_t d, best_d = 0xFFFFFFFF;
+	int dr, dg, db, best = 0;
+
+	if ((drv->fb.last_index >= 0) && (color.r == drv->fb.last_color.r) &&
+			(color.g == drv->fb.last_color.g) && (color.b == drv->fb.last_color.b)) return drv->fb.last_index;
+
+	for (int i=0; i<drv->fb.ncolors; i++) {
+		dr = (int)color.r - pal[i].r;
+		dg = (int)color.g - pal[i].g;
+		db = (int)color.b - pal[i].b;
+		d = (dr * dr) + (dg * dg) + (db * db);
+		if (d < best_d) {
+			best_d = d;
+			best = i;
+			if (d == 0) break;
+		}
+	}
+	drv->fb.last_color = color;
+	drv->fb.last_index = best;
+	return best;
+}
+
+// Set the pixel (x,y) of the indexed target, relative to the target area
+//-------------------------------------------------------------------------------
+static inline void _fb_put_index(disp_drv_t *drv, int x, int y, uint8_t index)
+{
+	uint32_t bit = x * fb_depth;
+	uint8_t *p = fb_buf + (y * disp_indexed_row_bytes(fb_w, fb_depth)) + (bit >> 3);
+	uint8_t shift = 8 - fb_depth - (bit & 7);
+	uint8_t mask = ((1 << fb_depth) - 1) << shift;
+
+	*p = (*p & ~mask) | ((index << shift) & mask);
+}
+
+// Get the pixel (x,y) of the indexed target, relative to the target area
+//-----------------------------------------------------------------
+static inline uint8_t _fb_get_index(disp_drv_t *drv, int x, int y)
+{
+	uint32_t bit = x * fb_depth;
+	uint8_t *p = fb_buf + (y * disp_indexed_row_bytes(fb_w, fb_depth)) + (bit >> 3);
+
+	return (*p >> (8 - fb_depth - (bit & 7))) & ((1 << fb_depth) - 1);
+}
+
+// Write 'len' colors (color[0] repeated if 'rep') to the indexed target row 'y' starting at 'x',
+// both relative to the target area
+//---------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _fb_write_indexed(disp_drv_t *drv, int x, int y, color_t *color, uint32_t len, uint8_t rep)
+{
+	uint8_t index = 0;
+	uint8_t gs = gray_scale;
+
+	if (rep) index = _fb_color_index(drv, _src_color(color, 0, gs));
+	for (uint32_t n=0; n<len; n++) {
+		if (rep == 0) index = _fb_color_index(drv, _src_color(color, n, gs));
+		_fb_put_index(drv, x + n, y, index);
+	}
+}
+
+// Write 'len' colors (color[0] repeated if 'rep') to the framebuffer window (x1,y1),(x2,y2)
+// Pixels outside of the framebuffer target area are skipped
+//-------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _fb_write(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t *color, uint8_t rep)
+{
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint32_t row_len = x2-x1+1;
+	int cx1 = ((x1 < fb_x) ? fb_x : x1);
+	int cx2 = ((x2 >= (fb_x + fb_w)) ? (fb_x + fb_w - 1) : x2);
+	uint32_t n, skip;
+	int y = y1;
+
+	if (x1 > x2) return;
+	fb_stats.drawn += len;
+	skip = cx1 - x1;
+	while ((len > 0) && (y <= y2)) {
+		n = ((len > row_len) ? row_len : len);
+		if ((y >= fb_y) && (y < (fb_y + fb_h)) && (cx1 <= cx2) && (skip < n)) {
+			if (fb_depth) _fb_write_indexed(drv, cx1 - fb_x, y - fb_y, (rep ? color : (color + skip)),
+					(((n < (cx2 - x1 + 1)) ? n : (cx2 - x1 + 1)) - skip), rep);
+			else _pack_colors(drv, fb_buf + ((((y - fb_y) * fb_w) + (cx1 - fb_x)) * bpp), (rep ? color : (color + skip)),
+					(((n < (cx2 - x1 + 1)) ? n : (cx2 - x1 + 1)) - skip), rep, gray_scale);
+		}
+		if (rep == 0) color += n;
+		len -= n;
+		y++;
+	}
+	if (y > y1) _fb_written(drv, x1, y1, x2, y-1);
+}
+
+// Convert 'len' framebuffer pixels to colors, as read from the display
+//------------------------------------------------------------------------------------------
+static void IRAM_ATTR _fb_unpack(disp_drv_t *drv, const uint8_t *src, color_t *color, uint32_t len)
+{
+	for (uint32_t n=0; n<len; n++) {
+		if (COLOR_BITS == 16) {
+			color[n].r = src[0] & 0xF8;
+			color[n].g = ((src[0] & 0x07) << 5) | ((src[1] & 0xE0) >> 3);
+			color[n].b = (src[1] & 0x1F) << 3;
+			src += 2;
+		}
+		else {
+			color[n].r = src[0] & 0xFC;
+			color[n].g = src[1] & 0xFC;
+			color[n].b = src[2] & 0xFC;
+			src += 3;
+		}
+	}
+}
+
+// Copy 'size' bytes in display transfer format to the framebuffer window (x1,y1),(x2,y2)
+// starting at byte 'pos' of the row 'y'; 'y' and 'pos' are advanced
+// Pixels outside of the framebuffer target area are skipped
+//--------------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _fb_copy(disp_drv_t *drv, int x1, int x2, int y2, int *y, uint32_t *pos, const uint8_t *data, uint32_t size)
+{
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint32_t row_bytes = (x2-x1+1) * bpp;
+	int cx1 = ((x1 < fb_x) ? fb_x : x1);
+	int cx2 = ((x2 >= (fb_x + fb_w)) ? (fb_x + fb_w - 1) : x2);
+	// part of the window row inside of the target, in bytes
+	uint32_t lo = (cx1 - x1) * bpp;
+	uint32_t hi = (cx2 - x1 + 1) * bpp;
+	uint32_t n, b1, b2, k;
+	color_t color;
+
+	while ((size > 0) && (*y <= y2)) {
+		n = row_bytes - *pos;
+		if (n > size) n = size;
+		if ((*y >= fb_y) && (*y < (fb_y + fb_h)) && (cx1 <= cx2)) {
+			b1 = ((*pos > lo) ? *pos : lo);
+			b2 = (((*pos + n) < hi) ? (*pos + n) : hi);
+			if ((b1 < b2) && (fb_depth)) {
+				// only the pixels with all bytes in this part of the data are written
+				for (k=(b1+bpp-1)/bpp; k<(b2/bpp); k++) {
+					_fb_unpack(drv, data + ((k * bpp) - *pos), &color, 1);
+					_fb_put_index(drv, x1 + k - fb_x, *y - fb_y, _fb_color_index(drv, color));
+				}
+			}
+			else if (b1 < b2) memcpy(fb_buf + ((((*y - fb_y) * fb_w) + (cx1 - fb_x)) * bpp) + (b1 - lo), data + (b1 - *pos), b2 - b1);
+		}
+		data += n;
+		size -= n;
+		*pos += n;
+		if (*pos >= row_bytes) {
+			*pos = 0;
+			(*y)++;
+		}
+	}
+}
+
+// Copy 'size' bytes in display transfer format to the framebuffer window (x1,y1),(x2,y2)
+//-------------------------------------------------------------------------------------------------------------
+static void _fb_write_data(disp_drv_t *drv, int x1, int y1, int x2, int y2, const uint8_t *data, uint32_t size)
+{
+	int y = y1;
+	uint32_t pos = 0;
+
+	if (x1 > x2) return;
+	_fb_copy(drv, x1, x2, y2, &y, &pos, data, size);
+	fb_stats.drawn += size / ((COLOR_BITS == 16) ? 2 : 3);
+	if (pos) y++;
+	if (y > y1) _fb_written(drv, x1, y1, x2, y-1);
+}
+
+// Load the framebuffer from the display RAM
+// If the display can't be read, the framebuffer is cleared and the whole screen is marked dirty
+//-----------------------------------
+static void _fb_load(disp_drv_t *drv)
+{
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	int rows = DISP_READ_BOUNCE_SIZE / (_width * 3);
+	int y, n;
+	esp_err_t res = ESP_ERR_NO_MEM;
+
+	if (rows < 1) rows = 1;
+	uint8_t *rdbuf = disp_dma_alloc((_width * rows * 3) + 4);
+
+	fb_ndirty = 0;
+	if (rdbuf) {
+		for (y=0; y<_height; y+=rows) {
+			n = ((rows > (_height-y)) ? (_height-y) : rows);
+			res = disp_drv_read_data(drv, 0, y, _width-1, y+n-1, _width*n, rdbuf, 1);
+			if (res != ESP_OK) break;
+			// colors read back are already converted, packed without gray scale conversion
+			_pack_colors(drv, fb_buf + (y * _width * bpp), (color_t *)(rdbuf+1), _width*n, 0, 0);
+		}
+		disp_dma_free(rdbuf);
+	}
+	if (res != ESP_OK) {
+		memset(fb_buf, 0, _width * _height * bpp);
+		_fb_dirty_add(drv, 0, 0, _width-1, _height-1);
+	}
+}
+
+// Send the framebuffer rectangle to the display
+// ** Device must already be selected **
+//--------------------------------------------------------------
+static void _fb_send_rect(disp_drv_t *drv, const disp_rect_t *r)
 {
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+
+	disp_drv_send_data_packed(drv, r->x1, r->y1, r->x2 - r->x1 + 1, r->y2 - r->y1 + 1, fb_buf + ((((r->y1 - fb_y) * fb_w) + (r->x1 - fb_x)) * bpp), fb_w);
+}
+
+//===========================================================
+esp_err_t disp_drv_fb_enable(disp_drv_t *drv, uint8_t enable)
+{
+	if (!enable) {
+		if ((fb_buf == NULL) || (drv->fb.tile)) return ESP_OK;
+		disp_drv_fb_flush(drv);
+		fb_on = 0;
+		free(fb_buf);
+		fb_buf = NULL;
+		fb_ndirty = 0;
+		return ESP_OK;
+	}
+
+	if (drv->fb.tile) return ESP_ERR_INVALID_STATE;
+	if (fb_buf) return ESP_OK;
+	if (drv->scroll.vsa) return ESP_ERR_INVALID_STATE;
+
+	uint32_t size = _width * _height * ((COLOR_BITS == 16) ? 2 : 3);
+	fb_buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	if (fb_buf == NULL) fb_buf = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+	if (fb_buf == NULL) return ESP_ERR_NO_MEM;
+	fb_x = 0;
+	fb_y = 0;
+	fb_w = _width;
+	fb_h = _height;
+
+	// Queued transactions are finished, then the screen content is copied
+	disp_drv_queue_flush(drv);
+	_fb_load(drv);
+	fb_on = 1;
+	return ESP_OK;
+}
+
+//==========================================
+esp_err_t disp_drv_fb_flush(disp_drv_t *drv)
+{
+	uint8_t was_selected;
+
+	if ((fb_on == 0) || (fb_ndirty == 0) || (drv->fb.tile)) return ESP_OK;
+
+	was_selected = disp_spi->cfg.selected;
+	if (!was_selected) {
+		if (disp_drv_select(drv) != ESP_OK) return ESP_FAIL;
+	}
+
+	// Pixels are sent to the display while flushing
+	fb_on = 0;
+	_fb_dirty_merge(drv);
+	for (int i=0; i<fb_ndirty; i++) {
+		_fb_send_rect(drv, &fb_dirty[i]);
+		fb_stats.sent += _rect_area(&fb_dirty[i]);
+		fb_stats.rects++;
+	}
+	fb_ndirty = 0;
+	fb_stats.flushes++;
+	fb_on = 1;
+
+	if (!was_selected) disp_drv_deselect(drv);
+	return ESP_OK;
+}
+
+//================================================================================
+void disp_drv_fb_get_stats(disp_drv_t *drv, disp_fb_stats_t *stats, uint8_t reset)
+{
+	if (stats) *stats = fb_stats;
+	if (reset) memset(&fb_stats, 0, sizeof(disp_fb_stats_t));
+}
+
+//======================================================================================
+esp_err_t disp_drv_tile_begin(disp_drv_t *drv, uint8_t *buf, int x, int y, int w, int h)
+{
+	if ((buf == NULL) || (w <= 0) || (h <= 0)) return ESP_ERR_INVALID_ARG;
+	if (drv->fb.tile) return ESP_ERR_INVALID_STATE;
+
+	// the shadow framebuffer target is restored by disp_drv_tile_end(drv)
+	drv->fb.saved.buf = fb_buf;
+	drv->fb.saved.on = fb_on;
+	drv->fb.saved.x = fb_x;
+	drv->fb.saved.y = fb_y;
+	drv->fb.saved.w = fb_w;
+	drv->fb.saved.h = fb_h;
+
+	fb_buf = buf;
+	fb_x = x;
+	fb_y = y;
+	fb_w = w;
+	fb_h = h;
+	fb_depth = 0;
+	drv->fb.tile = 1;
+	fb_on = 1;
+	return ESP_OK;
+}
+
+//==================================================================================================================================================
+esp_err_t disp_drv_tile_begin_indexed(disp_drv_t *drv, uint8_t *buf, int x, int y, int w, int h, uint8_t depth, const color_t *palette, int ncolors)
+{
+	if ((depth != 1) && (depth != 2) && (depth != 4) && (depth != 8)) return ESP_ERR_INVALID_ARG;
+	if ((palette == NULL) || (ncolors <= 0) || (ncolors > (1 << depth))) return ESP_ERR_INVALID_ARG;
+
+	esp_err_t res = disp_drv_tile_begin(drv, buf, x, y, w, h);
+	if (res != ESP_OK) return res;
+	fb_depth = depth;
+	drv->fb.palette = palette;
+	drv->fb.ncolors = ncolors;
+	drv->fb.last_index = -1;
+	return ESP_OK;
+}
+
+//=====================================
+void disp_drv_tile_end(disp_drv_t *drv)
+{
+	if (drv->fb.tile == 0) return;
+	drv->fb.tile = 0;
+	fb_depth = 0;
+	fb_buf = drv->fb.saved.buf;
+	fb_on = drv->fb.saved.on;
+	fb_x = drv->fb.saved.x;
+	fb_y = drv->fb.saved.y;
+	fb_w = drv->fb.saved.w;
+	fb_h = drv->fb.saved.h;
+}
+
+//=====================================================
+uint32_t disp_indexed_row_bytes(int w, uint8_t depth)
+{
+	return ((w * depth) + 7) / 8;
+}
+
+//=======================================================================================================================================================
+uint32_t IRAM_ATTR disp_drv_expand_indexed(disp_drv_t *drv, uint8_t *dst, const uint8_t *src, int x, uint32_t len, uint8_t depth, const uint8_t *palette)
+{
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint8_t mask = (1 << depth) - 1;
+	uint32_t bit = x * depth;
+	const uint8_t *p;
+
+	for (uint32_t n=0; n<len; n++) {
+		if (depth == 8) p = palette + (src[bit >> 3] * bpp);
+		else p = palette + (((src[bit >> 3] >> (8 - depth - (bit & 7))) & mask) * bpp);
+		*dst++ = p[0];
+		*dst++ = p[1];
+		if (bpp == 3) *dst++ = p[2];
+		bit += depth;
+	}
+	return len * bpp;
+}
+
+// Set display pixel at given coordinates to given color
+//--------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_drv_drawPixel(disp_drv_t *drv, int16_t x, int16_t y, color_t color, uint8_t sel)
+{
+	if (fb_on) {
+		_fb_write(drv, x, y, x, y, 1, &color, 1);
+		return;
+	}
 	if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
 
 	if (sel) {
-		if (disp_select()) return;
+		if (disp_drv_select(drv)) return;
 	}
-	else wait_trans_finish(1);
+	else disp_drv_wait_trans_finish(drv, 1);
 
 	uint32_t wd = 0;
+	int bits = 24;
     color_t _color = color;
 	if (gray_scale) _color = color2gs(color);
 
-    taskDISABLE_INTERRUPTS();
-	disp_spi_transfer_addrwin(x, x+1, y, y+1);
-
-	// Send RAM WRITE command
-    gpio_set_level(PIN_NUM_DC, 0);
-    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	disp_spi_write_window(drv, x, x, y, y, 1);
 
-	wd = (uint32_t)_color.r;
-	wd |= (uint32_t)_color.g << 8;
-	wd |= (uint32_t)_color.b << 16;
+	if (COLOR_BITS == 16) {
+		wd = (uint32_t)color2rgb565(_color);
+		bits = 16;
+	}
+	else {
+		wd = (uint32_t)_color.r;
+		wd |= (uint32_t)_color.g << 8;
+		wd |= (uint32_t)_color.b << 16;
+	}
 
     // Set DC to 1 (data mode);
-	gpio_set_level(PIN_NUM_DC, 1);
+	gpio_set_level(drv->dc_pin, 1);
 
 	disp_spi->host->hw->data_buf[0] = wd;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 23;
-	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = bits-1;
+	spi_lobo_start_trans(disp_spi, false);		// Start transfer
+	spi_lobo_spin_trans_done(disp_spi);	// Wait for SPI bus ready
 
-    taskENABLE_INTERRUPTS();
-   if (sel) disp_deselect();
+   if (sel) disp_drv_deselect(drv);
 }
 
-//-----------------------------------------------------------
-static void IRAM_ATTR _dma_send(uint8_t *data, uint32_t size)
+// Send 'size' bytes using the prepared DMA descriptor chain 'desc'
+//-----------------------------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_chain(disp_drv_t *drv, lldesc_t *desc, uint32_t size)
 {
-    //Fill DMA descriptors
     spi_lobo_dmaworkaround_transfer_active(disp_spi->host->dma_chan); //mark channel as active
+    disp_spi->host->hw->user.usr_mosi_highpart=0;
+    disp_spi->host->hw->dma_out_link.addr=(int)(&desc[0]) & 0xFFFFF;
+    disp_spi->host->hw->dma_out_link.start=1;
+    disp_spi->host->hw->user.usr_mosi_highpart=0;
+
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (size * 8) - 1;
+
+	_dma_sending = 1;
+	// Start transfer
+	spi_lobo_start_trans(disp_spi, true);
+}
+
+//-----------------------------------------------------------------------------
+static void IRAM_ATTR _dma_send(disp_drv_t *drv, uint8_t *data, uint32_t size)
+{
+    //Fill DMA descriptors
     spi_lobo_setup_dma_desc_links(disp_spi->host->dmadesc_tx, size, data, false);
+    _dma_send_chain(drv, disp_spi->host->dmadesc_tx, size);
+}
+
+// Send 'size' bytes repeating the 'pattern' buffer using the circular DMA descriptor chain
+// The whole fill is one spi transaction, no CPU work is needed while sending
+//-------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_loop(disp_drv_t *drv, uint8_t *pattern, uint32_t pat_size, uint32_t size)
+{
+	int ndesc = disp_spi->host->max_transfer_sz / SPI_MAX_DMA_LEN;
+	if (ndesc > 2) ndesc = 2;
+
+    spi_lobo_dmaworkaround_transfer_active(disp_spi->host->dma_chan); //mark channel as active
+    spi_lobo_setup_dma_desc_loop(disp_spi->host->dmadesc_tx, ndesc, pattern, pat_size);
     disp_spi->host->hw->user.usr_mosi_highpart=0;
     disp_spi->host->hw->dma_out_link.addr=(int)(&disp_spi->host->dmadesc_tx[0]) & 0xFFFFF;
     disp_spi->host->hw->dma_out_link.start=1;
-    disp_spi->host->hw->user.usr_mosi_highpart=0;
 
 	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (size * 8) - 1;
 
 	_dma_sending = 1;
 	// Start transfer
-	disp_spi->host->hw->cmd.usr = 1;
+	spi_lobo_start_trans(disp_spi, true);
 }
 
-//---------------------------------------------------------------------------
-static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
+// Send up to 512 bits of color data using SPI data buffer
+//--------------------------------------------------------------------------------------------
+static void IRAM_ATTR _direct_send(disp_drv_t *drv, color_t *color, uint32_t len, uint8_t rep)
 {
-	uint32_t cidx = 0;	// color buffer index
-	uint32_t wd = 0;
-	int idx = 0;
-	int bits = 0;
-	int wbits = 0;
-
-    taskDISABLE_INTERRUPTS();
-	color_t _color = color[0];
-	if ((rep) && (gray_scale)) _color = color2gs(color[0]);
-
-	while (len) {
-		// ** Get color data from color buffer **
-		if (rep == 0) {
-			if (gray_scale) _color = color2gs(color[cidx]);
-			else _color = color[cidx];
-		}
-
-		wd |= (uint32_t)_color.r << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
-		}
-		wd |= (uint32_t)_color.g << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
-		}
-		wd |= (uint32_t)_color.b << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+	uint32_t wbuf[16];
+	uint32_t bytes;
+
+	bytes = _pack_colors(drv, (uint8_t *)wbuf, color, len, rep, gray_scale);
+
+	if (bytes) {
+		spi_lobo_wait_trans_done(disp_spi);							// Wait for SPI bus ready
+		for (int idx=0; idx<((bytes+3)/4); idx++) {
+			disp_spi->host->hw->data_buf[idx] = wbuf[idx];
 		}
-    	len--;					// Decrement colors counter
-        if (rep == 0) cidx++;	// if not repeating color, increment color buffer index
-    }
-	if (bits) {
-		while (disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
-		disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = bits-1;	// set number of bits to be sent
-        disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+		disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (bytes*8)-1;	// set number of bits to be sent
+        spi_lobo_start_trans(disp_spi, false);							// Start transfer
+	}
+}
+
+// Send color buffer converted to the display transfer format (RGB565 and/or gray scale)
+// using DMA transfer from the driver staging buffer; the source buffer is not changed.
+// Two halves of the staging buffer are used alternately,
+// the next chunk is converted while the previous one is being sent
+//--------------------------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_converted(disp_drv_t *drv, color_t *color, uint32_t len)
+{
+	uint32_t buf_colors, half_bytes, n, bytes;
+	uint8_t *dest;
+	uint8_t idx = 0;
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+
+	buf_colors = ((len > _width) ? _width : len);
+	// keep the second half 32-bit aligned
+	half_bytes = ((buf_colors * bpp) + 3) & ~3;
+
+	disp_drv_wait_trans_finish(drv, 1);
+	trans_cline = disp_dma_alloc(half_bytes*2);
+	if (trans_cline == NULL) return;
+
+	while (len > 0) {
+		n = ((len > buf_colors) ? buf_colors : len);
+		dest = trans_cline + (idx * half_bytes);
+		bytes = _pack_colors(drv, dest, color, n, 0, gray_scale);
+		disp_drv_wait_trans_finish(drv, 0);
+		_dma_send(drv, dest, bytes);
+		color += n;
+		len -= n;
+		idx ^= 1;
 	}
-    taskENABLE_INTERRUPTS();
 }
 
 // ================================================================
 // === Main function to send data to display ======================
 // If  rep==true:  repeat sending color data to display 'len' times
 // If rep==false:  send 'len' color data from color buffer to display
-// ** Device must already be selected and address window set **
+// ** Device must already be selected and RAM write started (disp_spi_write_window) **
 // ================================================================
-//----------------------------------------------------------------------------------------------
-static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t rep, uint8_t wait)
+//---------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _TFT_pushColorRep(disp_drv_t *drv, color_t *color, uint32_t len, uint8_t rep, uint8_t wait)
 {
 	if (len == 0) return;
 	if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
 
-	// Send RAM WRITE command
-    gpio_set_level(PIN_NUM_DC, 0);
-    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
-
-	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
+	if ((len*COLOR_BITS) <= 512) {
 
-	if ((len*24) <= 512) {
-
-		_direct_send(color, len, rep);
+		_direct_send(drv, color, len, rep);
 
 	}
 	else if (rep == 0)  {
 		// ==== use DMA transfer ====
-		// ** Prepare data
-		if (gray_scale) {
-			for (int n=0; n<len; n++) {
-				color[n] = color2gs(color[n]);
-			}
-	    }
+		if ((COLOR_BITS == 16) || (gray_scale)) {
+			// ** Convert through the staging buffer
+			_dma_send_converted(drv, color, len);
+			if (wait) disp_drv_wait_trans_finish(drv, 1);
+			return;
+		}
 
-	    _dma_send((uint8_t *)color, len*3);
+	    _dma_send(drv, (uint8_t *)color, len*3);
 	}
 	else {
 		// ==== Repeat color, more than 512 bits total ====
+		// ==== The fill pattern is sent in one transaction using circular DMA chain ====
+
+		uint32_t to_send, n;
+		uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
 
-		color_t _color;
-		uint32_t buf_colors;
-		int buf_bytes, to_send;
+		// Wait for the previous fill using the pattern buffer to finish
+		disp_drv_wait_trans_finish(drv, 1);
+		// Fill pattern buffer with fill color
+		_pack_colors(drv, fill_pattern, color, FILL_PATTERN_SIZE / bpp, 1, gray_scale);
 
-		/*
-		to_send = len;
+		// Send 'len' colors, split only if more than 2^24 bits
+		to_send = len * bpp;
 		while (to_send > 0) {
-			wait_trans_finish(0);
-			_direct_send(color, ((to_send > 21) ? 21 : to_send), rep);
-			to_send -= 21;
+			n = ((to_send > FILL_MAX_BYTES) ? FILL_MAX_BYTES : to_send);
+			disp_drv_wait_trans_finish(drv, 0);
+			_dma_send_loop(drv, fill_pattern, FILL_PATTERN_SIZE, n);
+			to_send -= n;
 		}
-		*/
+	}
 
-		buf_colors = ((len > (_width*2)) ? (_width*2) : len);
-		buf_bytes = buf_colors * 3;
+	if (wait) disp_drv_wait_trans_finish(drv, 1);
+}
+
+// Number of whole rows of 'row_len' pixels sent between bus releases
+// Returns 0 if no higher priority device on the spi bus has a latency target
+//-------------------------------------------------------------------------
+static uint32_t IRAM_ATTR _slice_rows(disp_drv_t *drv, uint32_t row_len)
+{
+	uint32_t slice = spi_lobo_bus_slice_bytes(disp_spi) / ((COLOR_BITS == 16) ? 2 : 3);
+
+	if (slice == 0) return 0;
+	return ((slice > row_len) ? (slice / row_len) : 1);
+}
+
+// Write 'len' pixels of the same color to TFT 'window' (x1,y2),(x2,y2)
+// If higher priority devices on the spi bus have latency targets, the pixels are sent
+// in slices of whole rows and the bus is released to waiting devices between slices
+//--------------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _send_rep_sliced(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t color, uint8_t wait)
+{
+	uint32_t row_len = x2-x1+1;
+	uint32_t slice = _slice_rows(drv, row_len) * row_len;
+	uint32_t n, max;
+
+	if ((slice == 0) || (len <= slice)) slice = len;
+
+	while (len > 0) {
+		n = ((len > slice) ? slice : len);
+		// scrolled window is split where the lines are not consecutive in GRAM
+		max = disp_drv_scroll_rows(drv, y1, y2) * row_len;
+		if (n > max) n = max;
+		// ** Send address window & RAM WRITE command **
+		// the stream is continued if the bus was not released
+		disp_spi_write_window(drv, x1, x2, y1, y2, n);
+		_TFT_pushColorRep(drv, &color, n, 1, 0);
+		len -= n;
+		y1 += n / row_len;
+		if (len) disp_drv_bus_yield(drv);
+	}
+	if (wait) disp_drv_wait_trans_finish(drv, 1);
+}
+
+// Write 'len' color data to TFT 'window' (x1,y2),(x2,y2)
+//----------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_drv_pushColorRep(disp_drv_t *drv, int x1, int y1, int x2, int y2, color_t color, uint32_t len)
+{
+	if (len == 0) return;
+	if (fb_on) {
+		_fb_write(drv, x1, y1, x2, y2, len, &color, 1);
+		return;
+	}
+	if (disp_drv_select(drv) != ESP_OK) return;
 
-		// Prepare color buffer of maximum 2 color lines
-		trans_cline = heap_caps_malloc(buf_bytes, MALLOC_CAP_DMA);
-		if (trans_cline == NULL) return;
+	_send_rep_sliced(drv, x1, y1, x2, y2, len, color, 1);
 
-		// Prepare fill color
-		if (gray_scale) _color = color2gs(color[0]);
-		else _color = color[0];
+	disp_drv_deselect(drv);
+}
 
-		// Fill color buffer with fill color
-		for (uint32_t i=0; i<buf_colors; i++) {
-			trans_cline[i] = _color;
+// Write 'len' color data to TFT 'window' (x1,y2),(x2,y2) from given buffer
+// Like the repeated fills, large writes are sliced and the bus released between slices
+// ** Device must already be selected **
+//------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_drv_send_data(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
+{
+	uint32_t row_len = x2-x1+1;
+	uint32_t slice = _slice_rows(drv, row_len) * row_len;
+	uint32_t n;
+
+	if (fb_on) {
+		_fb_write(drv, x1, y1, x2, y2, len, buf, 0);
+		return;
+	}
+	while (len > 0) {
+		// scrolled window is split where the lines are not consecutive in GRAM
+		n = disp_drv_scroll_rows(drv, y1, y2) * row_len;
+		if (n > len) n = len;
+		if ((slice) && (n > slice)) n = slice;
+		// ** Send address window & RAM WRITE command **
+		disp_spi_write_window(drv, x1, x2, y1, y2, n);
+		_TFT_pushColorRep(drv, buf, n, 0, 0);
+		buf += n;
+		len -= n;
+		y1 += n / row_len;
+		if ((slice) && (len)) disp_drv_bus_yield(drv);
+	}
+}
+
+// Write 'len' pixels of the same color to TFT 'window' (x1,y2),(x2,y2)
+// ** Device must already be selected **
+//-----------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_drv_send_data_rep(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t color)
+{
+	if (len == 0) return;
+	if (fb_on) {
+		_fb_write(drv, x1, y1, x2, y2, len, &color, 1);
+		return;
+	}
+	_send_rep_sliced(drv, x1, y1, x2, y2, len, color, 0);
+}
+
+// Return the number of bytes of the segment which can be sent by DMA from its own buffer
+//--------------------------------------------------------------------------
+static uint32_t IRAM_ATTR _sg_direct_len(const uint8_t *data, uint32_t len)
+{
+	if ((len < DISP_SG_DIRECT_MIN) || (((uint32_t)data & 3) != 0) || (!esp_ptr_dma_capable(data))) return 0;
+	return len & ~3;
+}
+
+// Check if the repeated segment can be sent using the circular DMA descriptor chain
+//------------------------------------------------------------
+static uint8_t IRAM_ATTR _sg_is_loop(const disp_seg_t *seg)
+{
+	return ((seg->repeat >= DISP_SG_LOOP_MIN) && (seg->len <= SPI_MAX_DMA_LEN) &&
+			(_sg_direct_len(seg->data, seg->len) == seg->len));
+}
+
+// Add the staged data to the descriptor chain
+//---------------------------------------------------
+static void IRAM_ATTR _sg_add_staged(disp_drv_t *drv)
+{
+	if (sg.st_pos > sg.st_start) {
+		sg.used = spi_lobo_dma_desc_append(sg_desc[sg.set], DISP_SG_DESC, sg.used, sg.stage + sg.st_start, sg.st_pos - sg.st_start);
+		sg.bytes += sg.st_pos - sg.st_start;
+		sg.st_start = sg.st_pos;
+	}
+}
+
+// Send the descriptor chain and switch to the other descriptor set and stage half
+//---------------------------------------------
+static void IRAM_ATTR _sg_send(disp_drv_t *drv)
+{
+	_sg_add_staged(drv);
+	if (sg.bytes == 0) return;
+
+	disp_drv_wait_trans_finish(drv, 0);
+	_dma_send_chain(drv, sg_desc[sg.set], sg.bytes);
+
+	sg.set ^= 1;
+	sg.used = 0;
+	sg.bytes = 0;
+	sg.st_start = 0;
+	sg.st_pos = 0;
+	if (sg.stage) sg.stage = trans_cline + (sg.set * DISP_SG_STAGE);
+}
+
+// Copy 'len' bytes to the stage buffer
+//---------------------------------------------------------------------------------
+static void IRAM_ATTR _sg_stage(disp_drv_t *drv, const uint8_t *data, uint32_t len)
+{
+	uint32_t n, max;
+
+	while (len > 0) {
+		max = FILL_MAX_BYTES - sg.bytes - (sg.st_pos - sg.st_start);
+		if (max > (DISP_SG_STAGE - sg.st_pos)) max = DISP_SG_STAGE - sg.st_pos;
+		if (max == 0) {
+			_sg_send(drv);
+			continue;
 		}
+		n = ((len > max) ? max : len);
+		memcpy(sg.stage + sg.st_pos, data, n);
+		sg.st_pos += n;
+		data += n;
+		len -= n;
+	}
+}
 
-		// Send 'len' colors
-		to_send = len;
-		while (to_send > 0) {
-			wait_trans_finish(0);
-			_dma_send((uint8_t *)trans_cline, ((to_send > buf_colors) ? buf_bytes : (to_send*3)));
-			to_send -= buf_colors;
+// Add 'len' bytes from DMA capable, 32-bit aligned buffer to the descriptor chain
+// 'len' must be multiple of 4
+//----------------------------------------------------------------------------------
+static void IRAM_ATTR _sg_direct(disp_drv_t *drv, const uint8_t *data, uint32_t len)
+{
+	int avail;
+	uint32_t n, max;
+
+	while (len > 0) {
+		// Staged data must end on 32-bit boundary to be followed by another buffer
+		if ((sg.st_pos - sg.st_start) & 3) _sg_send(drv);
+		else _sg_add_staged(drv);
+
+		// one descriptor is always kept free for the staged data
+		avail = DISP_SG_DESC - 1 - sg.used;
+		max = (FILL_MAX_BYTES - sg.bytes) & ~3;
+		if ((avail <= 0) || (max == 0)) {
+			_sg_send(drv);
+			continue;
+		}
+		if (max > (avail * SPI_MAX_DMA_LEN)) max = avail * SPI_MAX_DMA_LEN;
+		n = ((len > max) ? max : len);
+		sg.used = spi_lobo_dma_desc_append(sg_desc[sg.set], DISP_SG_DESC, sg.used, data, n);
+		sg.bytes += n;
+		data += n;
+		len -= n;
+	}
+}
+
+// Write the pixel data segments to TFT 'window' (x1,y2),(x2,y2) as one RAM WRITE stream
+// Segments are gathered by DMA from their own buffers when possible, the rest is copied
+// to the stage buffer; repeated segments are sent using circular DMA descriptor chain
+// ** Device must already be selected **
+//---------------------------------------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_send_data_sg(disp_drv_t *drv, int x1, int y1, int x2, int y2, const disp_seg_t *segs, int nsegs)
+{
+	uint32_t total = 0, rep, direct, n;
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	uint8_t need_stage = 0;
+	uint8_t *stage = NULL;
+	const disp_seg_t *seg;
+
+	if ((segs == NULL) || (nsegs <= 0)) return ESP_ERR_INVALID_ARG;
+	if (fb_on) {
+		// ** Copy the segments to the framebuffer
+		int y = y1;
+		uint32_t pos = 0;
+		for (int i=0; i<nsegs; i++) {
+			if ((segs[i].len) && (segs[i].data == NULL)) return ESP_ERR_INVALID_ARG;
+			rep = ((segs[i].repeat > 1) ? segs[i].repeat : 1);
+			while (rep--) _fb_copy(drv, x1, x2, y2, &y, &pos, segs[i].data, segs[i].len);
+		}
+		if (pos) y++;
+		total = (y - y1) * (x2 - x1 + 1);
+		fb_stats.drawn += total;
+		if (y > y1) _fb_written(drv, x1, y1, x2, y-1);
+		return ESP_OK;
+	}
+	if ((!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) || (disp_spi->host->dma_chan == 0)) return ESP_ERR_NOT_SUPPORTED;
+
+	for (int i=0; i<nsegs; i++) {
+		seg = &segs[i];
+		if (seg->len == 0) continue;
+		if (seg->data == NULL) return ESP_ERR_INVALID_ARG;
+		rep = ((seg->repeat > 1) ? seg->repeat : 1);
+		total += seg->len * rep;
+		if ((!_sg_is_loop(seg)) && (_sg_direct_len(seg->data, seg->len) < seg->len)) need_stage = 1;
+	}
+	if (total == 0) return ESP_OK;
+	if (total % bpp) return ESP_ERR_INVALID_SIZE;
+	// the window must be stored in consecutive GRAM lines
+	if (disp_drv_scroll_rows(drv, y1, y2) < (y2 - y1 + 1)) return ESP_ERR_NOT_SUPPORTED;
+
+	disp_drv_wait_trans_finish(drv, 1);
+	if (need_stage) {
+		stage = disp_dma_alloc(DISP_SG_STAGE*2);
+		if (stage == NULL) return ESP_ERR_NO_MEM;
+	}
+
+	// ** Send address window & RAM WRITE command **
+	disp_spi_write_window(drv, x1, x2, y1, y2, total / bpp);
+	trans_cline = stage;
+
+	sg.set = 0;
+	sg.used = 0;
+	sg.bytes = 0;
+	sg.st_start = 0;
+	sg.st_pos = 0;
+	sg.stage = stage;
+
+	for (int i=0; i<nsegs; i++) {
+		seg = &segs[i];
+		if (seg->len == 0) continue;
+		if (_sg_is_loop(seg)) {
+			// ** Send the chain built so far, then the repeated segment in its own transaction
+			_sg_send(drv);
+			total = seg->len * seg->repeat;
+			while (total > 0) {
+				// split on pattern boundary only if more than 2^24 bits
+				n = (FILL_MAX_BYTES / seg->len) * seg->len;
+				if (n > total) n = total;
+				disp_drv_wait_trans_finish(drv, 0);
+				_dma_send_loop(drv, (uint8_t *)seg->data, seg->len, n);
+				total -= n;
+			}
+			continue;
+		}
+		rep = ((seg->repeat > 1) ? seg->repeat : 1);
+		direct = _sg_direct_len(seg->data, seg->len);
+		while (rep--) {
+			if (direct) _sg_direct(drv, seg->data, direct);
+			if (direct < seg->len) _sg_stage(drv, seg->data + direct, seg->len - direct);
+		}
+	}
+	_sg_send(drv);
+
+	return ESP_OK;
+}
+
+// Write the 'w' x 'h' rectangle of pixels in display transfer format from 'buf' (rows of 'stride' pixels)
+// to the screen at (x,y); consecutive rows are sent in one scatter-gather DMA transfer
+// The rows are sliced and the bus released between slices as in disp_drv_send_data()
+// ** Device must already be selected **
+//------------------------------------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_send_data_packed(disp_drv_t *drv, int x, int y, int w, int h, const uint8_t *buf, int stride)
+{
+	disp_seg_t segs[DISP_FB_SEND_ROWS];
+	uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+	color_t *line = NULL;
+	esp_err_t ret = ESP_OK;
+	int r, n, i;
+	int slice = _slice_rows(drv, w);
+
+	if ((buf == NULL) || (w <= 0) || (h <= 0)) return ESP_ERR_INVALID_ARG;
+	if (fb_on) {
+		for (r=0; r<h; r++) {
+			_fb_write_data(drv, x, y+r, x+w-1, y+r, buf + (r * stride * bpp), w * bpp);
+		}
+		return ESP_OK;
+	}
+
+	for (r=0; r<h; r+=n) {
+		if ((slice) && (r)) disp_drv_bus_yield(drv);
+		if (stride == w) {
+			// rows are consecutive in the buffer
+			n = h - r;
+			if ((slice) && (n > slice)) n = slice;
+			segs[0].data = buf + (r * w * bpp);
+			segs[0].len = n * w * bpp;
+			segs[0].repeat = 0;
+			i = 1;
+		}
+		else {
+			n = (((h - r) > DISP_FB_SEND_ROWS) ? DISP_FB_SEND_ROWS : (h - r));
+			if ((slice) && (n > slice)) n = slice;
+			for (i=0; i<n; i++) {
+				segs[i].data = buf + ((r + i) * stride * bpp);
+				segs[i].len = w * bpp;
+				segs[i].repeat = 0;
+			}
+		}
+		if (line == NULL) {
+			ret = disp_drv_send_data_sg(drv, x, y+r, x+w-1, y+r+n-1, segs, i);
+			if (ret == ESP_OK) continue;
+			if (ret != ESP_ERR_NOT_SUPPORTED) break;
+			// ** No DMA or scrolled window, send the converted rows
+			line = disp_dma_alloc(w * 3);
+			if (line == NULL) {
+				ret = ESP_ERR_NO_MEM;
+				break;
+			}
+		}
+		for (i=0; i<n; i++) {
+			disp_drv_wait_trans_finish(drv, 1);
+			_fb_unpack(drv, buf + ((r + i) * stride * bpp), line, w);
+			disp_drv_send_data(drv, x, y+r+i, x+w-1, y+r+i, w, line);
+		}
+		ret = ESP_OK;
+	}
+	disp_drv_wait_trans_finish(drv, 1);
+	if (line) disp_dma_free(line);
+	return ret;
+}
+
+// ==== Transformed writes using the panel memory access order ====
+
+// Map display coordinates in the orientation set by 'madctl' to the panel GRAM coordinates
+//------------------------------------------------------------------------------------------
+static void _madctl_to_gram(disp_drv_t *drv, uint8_t madctl, int x, int y, int *gx, int *gy)
+{
+	int gw = ((_width < _height) ? _width : _height);	// GRAM columns
+	int gh = ((_width < _height) ? _height : _width);	// GRAM rows
+	int t;
+
+	if (madctl & MADCTL_MV) {
+		t = x;
+		x = y;
+		y = t;
+	}
+	*gx = ((madctl & MADCTL_MX) ? (gw-1-x) : x);
+	*gy = ((madctl & MADCTL_MY) ? (gh-1-y) : y);
+}
+
+// Map the panel GRAM coordinates to display coordinates in the orientation set by 'madctl'
+//------------------------------------------------------------------------------------------
+static void _gram_to_madctl(disp_drv_t *drv, uint8_t madctl, int gx, int gy, int *x, int *y)
+{
+	int gw = ((_width < _height) ? _width : _height);
+	int gh = ((_width < _height) ? _height : _width);
+
+	if (madctl & MADCTL_MX) gx = gw-1-gx;
+	if (madctl & MADCTL_MY) gy = gh-1-gy;
+	if (madctl & MADCTL_MV) {
+		*x = gy;
+		*y = gx;
+	}
+	else {
+		*x = gx;
+		*y = gy;
+	}
+}
+
+//=================================================================================================
+void disp_xform_point(int w, int h, uint8_t xform, int sx, int sy, int *dx, int *dy)
+{
+	if (xform & DISP_XFORM_FLIPX) sx = w-1-sx;
+	if (xform & DISP_XFORM_FLIPY) sy = h-1-sy;
+	switch (xform & 3) {
+		case DISP_XFORM_ROT90:
+			*dx = h-1-sy;
+			*dy = sx;
+			break;
+		case DISP_XFORM_ROT180:
+			*dx = w-1-sx;
+			*dy = h-1-sy;
+			break;
+		case DISP_XFORM_ROT270:
+			*dx = sy;
+			*dy = w-1-sx;
+			break;
+		default:
+			*dx = sx;
+			*dy = sy;
+	}
+}
+
+// Write 'w' x 'h' pixels from 'buf' (rows of 'stride' pixels) transformed by 'xform' to the screen
+// rectangle with top left corner at (x,y). The panel memory access order is changed for the write,
+// so the pixels are sent in source order at full speed; orientation and window are restored after
+// ** Device must already be selected **
+//--------------------------------------------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR disp_drv_send_data_xform(disp_drv_t *drv, int x, int y, int w, int h, color_t *buf, int stride, uint8_t xform)
+{
+	uint8_t madctl = drv->madctl;
+	uint8_t wr_madctl = 0;
+	int gx, gy, dx, dy, x1 = 0, y1 = 0, x2, y2, i, k;
+
+	if ((w <= 0) || (h <= 0)) return ESP_OK;
+	// GRAM lines are translated in the current orientation only
+	if (drv->scroll.pos) return ESP_ERR_INVALID_STATE;
+	// transformed pixels are written to the framebuffer by the caller
+	if (fb_on) return ESP_ERR_NOT_SUPPORTED;
+
+	// Find the memory access order in which the source pixels (0,0),(1,0),(0,1)
+	// are written to successive columns and rows of the window
+	for (i=0; i<8; i++) {
+		wr_madctl = (madctl & ~(MADCTL_MV | MADCTL_MX | MADCTL_MY)) |
+				((i & 1) ? MADCTL_MX : 0) | ((i & 2) ? MADCTL_MY : 0) | ((i & 4) ? MADCTL_MV : 0);
+		for (k=0; k<3; k++) {
+			disp_xform_point(w, h, xform, (k == 1), (k == 2), &dx, &dy);
+			_madctl_to_gram(drv, madctl, x+dx, y+dy, &gx, &gy);
+			_gram_to_madctl(drv, wr_madctl, gx, gy, &x2, &y2);
+			if (k == 0) {
+				x1 = x2;
+				y1 = y2;
+			}
+			else if ((x2 != (x1 + (k == 1))) || (y2 != (y1 + (k == 2)))) break;
+		}
+		if (k == 3) break;
+	}
+	if (i == 8) return ESP_ERR_NOT_FOUND;
+
+	disp_drv_wait_trans_finish(drv, 1);
+	if (wr_madctl != madctl) disp_drv_transfer_cmd_data(drv, TFT_MADCTL, &wr_madctl, 1);
+
+	// ** Send address window & RAM WRITE command, the source rows are streamed in order
+	disp_spi_transfer_addrwin(drv, x1, x1+w-1, y1, y1+h-1);
+	_send_ramwr(drv);
+	if (stride == w) _TFT_pushColorRep(drv, buf, w*h, 0, 1);
+	else {
+		for (i=0; i<h; i++) {
+			_TFT_pushColorRep(drv, buf + (i*stride), w, 0, 1);
+			disp_drv_wait_trans_finish(drv, 1);
+		}
+	}
+	disp_drv_wait_trans_finish(drv, 1);
+
+	// ** Restore the orientation, the window cache is invalidated
+	if (wr_madctl != madctl) disp_drv_transfer_cmd_data(drv, TFT_MADCTL, &madctl, 1);
+	disp_drv_addrwin_invalidate(drv);
+	return ESP_OK;
+}
+
+// Convert 'len' colors from color buffer to the display transfer format
+//----------------------------------------------------------------------------------------
+uint32_t disp_drv_pack_colors(disp_drv_t *drv, uint8_t *buf, color_t *color, uint32_t len)
+{
+	return _pack_colors(drv, buf, color, len, 0, gray_scale);
+}
+
+// ==== Display transaction queue =================================
+// The first transfer is started by the task submitting the transaction.
+// If the spi host has the 'transaction done' interrupt, the following
+// data chunks and transactions are started from the interrupt until the
+// queue drains. Otherwise they are started whenever one of the queue
+// functions is called and the spi bus is not busy. The display stays
+// selected while transactions are pending and is released by the task
+// (the bus mutex owner) in the next queue or display select call.
+// ================================================================
+
+// Queue count and running state shared with the interrupt
+static portMUX_TYPE dq_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Start the next transfer of the queue, the previous one must be finished
+// and the display selected; used by the task and by the interrupt
+// Returns 0 if the queue is empty
+//---------------------------------------------
+static int IRAM_ATTR _dq_next(disp_drv_t *drv)
+{
+	disp_trans_t *t;
+	uint32_t size;
+
+	_dma_reset(drv);
+	while (dq_count) {
+		t = &disp_queue[dq_tail];
+		if ((dq_active) && (t->sent >= t->size)) {
+			// Transaction finished
+			dq_fence_done = t->fence;
+			dq_tail = (dq_tail + 1) % DISP_QUEUE_SIZE;
+			dq_active = 0;
+			portENTER_CRITICAL_ISR(&dq_mux);
+			dq_count--;
+			portEXIT_CRITICAL_ISR(&dq_mux);
+			continue;
+		}
+
+		if (dq_active == 0) {
+			// Send address window & RAM WRITE command
+			disp_spi_transfer_addrwin(drv, t->x1, t->x2, t->y1, t->y2);
+			_send_ramwr(drv);
+			dq_active = 1;
+		}
+
+		// Start sending the next data chunk, accounted before the interrupt can see it finished
+		size = t->size - t->sent;
+		if (size > disp_spi->host->max_transfer_sz) size = disp_spi->host->max_transfer_sz;
+		t->sent += size;
+		if (dq_running) spi_lobo_done_intr_arm(disp_spi);
+		_dma_send(drv, t->data + t->sent - size, size);
+		return 1;
+	}
+	return 0;
+}
+
+// 'Transaction done' interrupt callback, continues the queue of the display 'arg'
+// and stops chaining when the queue is empty
+//----------------------------------------------------------------------
+static void IRAM_ATTR _disp_queue_intr(void *arg, BaseType_t *do_yield)
+{
+	disp_drv_t *drv = (disp_drv_t *)arg;
+
+	while (_dq_next(drv) == 0) {
+		// transaction queued meanwhile is started, the submitting task saw the queue running
+		portENTER_CRITICAL_ISR(&dq_mux);
+		if (dq_count == 0) {
+			spi_lobo_set_done_cb(disp_spi, NULL, NULL);
+			dq_running = 0;
+		}
+		portEXIT_CRITICAL_ISR(&dq_mux);
+		if (dq_running == 0) break;
+	}
+	// the task waiting in _disp_queue_block() is woken by the spi driver
+}
+
+// Block the calling task until the interrupt finishes a transaction or the queue drains
+//-------------------------------------------------
+static void _disp_queue_block(disp_drv_t *drv)
+{
+	// the signal of an interrupt before the call is kept, the caller checks the queue again
+	if (dq_running) spi_lobo_wait_done_signal(disp_spi, 1 + (10 / portTICK_PERIOD_MS));
+}
+
+// Process the transaction queue
+// If wait==true, wait until all transactions are finished
+//---------------------------------------------------------------------------
+static esp_err_t IRAM_ATTR _disp_queue_process(disp_drv_t *drv, uint8_t wait)
+{
+
+	while ((dq_count) || (dq_running)) {
+		if (dq_running) {
+			// transfers are started by the interrupt
+			if (wait == 0) return ESP_OK;
+			_disp_queue_block(drv);
+			continue;
+		}
+		if (disp_spi->host->hw->cmd.usr) {
+			if (wait == 0) return ESP_OK;	// previous transfer still running
+			disp_drv_wait_trans_finish(drv, 0);
+		}
+		if (dq_selected == 0) {
+			if (spi_lobo_device_select(disp_spi, 0) != ESP_OK) return ESP_ERR_TIMEOUT;
+			dq_selected = 1;
+		}
+		// Hand the queue over to the interrupt if the spi host has it
+		if ((dq_active == 0) && (spi_lobo_set_done_cb(disp_spi, _disp_queue_intr, drv) == ESP_OK)) dq_running = 1;
+		if (_dq_next(drv) == 0) break;
+	}
+
+	// Queue is empty, release the display
+	if ((dq_selected) && (dq_running == 0) && (disp_spi->host->hw->cmd.usr == 0)) {
+		disp_drv_wait_trans_finish(drv, 0);
+		spi_lobo_device_deselect(disp_spi);
+		dq_selected = 0;
+	}
+	return ESP_OK;
+}
+
+// Wait for free queue slot
+//-------------------------------------------------------------
+static esp_err_t IRAM_ATTR _disp_queue_reserve(disp_drv_t *drv)
+{
+	while (dq_count >= DISP_QUEUE_SIZE) {
+		if (dq_running) {
+			_disp_queue_block(drv);
+			continue;
+		}
+		if (disp_spi->host->hw->cmd.usr) disp_drv_wait_trans_finish(drv, 0);
+		if (_disp_queue_process(drv, 0) != ESP_OK) return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+// Add the transaction to the queue, the window is translated to the scrolled GRAM lines
+//----------------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR _disp_queue_add(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint8_t *data, uint32_t size, uint32_t fence)
+{
+	disp_trans_t *t = &disp_queue[dq_head];
+	t->x1 = x1;
+	t->y1 = _scroll_line(drv, y1);
+	t->x2 = x2;
+	t->y2 = t->y1 + (y2 - y1);
+	t->data = data;
+	t->size = size;
+	t->sent = 0;
+	t->fence = fence;
+
+	dq_head = (dq_head + 1) % DISP_QUEUE_SIZE;
+	portENTER_CRITICAL(&dq_mux);
+	dq_count++;
+	portEXIT_CRITICAL(&dq_mux);
+}
+
+// Queue pixel data for sending to the display window (x1,y1),(x2,y2)
+//---------------------------------------------------------------------------------------------------------
+uint32_t disp_drv_queue_send(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint8_t *data, uint32_t size)
+{
+	if ((data == NULL) || (size == 0)) return 0;
+	if (fb_on) {
+		// written to the framebuffer, the fence is finished immediately
+		_fb_write_data(drv, x1, y1, x2, y2, data, size);
+		dq_fence_submitted++;
+		if (dq_fence_submitted == 0) dq_fence_submitted = 1;
+		dq_fence_done = dq_fence_submitted;
+		return dq_fence_submitted;
+	}
+	if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return 0;
+	if ((dq_selected == 0) && (disp_spi->cfg.selected)) return 0;	// display is selected by the caller
+
+	if (_disp_queue_reserve(drv) != ESP_OK) return 0;
+
+	// Scrolled window is split where the lines are not consecutive in GRAM,
+	// only the last part gets the new fence id
+	uint32_t row_bytes = (x2-x1+1) * ((COLOR_BITS == 16) ? 2 : 3);
+	uint32_t n;
+	int rows;
+	while (1) {
+		rows = disp_drv_scroll_rows(drv, y1, y2);
+		n = rows * row_bytes;
+		if (n >= size) break;
+
+		_disp_queue_add(drv, x1, y1, x2, y1+rows-1, data, n, dq_fence_submitted);
+		data += n;
+		size -= n;
+		y1 += rows;
+		if (_disp_queue_reserve(drv) != ESP_OK) return 0;
+	}
+
+	dq_fence_submitted++;
+	if (dq_fence_submitted == 0) dq_fence_submitted = 1;
+	_disp_queue_add(drv, x1, y1, x2, y2, data, size, dq_fence_submitted);
+
+	_disp_queue_process(drv, 0);
+	return dq_fence_submitted;
+}
+
+// Start the next queued transaction if the spi bus is free
+//======================================
+int disp_drv_queue_poll(disp_drv_t *drv)
+{
+	_disp_queue_process(drv, 0);
+	return dq_count;
+}
+
+// Check if the transaction with given fence id is finished
+//======================================================
+int disp_drv_queue_done(disp_drv_t *drv, uint32_t fence)
+{
+	_disp_queue_process(drv, 0);
+	if (dq_count == 0) return 1;
+	return ((int32_t)(dq_fence_done - fence) >= 0);
+}
+
+// Wait until the transaction with given fence id is finished
+//============================================================
+esp_err_t disp_drv_queue_wait(disp_drv_t *drv, uint32_t fence)
+{
+	esp_err_t ret;
+
+	while (dq_count) {
+		if ((int32_t)(dq_fence_done - fence) >= 0) break;
+		if (dq_running) {
+			_disp_queue_block(drv);
+			continue;
+		}
+		if (disp_spi->host->hw->cmd.usr) disp_drv_wait_trans_finish(drv, 0);
+		ret = _disp_queue_process(drv, 0);
+		if (ret != ESP_OK) return ret;
+	}
+	// release the display if the queue drained
+	if ((dq_count == 0) && (dq_selected)) return _disp_queue_process(drv, 0);
+	return ESP_OK;
+}
+
+// Wait until all queued transactions are finished
+//=============================================
+esp_err_t disp_drv_queue_flush(disp_drv_t *drv)
+{
+	return _disp_queue_process(drv, 1);
+}
+
+// Start receiving 'size' bytes from the display into DMA capable, 32-bit aligned buffer using DMA
+// 'size' must be a multiple of 4 and not larger than max_transfer_sz
+//-------------------------------------------------------------------------------
+static void IRAM_ATTR _dma_receive(disp_drv_t *drv, uint8_t *data, uint32_t size)
+{
+    //Fill DMA descriptors
+    spi_lobo_dmaworkaround_transfer_active(disp_spi->host->dma_chan); //mark channel as active
+    spi_lobo_setup_dma_desc_links(disp_spi->host->dmadesc_rx, size, data, true);
+    disp_spi->host->hw->user.usr_mosi = 0;
+    disp_spi->host->hw->user.usr_miso = 1;
+    disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 0;
+    disp_spi->host->hw->miso_dlen.usr_miso_dbitlen = (size * 8) - 1;
+    disp_spi->host->hw->dma_in_link.addr=(int)(&disp_spi->host->dmadesc_rx[0]) & 0xFFFFF;
+    disp_spi->host->hw->dma_in_link.start=1;
+
+	_dma_sending = 1;
+	// Start transfer
+	spi_lobo_start_trans(disp_spi, true);
+}
+
+// Receive 'size' bytes from the display into 'buf'
+// 32-bit aligned part is received using DMA in chunks of max_transfer_sz,
+// directly into the buffer if it is DMA capable and aligned, else through the DMA staging buffer.
+// The remaining bytes are received through the spi data buffer.
+// If wait==0 and the whole transfer is done by one DMA chunk into the caller's buffer,
+// returns without waiting for the transfer to finish (use disp_drv_wait_trans_finish(drv, 0))
+// ** Device must already be selected and RAMRD command sent **
+//--------------------------------------------------------------------------------------------------
+static esp_err_t IRAM_ATTR _disp_receive(disp_drv_t *drv, uint8_t *buf, uint32_t size, uint8_t wait)
+{
+	esp_err_t ret = ESP_OK;
+	uint8_t *bounce = NULL;
+	uint32_t chunk, max_chunk;
+	uint32_t dma_size = size & ~3;
+
+	if (dma_size > DISP_READ_DMA_MIN) {
+		max_chunk = disp_spi->host->max_transfer_sz & ~3;
+		if ((((uint32_t)buf & 3) != 0) || (!esp_ptr_dma_capable(buf))) {
+			// Receive through the staging buffer
+			if (max_chunk > DISP_READ_BOUNCE_SIZE) max_chunk = DISP_READ_BOUNCE_SIZE;
+			bounce = disp_dma_alloc(max_chunk);
+			if (bounce == NULL) dma_size = 0;
+		}
+	}
+	else dma_size = 0;
+
+	while (dma_size > 0) {
+		chunk = ((dma_size > max_chunk) ? max_chunk : dma_size);
+		disp_drv_wait_trans_finish(drv, 0);
+		_dma_receive(drv, (bounce) ? bounce : buf, chunk);
+		buf += chunk;
+		size -= chunk;
+		dma_size -= chunk;
+		if ((bounce) || (size > 0) || (wait)) {
+			disp_drv_wait_trans_finish(drv, 0);
+			if (bounce) memcpy(buf-chunk, bounce, chunk);
 		}
 	}
-
-	if (wait) wait_trans_finish(1);
+	if (bounce) disp_dma_free(bounce);
+
+	if (size > 0) {
+		// ** Receive the rest using direct mode
+		spi_lobo_transaction_t t;
+	    memset(&t, 0, sizeof(t));  //Zero out the transaction
+		disp_drv_wait_trans_finish(drv, 0);
+	    t.length=0;                //Send nothing
+	    t.tx_buffer=NULL;
+	    t.rxlength=8*size;         //Receive size in bits
+	    t.rx_buffer=buf;
+		ret = spi_lobo_transfer_data(disp_spi, &t);
+	}
+	return ret;
 }
 
-// Write 'len' color data to TFT 'window' (x1,y2),(x2,y2)
-//-------------------------------------------------------------------------------------------
-void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
+// Set the read spi clock and start reading from the display window
+// Returns the previous spi clock if it was changed, 0 if not
+//------------------------------------------------------------------------------------------------------------------------
+static int IRAM_ATTR _read_start(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint8_t set_sp, uint32_t *current_clock)
 {
-	if (disp_select() != ESP_OK) return;
+	*current_clock = 0;
+	if (set_sp) {
+		if (disp_drv_deselect(drv) != ESP_OK) return -1;
+		// Change spi clock if needed
+		*current_clock = spi_lobo_get_speed(disp_spi);
+		if (max_rdclock < *current_clock) spi_lobo_set_speed(disp_spi, max_rdclock);
+		else *current_clock = 0;
+	}
 
-	// ** Send address window **
-	disp_spi_transfer_addrwin(x1, x2, y1, y2);
+	if (disp_drv_select(drv) != ESP_OK) return -2;
 
-	_TFT_pushColorRep(&color, len, 1, 1);
+	// ** Send address window, translated to the scrolled GRAM lines **
+	y2 = _scroll_line(drv, y1) + (y2 - y1);
+	y1 = _scroll_line(drv, y1);
+	disp_spi_transfer_addrwin(drv, x1, x2, y1, y2);
 
-	disp_deselect();
+    // ** GET pixels/colors **
+	disp_drv_transfer_cmd(drv, TFT_RAMRD);
+	return ESP_OK;
 }
 
-// Write 'len' color data to TFT 'window' (x1,y2),(x2,y2) from given buffer
-// ** Device must already be selected **
-//-----------------------------------------------------------------------------------
-void IRAM_ATTR send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
+// Finish reading, restore the write mode and spi clock
+//-----------------------------------------------------------------------
+static void IRAM_ATTR _read_stop(disp_drv_t *drv, uint32_t current_clock)
 {
-	// ** Send address window **
-	disp_spi_transfer_addrwin(x1, x2, y1, y2);
-	_TFT_pushColorRep(buf, len, 0, 0);
+	disp_drv_wait_trans_finish(drv, 0);
+	disp_spi->host->hw->user.usr_mosi = 1;
+	disp_spi->host->hw->user.usr_miso = 0;
+	disp_spi->host->hw->miso_dlen.usr_miso_dbitlen = 0;
+
+	disp_drv_deselect(drv);
+
+	// Restore spi clock if needed
+	if (current_clock) spi_lobo_set_speed(disp_spi, current_clock);
 }
 
 // Reads 'len' pixels/colors from the TFT's GRAM 'window'
 // 'buf' is an array of bytes with 1st byte reserved for reading 1 dummy byte
 // and the rest is actually an array of color_t values
-//--------------------------------------------------------------------------------------------
-int IRAM_ATTR read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp)
+// ** The display always returns 3 bytes (6-6-6) per pixel, also in 16-bit mode
+// Large reads use DMA, fastest if 'buf' is DMA capable and 32-bit aligned
+//----------------------------------------------------------------------------------------------------------------------
+int IRAM_ATTR disp_drv_read_data(disp_drv_t *drv, int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp)
 {
-	spi_lobo_transaction_t t;
 	uint32_t current_clock = 0;
+	int row_len = x2-x1+1;
+	int n, res = ESP_OK;
+	uint8_t last;
 
-    memset(&t, 0, sizeof(t));  //Zero out the transaction
 	memset(buf, 0, len*sizeof(color_t));
 
-	if (set_sp) {
-		if (disp_deselect() != ESP_OK) return -1;
-		// Change spi clock if needed
-		current_clock = spi_lobo_get_speed(disp_spi);
-		if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, max_rdclock);
+	if (fb_on) {
+		// ** Read from the framebuffer
+		uint8_t bpp = ((COLOR_BITS == 16) ? 2 : 3);
+		color_t *color = (color_t *)(buf+1);
+		int cx1 = ((x1 < fb_x) ? fb_x : x1);
+		int cx2 = ((x2 >= (fb_x + fb_w)) ? (fb_x + fb_w - 1) : x2);
+		if (x1 > x2) return ESP_ERR_INVALID_ARG;
+		// pixels outside of the framebuffer target area are read as black
+		while ((len > 0) && (y1 <= y2)) {
+			n = ((len > row_len) ? row_len : len);
+			if ((y1 >= fb_y) && (y1 < (fb_y + fb_h)) && (cx1 <= cx2) && ((cx1 - x1) < n) && (fb_depth)) {
+				// indices without a palette color are read as black
+				for (int k=cx1; ((k <= cx2) && ((k - x1) < n)); k++) {
+					uint8_t index = _fb_get_index(drv, k - fb_x, y1 - fb_y);
+					if (index < drv->fb.ncolors) color[k - x1] = drv->fb.palette[index];
+				}
+			}
+			else if ((y1 >= fb_y) && (y1 < (fb_y + fb_h)) && (cx1 <= cx2) && ((cx1 - x1) < n)) {
+				_fb_unpack(drv, fb_buf + ((((y1 - fb_y) * fb_w) + (cx1 - fb_x)) * bpp), color + (cx1 - x1),
+						(((n < (cx2 - x1 + 1)) ? n : (cx2 - x1 + 1)) - (cx1 - x1)));
+			}
+			color += n;
+			len -= n;
+			y1++;
+		}
+		return ESP_OK;
+	}
+	while (len > 0) {
+		// scrolled window is split where the lines are not consecutive in GRAM
+		n = disp_drv_scroll_rows(drv, y1, y2) * row_len;
+		if (n > len) n = len;
+
+		res = _read_start(drv, x1, y1, x2, y2, set_sp, &current_clock);
+		if (res != ESP_OK) return res;
+
+		// Receive the dummy byte and pixel data
+		// the dummy byte of the next part overwrites the last byte of the previous one
+		last = buf[0];
+		res = _disp_receive(drv, buf, (n*3)+1, 1);
+		buf[0] = last;
+
+		_read_stop(drv, current_clock);
+		if (res != ESP_OK) break;
+
+		buf += n*3;
+		len -= n;
+		y1 += n / row_len;
 	}
 
-	if (disp_select() != ESP_OK) return -2;
-
-	// ** Send address window **
-	disp_spi_transfer_addrwin(x1, x2, y1, y2);
+    return res;
+}
 
-    // ** GET pixels/colors **
-	disp_spi_transfer_cmd(TFT_RAMRD);
+// Start streaming read of the display window (x1,y1),(x2,y2)
+//======================================================================
+int disp_drv_read_begin(disp_drv_t *drv, int x1, int y1, int x2, int y2)
+{
+	uint8_t dummy[4];
 
-    t.length=0;                //Send nothing
-    t.tx_buffer=NULL;
-    t.rxlength=8*((len*3)+1);  //Receive size in bits
-    t.rx_buffer=buf;
-    //t.user = (void*)1;
+	// The display RAM is read, send the framebuffer changes first
+	disp_drv_fb_flush(drv);
+	int res = _read_start(drv, x1, y1, x2, y2, 1, &rd_saved_clock);
+	if (res != ESP_OK) return res;
 
-	esp_err_t res = spi_lobo_transfer_data(disp_spi, &t); // Receive using direct mode
+	// Skip the dummy byte
+	return _disp_receive(drv, dummy, 1, 1);
+}
 
-	disp_deselect();
+// Read the next 'size' bytes of the window started with disp_read_begin
+//================================================================================
+int disp_drv_read_next(disp_drv_t *drv, uint8_t *buf, uint32_t size, uint8_t wait)
+{
+	if (!disp_spi->cfg.selected) return ESP_ERR_INVALID_STATE;
+	return _disp_receive(drv, buf, size, wait);
+}
 
-	if (set_sp) {
-		// Restore spi clock if needed
-		if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, current_clock);
-	}
+// Wait for the read started with disp_drv_read_next(drv, ..., 0) to finish
+//===========================================
+esp_err_t disp_drv_read_wait(disp_drv_t *drv)
+{
+	return disp_drv_wait_trans_finish(drv, 0);
+}
 
-    return res;
+// Finish streaming read, restore the spi clock
+//=====================================
+void disp_drv_read_end(disp_drv_t *drv)
+{
+	_read_stop(drv, rd_saved_clock);
+	rd_saved_clock = 0;
 }
 
 // Reads one pixel/color from the TFT's GRAM at position (x,y)
-//-----------------------------------------------
-color_t IRAM_ATTR readPixel(int16_t x, int16_t y)
+//-------------------------------------------------------------------------
+color_t IRAM_ATTR disp_drv_readPixel(disp_drv_t *drv, int16_t x, int16_t y)
 {
     uint8_t color_buf[sizeof(color_t)+1] = {0};
 
-    read_data(x, y, x+1, y+1, 1, color_buf, 1);
+    disp_drv_read_data(drv, x, y, x+1, y+1, 1, color_buf, 1);
 
     color_t color;
 	color.r = color_buf[1];
@@ -664,8 +2472,8 @@ int stmpe610_get_touch(uint16_t *x, uint16_t *y, uint16_t *z)
 
 // Find maximum spi clock for successful read from display RAM
 // ** Must be used AFTER the display is initialized **
-//======================
-uint32_t find_rd_speed()
+//==============================================
+uint32_t disp_drv_find_rd_speed(disp_drv_t *drv)
 {
 	esp_err_t ret;
 	color_t color;
@@ -675,11 +2483,13 @@ uint32_t find_rd_speed()
     color_t *color_line = NULL;
     uint8_t *line_rdbuf = NULL;
     uint8_t gs = gray_scale;
+    // In 16-bit mode only 5 bits of red & blue are written
+    uint8_t rb_mask = ((COLOR_BITS == 16) ? 0xF8 : 0xFC);
 
     gray_scale = 0;
     cur_speed = spi_lobo_get_speed(disp_spi);
 
-	color_line = malloc(_width*3);
+	color_line = disp_dma_alloc(_width*3);
     if (color_line == NULL) goto exit;
 
     line_rdbuf = malloc((_width*3)+1);
@@ -700,21 +2510,21 @@ uint32_t find_rd_speed()
 
 		memset(line_rdbuf, 0, _width*sizeof(color_t)+1);
 
-		if (disp_select()) goto exit;
+		if (disp_drv_select(drv)) goto exit;
 		// Write color line
-		send_data(0, _height/2, _width-1, _height/2, _width, color_line);
-		if (disp_deselect()) goto exit;
+		disp_drv_send_data(drv, 0, _height/2, _width-1, _height/2, _width, color_line);
+		if (disp_drv_deselect(drv)) goto exit;
 
 		// Read color line
-		ret = read_data(0, _height/2, _width-1, _height/2, _width, line_rdbuf, 0);
+		ret = disp_drv_read_data(drv, 0, _height/2, _width-1, _height/2, _width, line_rdbuf, 0);
 
 		// Compare
 		line_check = 0;
 		if (ret == ESP_OK) {
 			for (int y=0; y<_width; y++) {
-				if ((color_line[y].r & 0xFC) != (rdline[y].r & 0xFC)) line_check = 1;
+				if ((color_line[y].r & rb_mask) != (rdline[y].r & rb_mask)) line_check = 1;
 				else if ((color_line[y].g & 0xFC) != (rdline[y].g & 0xFC)) line_check = 1;
-				else if ((color_line[y].b & 0xFC) != (rdline[y].b & 0xFC)) line_check =  1;
+				else if ((color_line[y].b & rb_mask) != (rdline[y].b & rb_mask)) line_check =  1;
 				if (line_check) break;
 			}
 		}
@@ -727,7 +2537,7 @@ uint32_t find_rd_speed()
 exit:
     gray_scale = gs;
 	if (line_rdbuf) free(line_rdbuf);
-	if (color_line) free(color_line);
+	if (color_line) disp_dma_free(color_line);
 
 	// restore spi clk
 	change_speed = spi_lobo_set_speed(disp_spi, cur_speed);
@@ -735,11 +2545,211 @@ exit:
 	return max_speed;
 }
 
+// Write clock calibration record, stored in NVS
+typedef struct {
+	uint8_t type;			// display type the clock was found for
+	uint8_t color_bits;
+	uint16_t width;
+	uint32_t max_speed;		// maximum clock tested
+	uint32_t speed;			// selected write clock
+} wr_speed_rec_t;
+
+// Read the stored write clock calibration record
+// Returns 1 if the record was found for the current display
+//-------------------------------------------------------------
+static int _wr_speed_read(disp_drv_t *drv, wr_speed_rec_t *rec)
+{
+	nvs_handle nvs;
+	size_t rec_size = sizeof(wr_speed_rec_t);
+
+	memset(rec, 0, sizeof(wr_speed_rec_t));
+	if (nvs_open(WR_SPEED_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return 0;
+	if (nvs_get_blob(nvs, WR_SPEED_NVS_KEY, rec, &rec_size) != ESP_OK) rec->speed = 0;
+	nvs_close(nvs);
+	return ((rec->speed) && (rec->type == tft_disp_type) && (rec->color_bits == COLOR_BITS) &&
+			(rec->width == ((_width < _height) ? _width : _height)));
+}
+
+//=============================================
+uint32_t disp_drv_get_wr_speed(disp_drv_t *drv)
+{
+	wr_speed_rec_t rec;
+
+	if (_wr_speed_read(drv, &rec)) return rec.speed;
+	return 0;
+}
+
+// Write the test pattern block at 'speed', read it back at the read clock and compare
+// Returns 0 if the pattern was read back correctly
+//-----------------------------------------------------------------------------------------------------------------------------------
+static int _wr_speed_check(disp_drv_t *drv, uint32_t speed, color_t *pattern, uint8_t *rdbuf, int lines, uint8_t rb_mask, int passes)
+{
+	int y = (_height - lines) / 2;
+	int len = _width * lines;
+	color_t *rd = (color_t *)(rdbuf+1);
+
+	if (spi_lobo_set_speed(disp_spi, speed) == 0) return -1;
+	for (int pass=0; pass<passes; pass++) {
+		memset(rdbuf, 0, (len*3)+1);
+
+		if (disp_drv_select(drv)) return -2;
+		disp_drv_send_data(drv, 0, y, _width-1, y+lines-1, len, pattern);
+		if (disp_drv_deselect(drv)) return -3;
+
+		// read back at the read clock
+		if (disp_drv_read_data(drv, 0, y, _width-1, y+lines-1, len, rdbuf, 1) != ESP_OK) return -4;
+		if (spi_lobo_set_speed(disp_spi, speed) == 0) return -1;
+
+		for (int n=0; n<len; n++) {
+			if (((pattern[n].r & rb_mask) != (rd[n].r & rb_mask)) ||
+				((pattern[n].g & 0xFC) != (rd[n].g & 0xFC)) ||
+				((pattern[n].b & rb_mask) != (rd[n].b & rb_mask))) return 1;
+		}
+	}
+	return 0;
+}
+
+// Allocate the write clock test pattern and read back buffer
+// Test pattern: alternating, inverted and walking bit values in adjacent pixels & lines
+//----------------------------------------------------------------------------------------------
+static esp_err_t _wr_speed_alloc(disp_drv_t *drv, color_t **pattern, uint8_t **rdbuf, int lines)
+{
+	*pattern = disp_dma_alloc(_width*lines*3);
+	*rdbuf = heap_caps_malloc((_width*lines*3)+4, MALLOC_CAP_DMA);
+	if ((*pattern == NULL) || (*rdbuf == NULL)) return ESP_ERR_NO_MEM;
+
+	for (int y=0; y<lines; y++) {
+		for (int x=0; x<_width; x++) {
+			uint8_t v;
+			switch (y % 4) {
+				case 0: v = ((x & 1) ? 0xFC : 0x00); break;
+				case 1: v = ((x & 1) ? 0x54 : 0xA8); break;
+				case 2: v = (0x04 << ((x+y) % 6)); break;
+				default: v = (uint8_t)(x * 4);
+			}
+			(*pattern)[(y*_width)+x] = (color_t){v, (uint8_t)~v, (uint8_t)(v ^ 0xA8)};
+		}
+	}
+	return ESP_OK;
+}
+
+// Check if the display RAM is reliably written at 'speed' and read back at the read clock
+// ** Must be used AFTER the display is initialized **
+//================================================================
+esp_err_t disp_drv_check_wr_speed(disp_drv_t *drv, uint32_t speed)
+{
+	esp_err_t ret = ESP_ERR_NO_MEM;
+	color_t *pattern = NULL;
+	uint8_t *rdbuf = NULL;
+	uint8_t gs = gray_scale;
+	uint32_t cur_speed = spi_lobo_get_speed(disp_spi);
+
+	gray_scale = 0;
+	if (_wr_speed_alloc(drv, &pattern, &rdbuf, WR_SPEED_TEST_LINES) == ESP_OK) {
+		if (_wr_speed_check(drv, speed, pattern, rdbuf, WR_SPEED_TEST_LINES, ((COLOR_BITS == 16) ? 0xF8 : 0xFC), WR_SPEED_CONFIRM_PASSES) == 0) ret = ESP_OK;
+		else ret = ESP_FAIL;
+	}
+	gray_scale = gs;
+	if (rdbuf) free(rdbuf);
+	if (pattern) disp_dma_free(pattern);
+
+	spi_lobo_set_speed(disp_spi, cur_speed);
+	return ret;
+}
+
+// Read the display ID (RDDID command) at the read clock
+// Returns the first 4 bytes received after the command, 0 on error
+//========================================
+uint32_t disp_drv_read_id(disp_drv_t *drv)
+{
+	uint8_t id[4] = {0};
+	uint32_t current_clock = spi_lobo_get_speed(disp_spi);
+
+	if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, max_rdclock);
+	else current_clock = 0;
+
+	if (disp_drv_select(drv) != ESP_OK) return 0;
+	disp_drv_transfer_cmd(drv, TFT_CMD_RDDID);
+	if (_disp_receive(drv, id, 4, 1) != ESP_OK) memset(id, 0, 4);
+	_read_stop(drv, current_clock);
+
+	return ((uint32_t)id[0] << 24) | ((uint32_t)id[1] << 16) | ((uint32_t)id[2] << 8) | id[3];
+}
+
+// Find maximum spi clock for reliable writes to display RAM
+// ** Must be used AFTER the display is initialized and the read clock is set (find_rd_speed) **
+//=======================================================================================
+uint32_t disp_drv_find_wr_speed(disp_drv_t *drv, uint32_t max_speed, uint8_t recalibrate)
+{
+	wr_speed_rec_t rec = {0};
+	nvs_handle nvs;
+	uint32_t cur_speed, speed, found_speed;
+	int lines = WR_SPEED_TEST_LINES;
+	int div, found_div, start_div;
+	color_t *pattern = NULL;
+	uint8_t *rdbuf = NULL;
+	uint8_t gs = gray_scale;
+	uint8_t rb_mask = ((COLOR_BITS == 16) ? 0xF8 : 0xFC);
+
+	cur_speed = spi_lobo_get_speed(disp_spi);
+	found_speed = cur_speed;
+	if (max_speed > 80000000) max_speed = 80000000;
+
+	// Use the stored result if it was found for this display
+	if ((!recalibrate) && (_wr_speed_read(drv, &rec)) && (rec.max_speed == max_speed)) return rec.speed;
+
+	gray_scale = 0;
+	if (_wr_speed_alloc(drv, &pattern, &rdbuf, lines) != ESP_OK) goto exit;
+
+	// The starting clock must be reliable, otherwise the test can't be trusted
+	if (_wr_speed_check(drv, cur_speed, pattern, rdbuf, lines, rb_mask, WR_SPEED_PASSES) != 0) goto exit;
+
+	// Step the clock up through the available dividers of the 80 MHz spi clock
+	start_div = 80000000 / cur_speed;
+	found_div = start_div;
+	for (div=found_div-1; div>=1; div--) {
+		speed = 80000000 / div;
+		if (speed > max_speed) break;
+		if (_wr_speed_check(drv, speed, pattern, rdbuf, lines, rb_mask, WR_SPEED_PASSES) != 0) break;
+		found_div = div;
+	}
+	// Safety margin: the dividers are too coarse to step back a whole divider,
+	// the highest passing clock must also pass the longer confirmation test,
+	// otherwise the next lower clock is confirmed
+	while (found_div < start_div) {
+		if (_wr_speed_check(drv, 80000000 / found_div, pattern, rdbuf, lines, rb_mask, WR_SPEED_CONFIRM_PASSES) == 0) break;
+		found_div++;
+	}
+	speed = 80000000 / found_div;
+	if (speed > cur_speed) found_speed = speed;
+
+	// Store the result
+	if (nvs_open(WR_SPEED_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+		rec.type = tft_disp_type;
+		rec.color_bits = COLOR_BITS;
+		rec.width = ((_width < _height) ? _width : _height);
+		rec.max_speed = max_speed;
+		rec.speed = found_speed;
+		if (nvs_set_blob(nvs, WR_SPEED_NVS_KEY, &rec, sizeof(wr_speed_rec_t)) == ESP_OK) nvs_commit(nvs);
+		nvs_close(nvs);
+	}
+
+exit:
+	gray_scale = gs;
+	if (rdbuf) free(rdbuf);
+	if (pattern) disp_dma_free(pattern);
+
+	// restore spi clk
+	spi_lobo_set_speed(disp_spi, cur_speed);
+
+	return found_speed;
+}
+
 //---------------------------------------------------------------------------
 // Companion code to the initialization table.
 // Reads and issues a series of LCD commands stored in byte array
 //---------------------------------------------------------------------------
-static void commandList(spi_lobo_device_handle_t spi, const uint8_t *addr) {
+static void commandList(disp_drv_t *drv, const uint8_t *addr) {
   uint8_t  numCommands, numArgs, cmd;
   uint16_t ms;
 
@@ -750,7 +2760,7 @@ static void commandList(spi_lobo_device_handle_t spi, const uint8_t *addr) {
     ms       = numArgs & TFT_CMD_DELAY;	// If high bit set, delay follows args
     numArgs &= ~TFT_CMD_DELAY;			// Mask out delay bit
 
-	disp_spi_transfer_cmd_data(cmd, (uint8_t *)addr, numArgs);
+	disp_drv_transfer_cmd_data(drv, cmd, (uint8_t *)addr, numArgs);
 
 	addr += numArgs;
 
@@ -762,13 +2772,40 @@ static void commandList(spi_lobo_device_handle_t spi, const uint8_t *addr) {
   }
 }
 
-//==================================
-void _tft_setRotation(uint8_t rot) {
+//==========================================================
+uint8_t disp_drv_setColorBits(disp_drv_t *drv, uint8_t bits)
+{
+	uint8_t pixfmt;
+
+	uint8_t fb = ((drv->fb.buf != NULL) && (drv->fb.tile == 0));
+
+	// ILI9488 supports only 18-bit color in SPI mode
+	if ((bits != 16) || (tft_disp_type == DISP_TYPE_ILI9488)) bits = 24;
+	pixfmt = ((bits == 16) ? DISP_COLOR_BITS_16 : DISP_COLOR_BITS_24);
+
+	// The framebuffer pixel format is changed, it is flushed and loaded again
+	if ((fb) && (bits != COLOR_BITS)) disp_drv_fb_enable(drv, 0);
+	else fb = 0;
+
+	if (disp_drv_select(drv) == ESP_OK) {
+		disp_drv_transfer_cmd_data(drv, TFT_CMD_PIXFMT, &pixfmt, 1);
+		disp_drv_deselect(drv);
+	}
+	COLOR_BITS = bits;
+	if (fb) disp_drv_fb_enable(drv, 1);
+	return bits;
+}
+
+//=====================================================
+void disp_drv_setRotation(disp_drv_t *drv, uint8_t rot) {
 	uint8_t rotation = rot & 3; // can't be higher than 3
 	uint8_t send = 1;
 	uint8_t madctl = 0;
 	uint16_t tmp;
 
+	// The framebuffer is sent in the old orientation and loaded in the new one
+	disp_drv_fb_flush(drv);
+
     if ((rotation & 1)) {
         // in landscape modes must be width > height
         if (_width < _height) {
@@ -846,13 +2883,24 @@ void _tft_setRotation(uint8_t rot) {
         break;
     }
     #endif
+	drv->madctl = madctl;
 	if (send) {
-		if (disp_select() == ESP_OK) {
-			disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
-			disp_deselect();
+		if (disp_drv_select(drv) == ESP_OK) {
+			disp_drv_transfer_cmd_data(drv, TFT_MADCTL, &madctl, 1);
+			// GRAM lines are mapped differently, leave the vertical scrolling mode
+			if (drv->scroll.vsa) disp_drv_transfer_cmd(drv, TFT_CMD_NORON);
+			disp_drv_deselect(drv);
 		}
 	}
-
+	memset(&drv->scroll, 0, sizeof(drv->scroll));
+
+	if ((fb_on) && (drv->fb.tile == 0)) {
+		fb_on = 0;
+		fb_w = _width;
+		fb_h = _height;
+		_fb_load(drv);
+		fb_on = 1;
+	}
 }
 
 //=================
@@ -891,58 +2939,338 @@ void TFT_PinsInit()
 
 // Initialize the display
 // ====================
-void TFT_display_init()
+void disp_drv_display_init(disp_drv_t *drv)
 {
     esp_err_t ret;
 
-#if PIN_NUM_RST
-    //Reset the display
-    gpio_set_level(PIN_NUM_RST, 0);
-    vTaskDelay(20 / portTICK_RATE_MS);
-    gpio_set_level(PIN_NUM_RST, 1);
-    vTaskDelay(150 / portTICK_RATE_MS);
-#endif
+    if (drv->dc_pin != PIN_NUM_DC) {
+    	// DC pin of additional display
+        gpio_pad_select_gpio(drv->dc_pin);
+        gpio_set_direction(drv->dc_pin, GPIO_MODE_OUTPUT);
+        gpio_set_level(drv->dc_pin, 0);
+    }
+    if (drv->rst_pin) {
+        //Reset the display
+        gpio_pad_select_gpio(drv->rst_pin);
+        gpio_set_direction(drv->rst_pin, GPIO_MODE_OUTPUT);
+        gpio_set_level(drv->rst_pin, 0);
+        vTaskDelay(20 / portTICK_RATE_MS);
+        gpio_set_level(drv->rst_pin, 1);
+        vTaskDelay(150 / portTICK_RATE_MS);
+    }
+    disp_drv_addrwin_invalidate(drv);
+    disp_dma_pool_init();
 
-    ret = disp_select();
+    ret = disp_drv_select(drv);
     assert(ret==ESP_OK);
     //Send all the initialization commands
 	if (tft_disp_type == DISP_TYPE_ILI9341) {
-		commandList(disp_spi, ILI9341_init);
+		commandList(drv, ILI9341_init);
 	}
 	else if (tft_disp_type == DISP_TYPE_ILI9488) {
-		commandList(disp_spi, ILI9488_init);
+		commandList(drv, ILI9488_init);
 	}
 	else if (tft_disp_type == DISP_TYPE_ST7789V) {
-		commandList(disp_spi, ST7789V_init);
+		commandList(drv, ST7789V_init);
 	}
 	else if (tft_disp_type == DISP_TYPE_ST7735) {
-		commandList(disp_spi, STP7735_init);
+		commandList(drv, STP7735_init);
 	}
 	else if (tft_disp_type == DISP_TYPE_ST7735R) {
-		commandList(disp_spi, STP7735R_init);
-		commandList(disp_spi, Rcmd2green);
-		commandList(disp_spi, Rcmd3);
+		commandList(drv, STP7735R_init);
+		commandList(drv, Rcmd2green);
+		commandList(drv, Rcmd3);
 	}
 	else if (tft_disp_type == DISP_TYPE_ST7735B) {
-		commandList(disp_spi, STP7735R_init);
-		commandList(disp_spi, Rcmd2red);
-		commandList(disp_spi, Rcmd3);
+		commandList(drv, STP7735R_init);
+		commandList(drv, Rcmd2red);
+		commandList(drv, Rcmd3);
 	    uint8_t dt = 0xC0;
-		disp_spi_transfer_cmd_data(TFT_MADCTL, &dt, 1);
+		disp_drv_transfer_cmd_data(drv, TFT_MADCTL, &dt, 1);
 	}
 	else assert(0);
 
-    ret = disp_deselect();
+    ret = disp_drv_deselect(drv);
 	assert(ret==ESP_OK);
 
+	// Set the interface pixel format, init sequences set 18-bit color
+	disp_drv_setColorBits(drv, COLOR_BITS);
+
 	// Clear screen
-    _tft_setRotation(PORTRAIT);
-	TFT_pushColorRep(0, 0, _width-1, _height-1, (color_t){0,0,0}, (uint32_t)(_height*_width));
+    disp_drv_setRotation(drv, PORTRAIT);
+	disp_drv_pushColorRep(drv, 0, 0, _width-1, _height-1, (color_t){0,0,0}, (uint32_t)(_height*_width));
 
 	///Enable backlight
-#if PIN_NUM_BCKL
-    gpio_set_level(PIN_NUM_BCKL, PIN_BCKL_ON);
-#endif
+    if (drv->bckl_pin) {
+        gpio_pad_select_gpio(drv->bckl_pin);
+        gpio_set_direction(drv->bckl_pin, GPIO_MODE_OUTPUT);
+        gpio_set_level(drv->bckl_pin, PIN_BCKL_ON);
+    }
+}
+
+
+// ==== Functions on the display context bound to the calling task, or the default context ====
+
+//============================
+void disp_addrwin_invalidate()
+{
+	disp_drv_addrwin_invalidate(disp_drv);
+}
+
+//=====================================================================
+void disp_get_addrwin_stats(disp_addrwin_stats_t *stats, uint8_t reset)
+{
+	disp_drv_get_addrwin_stats(disp_drv, stats, reset);
+}
+
+//======================================================
+esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
+{
+	return disp_drv_wait_trans_finish(disp_drv, free_line);
+}
+
+//===============================
+esp_err_t IRAM_ATTR disp_select()
+{
+	return disp_drv_select(disp_drv);
+}
+
+//=================================
+esp_err_t IRAM_ATTR disp_deselect()
+{
+	return disp_drv_deselect(disp_drv);
 }
 
+//==================================
+esp_err_t IRAM_ATTR disp_bus_yield()
+{
+	return disp_drv_bus_yield(disp_drv);
+}
+
+//==============================================
+void IRAM_ATTR disp_spi_transfer_cmd(int8_t cmd)
+{
+	disp_drv_transfer_cmd(disp_drv, cmd);
+}
+
+//================================================================================
+void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len)
+{
+	disp_drv_transfer_cmd_data(disp_drv, cmd, data, len);
+}
+
+//============================================
+int IRAM_ATTR disp_scroll_rows(int y1, int y2)
+{
+	return disp_drv_scroll_rows(disp_drv, y1, y2);
+}
+
+//=====================================================
+esp_err_t disp_scroll_set(int top, int bottom, int pos)
+{
+	return disp_drv_scroll_set(disp_drv, top, bottom, pos);
+}
+
+//======================================
+esp_err_t disp_fb_enable(uint8_t enable)
+{
+	return disp_drv_fb_enable(disp_drv, enable);
+}
+
+//=======================
+esp_err_t disp_fb_flush()
+{
+	return disp_drv_fb_flush(disp_drv);
+}
+
+//===========================================================
+void disp_fb_get_stats(disp_fb_stats_t *stats, uint8_t reset)
+{
+	disp_drv_fb_get_stats(disp_drv, stats, reset);
+}
+
+//=================================================================
+esp_err_t disp_tile_begin(uint8_t *buf, int x, int y, int w, int h)
+{
+	return disp_drv_tile_begin(disp_drv, buf, x, y, w, h);
+}
+
+//=============================================================================================================================
+esp_err_t disp_tile_begin_indexed(uint8_t *buf, int x, int y, int w, int h, uint8_t depth, const color_t *palette, int ncolors)
+{
+	return disp_drv_tile_begin_indexed(disp_drv, buf, x, y, w, h, depth, palette, ncolors);
+}
+
+//==================
+void disp_tile_end()
+{
+	disp_drv_tile_end(disp_drv);
+}
+
+//==================================================================================================================================
+uint32_t IRAM_ATTR disp_expand_indexed(uint8_t *dst, const uint8_t *src, int x, uint32_t len, uint8_t depth, const uint8_t *palette)
+{
+	return disp_drv_expand_indexed(disp_drv, dst, src, x, len, depth, palette);
+}
+
+//========================================================================
+void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
+{
+	disp_drv_drawPixel(disp_drv, x, y, color, sel);
+}
+
+//==========================================================================================
+void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
+{
+	disp_drv_pushColorRep(disp_drv, x1, y1, x2, y2, color, len);
+}
+
+//==================================================================================
+void IRAM_ATTR send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
+{
+	disp_drv_send_data(disp_drv, x1, y1, x2, y2, len, buf);
+}
+
+//=======================================================================================
+void IRAM_ATTR send_data_rep(int x1, int y1, int x2, int y2, uint32_t len, color_t color)
+{
+	disp_drv_send_data_rep(disp_drv, x1, y1, x2, y2, len, color);
+}
+
+//=================================================================================================
+esp_err_t IRAM_ATTR send_data_sg(int x1, int y1, int x2, int y2, const disp_seg_t *segs, int nsegs)
+{
+	return disp_drv_send_data_sg(disp_drv, x1, y1, x2, y2, segs, nsegs);
+}
+
+//==============================================================================================
+esp_err_t IRAM_ATTR send_data_packed(int x, int y, int w, int h, const uint8_t *buf, int stride)
+{
+	return disp_drv_send_data_packed(disp_drv, x, y, w, h, buf, stride);
+}
+
+//======================================================================================================
+esp_err_t IRAM_ATTR send_data_xform(int x, int y, int w, int h, color_t *buf, int stride, uint8_t xform)
+{
+	return disp_drv_send_data_xform(disp_drv, x, y, w, h, buf, stride, xform);
+}
+
+//===================================================================
+uint32_t disp_pack_colors(uint8_t *buf, color_t *color, uint32_t len)
+{
+	return disp_drv_pack_colors(disp_drv, buf, color, len);
+}
+
+//====================================================================================
+uint32_t disp_queue_send(int x1, int y1, int x2, int y2, uint8_t *data, uint32_t size)
+{
+	return disp_drv_queue_send(disp_drv, x1, y1, x2, y2, data, size);
+}
+
+//===================
+int disp_queue_poll()
+{
+	return disp_drv_queue_poll(disp_drv);
+}
+
+//=================================
+int disp_queue_done(uint32_t fence)
+{
+	return disp_drv_queue_done(disp_drv, fence);
+}
+
+//=======================================
+esp_err_t disp_queue_wait(uint32_t fence)
+{
+	return disp_drv_queue_wait(disp_drv, fence);
+}
+
+//==========================
+esp_err_t disp_queue_flush()
+{
+	return disp_drv_queue_flush(disp_drv);
+}
+
+//============================================================================================
+int IRAM_ATTR read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp)
+{
+	return disp_drv_read_data(disp_drv, x1, y1, x2, y2, len, buf, set_sp);
+}
+
+//=================================================
+int disp_read_begin(int x1, int y1, int x2, int y2)
+{
+	return disp_drv_read_begin(disp_drv, x1, y1, x2, y2);
+}
+
+//===========================================================
+int disp_read_next(uint8_t *buf, uint32_t size, uint8_t wait)
+{
+	return disp_drv_read_next(disp_drv, buf, size, wait);
+}
+
+//========================
+esp_err_t disp_read_wait()
+{
+	return disp_drv_read_wait(disp_drv);
+}
+
+//==================
+void disp_read_end()
+{
+	disp_drv_read_end(disp_drv);
+}
+
+//===============================================
+color_t IRAM_ATTR readPixel(int16_t x, int16_t y)
+{
+	return disp_drv_readPixel(disp_drv, x, y);
+}
+
+//======================
+uint32_t find_rd_speed()
+{
+	return disp_drv_find_rd_speed(disp_drv);
+}
+
+//=====================
+uint32_t get_wr_speed()
+{
+	return disp_drv_get_wr_speed(disp_drv);
+}
+
+//======================================
+esp_err_t check_wr_speed(uint32_t speed)
+{
+	return disp_drv_check_wr_speed(disp_drv, speed);
+}
+
+//=====================
+uint32_t disp_read_id()
+{
+	return disp_drv_read_id(disp_drv);
+}
+
+//=============================================================
+uint32_t find_wr_speed(uint32_t max_speed, uint8_t recalibrate)
+{
+	return disp_drv_find_wr_speed(disp_drv, max_speed, recalibrate);
+}
+
+//=====================================
+uint8_t _tft_setColorBits(uint8_t bits)
+{
+	return disp_drv_setColorBits(disp_drv, bits);
+}
+
+//================================
+void _tft_setRotation(uint8_t rot)
+{
+	disp_drv_setRotation(disp_drv, rot);
+}
 
+//=====================
+void TFT_display_init()
+{
+	disp_drv_display_init(disp_drv);
+}
@@ -44,6 +44,7 @@
 #define DEFAULT_TFT_DISPLAY_WIDTH   240
 #define DEFAULT_TFT_DISPLAY_HEIGHT  320
 #define DISP_COLOR_BITS_24          0x66
+#define DISP_COLOR_BITS_16          0x55
 #define DEFAULT_GAMMA_CURVE         0
 #define DEFAULT_SPI_CLOCK           26000000
 #define TFT_INVERT_ROTATION         0
@@ -73,6 +74,7 @@
 #define DEFAULT_TFT_DISPLAY_WIDTH   240
 #define DEFAULT_TFT_DISPLAY_HEIGHT  320
 #define DISP_COLOR_BITS_24          0x66
+#define DISP_COLOR_BITS_16          0x55
 #define DEFAULT_GAMMA_CURVE         0
 #define DEFAULT_SPI_CLOCK           26000000
 #define TFT_INVERT_ROTATION         0
@@ -102,6 +104,7 @@
 #define DEFAULT_TFT_DISPLAY_WIDTH   320
 #define DEFAULT_TFT_DISPLAY_HEIGHT  240
 #define DISP_COLOR_BITS_24          0x66
+#define DISP_COLOR_BITS_16          0x55
 #define DEFAULT_GAMMA_CURVE         0
 #define DEFAULT_SPI_CLOCK           26000000
 #define TFT_INVERT_ROTATION         0
@@ -129,7 +132,7 @@
 // Configuration for other boards, set the correct values for the display used
 //----------------------------------------------------------------------------
 #define DISP_COLOR_BITS_24	0x66
-//#define DISP_COLOR_BITS_16	0x55  // Do not use!
+#define DISP_COLOR_BITS_16	0x55
 
 // #############################################
 // ### Set to 1 for some displays,           ###
@@ -192,24 +195,44 @@
 // ##############################################################
 // #### Global variables                                     ####
 // ##############################################################
+// The display variables are fields of the display driver state (disp_drv_t) of the
+// display context bound to the calling task, or of the default context, see TFT_ctx_bind()
+
+// Each access looks up the context bound to the calling task; to access one display
+// explicitly use the fields of 'ctx->drv' and the disp_drv_* functions.
+// The former global variable names (gray_scale, COLOR_BITS, _width, ...) are defined
+// as aliases of the tft_* names only if TFT_LEGACY_NAMES is defined before including the header
 
 // ==== Converts colors to grayscale if 1 =======================
-extern uint8_t gray_scale;
+#define tft_gray_scale	(disp_drv->gray)
 
 // ==== Spi clock for reading data from display memory in Hz ====
-extern uint32_t max_rdclock;
+#define tft_max_rdclock	(disp_drv->rdclock)
+
+// ==== Display color bits: 24 (18-bit, 0x66) or 16 (RGB565, 0x55) ====
+// ** ILI9488 supports only 18-bit color in SPI mode
+#define tft_color_bits	(disp_drv->color_bits)
 
 // ==== Display dimensions in pixels ============================
-extern int _width;
-extern int _height;
+#define tft_width		(disp_drv->width)
+#define tft_height		(disp_drv->height)
 
 // ==== Display type, DISP_TYPE_ILI9488 or DISP_TYPE_ILI9341 ====
-extern uint8_t tft_disp_type;
+#define tft_disp_type	(disp_drv->type)
 
 // ==== Spi device handles for display and touch screen =========
-extern spi_lobo_device_handle_t disp_spi;
+#define tft_disp_spi	(disp_drv->spi)
 extern spi_lobo_device_handle_t ts_spi;
 
+#ifdef TFT_LEGACY_NAMES
+#define gray_scale		tft_gray_scale
+#define max_rdclock		tft_max_rdclock
+#define COLOR_BITS		tft_color_bits
+#define _width			tft_width
+#define _height			tft_height
+#define disp_spi		tft_disp_spi
+#endif
+
 // ##############################################################
 
 // 24-bit color type structure
@@ -220,6 +243,30 @@ typedef struct __attribute__((__packed__)) {
 	uint8_t b;
 } color_t ;
 
+// Address window cache counters, see disp_get_addrwin_stats()
+typedef struct {
+	uint32_t caset_sent;		// column address commands sent
+	uint32_t caset_skipped;		// column address commands skipped, column window unchanged
+	uint32_t paset_sent;		// page address commands sent
+	uint32_t paset_skipped;		// page address commands skipped, page window unchanged
+	uint32_t ramwr_sent;		// RAM WRITE commands sent
+	uint32_t ramwr_continued;	// writes appended to the active RAM WRITE stream, no commands sent
+} disp_addrwin_stats_t;
+
+// Shadow framebuffer counters, see disp_fb_get_stats()
+typedef struct {
+	uint32_t drawn;				// pixels written to the framebuffer
+	uint32_t sent;				// pixels sent to the display by disp_fb_flush()
+	uint32_t flushes;			// flushes which sent data to the display
+	uint32_t rects;				// rectangles sent to the display
+} disp_fb_stats_t;
+
+// Screen rectangle
+typedef struct {
+	int16_t x1, y1;
+	int16_t x2, y2;
+} disp_rect_t;
+
 // ==== Display commands constants ====
 #define TFT_INVOFF     0x20
 #define TFT_INVONN     0x21
@@ -227,6 +274,8 @@ typedef struct __attribute__((__packed__)) {
 #define TFT_DISPON     0x29
 #define TFT_MADCTL	   0x36
 #define TFT_PTLAR 	   0x30
+#define TFT_VSCRDEF	   0x33
+#define TFT_VSCRSADD   0x37
 #define TFT_ENTRYM 	   0xB7
 
 #define TFT_CMD_NOP			0x00
@@ -325,6 +374,188 @@ typedef struct __attribute__((__packed__)) {
 
 #define TFT_CMD_DELAY	0x80
 
+// Maximum number of transactions in display transaction queue
+#define DISP_QUEUE_SIZE	8
+
+// Display reads larger than this (bytes) use DMA
+#define DISP_READ_DMA_MIN		64
+// Maximum staging buffer size used for DMA reads into non DMA capable or unaligned buffers
+#define DISP_READ_BOUNCE_SIZE	3072
+
+// Scatter-gather send, number of DMA descriptors in each of the two descriptor sets,
+// size of each of the two stage buffer halves used for segments not sent from their own buffer,
+// minimal segment size (bytes) sent from its own buffer and minimal repeat count sent using circular DMA
+#define DISP_SG_DESC			16
+#define DISP_SG_STAGE			512
+#define DISP_SG_DIRECT_MIN		64
+#define DISP_SG_LOOP_MIN		4
+
+// Write clock calibration (find_wr_speed), number of test pattern lines,
+// number of write/read back passes at each clock, consecutive passes required at the selected clock
+// and NVS location of the stored result
+#define WR_SPEED_TEST_LINES		8
+#define WR_SPEED_PASSES			4
+#define WR_SPEED_CONFIRM_PASSES	32
+#define WR_SPEED_NVS_NAMESPACE	"tft"
+#define WR_SPEED_NVS_KEY		"wr_clk"
+
+// Shadow framebuffer, maximum number of dirty rectangles (more are merged),
+// rectangles are merged if the union adds at most DISP_FB_MERGE_PIXELS to the sum of their areas
+// (about the cost of the address window commands) and number of rows sent in one transfer
+#define DISP_FB_DIRTY_MAX		16
+#define DISP_FB_MERGE_PIXELS	64
+#define DISP_FB_SEND_ROWS		16
+
+// Pixel data transformations for send_data_xform() and TFT_blit()
+// rotation (clockwise) can be combined with flips, the source is flipped before rotation
+#define DISP_XFORM_NONE		0
+#define DISP_XFORM_ROT90	1
+#define DISP_XFORM_ROT180	2
+#define DISP_XFORM_ROT270	3
+#define DISP_XFORM_FLIPX	4	// mirror left-right
+#define DISP_XFORM_FLIPY	8	// mirror top-bottom
+
+// Pixel data segment for send_data_sg()
+// data in display transfer format (see disp_pack_colors()), sent 'repeat' times (0 or 1: once)
+typedef struct {
+	const uint8_t *data;
+	uint32_t len;		// segment size in bytes
+	uint32_t repeat;
+} disp_seg_t;
+
+// Solid fill pattern, sent repeatedly by circular DMA descriptor chain
+// 768 bytes = 256 pixels in 24-bit mode, 384 pixels in 16-bit mode
+#define FILL_PATTERN_SIZE	768
+
+// Display transaction queue entry
+typedef struct {
+	uint16_t x1, y1, x2, y2;	// address window
+	uint8_t *data;				// pixel data in display transfer format
+	uint32_t size;				// data size in bytes
+	uint32_t sent;				// bytes already sent
+	uint32_t fence;				// fence id of the transaction
+} disp_trans_t;
+
+// ==== Display driver state, one for each display ====
+// First member of the display context; must be in DMA capable memory
+typedef struct {
+	spi_lobo_device_handle_t spi;	// display spi device
+	int width;						// display dimensions in pixels
+	int height;
+	uint8_t type;					// display type
+	uint8_t color_bits;				// 24 or 16
+	uint8_t gray;					// converts colors to grayscale if 1
+	uint32_t rdclock;				// spi clock for reading data from display memory in Hz
+	int8_t dc_pin;					// display DC pin
+	int8_t rst_pin;					// display reset pin, 0 if not used
+	int8_t bckl_pin;				// display backlight pin, 0 if not used
+	uint8_t madctl;					// memory access control set by _tft_setRotation()
+	// Hardware vertical scrolling, see disp_scroll_set()
+	struct {
+		int top;					// top fixed area lines
+		int bottom;					// bottom fixed area lines
+		int vsa;					// scroll area lines, 0 if not defined
+		int pos;					// scroll area content shifted up by 'pos' lines
+	} scroll;
+
+	// ** Used by the driver only **
+	uint8_t fill[FILL_PATTERN_SIZE] __attribute__((aligned(4)));	// solid fill pattern
+	uint8_t *cline;					// DMA buffer freed when the current transfer finishes
+	uint8_t dma_sending;			// DMA transfer started, DMA must be reset when finished
+	uint32_t rd_clock_saved;		// spi clock to be restored after streaming read
+	// Address window cache, current panel column & page window and RAMWR write pointer
+	struct {
+		int x1, x2;					// column window, -1 if unknown
+		int y1, y2;					// page window, -1 if unknown
+		int wx, wy;					// next pixel written by the active RAMWR stream
+		uint8_t ramwr;				// RAMWR data stream is active
+		disp_addrwin_stats_t stats;
+	} aw;
+	// Transaction queue
+	struct {
+		disp_trans_t trans[DISP_QUEUE_SIZE];
+		uint8_t head;				// next free slot
+		uint8_t tail;				// transaction being sent or next to send
+		volatile uint8_t count;		// number of queued transactions
+		uint8_t active;				// window & RAMWR sent for transaction at 'tail'
+		uint8_t selected;			// display is selected by the queue
+		volatile uint8_t running;	// transfers are started by the 'transaction done' interrupt
+		uint32_t fence_submitted;
+		volatile uint32_t fence_done;
+	} dq;
+	// Scatter-gather send, two descriptor sets and stage halves are used alternately
+	struct {
+		lldesc_t desc[2][DISP_SG_DESC];
+		uint8_t set;				// descriptor set and stage half being built
+		int used;					// descriptors used in the chain
+		uint32_t bytes;				// bytes in the chain
+		uint8_t *stage;				// stage half of the set, NULL if nothing is staged
+		uint32_t st_start;			// start of staged data not yet added to the chain
+		uint32_t st_pos;			// end of staged data
+	} sg;
+	// Shadow framebuffer, see disp_fb_enable()
+	struct {
+		uint8_t *buf;				// pixels in display transfer format, NULL if not used
+		uint8_t on;					// pixels are written to the framebuffer, cleared while flushing
+		uint8_t tile;				// 'buf' is a tile buffer set by disp_tile_begin()
+		uint8_t depth;				// bits per pixel of an indexed tile buffer, 0: display transfer format
+		const color_t *palette;		// colors of the indexed tile buffer
+		int ncolors;
+		color_t last_color;			// last color mapped to the palette index 'last_index'
+		int last_index;				// -1: none
+		int x, y;					// screen area held in 'buf', the whole screen or the tile
+		int w, h;
+		struct {					// target replaced by disp_tile_begin()
+			uint8_t *buf;
+			uint8_t on;
+			int x, y, w, h;
+		} saved;
+		int ndirty;					// number of dirty rectangles
+		disp_rect_t dirty[DISP_FB_DIRTY_MAX];
+		disp_fb_stats_t stats;
+	} fb;
+} disp_drv_t;
+
+// ==== Display context, defined in tft.h ====
+typedef struct tft_ctx tft_ctx_t;
+
+// FreeRTOS thread local storage pointer index used to bind the display context to a task
+// ** CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS must be greater than the index
+#define TFT_CTX_TLS_INDEX	1
+
+extern struct tft_ctx tft_default_ctx;
+extern uint32_t tft_ctx_bound;
+
+// Return the display context bound to the calling task, or the default context
+// The task local storage is only checked if any task has a bound context
+//--------------------------------------------------------
+static inline tft_ctx_t *tft_ctx_current()
+{
+	tft_ctx_t *ctx = NULL;
+	if (tft_ctx_bound) ctx = (tft_ctx_t *)pvTaskGetThreadLocalStoragePointer(NULL, TFT_CTX_TLS_INDEX);
+	return ((ctx) ? ctx : &tft_default_ctx);
+}
+
+// Display driver state of the current display context, the first member of tft_ctx_t
+#define disp_drv		((disp_drv_t *)tft_ctx_current())
+
+// DMA buffer pool, number of buffer classes, buffer sizes in bytes and number of buffers in each class
+// 512: small glyphs; 1536: JPEG/BMP/read lines (480*3); 3072: large glyphs, 16-bit conversion buffers
+#define DISP_DMA_POOL_CLASSES	3
+#define DISP_DMA_POOL_SIZES		{512, 1536, 3072}
+#define DISP_DMA_POOL_COUNTS	{4, 4, 2}
+
+// DMA buffer pool statistics, see disp_dma_pool_stats()
+typedef struct {
+	uint32_t size[DISP_DMA_POOL_CLASSES];		// buffer size of each class
+	uint8_t count[DISP_DMA_POOL_CLASSES];		// number of buffers in each class
+	uint8_t in_use[DISP_DMA_POOL_CLASSES];		// buffers currently in use
+	uint8_t high_water[DISP_DMA_POOL_CLASSES];	// maximum number of buffers used at the same time
+	uint32_t pool_allocs;						// allocations served from the pool
+	uint32_t heap_allocs;						// allocations served from heap (pool exhausted, too large or not initialized)
+	uint32_t failures;							// failed allocations
+} disp_dma_pool_stats_t;
+
 
 // Initialization sequence for ILI7749
 // ====================================
@@ -617,38 +848,277 @@ static const uint8_t Rcmd3[] = {
 
 
 // ==== Public functions =========================================================
+// The disp_drv_* functions operate on the display driver state 'drv' (the 'drv' member
+// of the display context), the same functions without it on the display context
+// bound to the calling task, or the default context
+
+// Set the display driver state to default values, used by TFT_ctx_create()
+void disp_drv_init(disp_drv_t *drv);
+
+// Set the hardware vertical scroll area and position, see TFT_setupScrollArea() and TFT_scrollTo()
+// Screen lines in the scroll area are translated to the GRAM lines displayed at them by
+// the write & read functions. Not supported if the panel scrolls horizontally (MADCTL_MV set)
+esp_err_t disp_scroll_set(int top, int bottom, int pos);
+esp_err_t disp_drv_scroll_set(disp_drv_t *drv, int top, int bottom, int pos);
+// Returns the number of screen lines from 'y1' (max y2-y1+1) which are stored in consecutive GRAM lines
+int disp_scroll_rows(int y1, int y2);
+int disp_drv_scroll_rows(disp_drv_t *drv, int y1, int y2);
 
 // == Low level functions; usually not used directly ==
 esp_err_t wait_trans_finish(uint8_t free_line);
+esp_err_t disp_drv_wait_trans_finish(disp_drv_t *drv, uint8_t free_line);
 void disp_spi_transfer_cmd(int8_t cmd);
+void disp_drv_transfer_cmd(disp_drv_t *drv, int8_t cmd);
 void disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len);
+void disp_drv_transfer_cmd_data(disp_drv_t *drv, int8_t cmd, uint8_t *data, uint32_t len);
 void drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
+void disp_drv_drawPixel(disp_drv_t *drv, int16_t x, int16_t y, color_t color, uint8_t sel);
 void send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf);
+void disp_drv_send_data(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t *buf);
+void send_data_rep(int x1, int y1, int x2, int y2, uint32_t len, color_t color);
+void disp_drv_send_data_rep(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint32_t len, color_t color);
+esp_err_t send_data_sg(int x1, int y1, int x2, int y2, const disp_seg_t *segs, int nsegs);
+esp_err_t disp_drv_send_data_sg(disp_drv_t *drv, int x1, int y1, int x2, int y2, const disp_seg_t *segs, int nsegs);
+esp_err_t send_data_xform(int x, int y, int w, int h, color_t *buf, int stride, uint8_t xform);
+esp_err_t disp_drv_send_data_xform(disp_drv_t *drv, int x, int y, int w, int h, color_t *buf, int stride, uint8_t xform);
+esp_err_t send_data_packed(int x, int y, int w, int h, const uint8_t *buf, int stride);
+esp_err_t disp_drv_send_data_packed(disp_drv_t *drv, int x, int y, int w, int h, const uint8_t *buf, int stride);
+// Position (dx,dy) of the source pixel (sx,sy) in the 'w' x 'h' source rectangle transformed by 'xform'
+void disp_xform_point(int w, int h, uint8_t xform, int sx, int sy, int *dx, int *dy);
 void TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t data, uint32_t len);
+void disp_drv_pushColorRep(disp_drv_t *drv, int x1, int y1, int x2, int y2, color_t data, uint32_t len);
 int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp);
+int disp_drv_read_data(disp_drv_t *drv, int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp);
 color_t readPixel(int16_t x, int16_t y);
+color_t disp_drv_readPixel(disp_drv_t *drv, int16_t x, int16_t y);
 int touch_get_data(uint8_t type);
 
 
+// Convert 'len' colors from color buffer to the display transfer format
+// 3 bytes per pixel in 24-bit mode, 2 bytes (RGB565) in 16-bit mode
+// Gray scale conversion is applied if 'tft_gray_scale' is set
+// Returns the number of bytes written to 'buf'
+//===================================================================
+uint32_t disp_pack_colors(uint8_t *buf, color_t *color, uint32_t len);
+uint32_t disp_drv_pack_colors(disp_drv_t *drv, uint8_t *buf, color_t *color, uint32_t len);
+
+// Queue pixel data for sending to the display window (x1,y1),(x2,y2)
+// 'data' must be in display transfer format (see disp_pack_colors) and DMA capable
+// The buffer must not be changed until the transaction is finished
+// The display must not be selected by the caller
+// The following transfers are started from the spi 'transaction done' interrupt;
+// when the queue is empty the display is released by the next queue function,
+// disp_select() or disp_deselect() call of the task
+// Returns the transaction fence id, 0 on error
+//====================================================================================
+uint32_t disp_queue_send(int x1, int y1, int x2, int y2, uint8_t *data, uint32_t size);
+uint32_t disp_drv_queue_send(disp_drv_t *drv, int x1, int y1, int x2, int y2, uint8_t *data, uint32_t size);
+
+// Start the next queued transaction if the spi bus is free,
+// needed only if the spi host has no 'transaction done' interrupt
+// Returns the number of pending transactions
+//==================
+int disp_queue_poll();
+int disp_drv_queue_poll(disp_drv_t *drv);
+
+// Returns 1 if the transaction with fence id 'fence' is finished, 0 if not
+//=================================
+int disp_queue_done(uint32_t fence);
+int disp_drv_queue_done(disp_drv_t *drv, uint32_t fence);
+
+// Wait until the transaction with fence id 'fence' is finished
+//=======================================
+esp_err_t disp_queue_wait(uint32_t fence);
+esp_err_t disp_drv_queue_wait(disp_drv_t *drv, uint32_t fence);
+
+// Create the driver DMA buffer pool; called from TFT_display_init
+// The pool memory is allocated once and never freed, so it cannot fragment
+//===========================
+esp_err_t disp_dma_pool_init();
+
+// Allocate DMA capable buffer of at least 'size' bytes
+// Smallest free pool buffer is used; if none is available, the buffer is allocated from heap
+// Returns NULL if no memory is available
+//=====================================
+void *disp_dma_alloc(uint32_t size);
+
+// Free the buffer allocated with disp_dma_alloc
+//==============================
+void disp_dma_free(void *buf);
+
+// Get the DMA buffer pool statistics; reset the counters and high water marks if 'reset' is not 0
+//===================================================================
+void disp_dma_pool_stats(disp_dma_pool_stats_t *stats, uint8_t reset);
+
+// Forget the cached display address window and RAM write pointer
+// Must be called if the display window is changed bypassing this driver
+//==============================
+void disp_addrwin_invalidate();
+void disp_drv_addrwin_invalidate(disp_drv_t *drv);
+
+// Get the address window cache counters; reset them if 'reset' is not 0
+//===================================================================
+void disp_get_addrwin_stats(disp_addrwin_stats_t *stats, uint8_t reset);
+void disp_drv_get_addrwin_stats(disp_drv_t *drv, disp_addrwin_stats_t *stats, uint8_t reset);
+
+// Enable or disable the shadow framebuffer of the display
+// When enabled, all pixel writes (drawPixel, TFT_pushColorRep, send_data*, disp_queue_send) go to
+// the framebuffer in RAM (PSRAM if available) and the written rectangles are recorded.
+// disp_fb_flush() sends only the changed rectangles; reads are served from the framebuffer.
+// The framebuffer is loaded from the display RAM when enabled, flushed and freed when disabled.
+// Hardware scrolling can't be used with the framebuffer
+// Returns ESP_ERR_NO_MEM if the framebuffer can't be allocated,
+//         ESP_ERR_INVALID_STATE if the scroll area is defined
+//=========================================
+esp_err_t disp_fb_enable(uint8_t enable);
+esp_err_t disp_drv_fb_enable(disp_drv_t *drv, uint8_t enable);
+
+// Merge the dirty rectangles and send them to the display
+//=======================
+esp_err_t disp_fb_flush();
+esp_err_t disp_drv_fb_flush(disp_drv_t *drv);
+
+// Get the shadow framebuffer counters; reset them if 'reset' is not 0
+//==============================================================
+void disp_fb_get_stats(disp_fb_stats_t *stats, uint8_t reset);
+void disp_drv_fb_get_stats(disp_drv_t *drv, disp_fb_stats_t *stats, uint8_t reset);
+
+// Render to the tile (or canvas) buffer 'buf' holding the area (x,y),(x+w-1,y+h-1) in display transfer format
+// Until disp_tile_end(), all pixel writes go to the tile buffer, pixels outside of the tile are skipped,
+// disp_select(), disp_deselect(), wait_trans_finish(), disp_bus_yield() and the display commands do not
+// access the spi bus, so the queued transfers continue in background and another task may use the display
+// The shadow framebuffer, if enabled, is used again after disp_tile_end()
+// Returns ESP_ERR_INVALID_STATE if already rendering to a tile
+//==================================================================
+esp_err_t disp_tile_begin(uint8_t *buf, int x, int y, int w, int h);
+esp_err_t disp_drv_tile_begin(disp_drv_t *drv, uint8_t *buf, int x, int y, int w, int h);
+
+// Render to the indexed color tile (or canvas) buffer 'buf' holding the area (x,y),(x+w-1,y+h-1)
+// Each pixel is a 'depth' (1, 2, 4 or 8) bit index into 'palette' of 'ncolors' colors,
+// rows start at byte boundary and pixels are packed from the most significant bit.
+// Written colors are mapped to the exact or the nearest palette color, reads return palette colors.
+// Returns ESP_ERR_INVALID_STATE if already rendering to a tile
+//=============================================================================================================================
+esp_err_t disp_tile_begin_indexed(uint8_t *buf, int x, int y, int w, int h, uint8_t depth, const color_t *palette, int ncolors);
+esp_err_t disp_drv_tile_begin_indexed(disp_drv_t *drv, uint8_t *buf, int x, int y, int w, int h, uint8_t depth, const color_t *palette, int ncolors);
+
+// Stop rendering to the tile buffer
+//==================
+void disp_tile_end();
+void disp_drv_tile_end(disp_drv_t *drv);
+
+// Bytes in one row of 'w' pixels of the indexed buffer with 'depth' bits per pixel
+//=====================================================
+uint32_t disp_indexed_row_bytes(int w, uint8_t depth);
+
+// Expand 'len' pixels of the indexed buffer row 'src', starting at pixel 'x',
+// to 'dst' using 'palette' of 2^depth colors already in display transfer format (see disp_pack_colors())
+// Returns the number of bytes written to 'dst'
+//=============================================================================================================================
+uint32_t disp_expand_indexed(uint8_t *dst, const uint8_t *src, int x, uint32_t len, uint8_t depth, const uint8_t *palette);
+uint32_t disp_drv_expand_indexed(disp_drv_t *drv, uint8_t *dst, const uint8_t *src, int x, uint32_t len, uint8_t depth, const uint8_t *palette);
+
+// Wait until all queued transactions are finished and release the display
+// Called automatically from disp_select()
+//==========================
+esp_err_t disp_queue_flush();
+esp_err_t disp_drv_queue_flush(disp_drv_t *drv);
+
 // Deactivate display's CS line
 //========================
 esp_err_t disp_deselect();
+esp_err_t disp_drv_deselect(disp_drv_t *drv);
+
+// Release the spi bus if a device with higher priority than the display waits for it
+// (see 'priority' and 'latency_us' in spi_lobo_device_interface_config_t)
+// The display is selected again when the waiting devices are done, the RAM write must be restarted
+// Long fills are split and the bus released automatically, call from loops sending many small blocks
+//==========================
+esp_err_t disp_bus_yield();
+esp_err_t disp_drv_bus_yield(disp_drv_t *drv);
 
 // Activate display's CS line and configure SPI interface if necessary
 //======================
 esp_err_t disp_select();
+esp_err_t disp_drv_select(disp_drv_t *drv);
+
+
+// Start streaming read of the display window (x1,y1),(x2,y2)
+// The display is selected and the spi clock is set to 'tft_max_rdclock' until disp_read_end()
+// No other spi device on the same bus can be used until then!
+// The display always returns 3 bytes (6-6-6) per pixel, the dummy byte is skipped
+// Returns 0 on success
+//===================================================
+int disp_read_begin(int x1, int y1, int x2, int y2);
+int disp_drv_read_begin(disp_drv_t *drv, int x1, int y1, int x2, int y2);
+
+// Read the next 'size' bytes of the window into 'buf'
+// If 'buf' is DMA capable and 32-bit aligned and 'size' is multiple of 4 and not larger than
+// the spi bus max transfer size, the read runs in background if 'wait' is 0; use disp_read_wait()
+// Returns 0 on success
+//===========================================================
+int disp_read_next(uint8_t *buf, uint32_t size, uint8_t wait);
+int disp_drv_read_next(disp_drv_t *drv, uint8_t *buf, uint32_t size, uint8_t wait);
+
+// Wait for the background read started by disp_read_next to finish
+//========================
+esp_err_t disp_read_wait();
+esp_err_t disp_drv_read_wait(disp_drv_t *drv);
 
+// Finish streaming read, deselect the display and restore the spi clock
+//===================
+void disp_read_end();
+void disp_drv_read_end(disp_drv_t *drv);
 
 // Find maximum spi clock for successful read from display RAM
 // ** Must be used AFTER the display is initialized **
 //======================
 uint32_t find_rd_speed();
+uint32_t disp_drv_find_rd_speed(disp_drv_t *drv);
+
+// Find maximum spi clock for reliable writes to display RAM, up to 'max_speed'
+// The clock is stepped up from the current spi clock, a test pattern is written and verified
+// by reading it back at the read clock. The highest passing clock is selected if it also passes
+// WR_SPEED_CONFIRM_PASSES consecutive passes, otherwise the next lower clock which does.
+// The result is stored in NVS (nvs_flash_init() must be called before) and returned
+// on later calls without testing, unless 'recalibrate' is set or the display or 'max_speed' changed.
+// Returns the current spi clock if it can't be verified (display RAM can't be read)
+// ** Must be used AFTER the display is initialized and 'tft_max_rdclock' is set **
+//==============================================================
+uint32_t find_wr_speed(uint32_t max_speed, uint8_t recalibrate);
+uint32_t disp_drv_find_wr_speed(disp_drv_t *drv, uint32_t max_speed, uint8_t recalibrate);
+
+// Get the write clock stored in NVS by find_wr_speed() for the current display, 0 if there is none
+// This is the only stored copy of the write clock, also used by TFT_profile_load()
+//======================
+uint32_t get_wr_speed();
+uint32_t disp_drv_get_wr_speed(disp_drv_t *drv);
+
+// Check if the display RAM is reliably written at 'speed', by reading back a test pattern at the read clock
+// The spi clock is restored; returns ESP_OK if the pattern was read back correctly
+//===========================================
+esp_err_t check_wr_speed(uint32_t speed);
+esp_err_t disp_drv_check_wr_speed(disp_drv_t *drv, uint32_t speed);
+
+// Read the display ID (RDDID command) at the read clock
+// Returns the first 4 bytes received after the command, 0 on error
+//======================
+uint32_t disp_read_id();
+uint32_t disp_drv_read_id(disp_drv_t *drv);
+
 
+// Set the display interface pixel format
+// Input: bits 16 (RGB565) or 24 (18-bit color)
+// Returns the color bits actually set (always 24 on ILI9488)
+//========================================
+uint8_t _tft_setColorBits(uint8_t bits);
+uint8_t disp_drv_setColorBits(disp_drv_t *drv, uint8_t bits);
 
 // Change the screen rotation.
 // Input: m new rotation value (0 to 3)
 //=================================
 void _tft_setRotation(uint8_t rot);
+void disp_drv_setRotation(disp_drv_t *drv, uint8_t rot);
 
 // Initialize all pins used by display driver
 // ** MUST be executed before SPI interface initialization
@@ -659,9 +1129,10 @@ void TFT_PinsInit();
 // Sets orientation to landscape; clears the screen
 // * All pins must be configured
 // * SPI interface must already be setup
-// * 'tft_disp_type', 'COLOR_BITS', '_width', '_height' variables must be set
+// * 'tft_disp_type', 'tft_color_bits', 'tft_width', 'tft_height' variables must be set
 //======================
 void TFT_display_init();
+void disp_drv_display_init(disp_drv_t *drv);
 
 //===================
 void stmpe610_Init();
@@ -46,6 +46,12 @@
 #define SPI_BUS TFT_HSPI_HOST
 // ==========================================================
 
+// Maximum display write clock tested by find_wr_speed()
+#define MAX_WR_SPI_CLOCK 40000000
+
+// Display profile with the measured spi clocks and touch calibration
+#define DISP_PROFILE_FILE SPIFFS_BASE_PATH"/disp_profile.bin"
+
 
 static int _demo_pass = 0;
 static uint8_t doprint = 1;
@@ -176,19 +182,19 @@ static void _checkTime()
 		TFT_saveClipWin();
 		TFT_resetclipwin();
 
-		Font curr_font = cfont;
-		last_bg = _bg;
-		last_fg = _fg;
-		_fg = TFT_YELLOW;
-		_bg = (color_t){ 64, 64, 64 };
+		Font curr_font = tft_cfont;
+		last_bg = tft_bg;
+		last_fg = tft_fg;
+		tft_fg = TFT_YELLOW;
+		tft_bg = (color_t){ 64, 64, 64 };
 		TFT_setFont(DEFAULT_FONT, NULL);
 
-		TFT_fillRect(1, _height-TFT_getfontheight()-8, _width-3, TFT_getfontheight()+6, _bg);
-		TFT_print(tmp_buff, CENTER, _height-TFT_getfontheight()-5);
+		TFT_fillRect(1, tft_height-TFT_getfontheight()-8, tft_width-3, TFT_getfontheight()+6, tft_bg);
+		TFT_print(tmp_buff, CENTER, tft_height-TFT_getfontheight()-5);
 
-		cfont = curr_font;
-		_fg = last_fg;
-		_bg = last_bg;
+		tft_cfont = curr_font;
+		tft_fg = last_fg;
+		tft_bg = last_bg;
 
 		TFT_restoreClipWin();
 	}
@@ -261,20 +267,29 @@ static color_t random_color() {
 	return color;
 }
 
+// Reference gray scale conversion, floating point, as used before the fixed point packing
+//----------------------------------------------
+static color_t color2gs_float(color_t color) {
+
+	float gs_clr = 0.2989 * color.r + 0.5870 * color.g + 0.1140 * color.b;
+	if (gs_clr > 255) gs_clr = 255;
+	return (color_t){(uint8_t)gs_clr, (uint8_t)gs_clr, (uint8_t)gs_clr};
+}
+
 //---------------------
 static void _dispTime()
 {
-	Font curr_font = cfont;
-    if (_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
+	Font curr_font = tft_cfont;
+    if (tft_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
 	else TFT_setFont(DEFAULT_FONT, NULL);
 
     time(&time_now);
 	time_last = time_now;
 	tm_info = localtime(&time_now);
 	sprintf(tmp_buff, "%02d:%02d:%02d", tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
-	TFT_print(tmp_buff, CENTER, _height-TFT_getfontheight()-5);
+	TFT_print(tmp_buff, CENTER, tft_height-TFT_getfontheight()-5);
 
-    cfont = curr_font;
+    tft_cfont = curr_font;
 }
 
 //---------------------------------
@@ -283,22 +298,22 @@ static void disp_header(char *info)
 	TFT_fillScreen(TFT_BLACK);
 	TFT_resetclipwin();
 
-	_fg = TFT_YELLOW;
-	_bg = (color_t){ 64, 64, 64 };
+	tft_fg = TFT_YELLOW;
+	tft_bg = (color_t){ 64, 64, 64 };
 
-    if (_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
+    if (tft_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
 	else TFT_setFont(DEFAULT_FONT, NULL);
-	TFT_fillRect(0, 0, _width-1, TFT_getfontheight()+8, _bg);
-	TFT_drawRect(0, 0, _width-1, TFT_getfontheight()+8, TFT_CYAN);
+	TFT_fillRect(0, 0, tft_width-1, TFT_getfontheight()+8, tft_bg);
+	TFT_drawRect(0, 0, tft_width-1, TFT_getfontheight()+8, TFT_CYAN);
 
-	TFT_fillRect(0, _height-TFT_getfontheight()-9, _width-1, TFT_getfontheight()+8, _bg);
-	TFT_drawRect(0, _height-TFT_getfontheight()-9, _width-1, TFT_getfontheight()+8, TFT_CYAN);
+	TFT_fillRect(0, tft_height-TFT_getfontheight()-9, tft_width-1, TFT_getfontheight()+8, tft_bg);
+	TFT_drawRect(0, tft_height-TFT_getfontheight()-9, tft_width-1, TFT_getfontheight()+8, TFT_CYAN);
 
 	TFT_print(info, CENTER, 4);
 	_dispTime();
 
-	_bg = TFT_BLACK;
-	TFT_setclipwin(0,TFT_getfontheight()+9, _width-1, _height-TFT_getfontheight()-10);
+	tft_bg = TFT_BLACK;
+	TFT_setclipwin(0,TFT_getfontheight()+9, tft_width-1, tft_height-TFT_getfontheight()-10);
 }
 
 //---------------------------------------------
@@ -309,28 +324,28 @@ static void update_header(char *hdr, char *ftr)
 	TFT_saveClipWin();
 	TFT_resetclipwin();
 
-	Font curr_font = cfont;
-	last_bg = _bg;
-	last_fg = _fg;
-	_fg = TFT_YELLOW;
-	_bg = (color_t){ 64, 64, 64 };
-    if (_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
+	Font curr_font = tft_cfont;
+	last_bg = tft_bg;
+	last_fg = tft_fg;
+	tft_fg = TFT_YELLOW;
+	tft_bg = (color_t){ 64, 64, 64 };
+    if (tft_width < 240) TFT_setFont(DEF_SMALL_FONT, NULL);
 	else TFT_setFont(DEFAULT_FONT, NULL);
 
 	if (hdr) {
-		TFT_fillRect(1, 1, _width-3, TFT_getfontheight()+6, _bg);
+		TFT_fillRect(1, 1, tft_width-3, TFT_getfontheight()+6, tft_bg);
 		TFT_print(hdr, CENTER, 4);
 	}
 
 	if (ftr) {
-		TFT_fillRect(1, _height-TFT_getfontheight()-8, _width-3, TFT_getfontheight()+6, _bg);
+		TFT_fillRect(1, tft_height-TFT_getfontheight()-8, tft_width-3, TFT_getfontheight()+6, tft_bg);
 		if (strlen(ftr) == 0) _dispTime();
-		else TFT_print(ftr, CENTER, _height-TFT_getfontheight()-5);
+		else TFT_print(ftr, CENTER, tft_height-TFT_getfontheight()-5);
 	}
 
-	cfont = curr_font;
-	_fg = last_fg;
-	_bg = last_bg;
+	tft_cfont = curr_font;
+	tft_fg = last_fg;
+	tft_bg = last_bg;
 
 	TFT_restoreClipWin();
 }
@@ -350,31 +365,163 @@ static void test_times() {
 		sprintf(tmp_buff, "Clear screen: %u ms", t1);
 		TFT_print(tmp_buff, 0, 140);
 
-		color_t *color_line = heap_caps_malloc((_width*3), MALLOC_CAP_DMA);
-		color_t *gsline = NULL;
-		if (gray_scale) gsline = malloc(_width*3);
+		color_t *color_line = disp_dma_alloc(tft_width*3);
 		if (color_line) {
-			float hue_inc = (float)((10.0 / (float)(_height-1) * 360.0));
-			for (int x=0; x<_width; x++) {
-				color_line[x] = HSBtoRGB(hue_inc, 1.0, (float)x / (float)_width);
-				if (gsline) gsline[x] = color_line[x];
+			float hue_inc = (float)((10.0 / (float)(tft_height-1) * 360.0));
+			for (int x=0; x<tft_width; x++) {
+				color_line[x] = HSBtoRGB(hue_inc, 1.0, (float)x / (float)tft_width);
 			}
+			spi_lobo_wait_stats_t wstats;
+			spi_lobo_bus_stats_t bstats;
+			spi_lobo_get_wait_stats(tft_disp_spi, &wstats, true);
+			spi_lobo_get_bus_stats(tft_disp_spi, &bstats, true);
 			disp_select();
 			tstart = clock();
 			for (int n=0; n<1000; n++) {
-				if (gsline) memcpy(color_line, gsline, _width*3);
-				send_data(0, 40+(n&63), dispWin.x2-dispWin.x1, 40+(n&63), (uint32_t)(dispWin.x2-dispWin.x1+1), color_line);
+				send_data(0, 40+(n&63), tft_dispWin.x2-tft_dispWin.x1, 40+(n&63), (uint32_t)(tft_dispWin.x2-tft_dispWin.x1+1), color_line);
 				wait_trans_finish(1);
 			}
 			t2 = clock() - tstart;
 			disp_deselect();
 
-			printf("Send color buffer time: %u us (%d pixels)\r\n", t2, dispWin.x2-dispWin.x1+1);
-			free(color_line);
+			printf("Send color buffer time: %u us (%d pixels)\r\n", t2, tft_dispWin.x2-tft_dispWin.x1+1);
+			// ** CPU cycles available to other tasks while waiting for the transfers
+			spi_lobo_get_wait_stats(tft_disp_spi, &wstats, true);
+			if (wstats.intr_waits) {
+				printf("      CPU cycles saved: %u per transfer (%u intr, %u spin waits)\r\n",
+						(uint32_t)(wstats.cycles_saved / wstats.intr_waits), wstats.intr_waits, wstats.spin_waits);
+			}
+			// ** Bus utilization from the transfer statistics
+			spi_lobo_get_bus_stats(tft_disp_spi, &bstats, true);
+			uint32_t speed = spi_lobo_get_speed(tft_disp_spi);
+			uint32_t busy_ms = (speed) ? (uint32_t)((bstats.tx_bytes * 8 * 1000) / speed) : 0;
+			printf("      Bus transactions: %u (%u DMA, %u direct), %u bytes sent\r\n",
+					bstats.transactions, bstats.dma_transactions, bstats.direct_transactions, (uint32_t)bstats.tx_bytes);
+			printf("      Bus busy: %u ms of %u ms, polling: %u us\r\n", busy_ms, t2, (uint32_t)bstats.spin_us);
 
 			sprintf(tmp_buff, "   Send line: %u us", t2);
 			TFT_print(tmp_buff, 0, 144+TFT_getfontheight());
+
+			// ** Same lines sent using the transaction queue,
+			//    the next line is prepared while the previous one is sent
+			int line_len = tft_dispWin.x2-tft_dispWin.x1+1;
+			uint8_t *qline[2];
+			uint32_t qfence[2] = {0, 0};
+			qline[0] = disp_dma_alloc(line_len*3);
+			qline[1] = disp_dma_alloc(line_len*3);
+			if ((qline[0]) && (qline[1])) {
+				tstart = clock();
+				for (int n=0; n<1000; n++) {
+					if (qfence[n&1]) disp_queue_wait(qfence[n&1]);
+					uint32_t size = disp_pack_colors(qline[n&1], color_line, line_len);
+					qfence[n&1] = disp_queue_send(0, 40+(n&63), line_len-1, 40+(n&63), qline[n&1], size);
+				}
+				disp_queue_flush();
+				t2 = clock() - tstart;
+				printf("  Queued send line time: %u us\r\n", t2);
+
+				sprintf(tmp_buff, " Queued line: %u us", t2);
+				TFT_print(tmp_buff, 0, 148+(TFT_getfontheight()*2));
+			}
+			// ** Line gathered from two sources in one RAM WRITE stream:
+			//    packed colors for the left part, 4-pixel pattern repeated for the right part
+			if ((qline[0]) && (qline[1])) {
+				int rep_len = (line_len / 2) & ~3;
+				disp_seg_t segs[2];
+				segs[0].data = qline[0];
+				segs[0].len = disp_pack_colors(qline[0], color_line, line_len - rep_len);
+				segs[0].repeat = 1;
+				segs[1].data = qline[1];
+				segs[1].len = disp_pack_colors(qline[1], color_line + (line_len - rep_len), 4);
+				segs[1].repeat = rep_len / 4;
+				disp_select();
+				tstart = clock();
+				for (int n=0; n<1000; n++) {
+					send_data_sg(0, 40+(n&63), line_len-1, 40+(n&63), segs, 2);
+				}
+				wait_trans_finish(1);
+				t2 = clock() - tstart;
+				disp_deselect();
+				printf("Gathered send line time: %u us\r\n", t2);
+			}
+			// ** Packing throughput, color vs. gray scale converted while packing,
+			// ** and the float conversion of the source line followed by color packing as reference
+			color_t *gs_line = disp_dma_alloc(line_len*3);
+			if ((qline[0]) && (gs_line)) {
+				uint32_t t3;
+				uint8_t last_gs = tft_gray_scale;
+				tft_gray_scale = 0;
+				tstart = clock();
+				for (int n=0; n<1000; n++) {
+					disp_pack_colors(qline[0], color_line, line_len);
+				}
+				t1 = clock() - tstart;
+				tft_gray_scale = 1;
+				tstart = clock();
+				for (int n=0; n<1000; n++) {
+					disp_pack_colors(qline[0], color_line, line_len);
+				}
+				t2 = clock() - tstart;
+				tft_gray_scale = 0;
+				tstart = clock();
+				for (int n=0; n<1000; n++) {
+					for (int x=0; x<line_len; x++) gs_line[x] = color2gs_float(color_line[x]);
+					disp_pack_colors(qline[0], gs_line, line_len);
+				}
+				t3 = clock() - tstart;
+				tft_gray_scale = last_gs;
+				printf("   Pack line, color: %u us, gray scale: %u us, float gray scale (reference): %u us\r\n", t1, t2, t3);
+			}
+			disp_dma_free(gs_line);
+			disp_dma_free(qline[0]);
+			disp_dma_free(qline[1]);
+			disp_dma_free(color_line);
+		}
+
+		// ** Address window cache savings when drawing pixel primitives
+		disp_addrwin_stats_t awstats;
+		disp_get_addrwin_stats(NULL, 1);
+		tstart = clock();
+		for (int n=0; n<20; n++) {
+			TFT_drawCircle(tft_width/2, tft_height/2, 4+(n*2), TFT_YELLOW);
+		}
+		t1 = clock() - tstart;
+		disp_get_addrwin_stats(&awstats, 1);
+		printf("          Circles time: %u ms\r\n", t1);
+		printf("    CASET sent/skipped: %u/%u, PASET sent/skipped: %u/%u\r\n",
+				awstats.caset_sent, awstats.caset_skipped, awstats.paset_sent, awstats.paset_skipped);
+		printf("  RAMWR sent/continued: %u/%u\r\n", awstats.ramwr_sent, awstats.ramwr_continued);
+
+		// ** DMA buffer pool usage
+		disp_dma_pool_stats_t pstats;
+		disp_dma_pool_stats(&pstats, 0);
+		for (int n=0; n<DISP_DMA_POOL_CLASSES; n++) {
+			printf("   DMA pool %4u bytes: %u/%u used, max %u\r\n", pstats.size[n], pstats.in_use[n], pstats.count[n], pstats.high_water[n]);
+		}
+		printf("  DMA pool/heap allocs: %u/%u, failed: %u\r\n", pstats.pool_allocs, pstats.heap_allocs, pstats.failures);
+
+#if USE_TOUCH > TOUCH_TYPE_NONE
+		// ** Display/touch device switch time, cached register image vs. full reconfiguration
+		for (int force=0; force<2; force++) {
+			tstart = clock();
+			for (int n=0; n<10000; n++) {
+				spi_lobo_device_select(tft_disp_spi, force);
+				spi_lobo_device_deselect(tft_disp_spi);
+				spi_lobo_device_select(ts_spi, force);
+				spi_lobo_device_deselect(ts_spi);
+			}
+			t1 = clock() - tstart;
+			// 20000 switches, time in ns per switch
+			printf("  Device switch, %s: %u ns\r\n", (force) ? "reconfigured" : "cached", t1 * 50);
 		}
+		// ** Worst case time the touch waited for the bus
+		spi_lobo_bus_stats_t bstats;
+		spi_lobo_get_bus_stats(ts_spi, &bstats, 0);
+		printf("   Touch bus wait, max: %u us, avg: %u us (%u acquires)\r\n", bstats.max_wait_us,
+				(bstats.acquires) ? (uint32_t)(bstats.total_wait_us / bstats.acquires) : 0, bstats.acquires);
+		spi_lobo_get_bus_stats(tft_disp_spi, &bstats, 0);
+		printf("  Display bus wait, max: %u us, yielded %u times\r\n", bstats.max_wait_us, bstats.yields);
+#endif
 		Wait(GDEMO_INFO_TIME);
     }
 }
@@ -418,6 +565,51 @@ static void disp_images() {
 			Wait(-500);
 		}
 		Wait(-GDEMO_INFO_TIME);
+
+		// ** Capture the center of the screen to BMP file and show it
+		update_header("SCREEN CAPTURE", "");
+		int cap_x = (tft_width - (tft_width/2)) / 2;
+		int cap_y = (tft_height - (tft_height/2)) / 2;
+		tstart = clock();
+		int cap_size = TFT_captureRegion(cap_x, cap_y, tft_width/2, tft_height/2, TFT_CAPTURE_BMP, SPIFFS_BASE_PATH"/images/capture.bmp", NULL, 0);
+		tstart = clock() - tstart;
+		if (doprint) printf("    Capture time: %u ms (%d bytes)\r\n", tstart, cap_size);
+		if (cap_size > 0) {
+			TFT_fillWindow(TFT_BLACK);
+			TFT_bmp_image(CENTER, CENTER, 0, SPIFFS_BASE_PATH"/images/capture.bmp", NULL, 0);
+			remove(SPIFFS_BASE_PATH"/images/capture.bmp");
+		}
+		sprintf(tmp_buff, "Capture time: %u ms", tstart);
+		update_header(NULL, tmp_buff);
+		Wait(-GDEMO_INFO_TIME);
+
+		// ** Draw a gradient block in all orientations using the display memory access order
+		update_header("ROTATED BLIT", "");
+		int bw = tft_dispWin.x2 / 5;
+		int bh = tft_dispWin.y2 / 5;
+		color_t *blk = disp_dma_alloc(bw*bh*3);
+		if (blk) {
+			for (int j=0; j<bh; j++) {
+				for (int i=0; i<bw; i++) {
+					blk[(j*bw)+i].r = (i*255) / bw;
+					blk[(j*bw)+i].g = (j*255) / bh;
+					blk[(j*bw)+i].b = ((i < 4) || (j < 4)) ? 255 : 0;
+				}
+			}
+			TFT_fillWindow(TFT_BLACK);
+			tstart = clock();
+			for (int n=0; n<8; n++) {
+				int bx = 4 + ((n % 4) * ((tft_dispWin.x2 - 8) / 4));
+				int by = 4 + ((n / 4) * ((tft_dispWin.y2 - 8) / 2));
+				TFT_blit(bx, by, bw, bh, blk, (n & 3) | ((n & 4) ? DISP_XFORM_FLIPX : 0));
+			}
+			tstart = clock() - tstart;
+			disp_dma_free(blk);
+			if (doprint) printf("    Rotated blit time: %u ms\r\n", tstart);
+			sprintf(tmp_buff, "8 blits: %u ms", tstart);
+			update_header(NULL, tmp_buff);
+			Wait(-GDEMO_INFO_TIME);
+		}
 	}
 	else if (doprint) printf("  No file system found.\r\n");
 }
@@ -435,7 +627,7 @@ static void font_demo()
 	while ((clock() < end_time) && (Wait(0))) {
 		y = 4;
 		for (int f=DEFAULT_FONT; f<FONT_7SEG; f++) {
-			_fg = random_color();
+			tft_fg = random_color();
 			TFT_setFont(f, NULL);
 			TFT_print("Welcome to ESP32", 4, y);
 			y += TFT_getfontheight() + 4;
@@ -449,31 +641,31 @@ static void font_demo()
 	if (spiffs_is_mounted) {
 		disp_header("FONT FROM FILE DEMO");
 
-		text_wrap = 1;
+		tft_text_wrap = 1;
 		for (int f=0; f<3; f++) {
 			TFT_fillWindow(TFT_BLACK);
 			update_header(NULL, "");
 
 			TFT_setFont(USER_FONT, file_fonts[f]);
-			if (f == 0) font_line_space = 4;
+			if (f == 0) tft_font_line_space = 4;
 			end_time = clock() + GDEMO_TIME;
 			n = 0;
 			while ((clock() < end_time) && (Wait(0))) {
-				_fg = random_color();
+				tft_fg = random_color();
 				TFT_print("Welcome to ESP32\nThis is user font.", 0, 8);
 				n++;
 			}
-			if ((_width < 240) || (_height < 240)) TFT_setFont(DEF_SMALL_FONT, NULL);
+			if ((tft_width < 240) || (tft_height < 240)) TFT_setFont(DEF_SMALL_FONT, NULL);
             else TFT_setFont(DEFAULT_FONT, NULL);
-			_fg = TFT_YELLOW;
-			TFT_print((char *)file_fonts[f], 0, (dispWin.y2-dispWin.y1)-TFT_getfontheight()-4);
+			tft_fg = TFT_YELLOW;
+			TFT_print((char *)file_fonts[f], 0, (tft_dispWin.y2-tft_dispWin.y1)-TFT_getfontheight()-4);
 
-            font_line_space = 0;
+            tft_font_line_space = 0;
 			sprintf(tmp_buff, "%d STRINGS", n);
 			update_header(NULL, tmp_buff);
 			Wait(-GDEMO_INFO_TIME);
 		}
-		text_wrap = 0;
+		tft_text_wrap = 0;
 	}
 
 	disp_header("ROTATED FONT DEMO");
@@ -482,17 +674,17 @@ static void font_demo()
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
 		for (int f=DEFAULT_FONT; f<FONT_7SEG; f++) {
-			_fg = random_color();
+			tft_fg = random_color();
 			TFT_setFont(f, NULL);
-			x = rand_interval(8, dispWin.x2-8);
-			y = rand_interval(0, (dispWin.y2-dispWin.y1)-TFT_getfontheight()-2);
-			font_rotate = rand_interval(0, 359);
+			x = rand_interval(8, tft_dispWin.x2-8);
+			y = rand_interval(0, (tft_dispWin.y2-tft_dispWin.y1)-TFT_getfontheight()-2);
+			tft_font_rotate = rand_interval(0, 359);
 
 			TFT_print("Welcome to ESP32", x, y);
 			n++;
 		}
 	}
-	font_rotate = 0;
+	tft_font_rotate = 0;
 	sprintf(tmp_buff, "%d STRINGS", n);
 	update_header(NULL, tmp_buff);
 	Wait(-GDEMO_INFO_TIME);
@@ -515,25 +707,25 @@ static void font_demo()
 			ctime = clock();
 		}
 
-		_fg = TFT_ORANGE;
+		tft_fg = TFT_ORANGE;
 		sprintf(tmp_buff, "%02d:%02d:%03d", tm_info->tm_min, tm_info->tm_sec, ms);
 		TFT_setFont(FONT_7SEG, NULL);
-        if ((_width < 240) || (_height < 240)) set_7seg_font_atrib(8, 1, 1, TFT_DARKGREY);
+        if ((tft_width < 240) || (tft_height < 240)) set_7seg_font_atrib(8, 1, 1, TFT_DARKGREY);
 		else set_7seg_font_atrib(12, 2, 1, TFT_DARKGREY);
 		//TFT_clearStringRect(12, y, tmp_buff);
 		TFT_print(tmp_buff, CENTER, y);
 		n++;
 
-		_fg = TFT_GREEN;
+		tft_fg = TFT_GREEN;
 		y += TFT_getfontheight() + 12;
-		if ((_width < 240) || (_height < 240)) set_7seg_font_atrib(9, 1, 1, TFT_DARKGREY);
+		if ((tft_width < 240) || (tft_height < 240)) set_7seg_font_atrib(9, 1, 1, TFT_DARKGREY);
         else set_7seg_font_atrib(14, 3, 1, TFT_DARKGREY);
 		sprintf(tmp_buff, "%02d:%02d", tm_info->tm_sec, ms / 10);
 		//TFT_clearStringRect(12, y, tmp_buff);
 		TFT_print(tmp_buff, CENTER, y);
 		n++;
 
-		_fg = random_color();
+		tft_fg = random_color();
 		y += TFT_getfontheight() + 8;
 		set_7seg_font_atrib(6, 1, 1, TFT_DARKGREY);
 		getFontCharacters((uint8_t *)tmp_buff);
@@ -549,20 +741,20 @@ static void font_demo()
 
 	TFT_saveClipWin();
 	TFT_resetclipwin();
-	TFT_drawRect(38, 48, (_width*3/4) - 36, (_height*3/4) - 46, TFT_WHITE);
-	TFT_setclipwin(40, 50, _width*3/4, _height*3/4);
+	TFT_drawRect(38, 48, (tft_width*3/4) - 36, (tft_height*3/4) - 46, TFT_WHITE);
+	TFT_setclipwin(40, 50, tft_width*3/4, tft_height*3/4);
 
-	if ((_width < 240) || (_height < 240)) TFT_setFont(DEF_SMALL_FONT, NULL);
+	if ((tft_width < 240) || (tft_height < 240)) TFT_setFont(DEF_SMALL_FONT, NULL);
     else TFT_setFont(UBUNTU16_FONT, NULL);
-	text_wrap = 1;
+	tft_text_wrap = 1;
 	end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		_fg = random_color();
+		tft_fg = random_color();
 		TFT_print("This text is printed inside the window.\nLong line can be wrapped to the next line.\nWelcome to ESP32", 0, 0);
 		n++;
 	}
-	text_wrap = 0;
+	tft_text_wrap = 0;
 	sprintf(tmp_buff, "%d STRINGS", n);
 	update_header(NULL, tmp_buff);
 	Wait(-GDEMO_INFO_TIME);
@@ -580,10 +772,10 @@ static void rect_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(4, dispWin.x2-4);
-		y = rand_interval(4, dispWin.y2-2);
-		w = rand_interval(2, dispWin.x2-x);
-		h = rand_interval(2, dispWin.y2-y);
+		x = rand_interval(4, tft_dispWin.x2-4);
+		y = rand_interval(4, tft_dispWin.y2-2);
+		w = rand_interval(2, tft_dispWin.x2-x);
+		h = rand_interval(2, tft_dispWin.y2-y);
 		TFT_drawRect(x,y,w,h,random_color());
 		n++;
 	}
@@ -596,10 +788,10 @@ static void rect_demo()
 	end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(4, dispWin.x2-4);
-		y = rand_interval(4, dispWin.y2-2);
-		w = rand_interval(2, dispWin.x2-x);
-		h = rand_interval(2, dispWin.y2-y);
+		x = rand_interval(4, tft_dispWin.x2-4);
+		y = rand_interval(4, tft_dispWin.y2-2);
+		w = rand_interval(2, tft_dispWin.x2-x);
+		h = rand_interval(2, tft_dispWin.y2-y);
 		TFT_fillRect(x,y,w,h,random_color());
 		TFT_drawRect(x,y,w,h,random_color());
 		n++;
@@ -619,8 +811,8 @@ static void pixel_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(0, dispWin.x2);
-		y = rand_interval(0, dispWin.y2);
+		x = rand_interval(0, tft_dispWin.x2);
+		y = rand_interval(0, tft_dispWin.y2);
 		TFT_drawPixel(x,y,random_color(),1);
 		n++;
 	}
@@ -629,6 +821,347 @@ static void pixel_demo()
 	Wait(-GDEMO_INFO_TIME);
 }
 
+//-----------------------
+static void scroll_demo()
+{
+	int line_h, win_h, pos, n;
+
+	disp_header("HW SCROLL DEMO");
+
+	// Header and footer are fixed, the window between them is scrolled by the display
+	if (TFT_setupScrollArea(tft_dispWin.y1, tft_height-1-tft_dispWin.y2) != ESP_OK) {
+		TFT_print("Not supported", CENTER, CENTER);
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+	line_h = TFT_getfontheight() + 2;
+	win_h = tft_dispWin.y2 - tft_dispWin.y1 + 1;
+
+	uint32_t end_time = clock() + GDEMO_TIME;
+	pos = 0;
+	n = 0;
+	while ((clock() < end_time) && (Wait(0))) {
+		// Scroll up by one text line, only the exposed bottom line is drawn
+		pos += line_h;
+		TFT_scrollTo(pos);
+		TFT_fillRect(0, win_h-line_h, tft_dispWin.x2-tft_dispWin.x1+1, line_h, TFT_BLACK);
+		tft_fg = random_color();
+		sprintf(tmp_buff, "Scrolled line %d", n);
+		TFT_print(tmp_buff, 4, win_h-line_h+1);
+		n++;
+	}
+	sprintf(tmp_buff, "%d LINES", n);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+
+	TFT_setupScrollArea(tft_dispWin.y1, tft_height-1-tft_dispWin.y2);
+}
+
+// Draw one frame of a simple UI: background, widgets and text over them
+//-------------------------------------
+static void fb_demo_frame(int n)
+{
+	int w = tft_dispWin.x2 - tft_dispWin.x1 + 1;
+	int h = tft_dispWin.y2 - tft_dispWin.y1 + 1;
+
+	TFT_fillRect(0, 0, w, h, TFT_NAVY);
+	TFT_fillRoundRect(8, 8, w-16, h/3, 6, TFT_DARKGREY);
+	TFT_fillRect(16, h/3 - 16, ((w-32) * (n % 100)) / 100, 12, TFT_GREEN);
+	TFT_fillCircle(w/2, (h*2)/3, h/6, TFT_ORANGE);
+	tft_fg = TFT_WHITE;
+	sprintf(tmp_buff, "Frame %d", n);
+	TFT_print(tmp_buff, CENTER, 16);
+}
+
+//-------------------
+static void fb_demo()
+{
+	disp_fb_stats_t stats;
+	uint32_t t_direct, t_fb;
+	int n;
+
+	disp_header("FRAMEBUFFER DEMO");
+	tft_font_transparent = 1;
+
+	// Redraw the whole UI directly to the display
+	t_direct = clock();
+	for (n=0; n<20; n++) fb_demo_frame(n);
+	t_direct = clock() - t_direct;
+
+	// Redraw to the framebuffer, only the changed rectangles are sent
+	if (TFT_setFramebuffer(1) != ESP_OK) {
+		tft_font_transparent = 0;
+		update_header(NULL, "No memory");
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+	disp_fb_get_stats(NULL, 1);
+	t_fb = clock();
+	for (n=0; n<20; n++) {
+		fb_demo_frame(n);
+		TFT_flush();
+	}
+	t_fb = clock() - t_fb;
+	disp_fb_get_stats(&stats, 1);
+	TFT_setFramebuffer(0);
+	tft_font_transparent = 0;
+
+	if (doprint) {
+		printf("   Framebuffer: 20 frames direct: %u ms, framebuffer: %u ms\r\n", t_direct, t_fb);
+		printf("                drawn: %u px, sent: %u px in %u rects\r\n", stats.drawn, stats.sent, stats.rects);
+	}
+	sprintf(tmp_buff, "%u ms / %u ms", t_direct, t_fb);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
+//------------------------
+static void canvas_demo()
+{
+	int cw, ch, n = 0;
+	uint32_t t_draw, t_push = 0;
+
+	disp_header("CANVAS DEMO");
+	cw = (tft_dispWin.x2 - tft_dispWin.x1 + 1) / 2;
+	ch = (tft_dispWin.y2 - tft_dispWin.y1 + 1) / 3;
+
+	tft_canvas_t *canvas = TFT_canvas_create(cw, ch);
+	if (canvas == NULL) {
+		update_header(NULL, "No memory");
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+
+	uint32_t end_time = clock() + GDEMO_TIME*2;
+	while ((clock() < end_time) && (Wait(0))) {
+		// ** Build the widget in RAM, the screen is updated at once without flicker
+		t_draw = clock();
+		TFT_canvas_begin(canvas);
+		TFT_fillRect(0, 0, cw, ch, TFT_NAVY);
+		TFT_drawRoundRect(0, 0, cw, ch, 6, TFT_WHITE);
+		TFT_fillCircle(ch/2, ch/2, ch/3, random_color());
+		TFT_drawLine(ch, ch/2, cw-8, ch/2, TFT_YELLOW);
+		tft_fg = TFT_WHITE;
+		tft_font_transparent = 1;
+		sprintf(tmp_buff, "%d", n);
+		TFT_print(tmp_buff, ch, 6);
+		tft_font_transparent = 0;
+		TFT_canvas_end(canvas);
+		t_draw = clock() - t_draw;
+
+		t_push = clock();
+		TFT_pushCanvas(canvas, rand_interval(0, tft_dispWin.x2-tft_dispWin.x1-cw), rand_interval(0, tft_dispWin.y2-tft_dispWin.y1-ch));
+		t_push = clock() - t_push;
+		n++;
+	}
+	TFT_canvas_delete(canvas);
+
+	if (doprint) printf("   Canvas: %d pushed, last draw %u ms, push %u ms\r\n", n, t_draw, t_push);
+	sprintf(tmp_buff, "%d CANVASES", n);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
+//---------------------------------
+static void indexed_canvas_demo()
+{
+	int cw, ch, n = 0;
+	uint32_t t_draw, t_push = 0;
+	color_t palette[16];
+
+	disp_header("INDEXED CANVAS");
+	cw = tft_dispWin.x2 - tft_dispWin.x1 + 1;
+	ch = tft_dispWin.y2 - tft_dispWin.y1 + 1;
+
+	// 4-bit canvas of the whole window, color 0 is the background
+	palette[0] = TFT_BLACK;
+	for (int i=1; i<16; i++) {
+		palette[i] = HSBtoRGB((float)i / 15.0, 1.0, 1.0);
+	}
+	tft_canvas_t *canvas = TFT_canvas_create_indexed(cw, ch, 4, palette, 16);
+	if (canvas == NULL) {
+		update_header(NULL, "No memory");
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+
+	TFT_canvas_begin(canvas);
+	for (int i=1; i<16; i++) {
+		TFT_fillCircle(cw/2, ch/2, ((16-i) * ((ch < cw) ? ch : cw)) / 32, palette[i]);
+	}
+	TFT_canvas_end(canvas);
+
+	uint32_t end_time = clock() + GDEMO_TIME;
+	while ((clock() < end_time) && (Wait(0))) {
+		// ** Rotate the palette, the canvas pixels are not changed
+		t_draw = clock();
+		color_t c = canvas->palette[1];
+		for (int i=1; i<15; i++) {
+			canvas->palette[i] = canvas->palette[i+1];
+		}
+		canvas->palette[15] = c;
+		t_draw = clock() - t_draw;
+
+		t_push = clock();
+		TFT_pushCanvas(canvas, 0, 0);
+		t_push = clock() - t_push;
+		n++;
+	}
+	TFT_canvas_delete(canvas);
+
+	if (doprint) printf("   Indexed canvas: %d frames, %u bytes, palette %u ms, push %u ms\r\n",
+			n, disp_indexed_row_bytes(cw, 4) * ch, t_draw, t_push);
+	sprintf(tmp_buff, "%d FRAMES", n);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
+//---------------------------------
+static void pipeline_demo()
+{
+	int s, r, value = 0, step = 3, n = 0;
+	uint32_t t_start;
+
+	disp_header("PIPELINE DEMO");
+	s = (((tft_dispWin.y2 - tft_dispWin.y1) < (tft_dispWin.x2 - tft_dispWin.x1)) ? (tft_dispWin.y2 - tft_dispWin.y1 + 1) : (tft_dispWin.x2 - tft_dispWin.x1 + 1)) * 3 / 4;
+	r = s / 2;
+
+	// The gauge is drawn by this task, the previous frame is sent from the other core
+	tft_pipeline_t *pipeline = TFT_pipeline_create(tft_dispWin.x1 + ((tft_dispWin.x2 - tft_dispWin.x1 + 1 - s) / 2),
+			tft_dispWin.y1 + ((tft_dispWin.y2 - tft_dispWin.y1 + 1 - s) / 2), s, s, (xPortGetCoreID() == 0) ? 1 : 0);
+	if (pipeline == NULL) {
+		update_header(NULL, "No memory");
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+
+	t_start = clock();
+	uint32_t end_time = clock() + GDEMO_TIME;
+	while ((clock() < end_time) && (Wait(0))) {
+		if (TFT_pipeline_begin(pipeline, 0) != ESP_OK) break;
+		TFT_fillRect(0, 0, s, s, TFT_BLACK);
+		TFT_drawArc(r, r, r-2, 8, -120, 120, TFT_DARKGREY, TFT_DARKGREY);
+		TFT_drawArc(r, r, r-2, 8, -120, -120 + ((value * 240) / 100), TFT_GREEN, TFT_GREEN);
+		TFT_drawLineByAngle(r, r, 0, r-14, (((value * 240) / 100) + 240) % 360, TFT_YELLOW);
+		TFT_fillCircle(r, r, 4, TFT_YELLOW);
+		tft_fg = TFT_WHITE;
+		sprintf(tmp_buff, "%d", value);
+		TFT_print(tmp_buff, CENTER, r + (r / 2));
+		TFT_pipeline_end(pipeline, NULL);
+
+		value += step;
+		if ((value >= 100) || (value <= 0)) step = -step;
+		n++;
+		if ((n % 50) == 0) {
+			// the display is used by the flush task, the header is drawn while holding the lock
+			TFT_pipeline_lock(pipeline);
+			sprintf(tmp_buff, "%d FRAMES", n);
+			update_header(NULL, tmp_buff);
+			TFT_pipeline_unlock(pipeline);
+		}
+	}
+	TFT_pipeline_sync(pipeline);
+	t_start = clock() - t_start;
+
+	if (doprint) printf("   Pipeline: %d frames in %u ms, last send %u ms, render waited %u ms\r\n",
+			n, t_start, pipeline->flush_time, pipeline->wait_time);
+	TFT_pipeline_delete(pipeline);
+	sprintf(tmp_buff, "%d FRAMES", n);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
+// Tile demo scene: background, a moving ball and a frame counter
+typedef struct {
+	int x, y, r;
+	int n;
+} tile_scene_t;
+
+static tile_scene_t tile_scene;
+
+//-------------------------------------
+static void tile_draw_bg(void *arg)
+{
+	int w = tft_dispWin.x2 - tft_dispWin.x1 + 1;
+	int h = tft_dispWin.y2 - tft_dispWin.y1 + 1;
+
+	for (int y=0; y<h; y+=16) {
+		TFT_drawFastHLine(0, y, w, TFT_DARKGREY);
+	}
+	for (int x=0; x<w; x+=16) {
+		TFT_drawFastVLine(x, 0, h, TFT_DARKGREY);
+	}
+}
+
+//---------------------------------------
+static void tile_draw_ball(void *arg)
+{
+	tile_scene_t *sc = (tile_scene_t *)arg;
+	TFT_fillCircle(sc->x, sc->y, sc->r, TFT_ORANGE);
+}
+
+//----------------------------------------
+static void tile_draw_label(void *arg)
+{
+	tile_scene_t *sc = (tile_scene_t *)arg;
+	tft_fg = TFT_WHITE;
+	sprintf(tmp_buff, "Frame %d", sc->n);
+	TFT_print(tmp_buff, 4, 4);
+}
+
+//----------------------
+static void tile_demo()
+{
+	int w, h, dx = 3, dy = 2, n = 0, sent = 0;
+	int label_h;
+
+	disp_header("TILE RENDER DEMO");
+	w = tft_dispWin.x2 - tft_dispWin.x1 + 1;
+	h = tft_dispWin.y2 - tft_dispWin.y1 + 1;
+	label_h = TFT_getfontheight() + 8;
+
+	tft_tiles_t *tiles = TFT_tiles_create(TFT_TILE_SIZE, TFT_TILE_SIZE, 8, TFT_NAVY);
+	if (tiles == NULL) {
+		update_header(NULL, "No memory");
+		Wait(-GDEMO_INFO_TIME);
+		return;
+	}
+	tile_scene.r = h / 10;
+	tile_scene.x = w / 2;
+	tile_scene.y = h / 2;
+	tile_scene.n = 0;
+	tft_font_transparent = 1;
+
+	// The scene is recorded once, only the tiles changed by the ball and label are rendered
+	TFT_tiles_add(tiles, 0, 0, w, h, tile_draw_bg, NULL);
+	TFT_tiles_add(tiles, 0, 0, w, h, tile_draw_ball, &tile_scene);
+	TFT_tiles_add(tiles, 0, 0, w, label_h, tile_draw_label, &tile_scene);
+	TFT_tiles_render(tiles);
+
+	uint32_t end_time = clock() + GDEMO_TIME*2;
+	while ((clock() < end_time) && (Wait(0))) {
+		// old and new ball position
+		TFT_tiles_invalidate(tiles, tile_scene.x-tile_scene.r, tile_scene.y-tile_scene.r, (tile_scene.r*2)+1, (tile_scene.r*2)+1);
+		tile_scene.x += dx;
+		tile_scene.y += dy;
+		if ((tile_scene.x < tile_scene.r) || (tile_scene.x >= (w - tile_scene.r))) dx = -dx;
+		if ((tile_scene.y < tile_scene.r) || (tile_scene.y >= (h - tile_scene.r))) dy = -dy;
+		TFT_tiles_invalidate(tiles, tile_scene.x-tile_scene.r, tile_scene.y-tile_scene.r, (tile_scene.r*2)+1, (tile_scene.r*2)+1);
+		tile_scene.n++;
+		TFT_tiles_invalidate(tiles, 0, 0, w, label_h);
+
+		sent += TFT_tiles_render(tiles);
+		n++;
+	}
+	TFT_tiles_delete(tiles);
+	tft_font_transparent = 0;
+
+	if (doprint) printf("   Tile render: %d frames, %d tiles sent\r\n", n, sent);
+	sprintf(tmp_buff, "%d FRAMES, %d TILES", n, sent);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
 //---------------------
 static void line_demo()
 {
@@ -639,10 +1172,10 @@ static void line_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x1 = rand_interval(0, dispWin.x2);
-		y1 = rand_interval(0, dispWin.y2);
-		x2 = rand_interval(0, dispWin.x2);
-		y2 = rand_interval(0, dispWin.y2);
+		x1 = rand_interval(0, tft_dispWin.x2);
+		y1 = rand_interval(0, tft_dispWin.y2);
+		x2 = rand_interval(0, tft_dispWin.x2);
+		y2 = rand_interval(0, tft_dispWin.y2);
 		TFT_drawLine(x1,y1,x2,y2,random_color());
 		n++;
 	}
@@ -658,8 +1191,8 @@ static void aline_demo()
 
 	disp_header("LINE BY ANGLE DEMO");
 
-	x = (dispWin.x2 - dispWin.x1) / 2;
-	y = (dispWin.y2 - dispWin.y1) / 2;
+	x = (tft_dispWin.x2 - tft_dispWin.x1) / 2;
+	y = (tft_dispWin.y2 - tft_dispWin.y1) / 2;
 	if (x < y) len = x - 8;
 	else len = y -8;
 
@@ -698,8 +1231,8 @@ static void arc_demo()
 
 	disp_header("ARC DEMO");
 
-	x = (dispWin.x2 - dispWin.x1) / 2;
-	y = (dispWin.y2 - dispWin.y1) / 2;
+	x = (tft_dispWin.x2 - tft_dispWin.x1) / 2;
+	y = (tft_dispWin.y2 - tft_dispWin.y1) / 2;
 
 	th = 6;
 	uint32_t end_time = clock() + GDEMO_TIME;
@@ -761,8 +1294,8 @@ static void circle_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(8, dispWin.x2-8);
-		y = rand_interval(8, dispWin.y2-8);
+		x = rand_interval(8, tft_dispWin.x2-8);
+		y = rand_interval(8, tft_dispWin.y2-8);
 		if (x < y) r = rand_interval(2, x/2);
 		else r = rand_interval(2, y/2);
 		TFT_drawCircle(x,y,r,random_color());
@@ -777,8 +1310,8 @@ static void circle_demo()
 	end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(8, dispWin.x2-8);
-		y = rand_interval(8, dispWin.y2-8);
+		x = rand_interval(8, tft_dispWin.x2-8);
+		y = rand_interval(8, tft_dispWin.y2-8);
 		if (x < y) r = rand_interval(2, x/2);
 		else r = rand_interval(2, y/2);
 		TFT_fillCircle(x,y,r,random_color());
@@ -800,8 +1333,8 @@ static void ellipse_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(8, dispWin.x2-8);
-		y = rand_interval(8, dispWin.y2-8);
+		x = rand_interval(8, tft_dispWin.x2-8);
+		y = rand_interval(8, tft_dispWin.y2-8);
 		if (x < y) rx = rand_interval(2, x/4);
 		else rx = rand_interval(2, y/4);
 		if (x < y) ry = rand_interval(2, x/4);
@@ -818,8 +1351,8 @@ static void ellipse_demo()
 	end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(8, dispWin.x2-8);
-		y = rand_interval(8, dispWin.y2-8);
+		x = rand_interval(8, tft_dispWin.x2-8);
+		y = rand_interval(8, tft_dispWin.y2-8);
 		if (x < y) rx = rand_interval(2, x/4);
 		else rx = rand_interval(2, y/4);
 		if (x < y) ry = rand_interval(2, x/4);
@@ -838,8 +1371,8 @@ static void ellipse_demo()
 	n = 0;
 	int k = 1;
 	while ((clock() < end_time) && (Wait(0))) {
-		x = rand_interval(8, dispWin.x2-8);
-		y = rand_interval(8, dispWin.y2-8);
+		x = rand_interval(8, tft_dispWin.x2-8);
+		y = rand_interval(8, tft_dispWin.y2-8);
 		if (x < y) rx = rand_interval(2, x/4);
 		else rx = rand_interval(2, y/4);
 		if (x < y) ry = rand_interval(2, x/4);
@@ -864,12 +1397,12 @@ static void triangle_demo()
 	uint32_t end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x1 = rand_interval(4, dispWin.x2-4);
-		y1 = rand_interval(4, dispWin.y2-2);
-		x2 = rand_interval(4, dispWin.x2-4);
-		y2 = rand_interval(4, dispWin.y2-2);
-		x3 = rand_interval(4, dispWin.x2-4);
-		y3 = rand_interval(4, dispWin.y2-2);
+		x1 = rand_interval(4, tft_dispWin.x2-4);
+		y1 = rand_interval(4, tft_dispWin.y2-2);
+		x2 = rand_interval(4, tft_dispWin.x2-4);
+		y2 = rand_interval(4, tft_dispWin.y2-2);
+		x3 = rand_interval(4, tft_dispWin.x2-4);
+		y3 = rand_interval(4, tft_dispWin.y2-2);
 		TFT_drawTriangle(x1,y1,x2,y2,x3,y3,random_color());
 		n++;
 	}
@@ -882,12 +1415,12 @@ static void triangle_demo()
 	end_time = clock() + GDEMO_TIME;
 	n = 0;
 	while ((clock() < end_time) && (Wait(0))) {
-		x1 = rand_interval(4, dispWin.x2-4);
-		y1 = rand_interval(4, dispWin.y2-2);
-		x2 = rand_interval(4, dispWin.x2-4);
-		y2 = rand_interval(4, dispWin.y2-2);
-		x3 = rand_interval(4, dispWin.x2-4);
-		y3 = rand_interval(4, dispWin.y2-2);
+		x1 = rand_interval(4, tft_dispWin.x2-4);
+		y1 = rand_interval(4, tft_dispWin.y2-2);
+		x2 = rand_interval(4, tft_dispWin.x2-4);
+		y2 = rand_interval(4, tft_dispWin.y2-2);
+		x3 = rand_interval(4, tft_dispWin.x2-4);
+		y3 = rand_interval(4, tft_dispWin.y2-2);
 		TFT_fillTriangle(x1,y1,x2,y2,x3,y3,random_color());
 		TFT_drawTriangle(x1,y1,x2,y2,x3,y3,random_color());
 		n++;
@@ -908,8 +1441,8 @@ static void poly_demo()
 
 	disp_header("POLYGON DEMO");
 
-	x = (dispWin.x2 - dispWin.x1) / 2;
-	y = (dispWin.y2 - dispWin.y1) / 2;
+	x = (tft_dispWin.x2 - tft_dispWin.x1) / 2;
+	y = (tft_dispWin.y2 - tft_dispWin.y1) / 2;
 
 	rot = 0;
 	oldrot = 0;
@@ -963,7 +1496,7 @@ static void touch_demo()
 
 	disp_header("TOUCH DEMO");
 	TFT_setFont(DEFAULT_FONT, NULL);
-	_fg = TFT_YELLOW;
+	tft_fg = TFT_YELLOW;
 	TFT_print("Touch to draw", CENTER, 40);
 	TFT_print("Touch footer to clear", CENTER, 60);
 
@@ -972,11 +1505,11 @@ static void touch_demo()
 	while (1) {
 		if (TFT_read_touch(&tx, &ty, 0)) {
 			// Touched
-			if (((tx >= dispWin.x1) && (tx <= dispWin.x2)) &&
-				((ty >= dispWin.y1) && (ty <= dispWin.y2))) {
+			if (((tx >= tft_dispWin.x1) && (tx <= tft_dispWin.x2)) &&
+				((ty >= tft_dispWin.y1) && (ty <= tft_dispWin.y2))) {
 				if ((doexit > 2) || ((abs(tx-ltx) < 5) && (abs(ty-lty) < 5))) {
 					if (((abs(tx-ltx) > 0) || (abs(ty-lty) > 0))) {
-						TFT_fillCircle(tx-dispWin.x1, ty-dispWin.y1, 4,random_color());
+						TFT_fillCircle(tx-tft_dispWin.x1, ty-tft_dispWin.y1, 4,random_color());
 						sprintf(tmp_buff, "%d,%d", tx, ty);
 						update_header(NULL, tmp_buff);
 					}
@@ -985,7 +1518,7 @@ static void touch_demo()
 				}
 				doexit = 0;
 			}
-			else if (ty > (dispWin.y2+5)) TFT_fillWindow(TFT_BLACK);
+			else if (ty > (tft_dispWin.y2+5)) TFT_fillWindow(TFT_BLACK);
 			else {
 				doexit++;
 				if (doexit == 2) update_header(NULL, "---");
@@ -1007,10 +1540,10 @@ static void touch_demo()
 //===============
 void tft_demo() {
 
-	font_rotate = 0;
-	text_wrap = 0;
-	font_transparent = 0;
-	font_forceFixed = 0;
+	tft_font_rotate = 0;
+	tft_text_wrap = 0;
+	tft_font_transparent = 0;
+	tft_font_forceFixed = 0;
 	TFT_resetclipwin();
 
 	image_debug = 0;
@@ -1042,22 +1575,22 @@ void tft_demo() {
     
     uint8_t disp_rot = PORTRAIT;
 	_demo_pass = 0;
-	gray_scale = 0;
+	tft_gray_scale = 0;
 	doprint = 1;
 
 	TFT_setRotation(disp_rot);
 	disp_header("ESP32 TFT DEMO");
 	TFT_setFont(COMIC24_FONT, NULL);
 	int tempy = TFT_getfontheight() + 4;
-	_fg = TFT_ORANGE;
-	TFT_print("ESP32", CENTER, (dispWin.y2-dispWin.y1)/2 - tempy);
+	tft_fg = TFT_ORANGE;
+	TFT_print("ESP32", CENTER, (tft_dispWin.y2-tft_dispWin.y1)/2 - tempy);
 	TFT_setFont(UBUNTU16_FONT, NULL);
-	_fg = TFT_CYAN;
+	tft_fg = TFT_CYAN;
 	TFT_print("TFT Demo", CENTER, LASTY+tempy);
 	tempy = TFT_getfontheight() + 4;
 	TFT_setFont(DEFAULT_FONT, NULL);
-	_fg = TFT_GREEN;
-	sprintf(tmp_buff, "Read speed: %5.2f MHz", (float)max_rdclock/1000000.0);
+	tft_fg = TFT_GREEN;
+	sprintf(tmp_buff, "Read speed: %5.2f MHz", (float)tft_max_rdclock/1000000.0);
 	TFT_print(tmp_buff, CENTER, LASTY+tempy);
 
 	Wait(4000);
@@ -1066,10 +1599,10 @@ void tft_demo() {
 		if (run_gs_demo) {
 			if (_demo_pass == 8) doprint = 0;
 			// Change gray scale mode on every 2nd pass
-			gray_scale = _demo_pass & 1;
+			tft_gray_scale = _demo_pass & 1;
 			// change display rotation
 			if ((_demo_pass % 2) == 0) {
-				_bg = TFT_BLACK;
+				tft_bg = TFT_BLACK;
 				TFT_setRotation(disp_rot);
 				disp_rot++;
 				disp_rot &= 3;
@@ -1078,7 +1611,7 @@ void tft_demo() {
 		else {
 			if (_demo_pass == 4) doprint = 0;
 			// change display rotation
-			_bg = TFT_BLACK;
+			tft_bg = TFT_BLACK;
 			TFT_setRotation(disp_rot);
 			disp_rot++;
 			disp_rot &= 3;
@@ -1090,7 +1623,7 @@ void tft_demo() {
 			if (disp_rot == 3) sprintf(tmp_buff, "PORTRAIT FLIP");
 			if (disp_rot == 0) sprintf(tmp_buff, "LANDSCAPE FLIP");
 			printf("\r\n==========================================\r\nDisplay: %s: %s %d,%d %s\r\n\r\n",
-					dtype, tmp_buff, _width, _height, ((gray_scale) ? "Gray" : "Color"));
+					dtype, tmp_buff, tft_width, tft_height, ((tft_gray_scale) ? "Gray" : "Color"));
 		}
 
 		disp_header("Welcome to ESP32");
@@ -1106,6 +1639,12 @@ void tft_demo() {
 		triangle_demo();
 		poly_demo();
 		pixel_demo();
+		scroll_demo();
+		fb_demo();
+		tile_demo();
+		canvas_demo();
+		indexed_canvas_demo();
+		pipeline_demo();
 		disp_images();
 		touch_demo();
 
@@ -1261,8 +1800,8 @@ void app_main()
 	// === Set display resolution if NOT using default ===
 	// === DEFAULT_TFT_DISPLAY_WIDTH &                 ===
     // === DEFAULT_TFT_DISPLAY_HEIGHT                  ===
-	_width = DEFAULT_TFT_DISPLAY_WIDTH;  // smaller dimension
-	_height = DEFAULT_TFT_DISPLAY_HEIGHT; // larger dimension
+	tft_width = DEFAULT_TFT_DISPLAY_WIDTH;  // smaller dimension
+	tft_height = DEFAULT_TFT_DISPLAY_HEIGHT; // larger dimension
 	//_width = 128;  // smaller dimension
 	//_height = 160; // larger dimension
 	// ===================================================
@@ -1271,7 +1810,14 @@ void app_main()
 	// ==== Set maximum spi clock for display read    ====
 	//      operations, function 'find_rd_speed()'    ====
 	//      can be used after display initialization  ====
-	max_rdclock = 8000000;
+	tft_max_rdclock = 8000000;
+	// ===================================================
+
+	// ===================================================
+	// ==== Set display color bits, 24 (18-bit color) ====
+	//      or 16 (RGB565, less data sent per pixel)  ====
+	//      ILI9488 supports only 24                  ====
+	tft_color_bits = 24;
 	// ===================================================
 
     // ====================================================================
@@ -1308,6 +1854,8 @@ void app_main()
         .spics_io_num=PIN_NUM_TCS,              //Touch CS pin
 		.spics_ext_io_num=-1,                   //Not using the external CS
 		//.command_bits=8,                        //1 byte command
+		.priority=1,                            //Long display transfers are interrupted for touch reads
+		.latency_us=2000,                       //Touch should not wait for the bus more than 2 ms
     };
 #elif USE_TOUCH == TOUCH_TYPE_STMPE610
     spi_lobo_device_handle_t tsspi = NULL;
@@ -1318,6 +1866,8 @@ void app_main()
         .spics_io_num=PIN_NUM_TCS,              //Touch CS pin
 		.spics_ext_io_num=-1,                   //Not using the external CS
         .flags = 0,
+		.priority=1,                            //Long display transfers are interrupted for touch reads
+		.latency_us=2000,                       //Touch should not wait for the bus more than 2 ms
     };
 #endif
 
@@ -1340,7 +1890,7 @@ void app_main()
 	ret=spi_lobo_bus_add_device(SPI_BUS, &buscfg, &devcfg, &spi);
     assert(ret==ESP_OK);
 	printf("SPI: display device added to spi bus (%d)\r\n", SPI_BUS);
-	disp_spi = spi;
+	tft_disp_spi = spi;
 
 	// ==== Test select/deselect ====
 	ret = spi_lobo_device_select(spi, 1);
@@ -1369,6 +1919,9 @@ void app_main()
 	printf("SPI: attached TS device, speed=%u\r\n", spi_lobo_get_speed(tsspi));
 #endif
 
+    // ==== NVS is used to store the display write clock ====
+    ESP_ERROR_CHECK( nvs_flash_init() );
+
 	// ================================
 	// ==== Initialize the Display ====
 
@@ -1382,23 +1935,39 @@ void app_main()
     printf("STMPE touch initialized, ver: %04x - %02x\r\n", tver >> 8, tver & 0xFF);
     #endif
 	
-	// ---- Detect maximum read speed ----
-	max_rdclock = find_rd_speed();
-	printf("SPI: Max rd speed = %u\r\n", max_rdclock);
+    // ==== Mount the file system, the display profile is stored there ====
+    printf("\r\n\n");
+	vfs_spiffs_register();
 
-    // ==== Set SPI clock used for display operations ====
-	spi_lobo_set_speed(spi, DEFAULT_SPI_CLOCK);
+	// ---- Load the display profile, skip measuring the spi clocks if verified ----
+	ret = ESP_ERR_NOT_FOUND;
+	if (spiffs_is_mounted) ret = TFT_profile_load(DISP_PROFILE_FILE, 1);
+	if (ret == ESP_OK) printf("SPI: Display profile loaded, rd speed = %u\r\n", tft_max_rdclock);
+	else {
+		// ---- Detect maximum read speed ----
+		tft_max_rdclock = find_rd_speed();
+		printf("SPI: Max rd speed = %u\r\n", tft_max_rdclock);
+
+		// ==== Set SPI clock used for display operations ====
+		spi_lobo_set_speed(spi, DEFAULT_SPI_CLOCK);
+		// ---- Find maximum write speed, stored in NVS; measure again if the profile verification failed ----
+		spi_lobo_set_speed(spi, find_wr_speed(MAX_WR_SPI_CLOCK, (ret == ESP_FAIL)));
+		// e.g. 26.7 MHz (80/3) raised to 40 MHz (80/2) if the panel passes at 40 MHz
+		printf("SPI: Max wr speed = %u (default %u)\r\n", spi_lobo_get_speed(spi), DEFAULT_SPI_CLOCK);
+
+		if ((spiffs_is_mounted) && (TFT_profile_save(DISP_PROFILE_FILE) == ESP_OK)) printf("SPI: Display profile saved\r\n");
+	}
 	printf("SPI: Changed speed to %u\r\n", spi_lobo_get_speed(spi));
 
     printf("\r\n---------------------\r\n");
 	printf("Graphics demo started\r\n");
 	printf("---------------------\r\n");
 
-	font_rotate = 0;
-	text_wrap = 0;
-	font_transparent = 0;
-	font_forceFixed = 0;
-	gray_scale = 0;
+	tft_font_rotate = 0;
+	tft_text_wrap = 0;
+	tft_font_transparent = 0;
+	tft_font_forceFixed = 0;
+	tft_gray_scale = 0;
     TFT_setGammaCurve(DEFAULT_GAMMA_CURVE);
 	TFT_setRotation(PORTRAIT);
 	TFT_setFont(DEFAULT_FONT, NULL);
@@ -1406,8 +1975,6 @@ void app_main()
 
 #ifdef CONFIG_EXAMPLE_USE_WIFI
 
-    ESP_ERROR_CHECK( nvs_flash_init() );
-
     // ===== Set time zone ======
 	setenv("TZ", "CET-1CEST", 0);
 	tzset();
@@ -1421,18 +1988,18 @@ void app_main()
 	// Is time set? If not, tm_year will be (1970 - 1900).
     if (tm_info->tm_year < (2016 - 1900)) {
         ESP_LOGI(tag, "Time is not set yet. Connecting to WiFi and getting time over NTP.");
-        _fg = TFT_CYAN;
+        tft_fg = TFT_CYAN;
     	TFT_print("Time is not set yet", CENTER, CENTER);
     	TFT_print("Connecting to WiFi", CENTER, LASTY+TFT_getfontheight()+2);
     	TFT_print("Getting time over NTP", CENTER, LASTY+TFT_getfontheight()+2);
-    	_fg = TFT_YELLOW;
+    	tft_fg = TFT_YELLOW;
     	TFT_print("Wait", CENTER, LASTY+TFT_getfontheight()+2);
         if (obtain_time()) {
-        	_fg = TFT_GREEN;
+        	tft_fg = TFT_GREEN;
         	TFT_print("System time is set.", CENTER, LASTY);
         }
         else {
-        	_fg = TFT_RED;
+        	tft_fg = TFT_RED;
         	TFT_print("ERROR.", CENTER, LASTY);
         }
         time(&time_now);
@@ -1442,17 +2009,15 @@ void app_main()
 #endif
 
 	disp_header("File system INIT");
-    _fg = TFT_CYAN;
+    tft_fg = TFT_CYAN;
 	TFT_print("Initializing SPIFFS...", CENTER, CENTER);
-    // ==== Initialize the file system ====
-    printf("\r\n\n");
-	vfs_spiffs_register();
+    // ==== The file system was initialized before the display profile was loaded ====
     if (!spiffs_is_mounted) {
-    	_fg = TFT_RED;
+    	tft_fg = TFT_RED;
     	TFT_print("SPIFFS not mounted !", CENTER, LASTY+TFT_getfontheight()+2);
     }
     else {
-    	_fg = TFT_GREEN;
+    	tft_fg = TFT_GREEN;
     	TFT_print("SPIFFS Mounted.", CENTER, LASTY+TFT_getfontheight()+2);
     }
 	Wait(-2000);